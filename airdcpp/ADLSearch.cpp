@@ -426,41 +426,41 @@ void ADLSearchManager::save(bool force /*false*/) noexcept {
 	SettingsManager::saveSettingFile(xml, CONFIG_DIR, CONFIG_NAME);
 }
 
-void ADLSearchManager::MatchesFile(DestDirList& destDirVector, const DirectoryListing::File::Ptr& currentFile, const string& aAdcPath) noexcept {
+void ADLSearchManager::MatchesFile(DestDirList& destDirVector, const DirectoryListing::File* currentFile, const string& aAdcPath) noexcept {
 	// Add to any substructure being stored
 	for(auto& id: destDirVector) {
 		if(id.subdir != NULL) {
-			auto copyFile = make_shared<DirectoryListing::File>(*currentFile, true);
 			dcassert(id.subdir->getAdls());
-
-			id.subdir->files.push_back(copyFile);
+			id.subdir->files.push_back(DirectoryListing::File::create(id.subdir, *currentFile, true));
 		}
 		id.fileAdded = false;	// Prepare for next stage
 	}
 
 	// Prepare to match searches
-	if(currentFile->getName().size() < 1) {
+	if(currentFile->getName().empty()) {
 		return;
 	}
 
 	dcassert(Util::isAdcDirectoryPath(aAdcPath));
 
+	const string name(currentFile->getName());
+
 	// Use NMDC path for matching due to compatibility reasons
-	const auto nmdcPath = Util::toNmdcFile(aAdcPath + currentFile->getName());
+	const auto nmdcPath = Util::toNmdcFile(aAdcPath + name);
 
 	// Match searches
 	for(auto& is: collection) {
 		if(destDirVector[is.ddIndex].fileAdded) {
 			continue;
 		}
-		if(is.matchesFile(currentFile->getName(), nmdcPath, currentFile->getSize())) {
-			auto copyFile = make_shared<DirectoryListing::File>(*currentFile, true);
-			destDirVector[is.ddIndex].dir->files.push_back(copyFile);
+		if(is.matchesFile(name, nmdcPath, currentFile->getSize())) {
+			auto& destDir = destDirVector[is.ddIndex].dir;
+			destDir->files.push_back(DirectoryListing::File::create(destDir, *currentFile, true));
 			destDirVector[is.ddIndex].fileAdded = true;
 
 			if(is.isAutoQueue){
 				try {
-					QueueManager::getInstance()->createFileBundle(SETTING(DOWNLOAD_DIRECTORY) + currentFile->getName(),
+					QueueManager::getInstance()->createFileBundle(SETTING(DOWNLOAD_DIRECTORY) + name,
 						currentFile->getSize(), currentFile->getTTH(), getUser(), currentFile->getRemoteDate());
 				} catch(const Exception&) { }
 			}
@@ -473,30 +473,29 @@ void ADLSearchManager::MatchesFile(DestDirList& destDirVector, const DirectoryLi
 	}
 }
 
-void ADLSearchManager::MatchesDirectory(DestDirList& destDirVector, const DirectoryListing::Directory::Ptr& currentDir, const string& aAdcPath) noexcept {
+void ADLSearchManager::MatchesDirectory(DestDirList& destDirVector, const DirectoryListing::Directory* currentDir, const string& aAdcPath) noexcept {
 	dcassert(Util::isAdcDirectoryPath(aAdcPath));
 
 	// Add to any substructure being stored
 	for (auto& id: destDirVector) {
 		if (id.subdir) {
-			auto newDir = DirectoryListing::AdlDirectory::create(aAdcPath, id.subdir, currentDir->getName());
-			id.subdir = newDir.get();
+			id.subdir = DirectoryListing::AdlDirectory::create(aAdcPath, id.subdir, currentDir->getName());
 		}
 	}
 
 	// Prepare to match searches
-	if(currentDir->getName().size() < 1) {
+	if(currentDir->getName().empty()) {
 		return;
 	}
 
+	const string name(currentDir->getName());
 	for (auto& is: collection) {
 		if(destDirVector[is.ddIndex].subdir) {
 			continue;
 		}
 
-		if(is.matchesDirectory(currentDir->getName())) {
-			auto newDir = DirectoryListing::AdlDirectory::create(aAdcPath, destDirVector[is.ddIndex].dir.get(), currentDir->getName());;
-			destDirVector[is.ddIndex].subdir = newDir.get();
+		if(is.matchesDirectory(name)) {
+			destDirVector[is.ddIndex].subdir = DirectoryListing::AdlDirectory::create(aAdcPath, destDirVector[is.ddIndex].dir, name);
 			if(breakOnFirst) {
 				// Found a match, search no more
 				break;
@@ -509,7 +508,7 @@ void ADLSearchManager::stepUpDirectory(DestDirList& destDirVector) noexcept {
 	for(auto id = destDirVector.begin(); id != destDirVector.end(); ++id) {
 		if(id->subdir) {
 			id->subdir = id->subdir->getParent();
-			if(id->subdir == id->dir.get()) {
+			if(id->subdir == id->dir) {
 				id->subdir = nullptr;
 			}
 		}
@@ -565,11 +564,11 @@ void ADLSearchManager::FinalizeDestinationDirectories(DestDirList& destDirs, Dir
 			continue;;
 		} 
 		
-		if(Util::stricmp(i.dir->getName(), szDiscard) == 0) {
+		if(Util::stricmp(i.dir->getName(), szDiscard.c_str()) == 0) {
 			continue;
 		}
 
-		root->directories.emplace(&i.dir->getName(), i.dir);
+		root->addDirectory(i.dir);
 	}
 }
 
@@ -585,17 +584,17 @@ void ADLSearchManager::matchListing(DirectoryListing& aDirList) {
 	setBreakOnFirst(SETTING(ADLS_BREAK_ON_FIRST));
 
 	string path(aDirList.getRoot()->getName());
-	matchRecurse(destDirs, aDirList.getRoot(), path, aDirList);
+	matchRecurse(destDirs, root.get(), path, aDirList);
 
 	FinalizeDestinationDirectories(destDirs, root);
 }
 
-void ADLSearchManager::matchRecurse(DestDirList &aDestList, const DirectoryListing::Directory::Ptr& aDir, const string& aAdcPath, DirectoryListing& aDirList) {
+void ADLSearchManager::matchRecurse(DestDirList &aDestList, const DirectoryListing::Directory* aDir, const string& aAdcPath, DirectoryListing& aDirList) {
 	if (aDirList.getClosing()) {
 		throw AbortException();
 	}
 
-	for (const auto& dir: aDir->directories | map_values) {
+	for (const auto& dir: aDir->directories) {
 		auto subAdcPath = aAdcPath + dir->getName() + ADC_SEPARATOR_STR;
 		MatchesDirectory(aDestList, dir, subAdcPath);
 		matchRecurse(aDestList, dir, subAdcPath, aDirList);
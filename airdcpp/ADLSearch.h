@@ -118,11 +118,11 @@ class ADLSearchManager : public Singleton<ADLSearchManager>
 public:
 	// Destination directory indexing
 	struct DestDir {
-		DestDir(const string& aName, const DirectoryListing::Directory::Ptr& aDir) :
+		DestDir(const string& aName, DirectoryListing::Directory* aDir) :
 			name(aName), dir(aDir) { }
 
 		const string name;
-		DirectoryListing::Directory::Ptr dir = nullptr;
+		DirectoryListing::Directory* dir = nullptr;
 		DirectoryListing::Directory* subdir = nullptr;
 		bool fileAdded = false;
 	};
@@ -159,11 +159,11 @@ private:
 
 	// @internal
 	// Throws AbortException
-	void matchRecurse(DestDirList& /*aDestList*/, const DirectoryListing::Directory::Ptr& /*aDir*/, const string& aAdcPath, DirectoryListing& /*aDirList*/);
+	void matchRecurse(DestDirList& /*aDestList*/, const DirectoryListing::Directory* /*aDir*/, const string& aAdcPath, DirectoryListing& /*aDirList*/);
 	// Search for file match
-	void MatchesFile(DestDirList& destDirVector, const DirectoryListing::File::Ptr& currentFile, const string& aAdcPath) noexcept;
+	void MatchesFile(DestDirList& destDirVector, const DirectoryListing::File* currentFile, const string& aAdcPath) noexcept;
 	// Search for directory match
-	void MatchesDirectory(DestDirList& destDirVector, const DirectoryListing::Directory::Ptr& currentDir, const string& aAdcPath) noexcept;
+	void MatchesDirectory(DestDirList& destDirVector, const DirectoryListing::Directory* currentDir, const string& aAdcPath) noexcept;
 	// Step up directory
 	void stepUpDirectory(DestDirList& destDirVector) noexcept;
 
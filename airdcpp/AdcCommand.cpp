@@ -65,86 +65,108 @@ void AdcCommand::parse(const string& aLine, bool nmdc /* = false */) {
 		from = HUB_SID;
 	}
 
-	string::size_type len = aLine.length();
-	const char* buf = aLine.c_str();
-	string cur;
-	cur.reserve(128);
-
 	bool toSet = false;
 	bool featureSet = false;
 	bool fromSet = nmdc; // $ADCxxx never have a from CID...
 
-	while(i < len) {
-		switch(buf[i]) {
-		case '\\':
-			++i;
-			if(i == len)
-				throw ParseException("Escape at eol");
-			if(buf[i] == 's')
-				cur += ' ';
-			else if(buf[i] == 'n')
-				cur += '\n';
-			else if(buf[i] == '\\')
-				cur += '\\';
-			else if(buf[i] == ' ' && nmdc)	// $ADCGET escaping, leftover from old specs
-				cur += ' ';
-			else
-				throw ParseException("Unknown escape");
-			break;
-		case ' ': 
-			// New parameter...
-			{
-				if((type == TYPE_BROADCAST || type == TYPE_DIRECT || type == TYPE_ECHO || type == TYPE_FEATURE) && !fromSet) {
-					if(cur.length() != 4) {
-						throw ParseException("Invalid SID length");
-					}
-					from = toSID(cur);
-					fromSet = true;
-				} else if((type == TYPE_DIRECT || type == TYPE_ECHO) && !toSet) {
-					if(cur.length() != 4) {
-						throw ParseException("Invalid SID length");
-					}
-					to = toSID(cur);
-					toSet = true;
-				} else if(type == TYPE_FEATURE && !featureSet) {
-					if(cur.length() % 5 != 0) {
-						throw ParseException("Invalid feature length");
-					}
-					// Skip...
-					featureSet = true;
-				} else {
-					parameters.push_back(cur);
-				}
-				cur.clear();
-			}
-			break;
-		default:
-			cur += buf[i];
+	// The parameters reference the line (or the unescaped content that is appended after it)
+	// instead of being copied in separate strings
+	if (!parameters.empty()) {
+		// Parameters that exist already need to be stored in the same way
+		for (const auto& param: parameters) {
+			paramRefs.push_back({ static_cast<uint32_t>(paramBuffer.size()), static_cast<uint32_t>(param.size()) });
+			paramBuffer += param;
 		}
-		++i;
+
+		parameters.clear();
 	}
-	if(!cur.empty()) {
+
+	const auto lineStart = static_cast<uint32_t>(paramBuffer.size());
+	paramBuffer += aLine;
+
+	auto addToken = [&](const char* aData, size_t aLen, uint32_t aPos) {
 		if((type == TYPE_BROADCAST || type == TYPE_DIRECT || type == TYPE_ECHO || type == TYPE_FEATURE) && !fromSet) {
-			if(cur.length() != 4) {
+			if(aLen != 4) {
 				throw ParseException("Invalid SID length");
 			}
-			from = toSID(cur);
+			memcpy(&from, aData, 4);
 			fromSet = true;
 		} else if((type == TYPE_DIRECT || type == TYPE_ECHO) && !toSet) {
-			if(cur.length() != 4) {
+			if(aLen != 4) {
 				throw ParseException("Invalid SID length");
 			}
-			to = toSID(cur);
+			memcpy(&to, aData, 4);
 			toSet = true;
 		} else if(type == TYPE_FEATURE && !featureSet) {
-			if(cur.length() % 5 != 0) {
+			if(aLen % 5 != 0) {
 				throw ParseException("Invalid feature length");
 			}
 			// Skip...
 			featureSet = true;
 		} else {
-			parameters.push_back(cur);
+			paramRefs.push_back({ aPos, static_cast<uint32_t>(aLen) });
+		}
+	};
+
+	const char* end = aLine.data() + aLine.length();
+	const char* p = aLine.data() + min(i, aLine.length());
+
+	// Each separator starts a new parameter
+	paramRefs.reserve(paramRefs.size() + std::count(p, end, ' ') + 1);
+
+	// Unescaped content of the current parameter (only used if it contains escapes)
+	string cur;
+	auto addUnescaped = [&] {
+		auto pos = static_cast<uint32_t>(paramBuffer.size());
+		paramBuffer += cur;
+		addToken(cur.data(), cur.length(), pos);
+		cur.clear();
+	};
+
+	while(p < end) {
+		// memchr is vectorized, which makes this considerably faster than checking each character separately
+		auto sep = static_cast<const char*>(memchr(p, ' ', end - p));
+		if(!sep)
+			sep = end;
+
+		auto esc = static_cast<const char*>(memchr(p, '\\', sep - p));
+		if(esc) {
+			cur.append(p, esc);
+
+			++esc;
+			if(esc == end)
+				throw ParseException("Escape at eol");
+			if(*esc == 's')
+				cur += ' ';
+			else if(*esc == 'n')
+				cur += '\n';
+			else if(*esc == '\\')
+				cur += '\\';
+			else if(*esc == ' ' && nmdc)	// $ADCGET escaping, leftover from old specs
+				cur += ' ';
+			else
+				throw ParseException("Unknown escape");
+
+			p = esc + 1;
+			continue;
+		}
+
+		if(cur.empty()) {
+			// The parameter can be referenced directly from the line
+			if(sep != end || sep != p) {
+				addToken(p, sep - p, lineStart + static_cast<uint32_t>(p - aLine.data()));
+			}
+		} else {
+			cur.append(p, sep);
+			addUnescaped();
 		}
+
+		p = sep + 1;
+	}
+
+	// The line ended with an escape
+	if(!cur.empty()) {
+		addUnescaped();
 	}
 
 	if((type == TYPE_BROADCAST || type == TYPE_DIRECT || type == TYPE_ECHO || type == TYPE_FEATURE) && !fromSet) {
@@ -161,104 +183,159 @@ void AdcCommand::parse(const string& aLine, bool nmdc /* = false */) {
 }
 
 string AdcCommand::toString(const CID& aCID) const noexcept {
-	return getHeaderString(aCID) + getParamString(false);
+	string tmp;
+	appendString(tmp, aCID);
+	return tmp;
 }
 
 string AdcCommand::toString() const noexcept {
-	return getHeaderString() + getParamString(false);
+	string tmp;
+	appendString(tmp);
+	return tmp;
 }
 
 string AdcCommand::toString(uint32_t sid /* = 0 */, bool nmdc /* = false */) const noexcept {
-	return getHeaderString(sid, nmdc) + getParamString(nmdc);
+	string tmp;
+	appendString(tmp, sid, nmdc);
+	return tmp;
 }
 
-string AdcCommand::escape(const string& str, bool old) noexcept {
-	string tmp = str;
-	string::size_type i = 0;
-	while( (i = tmp.find_first_of(" \n\\", i)) != string::npos) {
-		if(old) {
-			tmp.insert(i, "\\");
-		} else {
-			switch(tmp[i]) {
-				case ' ': tmp.replace(i, 1, "\\s"); break;
-				case '\n': tmp.replace(i, 1, "\\n"); break;
-				case '\\': tmp.replace(i, 1, "\\\\"); break;
-			}
-		}
-		i+=2;
-	}
-	return tmp;
+void AdcCommand::appendString(string& str_, const CID& aCID) const noexcept {
+	dcassert(type == TYPE_UDP);
+	reserveString(str_, 1 + 39);
+
+	str_ += getType();
+	str_ += cmdChar;
+	str_ += ' ';
+	str_ += aCID.toBase32();
+	appendParams(str_, false);
 }
 
-string AdcCommand::getHeaderString(uint32_t sid, bool nmdc) const noexcept {
-	string tmp;
+void AdcCommand::appendString(string& str_) const noexcept {
+	dcassert(type == TYPE_UDP);
+	reserveString(str_, 0);
+
+	str_ += getType();
+	str_ += cmdChar;
+	appendParams(str_, false);
+}
+
+void AdcCommand::appendString(string& str_, uint32_t sid, bool nmdc) const noexcept {
+	reserveString(str_, 4 + 5 + 5 + 1 + features.size());
+
 	if(nmdc) {
-		tmp += "$ADC";
+		str_ += "$ADC";
 	} else {
-		tmp += getType();
+		str_ += getType();
 	}
 
-	tmp += cmdChar;
+	str_ += cmdChar;
 
 	if(type == TYPE_BROADCAST || type == TYPE_DIRECT || type == TYPE_ECHO || type == TYPE_FEATURE) {
-		tmp += ' ';
-		tmp += fromSID(sid);
+		str_ += ' ';
+		str_.append(reinterpret_cast<const char*>(&sid), sizeof(sid));
 	}
 
 	if(type == TYPE_DIRECT || type == TYPE_ECHO) {
-		tmp += ' ';
-		tmp += fromSID(to);
+		str_ += ' ';
+		str_.append(reinterpret_cast<const char*>(&to), sizeof(to));
 	}
 
 	if(type == TYPE_FEATURE) {
-		tmp += ' ';
-		tmp += features;
+		str_ += ' ';
+		str_ += features;
 	}
-	return tmp;
+
+	appendParams(str_, nmdc);
 }
 
-string AdcCommand::getHeaderString(const CID& cid) const noexcept {
-	dcassert(type == TYPE_UDP);
+string AdcCommand::escape(boost::string_ref str, bool old) noexcept {
 	string tmp;
-	
-	tmp += getType();
-	tmp += cmdChar;
-	tmp += ' ';
-	tmp += cid.toBase32();
+	escape(str, old, tmp);
 	return tmp;
 }
 
-string AdcCommand::getHeaderString() const noexcept {
-	dcassert(type == TYPE_UDP);
-	string tmp;
-	
-	tmp += getType();
-	tmp += cmdChar;
-	return tmp;
+void AdcCommand::escape(boost::string_ref str, bool old, string& out_) noexcept {
+	static const char special[] = " \n\\";
+
+	auto prev = str.begin(), i = str.begin();
+	while( (i = std::find_first_of(prev, str.end(), special, special + sizeof(special) - 1)) != str.end()) {
+		out_.append(prev, i);
+		if(old) {
+			out_ += '\\';
+			out_ += *i;
+		} else {
+			switch(*i) {
+				case ' ': out_ += "\\s"; break;
+				case '\n': out_ += "\\n"; break;
+				case '\\': out_ += "\\\\"; break;
+			}
+		}
+		prev = i + 1;
+	}
+
+	out_.append(prev, str.end());
 }
 
-const string& AdcCommand::getParam(size_t n) const noexcept {
-	return getParameters().size() > n ? getParameters()[n] : Util::emptyString;
+void AdcCommand::reserveString(string& str_, size_t aHeaderSize) const noexcept {
+	// Escaping is rare enough to be ignored
+	auto size = str_.size() + 3 + aHeaderSize + 1;
+	for(size_t i = 0; i < getParamCount(); ++i) {
+		size += getParamView(i).size() + 1;
+	}
+
+	str_.reserve(size);
 }
 
-string AdcCommand::getParamString(bool nmdc) const noexcept {
-	string tmp;
-	for(const auto& i: getParameters()) {
-		tmp += ' ';
-		tmp += escape(i, nmdc);
+void AdcCommand::appendParams(string& str_, bool nmdc) const noexcept {
+	for(size_t i = 0; i < getParamCount(); ++i) {
+		str_ += ' ';
+		escape(getParamView(i), nmdc, str_);
 	}
 	if(nmdc) {
-		tmp += '|';
+		str_ += '|';
 	} else {
-		tmp += '\n';
+		str_ += '\n';
 	}
-	return tmp;
+}
+
+void AdcCommand::toStringParams() const noexcept {
+	if(paramRefs.empty()) {
+		return;
+	}
+
+	dcassert(parameters.empty());
+	parameters.reserve(paramRefs.size());
+	for(const auto& r: paramRefs) {
+		parameters.emplace_back(paramBuffer, r.pos, r.len);
+	}
+
+	paramRefs.clear();
+	paramBuffer.clear();
+}
+
+boost::string_ref AdcCommand::getParamView(size_t n) const noexcept {
+	if(!paramRefs.empty()) {
+		return n < paramRefs.size() ? boost::string_ref(paramBuffer.data() + paramRefs[n].pos, paramRefs[n].len) : boost::string_ref();
+	}
+
+	return n < parameters.size() ? boost::string_ref(parameters[n]) : boost::string_ref();
+}
+
+const string& AdcCommand::getParam(size_t n) const noexcept {
+	return getParameters().size() > n ? getParameters()[n] : Util::emptyString;
+}
+
+// Returns true if the parameter exists and starts with the two-letter code
+static bool hasCode(const boost::string_ref& aParam, const char* aName) noexcept {
+	return aParam.size() >= 2 && aParam[0] == aName[0] && aParam[1] == aName[1];
 }
 
 bool AdcCommand::getParam(const char* name, size_t start, string& ret) const noexcept {
-	for(string::size_type i = start; i < getParameters().size(); ++i) {
-		if(toCode(name) == toCode(getParameters()[i].c_str())) {
-			ret = getParameters()[i].substr(2);
+	for(auto i = start; i < getParamCount(); ++i) {
+		auto param = getParamView(i);
+		if(hasCode(param, name)) {
+			ret.assign(param.data() + 2, param.size() - 2);
 			return true;
 		}
 	}
@@ -266,20 +343,19 @@ bool AdcCommand::getParam(const char* name, size_t start, string& ret) const noe
 }
 
 bool AdcCommand::getParam(const char* name, size_t start, StringList& ret) const noexcept {
-	for(string::size_type i = start; i < getParameters().size(); ++i) {
-		if(toCode(name) == toCode(getParameters()[i].c_str())) {
-			ret.push_back(getParameters()[i].substr(2));
+	for(auto i = start; i < getParamCount(); ++i) {
+		auto param = getParamView(i);
+		if(hasCode(param, name)) {
+			ret.emplace_back(param.data() + 2, param.size() - 2);
 		}
 	}
 	return !ret.empty();
 }
 
 bool AdcCommand::hasFlag(const char* name, size_t start) const noexcept {
-	for(string::size_type i = start; i < getParameters().size(); ++i) {
-		if(toCode(name) == toCode(getParameters()[i].c_str()) && 
-			getParameters()[i].size() == 3 &&
-			getParameters()[i][2] == '1')
-		{
+	for(auto i = start; i < getParamCount(); ++i) {
+		auto param = getParamView(i);
+		if(hasCode(param, name) && param.size() == 3 && param[2] == '1') {
 			return true;
 		}
 	}
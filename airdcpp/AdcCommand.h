@@ -23,6 +23,8 @@
 
 #include "Exception.h"
 
+#include <boost/utility/string_ref.hpp>
+
 namespace dcpp {
 
 class CID;
@@ -139,19 +141,32 @@ public:
 	const string& getFeatures() const noexcept { return features; }
 	AdcCommand& setFeatures(const string& feat) noexcept { features = feat; return *this; }
 
-	StringList& getParameters() noexcept { return parameters; }
-	const StringList& getParameters() const noexcept { return parameters; }
+	// Parsed parameters reference the parsed line and they are copied in separate strings only when they are
+	// accessed via the string API (getParameters/getParam(n)/addParam)
+	StringList& getParameters() noexcept { toStringParams(); return parameters; }
+	const StringList& getParameters() const noexcept { toStringParams(); return parameters; }
+
+	// Parameter access without copying (the views are invalidated if the parameters are accessed via the string API)
+	size_t getParamCount() const noexcept { return paramRefs.empty() ? parameters.size() : paramRefs.size(); }
+	boost::string_ref getParamView(size_t n) const noexcept;
 
 	string toString() const noexcept;
 	string toString(const CID& aCID) const noexcept;
 	string toString(uint32_t sid, bool nmdc = false) const noexcept;
 
+	// Same as toString but the command is appended to an existing buffer (which can be reused for multiple commands)
+	void appendString(string& str_) const noexcept;
+	void appendString(string& str_, const CID& aCID) const noexcept;
+	void appendString(string& str_, uint32_t sid, bool nmdc = false) const noexcept;
+
 	AdcCommand& addParam(const string& name, const string& value) noexcept {
+		toStringParams();
 		parameters.push_back(name);
 		parameters.back() += value;
 		return *this;
 	}
 	AdcCommand& addParam(const string& str) noexcept {
+		toStringParams();
 		parameters.push_back(str);
 		return *this;
 	}
@@ -164,7 +179,8 @@ public:
 
 	bool operator==(uint32_t aCmd) const noexcept { return cmdInt == aCmd; }
 
-	static string escape(const string& str, bool old) noexcept;
+	static string escape(boost::string_ref str, bool old) noexcept;
+	static void escape(boost::string_ref str, bool old, string& out_) noexcept;
 	uint32_t getTo() const noexcept { return to; }
 	AdcCommand& setTo(const uint32_t sid) noexcept { to = sid; return *this; }
 	uint32_t getFrom() const noexcept { return from; }
@@ -173,11 +189,25 @@ public:
 	static uint32_t toSID(const string& aSID) noexcept { return *reinterpret_cast<const uint32_t*>(aSID.data()); }
 	static string fromSID(const uint32_t aSID) noexcept { return string(reinterpret_cast<const char*>(&aSID), sizeof(aSID)); }
 private:
-	string getHeaderString(const CID& cid) const noexcept;
-	string getHeaderString() const noexcept;
-	string getHeaderString(uint32_t sid, bool nmdc) const noexcept;
-	string getParamString(bool nmdc) const noexcept;
-	StringList parameters;
+	void reserveString(string& str_, size_t aHeaderSize) const noexcept;
+	void appendParams(string& str_, bool nmdc) const noexcept;
+
+	// Parameter inside paramBuffer
+	struct ParamRef {
+		uint32_t pos;
+		uint32_t len;
+	};
+
+	// Moves the parsed parameters in the string list
+	void toStringParams() const noexcept;
+
+	// Either the parameter strings or references to the parsed line are used (the other one is empty)
+	mutable StringList parameters;
+	mutable vector<ParamRef> paramRefs;
+
+	// Copy of the parsed line, followed by the unescaped parameters
+	mutable string paramBuffer;
+
 	string features;
 	union {
 		char cmdChar[4];
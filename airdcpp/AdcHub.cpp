@@ -179,7 +179,7 @@ void AdcHub::clearUsers() noexcept {
 }
 
 void AdcHub::handle(AdcCommand::INF, AdcCommand& c) noexcept {
-	if(c.getParameters().empty())
+	if(c.getParamCount() == 0)
 		return;
 
 	string cid;
@@ -215,20 +215,22 @@ void AdcHub::handle(AdcCommand::INF, AdcCommand& c) noexcept {
 		return;
 	}
 
-	for (const auto& p: c.getParameters()) {
+	// Avoid copying the parameters as they are stored in the identity anyway
+	for (size_t i = 0; i < c.getParamCount(); ++i) {
+		auto p = c.getParamView(i);
 		if(p.length() < 2)
 			continue;
 
-		if(p.substr(0, 2) == "SS") {
+		if(p.starts_with("SS")) {
 			availableBytes -= u->getIdentity().getBytesShared();
-			u->getIdentity().setBytesShared(p.substr(2));
+			u->getIdentity().setBytesShared(p.substr(2).to_string());
 			availableBytes += u->getIdentity().getBytesShared();
 		} else {
-			u->getIdentity().set(p.c_str(), p.substr(2));
+			u->getIdentity().set(p.data(), p.substr(2).to_string());
 		}
 		
-		if((p.substr(0, 2) == "VE") || (p.substr(0, 2) == "AP")) {
-			if (p.find("AirDC++") != string::npos) {
+		if(p.starts_with("VE") || p.starts_with("AP")) {
+			if (p.find("AirDC++") != boost::string_ref::npos) {
 				u->getUser()->setFlag(User::AIRDCPLUSPLUS);
 			}
 		}
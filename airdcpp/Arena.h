@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_ARENA_H
+#define DCPLUSPLUS_DCPP_ARENA_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace dcpp {
+
+/**
+ * Monotonic allocator for a large number of small objects that are released at the same time
+ *
+ * Allocations are carved from large chunks and deallocation is a no-op, the chunks are freed only
+ * when the arena is destroyed. Destructors of the objects aren't called so they must not own any
+ * other resources.
+ *
+ * Parts of the content that are replaced separately can be allocated from child arenas. Child arenas
+ * are owned by their parent and their items may refer to the items of the parent arenas.
+ *
+ * The arena isn't thread safe, all allocations must be done from the same thread.
+ */
+class Arena : public std::enable_shared_from_this<Arena>, boost::noncopyable {
+public:
+	typedef std::shared_ptr<Arena> Ptr;
+
+	// For containers that are stored inside the arena
+	template<class T>
+	class Allocator {
+	public:
+		typedef T value_type;
+
+		// Containers take the allocator of the assigned container (the content is never moved between arenas)
+		typedef std::true_type propagate_on_container_move_assignment;
+		typedef std::true_type propagate_on_container_swap;
+
+		explicit Allocator(Arena* aArena) noexcept : arena(aArena) { }
+		template<class U> Allocator(const Allocator<U>& aOther) noexcept : arena(aOther.arena) { }
+
+		T* allocate(size_t aCount) {
+			return static_cast<T*>(arena->allocate(aCount * sizeof(T), alignof(T)));
+		}
+
+		void deallocate(T*, size_t) noexcept { }
+
+		template<class U> bool operator==(const Allocator<U>& aOther) const noexcept { return arena == aOther.arena; }
+		template<class U> bool operator!=(const Allocator<U>& aOther) const noexcept { return arena != aOther.arena; }
+	private:
+		template<class U> friend class Allocator;
+
+		Arena* arena;
+	};
+
+	explicit Arena(size_t aChunkSize = MIN_CHUNK_SIZE) noexcept : nextChunkSize(aChunkSize) { }
+
+	~Arena() {
+		for (auto c: chunks) {
+			::operator delete(c);
+		}
+	}
+
+	void* allocate(size_t aSize, size_t aAlignment) {
+		auto p = align(aAlignment);
+		if (!pos || p > end || static_cast<size_t>(end - p) < aSize) {
+			addChunk(aSize + aAlignment);
+			p = align(aAlignment);
+		}
+
+		pos = p + aSize;
+		return p;
+	}
+
+	// Returns a null-terminated copy of the string
+	const char* addString(const char* aStr, size_t aLen) {
+		auto p = static_cast<char*>(allocate(aLen + 1, 1));
+		memcpy(p, aStr, aLen + 1);
+		return p;
+	}
+
+	const char* addString(const std::string& aStr) {
+		return addString(aStr.c_str(), aStr.size());
+	}
+
+	// Creates a new child arena for the given key, an existing child arena with the same key is released
+	Arena& createChild(const void* aKey) {
+		auto child = std::make_shared<Arena>(size_t(CHILD_CHUNK_SIZE)); // Passed by value to avoid ODR-use
+		child->parent = this;
+		children[aKey] = child;
+		return *child;
+	}
+
+	// Returns the child arena for the given key (a new one is created if needed)
+	Arena& getChild(const void* aKey) {
+		auto i = children.find(aKey);
+		return i != children.end() ? *i->second : createChild(aKey);
+	}
+
+	void releaseChild(const void* aKey) noexcept {
+		children.erase(aKey);
+	}
+
+	Arena* getParent() const noexcept {
+		return parent;
+	}
+
+	// Returns true if this is the given arena or one of its children (the given arena can't be released before this one)
+	bool isWithin(const Arena& aArena) const noexcept {
+		for (auto a = this; a; a = a->parent) {
+			if (a == &aArena) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Returns a handle that keeps the arena and all its parents in memory
+	std::shared_ptr<void> getHandle() {
+		if (!parent) {
+			return shared_from_this();
+		}
+
+		auto arenas = std::make_shared<std::vector<Ptr>>();
+		for (auto a = this; a; a = a->parent) {
+			arenas->push_back(a->shared_from_this());
+		}
+
+		return arenas;
+	}
+
+	// Total size of the allocated chunks
+	size_t getAllocatedBytes() const noexcept {
+		return allocatedBytes;
+	}
+private:
+	static const size_t MIN_CHUNK_SIZE = 16 * 1024;
+	static const size_t MAX_CHUNK_SIZE = 1024 * 1024;
+
+	// Child arenas are mostly used for single directories
+	static const size_t CHILD_CHUNK_SIZE = 2 * 1024;
+
+	uint8_t* align(size_t aAlignment) const noexcept {
+		auto p = reinterpret_cast<uintptr_t>(pos);
+		return reinterpret_cast<uint8_t*>((p + aAlignment - 1) & ~(static_cast<uintptr_t>(aAlignment) - 1));
+	}
+
+	void addChunk(size_t aMinSize) {
+		// Grow the chunks with the arena so that small lists won't waste memory
+		auto size = std::max(nextChunkSize, aMinSize);
+		nextChunkSize = nextChunkSize * 2 < MAX_CHUNK_SIZE ? nextChunkSize * 2 : MAX_CHUNK_SIZE;
+
+		// Reserve the slot first so that the chunk can't leak
+		chunks.push_back(nullptr);
+		auto chunk = static_cast<uint8_t*>(::operator new(size));
+		chunks.back() = chunk;
+
+		pos = chunk;
+		end = chunk + size;
+		allocatedBytes += size;
+	}
+
+	std::vector<void*> chunks;
+	uint8_t* pos = nullptr;
+	uint8_t* end = nullptr;
+
+	size_t nextChunkSize;
+	size_t allocatedBytes = 0;
+
+	// Child arenas hold only a raw pointer to the parent to avoid reference cycles
+	Arena* parent = nullptr;
+	std::unordered_map<const void*, Ptr> children;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_ARENA_H)
@@ -21,6 +21,9 @@
 
 #include "Exception.h"
 #include "ResourceManager.h"
+#include "Semaphore.h"
+
+#include <thread>
 
 namespace dcpp {
 	
@@ -65,6 +68,182 @@ bool BZFilter::operator()(const void* in, size_t& insize, void* out, size_t& out
 	}
 }
 
+// Each block must fit in a single bzip2 block (900 000 bytes with level 9) after the initial run-length
+// encoding, which may expand the data by 25%
+static const size_t PARALLEL_BLOCK_SIZE = 700 * 1000;
+
+struct ParallelBZFilter::Block {
+	string data;
+	string compressed;
+	bool failed = false;
+
+	// Set by the thread that compresses the block
+	atomic_flag claimed = ATOMIC_FLAG_INIT;
+	atomic<bool> done { false };
+	Semaphore finished;
+};
+
+// Read max 32 bits starting from the bit position (most significant bit first)
+static uint32_t getBits(const string& aData, size_t aPos, int aCount) noexcept {
+	auto first = aPos / 8;
+	auto last = (aPos + aCount - 1) / 8;
+
+	uint64_t bits = 0;
+	for (auto i = first; i <= last; ++i) {
+		bits = (bits << 8) | static_cast<uint8_t>(aData[i]);
+	}
+
+	auto shift = (last + 1) * 8 - (aPos + aCount);
+	return static_cast<uint32_t>((bits >> shift) & ((1ULL << aCount) - 1));
+}
+
+ParallelBZFilter::ParallelBZFilter() : maxPendingBlocks(max(std::thread::hardware_concurrency(), 1U) * 2) {
+	input.reserve(PARALLEL_BLOCK_SIZE);
+
+	// Stream header (the merged blocks must have been compressed with the same block size)
+	output = "BZh9";
+}
+
+ParallelBZFilter::~ParallelBZFilter() noexcept {
+	tasks.wait();
+}
+
+void ParallelBZFilter::compressBlock(Block& aBlock) noexcept {
+	auto len = static_cast<unsigned int>(aBlock.data.size() + aBlock.data.size() / 100 + 600);
+	aBlock.compressed.resize(len);
+
+	if (BZ2_bzBuffToBuffCompress(&aBlock.compressed[0], &len, &aBlock.data[0], static_cast<unsigned int>(aBlock.data.size()), 9, 0, 30) == BZ_OK) {
+		aBlock.compressed.resize(len);
+	} else {
+		aBlock.failed = true;
+	}
+
+	string().swap(aBlock.data);
+
+	aBlock.done = true;
+	aBlock.finished.signal();
+}
+
+void ParallelBZFilter::waitBlock(Block& aBlock) noexcept {
+	if (!aBlock.claimed.test_and_set()) {
+		// Not started yet, compress it in this thread rather than waiting for a free worker
+		compressBlock(aBlock);
+	} else if (!aBlock.done) {
+		aBlock.finished.wait();
+	}
+}
+
+void ParallelBZFilter::queueBlock() {
+	auto block = make_shared<Block>();
+	block->data.swap(input);
+	input.reserve(PARALLEL_BLOCK_SIZE);
+
+	blocks.push_back(block);
+
+	tasks.run([block] {
+		if (!block->claimed.test_and_set()) {
+			compressBlock(*block);
+		}
+	});
+}
+
+void ParallelBZFilter::writeBits(uint32_t aBits, int aCount) noexcept {
+	bitBuffer = (bitBuffer << aCount) | aBits;
+	bitCount += aCount;
+
+	while (bitCount >= 8) {
+		bitCount -= 8;
+		output.push_back(static_cast<char>(bitBuffer >> bitCount));
+	}
+
+	bitBuffer &= (1ULL << bitCount) - 1;
+}
+
+void ParallelBZFilter::mergeBlock(Block& aBlock) {
+	if (aBlock.failed) {
+		throw Exception(STRING(COMPRESSION_ERROR));
+	}
+
+	// The compressed data is a complete stream: header (32 bits), block magic (48 bits), block CRC (32 bits), 
+	// the rest of the block, end of stream magic (48 bits), combined CRC (32 bits) and padding to a full byte.
+	// The combined CRC equals to the block CRC when the stream contains a single block.
+	const auto& data = aBlock.compressed;
+	auto blockCRC = getBits(data, 32 + 48, 32);
+
+	size_t blockEnd = 0;
+	for (size_t padding = 0; padding < 8; ++padding) {
+		auto pos = data.size() * 8 - padding - 80;
+		if (getBits(data, pos, 24) == 0x177245 && getBits(data, pos + 24, 24) == 0x385090 && getBits(data, pos + 48, 32) == blockCRC) {
+			blockEnd = pos;
+			break;
+		}
+	}
+
+	if (blockEnd == 0) {
+		throw Exception(STRING(COMPRESSION_ERROR));
+	}
+
+	for (size_t pos = 32; pos < blockEnd; pos += 24) {
+		auto count = static_cast<int>(min<size_t>(24, blockEnd - pos));
+		writeBits(getBits(data, pos, count), count);
+	}
+
+	combinedCRC = ((combinedCRC << 1) | (combinedCRC >> 31)) ^ blockCRC;
+}
+
+bool ParallelBZFilter::operator()(const void* in, size_t& insize, void* out, size_t& outsize) {
+	if(outsize == 0)
+		return 0;
+
+	if (insize > 0) {
+		insize = min(insize, PARALLEL_BLOCK_SIZE - input.size());
+		input.append(static_cast<const char*>(in), insize);
+		if (input.size() == PARALLEL_BLOCK_SIZE) {
+			queueBlock();
+		}
+	} else if (!inputEnded) {
+		if (!input.empty()) {
+			queueBlock();
+		}
+
+		inputEnded = true;
+	}
+
+	// Wait only for the oldest block if there are too many of them pending (or there's no more input),
+	// the following blocks keep being compressed meanwhile
+	if (!blocks.empty() && (inputEnded || blocks.size() > maxPendingBlocks)) {
+		waitBlock(*blocks.front());
+	}
+
+	// Merge the compressed blocks in order
+	while (!blocks.empty() && blocks.front()->done) {
+		mergeBlock(*blocks.front());
+		blocks.pop_front();
+	}
+
+	if (inputEnded && blocks.empty() && !streamEnded) {
+		writeBits(0x177245, 24);
+		writeBits(0x385090, 24);
+		writeBits(combinedCRC, 32);
+		if (bitCount > 0) {
+			writeBits(0, 8 - bitCount);
+		}
+
+		streamEnded = true;
+	}
+
+	outsize = min(outsize, output.size() - outputPos);
+	memcpy(out, output.data() + outputPos, outsize);
+	outputPos += outsize;
+
+	if (outputPos == output.size()) {
+		output.clear();
+		outputPos = 0;
+	}
+
+	return !streamEnded || !output.empty();
+}
+
 UnBZFilter::UnBZFilter() {
 	memzero(&zs, sizeof(zs));
 
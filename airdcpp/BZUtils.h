@@ -21,6 +21,8 @@
 
 #include <bzlib.h>
 
+#include "concurrency.h"
+
 namespace dcpp {
 
 class BZFilter {
@@ -40,6 +42,50 @@ private:
 	bz_stream zs;
 };
 
+/**
+* Compresses the data in independent blocks by using multiple threads. The compressed blocks
+* are merged into a single standard bzip2 stream in their original order.
+*/
+class ParallelBZFilter {
+public:
+	ParallelBZFilter();
+	~ParallelBZFilter() noexcept;
+	/**
+	* Compress data.
+	* @param in Input data
+	* @param insize Input size (Set to 0 to indicate that no more data will follow)
+	* @param out Output buffer
+	* @param outsize Output size, set to compressed size on return.
+	* @return True if there's more processing to be done.
+	*/
+	bool operator()(const void* in, size_t& insize, void* out, size_t& outsize);
+private:
+	struct Block;
+	typedef shared_ptr<Block> BlockPtr;
+
+	static void compressBlock(Block& aBlock) noexcept;
+	static void waitBlock(Block& aBlock) noexcept;
+	void queueBlock();
+	void mergeBlock(Block& aBlock);
+	void writeBits(uint32_t aBits, int aCount) noexcept;
+
+	// Blocks that haven't been merged yet
+	deque<BlockPtr> blocks;
+	const size_t maxPendingBlocks;
+	task_group tasks;
+
+	string input;
+	bool inputEnded = false;
+
+	string output;
+	size_t outputPos = 0;
+	bool streamEnded = false;
+
+	uint64_t bitBuffer = 0;
+	int bitCount = 0;
+	uint32_t combinedCRC = 0;
+};
+
 class UnBZFilter {
 public:
 	UnBZFilter();
@@ -39,9 +39,13 @@ using std::max;
 // Polling is used for tasks...should be fixed...
 #define POLL_TIMEOUT 250
 
+// Maximum number of reads/writes for a single socket event when running in a socket reactor
+#define REACTOR_MAX_READS 16
+#define REACTOR_MAX_WRITES 64
+
 BufferedSocket::BufferedSocket(char aSeparator, bool v4only) :
 separator(aSeparator), useLimiter(false), mode(MODE_LINE), dataBytes(0), rollback(0), state(STARTING),
-disconnecting(false), v4only(v4only)
+disconnecting(false), v4only(v4only), useReactor(SETTING(SOCKET_IO_THREADS) > 0 && SocketReactor::isSupported())
 {
 	start();
 
@@ -188,14 +192,14 @@ void BufferedSocket::threadAccept() {
 	}
 }
 
-void BufferedSocket::threadRead() {
+int BufferedSocket::threadRead(bool aWaitLimiter) {
 	if(state != RUNNING)
-		return;
+		return -1;
 
-	int left = (mode == MODE_DATA && useLimiter) ? ThrottleManager::getInstance()->read(sock.get(), &inbuf[0], inbuf.size()) : sock->read(&inbuf[0], inbuf.size());
+	int left = (mode == MODE_DATA && useLimiter) ? ThrottleManager::getInstance()->read(sock.get(), downBucket, &inbuf[0], inbuf.size(), aWaitLimiter) : sock->read(&inbuf[0], inbuf.size());
 	if(left == -1) {
 		// EWOULDBLOCK, no data received...
-		return;
+		return -1;
 	} else if(left == 0) {
 		// This socket has been closed...
 		throw SocketException(STRING(CONNECTION_CLOSED));
@@ -292,6 +296,8 @@ void BufferedSocket::threadRead() {
 	if(mode == MODE_LINE && line.size() > static_cast<size_t>(SETTING(MAX_COMMAND_LENGTH))) {
 		throw SocketException(STRING(COMMAND_TOO_LONG));
 	}
+
+	return total;
 }
 
 void BufferedSocket::threadSendFile(InputStream* file) {
@@ -301,6 +307,14 @@ void BufferedSocket::threadSendFile(InputStream* file) {
 	if(disconnecting)
 		return;
 	dcassert(file != NULL);
+	{
+		int64_t directBytes = 0;
+		auto f = getDirectFile(file, directBytes);
+		if (f && threadSendFileDirect(file, *f, directBytes)) {
+			return;
+		}
+	}
+
 	size_t sockSize = (size_t)sock->getSocketOptInt(SO_SNDBUF);
 	size_t bufSize = max(sockSize, (size_t)64*1024);
 
@@ -350,7 +364,7 @@ void BufferedSocket::threadSendFile(InputStream* file) {
 				written = sock->write(&writeBufTmp[writePos], writeSize);
 			} else {
 				writeSize = min(sockSize / 2, writeBufTmp.size() - writePos);
-				written = useLimiter ? ThrottleManager::getInstance()->write(sock.get(), &writeBufTmp[writePos], writeSize) : sock->read(&inbuf[0], inbuf.size());
+				written = useLimiter ? ThrottleManager::getInstance()->write(sock.get(), upBucket, &writeBufTmp[writePos], writeSize) : sock->write(&writeBufTmp[writePos], writeSize);
 			}
 			
 			if(written > 0) {
@@ -389,6 +403,60 @@ void BufferedSocket::threadSendFile(InputStream* file) {
 	}
 }
 
+File* BufferedSocket::getDirectFile(InputStream* aStream, int64_t& maxBytes_) const noexcept {
+	if (!sock->canSendFile()) {
+		return nullptr;
+	}
+
+	return aStream->getDirectFile(maxBytes_);
+}
+
+bool BufferedSocket::threadSendFileDirect(InputStream* aStream, File& aFile, int64_t aBytes) {
+	size_t chunkSize = max((size_t)sock->getSocketOptInt(SO_SNDBUF), (size_t)64*1024);
+
+	while (aBytes > 0) {
+		if (disconnecting)
+			return true;
+
+		auto len = static_cast<size_t>(min(aBytes, static_cast<int64_t>(chunkSize)));
+		ThrottleManager::Tokens tokens;
+		if (useLimiter) {
+			tokens = ThrottleManager::getInstance()->takeUpTokens(upBucket, len);
+			len = tokens.get();
+			if (len == 0) {
+				continue;
+			}
+		}
+
+		auto sent = sock->sendFile(aFile, static_cast<int>(len));
+		if (useLimiter && sent < static_cast<int>(len)) {
+			ThrottleManager::getInstance()->returnUpTokens(upBucket, tokens, len - max(sent, 0));
+		}
+		if (sent > 0) {
+			aStream->directRead(sent);
+			aBytes -= sent;
+
+			fire(BufferedSocketListener::BytesSent(), sent, sent);
+		} else if (sent == 0) {
+			// Not supported by the file system (or the file was truncated)
+			return false;
+		} else {
+			while (!disconnecting) {
+				auto w = sock->wait(POLL_TIMEOUT, true, true);
+				if (w.first) {
+					threadRead();
+				}
+				if (w.second) {
+					break;
+				}
+			}
+		}
+	}
+
+	fire(BufferedSocketListener::TransmitDone());
+	return true;
+}
+
 void BufferedSocket::write(const char* aBuf, size_t aLen) noexcept {
 	if(!sock.get())
 		return;
@@ -498,6 +566,11 @@ int BufferedSocket::run() {
 				break;
 			}
 			if(state == RUNNING) {
+				if(handOver()) {
+					// The socket is owned by the reactor now
+					return 0;
+				}
+
 				checkSocket();
 			}
 		} catch(const Exception& e) {
@@ -515,6 +588,10 @@ void BufferedSocket::fail(const string& aError) {
 		fire(BufferedSocketListener::Failed(), aError);
 	}
 	//fire listener before deleting socket to be able to retrieve information from it.. does it cause any problems?? 
+	if (reactorLoop) {
+		reactorLoop->remove(this);
+	}
+
 	if (sock.get()) {
 		sock->disconnect();
 	}
@@ -528,7 +605,254 @@ void BufferedSocket::shutdown(function<void ()> f) {
 
 void BufferedSocket::addTask(Tasks task, TaskData* data) {
 	dcassert(task == DISCONNECT || task == SHUTDOWN || sock.get());
-	tasks.emplace_back(task, unique_ptr<TaskData>(data)); taskSem.signal();
+	tasks.emplace_back(task, unique_ptr<TaskData>(data));
+
+	if (reactorLoop) {
+		if (!reactorScheduled.exchange(true)) {
+			reactorLoop->schedule(this);
+		}
+	} else {
+		taskSem.signal();
+	}
+}
+
+bool BufferedSocket::handOver() noexcept {
+	auto reactor = SocketReactor::getInstance();
+	if (!reactor || !useReactor) {
+		return false;
+	}
+
+	// Don't try again if there are no loops available
+	useReactor = false;
+	return reactor->adopt(this);
+}
+
+void BufferedSocket::reactorTasks() {
+	for (;;) {
+		pair<Tasks, unique_ptr<TaskData> > p;
+		{
+			Lock l(cs);
+			if (tasks.empty()) {
+				return;
+			}
+
+			p = move(tasks.front());
+			tasks.pop_front();
+		}
+
+		if (p.first == SHUTDOWN) {
+			if (p.second)
+				static_cast<CallData*>(p.second.get())->f();
+
+			reactorLoop->close(this);
+			return;
+		} else if (p.first == ASYNC_CALL) {
+			static_cast<CallData*>(p.second.get())->f();
+			continue;
+		}
+
+		if (state != RUNNING) {
+			dcdebug("%d unexpected in state %d\n", p.first, state);
+			continue;
+		}
+
+		if (p.first == SEND_DATA) {
+			// The actual writing is done when the socket is writable
+			Lock l(cs);
+			if (!hasPendingWrite()) {
+				writeBuf.swap(sendBuf);
+				sendPos = 0;
+			}
+		} else if (p.first == SEND_FILE) {
+			size_t sockSize = (size_t)sock->getSocketOptInt(SO_SNDBUF);
+			fileSend = make_unique<FileSend>(static_cast<SendFileInfo*>(p.second.get())->stream, max(sockSize, (size_t)64*1024));
+			fileSend->directFile = getDirectFile(fileSend->stream, fileSend->directBytes);
+
+			{
+				// Data that was written before the file must be sent first
+				// (the pending send buffer can't be modified because of OpenSSL write retries)
+				Lock l(cs);
+				auto& f = *fileSend;
+				f.buf.resize(max(f.buf.size(), writeBuf.size()));
+				copy(writeBuf.begin(), writeBuf.end(), f.buf.begin());
+				f.len = f.dataBytes = writeBuf.size();
+				writeBuf.clear();
+			}
+		} else if (p.first == DISCONNECT) {
+			bool hasData = false;
+			{
+				Lock l(cs);
+				hasData = hasPendingWrite() || !writeBuf.empty();
+			}
+
+			if (hasData && !disconnecting) {
+				// Data that was written before disconnecting must be sent first
+				disconnectPending = true;
+			} else {
+				fail(STRING(DISCONNECTED));
+			}
+		}
+	}
+}
+
+BufferedSocket::ReactorResult BufferedSocket::reactorRead(bool aHangup) {
+	for (int i = 0; i < REACTOR_MAX_READS; ++i) {
+		auto limited = mode == MODE_DATA && useLimiter;
+		auto received = threadRead(false);
+		if (state != RUNNING) {
+			return REACTOR_WAIT;
+		}
+
+		if (received == -1) {
+			if (aHangup) {
+				throw SocketException(STRING(CONNECTION_CLOSED));
+			}
+
+			return limited ? REACTOR_THROTTLED : REACTOR_WAIT;
+		}
+
+		if (limited) {
+			// Give a chance for other transfers
+			return REACTOR_WAIT;
+		}
+	}
+
+	// TLS sockets may have buffered data that won't trigger new events
+	return REACTOR_AGAIN;
+}
+
+BufferedSocket::ReactorResult BufferedSocket::reactorWrite() {
+	for (int i = 0; i < REACTOR_MAX_WRITES; ++i) {
+		if (disconnecting) {
+			return REACTOR_WAIT;
+		}
+
+		if (sendPos < sendBuf.size()) {
+			int n = sock->write(&sendBuf[sendPos], static_cast<int>(sendBuf.size() - sendPos));
+			if (n <= 0) {
+				return REACTOR_WAIT;
+			}
+
+			sendPos += n;
+			continue;
+		}
+
+		sendBuf.clear();
+		sendPos = 0;
+
+		if (fileSend) {
+			auto ret = reactorSendFile();
+			if (ret != REACTOR_AGAIN) {
+				return ret;
+			}
+
+			continue;
+		}
+
+		{
+			Lock l(cs);
+			if (!writeBuf.empty()) {
+				writeBuf.swap(sendBuf);
+				continue;
+			}
+		}
+
+		if (disconnectPending) {
+			fail(STRING(DISCONNECTED));
+		}
+
+		return REACTOR_WAIT;
+	}
+
+	// Let other sockets to be handled as well, the socket will still be writable
+	return REACTOR_WAIT;
+}
+
+BufferedSocket::ReactorResult BufferedSocket::reactorSendFile() {
+	auto& f = *fileSend;
+	if (f.pos == f.len && f.directFile) {
+		if (f.directBytes == 0) {
+			fileSend.reset();
+			fire(BufferedSocketListener::TransmitDone());
+			return REACTOR_AGAIN;
+		}
+
+		auto len = static_cast<size_t>(min(f.directBytes, static_cast<int64_t>(f.buf.size())));
+		ThrottleManager::Tokens tokens;
+		if (useLimiter) {
+			tokens = ThrottleManager::getInstance()->takeUpTokens(upBucket, len, false);
+			len = tokens.get();
+			if (len == 0) {
+				return REACTOR_THROTTLED;
+			}
+		}
+
+		auto sent = sock->sendFile(*f.directFile, static_cast<int>(len));
+		if (useLimiter && sent < static_cast<int>(len)) {
+			ThrottleManager::getInstance()->returnUpTokens(upBucket, tokens, len - max(sent, 0));
+		}
+		if (sent > 0) {
+			f.stream->directRead(sent);
+			f.directBytes -= sent;
+
+			fire(BufferedSocketListener::BytesSent(), sent, sent);
+			return REACTOR_AGAIN;
+		} else if (sent == 0) {
+			// Not supported by the file system (or the file was truncated), read the rest through the stream
+			f.directFile = nullptr;
+			return REACTOR_AGAIN;
+		}
+
+		return REACTOR_WAIT;
+	}
+
+	if (f.pos == f.len) {
+		if (f.readDone) {
+			fileSend.reset();
+			fire(BufferedSocketListener::TransmitDone());
+			return REACTOR_AGAIN;
+		}
+
+		// Fill the buffer
+		size_t bytesRead = f.buf.size();
+		size_t actual = f.stream->read(&f.buf[0], bytesRead);
+
+		if (bytesRead > 0) {
+			fire(BufferedSocketListener::BytesSent(), bytesRead, 0);
+		}
+
+		if (actual == 0) {
+			f.readDone = true;
+		}
+
+		f.pos = 0;
+		f.len = actual;
+		return REACTOR_AGAIN;
+	}
+
+	int written;
+	if (f.lastWritten == -1) {
+		// workaround for OpenSSL (crashes when previous write failed and now retrying with different writeSize)
+		written = sock->write(&f.buf[f.pos], f.writeSize);
+	} else {
+		f.writeSize = min(f.buf.size() / 2, f.len - f.pos);
+		written = useLimiter ? ThrottleManager::getInstance()->write(sock.get(), upBucket, &f.buf[f.pos], f.writeSize, false) : sock->write(&f.buf[f.pos], f.writeSize);
+	}
+
+	f.lastWritten = written;
+	if (written > 0) {
+		f.pos += written;
+
+		auto dataWritten = min(static_cast<size_t>(written), f.dataBytes);
+		f.dataBytes -= dataWritten;
+		if (static_cast<size_t>(written) > dataWritten) {
+			fire(BufferedSocketListener::BytesSent(), 0, written - dataWritten);
+		}
+
+		return REACTOR_AGAIN;
+	}
+
+	return written == -1 ? REACTOR_WAIT : REACTOR_THROTTLED;
 }
 
 } // namespace dcpp
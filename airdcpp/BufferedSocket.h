@@ -28,9 +28,11 @@
 #include "BufferedSocketListener.h"
 #include "GetSet.h"
 #include "Semaphore.h"
+#include "SocketReactor.h"
 #include "Thread.h"
 #include "Socket.h"
 #include "Speaker.h"
+#include "TokenBucket.h"
 
 namespace dcpp {
 
@@ -149,6 +151,31 @@ private:
 		function<void ()> f;
 	};
 
+	// Upload state when running in a socket reactor
+	struct FileSend {
+		FileSend(InputStream* aStream, size_t aBufSize) : stream(aStream), buf(aBufSize) { }
+		InputStream* stream;
+		ByteVector buf;
+		size_t pos = 0;
+		size_t len = 0;
+		size_t writeSize = 0;
+		int lastWritten = 0;
+		bool readDone = false;
+
+		// Leading bytes in the buffer that aren't part of the file
+		size_t dataBytes = 0;
+
+		// Set when the file is sent without reading it through the stream
+		File* directFile = nullptr;
+		int64_t directBytes = 0;
+	};
+
+	enum ReactorResult {
+		REACTOR_WAIT, // Wait for the next event
+		REACTOR_AGAIN, // More data may be available without a new event
+		REACTOR_THROTTLED // Retry after the bandwidth limiter has new tokens
+	};
+
 	BufferedSocket(char aSeparator, bool v4only);
 
 	virtual ~BufferedSocket();
@@ -171,15 +198,28 @@ private:
 	State state;
 	bool disconnecting;
 	bool v4only;
+	bool useReactor;
+
+	// Bandwidth limiter buckets of this connection
+	TokenBucket downBucket;
+	TokenBucket upBucket;
 
 	virtual int run();
 
 	void threadConnect(const AddressInfo& aAddr, const string& aPort, const string& localPort, NatRoles natRole, bool proxy);
 	void threadAccept();
-	void threadRead();
+
+	// Returns the number of bytes read or -1 if nothing was received
+	int threadRead(bool aWaitLimiter = true);
 	void threadSendFile(InputStream* is);
 	void threadSendData();
 
+	// Uploads can be sent directly from the file if the socket supports it and the stream doesn't modify the data
+	File* getDirectFile(InputStream* aStream, int64_t& maxBytes_) const noexcept;
+
+	// Returns false if the rest of the file needs to be read through the stream
+	bool threadSendFileDirect(InputStream* aStream, File& aFile, int64_t aBytes);
+
 	void fail(const string& aError);
 	static atomic<long> sockets;
 
@@ -190,6 +230,34 @@ private:
 	void setOptions();
 	void shutdown(function<void ()> f);
 	void addTask(Tasks task, TaskData* data);
+
+	// Socket reactor, the fields are only accessed from the loop thread (unless mentioned otherwise)
+	friend class SocketReactor;
+
+	// Set when the socket is handed over (protected by cs)
+	SocketReactor::Loop* reactorLoop = nullptr;
+	atomic<bool> reactorScheduled { false };
+
+	bool reactorRegistered = false;
+	bool reactorClosed = false;
+	uint32_t reactorEvents = 0;
+	bool readParked = false;
+	bool writeParked = false;
+
+	size_t sendPos = 0;
+	unique_ptr<FileSend> fileSend;
+	bool disconnectPending = false;
+
+	// Returns false if the socket should keep using its own thread
+	bool handOver() noexcept;
+
+	// Returns when there are no tasks left, throws on errors
+	void reactorTasks();
+
+	ReactorResult reactorRead(bool aHangup);
+	ReactorResult reactorWrite();
+	ReactorResult reactorSendFile();
+	bool hasPendingWrite() const noexcept { return fileSend || sendPos < sendBuf.size(); }
 };
 
 } // namespace dcpp
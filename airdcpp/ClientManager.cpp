@@ -854,54 +854,41 @@ void ClientManager::userCommand(const HintedUser& user, const UserCommand& uc, P
 }
 
 bool ClientManager::sendUDP(AdcCommand& cmd, const CID& aCID, bool aNoCID /*false*/, bool aNoPassive /*false*/, const string& aKey /*Util::emptyString*/, const string& aHubUrl /*Util::emptyString*/) noexcept {
+	vector<AdcCommand> commands;
+	commands.push_back(move(cmd));
+
+	auto ret = sendUDP(commands, aCID, aNoCID, aNoPassive, aKey, aHubUrl);
+
+	// The command is modified when it's sent via the hub
+	cmd = move(commands.front());
+	return ret;
+}
+
+bool ClientManager::sendUDP(vector<AdcCommand>& aCommands, const CID& aCID, bool aNoCID /*false*/, bool aNoPassive /*false*/, const string& aKey /*Util::emptyString*/, const string& aHubUrl /*Util::emptyString*/) noexcept {
 	auto u = findOnlineUser(aCID, aHubUrl);
 	if (!u) {
 		return false;
 	}
 
-	if (cmd.getType() == AdcCommand::TYPE_UDP && !u->getIdentity().isUdpActive()) {
-		if (u->getUser()->isNMDC() || aNoPassive) {
-			return false;
-		}
+	StringList datagrams;
+	for (auto& cmd: aCommands) {
+		if (cmd.getType() == AdcCommand::TYPE_UDP && !u->getIdentity().isUdpActive()) {
+			if (u->getUser()->isNMDC() || aNoPassive) {
+				return false;
+			}
 
-		cmd.setType(AdcCommand::TYPE_DIRECT);
-		cmd.setTo(u->getIdentity().getSID());
-		u->getClient()->send(cmd);
-	} else {
-		try {
+			cmd.setType(AdcCommand::TYPE_DIRECT);
+			cmd.setTo(u->getIdentity().getSID());
+			u->getClient()->send(cmd);
+		} else {
 			COMMAND_DEBUG(cmd.toString(), DebugManager::TYPE_CLIENT_UDP, DebugManager::OUTGOING, u->getIdentity().getUdpIp() + ":" + u->getIdentity().getUdpPort());
-			auto cmdStr = aNoCID ? cmd.toString() : cmd.toString(getMe()->getCID());
-			if (!aKey.empty() && Encoder::isBase32(aKey.c_str())) {
-				uint8_t keyChar[16];
-				Encoder::fromBase32(aKey.c_str(), keyChar, 16);
-
-				uint8_t ivd[16] = { };
-
-				// prepend 16 random bytes to message
-				RAND_bytes(ivd, 16);
-				cmdStr.insert(0, (char*)ivd, 16);
-					
-				// use PKCS#5 padding to align the message length to the cypher block size (16)
-				uint8_t pad = 16 - (cmdStr.length() & 15);
-				cmdStr.append(pad, (char)pad);
-
-				// encrypt it
-				uint8_t* out = new uint8_t[cmdStr.length()];
-				memset(ivd, 0, 16);
-				int aLen = cmdStr.length();
-
-				AES_KEY key;
-				AES_set_encrypt_key(keyChar, 128, &key);
-				AES_cbc_encrypt((unsigned char*)cmdStr.c_str(), out, cmdStr.length(), &key, ivd, AES_ENCRYPT);
-
-				dcassert((aLen & 15) == 0);
-
-				cmdStr.clear();
-				cmdStr.insert(0, (char*)out, aLen);
-				delete[] out;
-			}
+			datagrams.push_back(toUdpData(cmd, aNoCID, aKey));
+		}
+	}
 
-			udp->writeTo(u->getIdentity().getUdpIp(), u->getIdentity().getUdpPort(), cmdStr);
+	if (!datagrams.empty()) {
+		try {
+			udp->writeTo(u->getIdentity().getUdpIp(), u->getIdentity().getUdpPort(), datagrams);
 		} catch(const SocketException&) {
 			dcdebug("Socket exception sending ADC UDP command\n");
 		}
@@ -910,6 +897,50 @@ bool ClientManager::sendUDP(AdcCommand& cmd, const CID& aCID, bool aNoCID /*fals
 	return true;
 }
 
+string ClientManager::toUdpData(const AdcCommand& aCmd, bool aNoCID, const string& aKey) noexcept {
+	string cmdStr;
+	auto encrypt = !aKey.empty() && Encoder::isBase32(aKey.c_str());
+
+	uint8_t ivd[16] = { };
+	if (encrypt) {
+		// prepend 16 random bytes to message
+		RAND_bytes(ivd, 16);
+		cmdStr.append((char*)ivd, 16);
+	}
+
+	if (aNoCID) {
+		aCmd.appendString(cmdStr);
+	} else {
+		aCmd.appendString(cmdStr, getMe()->getCID());
+	}
+
+	if (encrypt) {
+		uint8_t keyChar[16];
+		Encoder::fromBase32(aKey.c_str(), keyChar, 16);
+
+		// use PKCS#5 padding to align the message length to the cypher block size (16)
+		uint8_t pad = 16 - (cmdStr.length() & 15);
+		cmdStr.append(pad, (char)pad);
+
+		// encrypt it
+		uint8_t* out = new uint8_t[cmdStr.length()];
+		memset(ivd, 0, 16);
+		int aLen = cmdStr.length();
+
+		AES_KEY key;
+		AES_set_encrypt_key(keyChar, 128, &key);
+		AES_cbc_encrypt((unsigned char*)cmdStr.c_str(), out, cmdStr.length(), &key, ivd, AES_ENCRYPT);
+
+		dcassert((aLen & 15) == 0);
+
+		cmdStr.clear();
+		cmdStr.insert(0, (char*)out, aLen);
+		delete[] out;
+	}
+
+	return cmdStr;
+}
+
 void ClientManager::infoUpdated() noexcept {
 	RLock l(cs);
 	for (auto c: clients | map_values) {
@@ -987,11 +1018,14 @@ void ClientManager::on(ClientListener::NmdcSearch, Client* aClient, const string
 				if(port.empty()) 
 					port = "412";
 
+				StringList datagrams;
 				for (const auto& sr: l) {
 					auto data = sr->toSR(*aClient);
 					COMMAND_DEBUG(data, DebugManager::TYPE_CLIENT_UDP, DebugManager::OUTGOING, ip + ":" + port);
-					udp->writeTo(ip, port, data);
+					datagrams.push_back(move(data));
 				}
+
+				udp->writeTo(ip, port, datagrams);
 			} catch(...) {
 				dcdebug("Search caught error\n");
 			}
@@ -219,6 +219,9 @@ public:
 	
 	bool sendUDP(AdcCommand& c, const CID& to, bool aNoCID = false, bool aNoPassive = false, const string& aEncryptionKey = Util::emptyString, const string& aHubUrl = Util::emptyString) noexcept;
 
+	// Send multiple commands to the same user, the datagrams are sent with a single call when possible
+	bool sendUDP(vector<AdcCommand>& aCommands, const CID& to, bool aNoCID = false, bool aNoPassive = false, const string& aEncryptionKey = Util::emptyString, const string& aHubUrl = Util::emptyString) noexcept;
+
 	bool connect(const UserPtr& aUser, const string& aToken, bool aAllowUrlChange, string& lastError_, string& hubHint_, bool& isProtocolError_, ConnectionType type = CONNECTION_TYPE_LAST) const noexcept;
 	bool privateMessageHooked(const HintedUser& aUser, const OutgoingChatMessage& aMessage, string& error_, bool aEcho = true) noexcept;
 	void userCommand(const HintedUser& aUser, const UserCommand& uc, ParamMap& params_, bool aCompatibility) noexcept;
@@ -262,6 +265,9 @@ private:
 	UserPtr me;
 
 	unique_ptr<Socket> udp;
+
+	// Returns the datagram to send, encrypted if a key is provided
+	string toUdpData(const AdcCommand& aCmd, bool aNoCID, const string& aKey) noexcept;
 	
 	CID pid;
 	uint64_t lastOfflineUserCleanup;
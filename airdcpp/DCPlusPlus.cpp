@@ -45,6 +45,7 @@
 #include "ShareManager.h"
 #include "SearchManager.h"
 #include "SettingsManager.h"
+#include "SocketReactor.h"
 #include "ThrottleManager.h"
 #include "TransferInfoManager.h"
 #include "UpdateManager.h"
@@ -89,6 +90,7 @@ void startup(StepF stepF, MessageF messageF, Callback runWizard, ProgressF progr
 	DownloadManager::newInstance();
 	UploadManager::newInstance();
 	ThrottleManager::newInstance();
+	SocketReactor::newInstance();
 	QueueManager::newInstance();
 	FavoriteManager::newInstance();
 	ADLSearchManager::newInstance();
@@ -207,6 +209,7 @@ void shutdown(StepF stepF, ProgressF progressF, Callback moduleDestroyF) {
 	DebugManager::deleteInstance();
 	ADLSearchManager::deleteInstance();
 	CryptoManager::deleteInstance();
+	SocketReactor::deleteInstance();
 	ThrottleManager::deleteInstance();
 	DirectoryListingManager::deleteInstance();
 	QueueManager::deleteInstance();
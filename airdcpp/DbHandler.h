@@ -26,6 +26,7 @@
 #include "Util.h"
 
 #include <functional>
+#include <map>
 
 namespace dcpp {
 
@@ -35,6 +36,9 @@ class DbSnapshot {
 
 };
 
+// Key -> value pairs that are written with a single database operation (an empty value removes the key)
+typedef std::map<string, string> DbWriteBatch;
+
 // Most methods throw DbException in case of errors
 class DbHandler : boost::noncopyable {
 public:
@@ -46,6 +50,7 @@ public:
 	virtual void put(void* key, size_t keyLen, void* value, size_t valueLen, DbSnapshot* aSnapshot = nullptr) = 0;
 	virtual bool get(void* key, size_t keyLen, size_t initialValueLen, std::function<bool(void* aValue, size_t aValueLen)> loadF, DbSnapshot* aSnapshot = nullptr) = 0;
 	virtual void remove(void* aKey, size_t keyLen, DbSnapshot* aSnapshot = nullptr) = 0;
+	virtual void write(const DbWriteBatch& aBatch) = 0;
 
 	virtual bool hasKey(void* key, size_t keyLen, DbSnapshot* aSnapshot = nullptr) = 0;
 
@@ -53,6 +58,10 @@ public:
 	virtual int64_t getSizeOnDisk() = 0;
 
 	virtual void remove_if(std::function<bool(void* aKey, size_t keyLen, void* aValue, size_t valueLen)> f, DbSnapshot* aSnapshot = nullptr) = 0;
+
+	// Calls f in key order for each key that starts with aPrefix and has no aSeparator after the prefix
+	// Keys under the separated sub paths are skipped without iterating through them
+	virtual void forEachChild(void* aPrefix, size_t aPrefixLen, char aSeparator, std::function<void(void* aKey, size_t keyLen, void* aValue, size_t valueLen)> f, DbSnapshot* aSnapshot = nullptr) = 0;
 	virtual void compact() {}
 
 	virtual string getStats() { return "Not supported"; }
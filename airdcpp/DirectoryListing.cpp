@@ -43,7 +43,7 @@ using boost::range::find_if;
 
 DirectoryListing::DirectoryListing(const HintedUser& aUser, bool aPartial, const string& aFileName, bool aIsClientView, bool aIsOwnList) : 
 	TrackableDownloadItem(aIsOwnList || (!aPartial && Util::fileExists(aFileName))), // API requires the download state to be set correctly
-	hintedUser(aUser), root(Directory::create(nullptr, ADC_ROOT_STR, Directory::TYPE_INCOMPLETE_NOCHILD, 0)), partialList(aPartial), isOwnList(aIsOwnList), fileName(aFileName),
+	hintedUser(aUser), root(Directory::createRoot()), partialList(aPartial), isOwnList(aIsOwnList), fileName(aFileName),
 	isClientView(aIsClientView), matchADL(SETTING(USE_ADLS) && !aPartial), 
 	tasks(isClientView, Thread::NORMAL, std::bind(&DirectoryListing::dispatch, this, std::placeholders::_1))
 {
@@ -68,12 +68,12 @@ bool DirectoryListing::isMyCID() const noexcept {
 }
 
 
-bool DirectoryListing::Directory::Sort::operator()(const Ptr& a, const Ptr& b) const {
-	return compare(a->getName(), b->getName()) < 0;
+bool DirectoryListing::Directory::Sort::operator()(const Directory* a, const Directory* b) const noexcept {
+	return strcmp(a->name, b->name) < 0;
 }
 
-bool DirectoryListing::File::Sort::operator()(const Ptr& a, const Ptr& b) const {
-	return compare(a->getName(), b->getName()) < 0;
+bool DirectoryListing::File::Sort::operator()(const File* a, const File* b) const noexcept {
+	return strcmp(a->name, b->name) < 0;
 }
 
 string DirectoryListing::getNick(bool aFirstOnly) const noexcept {
@@ -220,20 +220,19 @@ void DirectoryListing::onStateChanged() noexcept {
 
 DirectoryListing::Directory::Ptr DirectoryListing::createBaseDirectory(const string& aBasePath, time_t aDownloadDate) noexcept {
 	dcassert(Util::isAdcDirectoryPath(aBasePath));
-	auto cur = root;
+	auto cur = root.get();
 
 	const auto sl = StringTokenizer<string>(aBasePath, ADC_SEPARATOR).getTokens();
 	for (const auto& curDirName: sl) {
-		auto s = cur->directories.find(&curDirName);
-		if (s == cur->directories.end()) {
-			auto d = DirectoryListing::Directory::create(cur.get(), curDirName, DirectoryListing::Directory::TYPE_INCOMPLETE_CHILD, aDownloadDate, true);
-			cur = d;
-		} else {
-			cur = s->second;
+		auto d = cur->findDirectory(curDirName);
+		if (!d) {
+			d = DirectoryListing::Directory::create(cur, curDirName, DirectoryListing::Directory::TYPE_INCOMPLETE_CHILD, aDownloadDate, true);
 		}
+
+		cur = d;
 	}
 
-	return cur;
+	return cur->getPtr();
 }
 
 void DirectoryListing::loadFile() {
@@ -271,6 +270,13 @@ public:
 private:
 	void validateName(const string& aName);
 
+	// Files are collected for each open directory so that they can be moved in arrays of exact size
+	void startFiles() noexcept;
+	void flushFiles() noexcept;
+
+	vector<DirectoryListing::File*> pendingFiles;
+	vector<size_t> pendingFileLevels;
+
 	DirectoryListing* list;
 	DirectoryListing::Directory* cur;
 	UserPtr user;
@@ -300,6 +306,22 @@ int DirectoryListing::loadXML(InputStream& is, bool aUpdating, const string& aBa
 	return ll.getLoadedDirs();
 }
 
+void ListLoader::startFiles() noexcept {
+	pendingFileLevels.push_back(pendingFiles.size());
+}
+
+void ListLoader::flushFiles() noexcept {
+	dcassert(!pendingFileLevels.empty());
+	auto start = pendingFiles.begin() + pendingFileLevels.back();
+	pendingFileLevels.pop_back();
+
+	if (start != pendingFiles.end()) {
+		cur->files.reserve(cur->files.size() + distance(start, pendingFiles.end()));
+		cur->files.insert(cur->files.end(), start, pendingFiles.end());
+		pendingFiles.erase(start, pendingFiles.end());
+	}
+}
+
 void ListLoader::validateName(const string& aName) {
 	if (aName.empty()) {
 		throw SimpleXMLException("Name attribute missing");
@@ -350,8 +372,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 
 			TTHValue tth(h); /// @todo verify validity?
 
-			auto f = make_shared<DirectoryListing::File>(cur, n, size, tth, checkDupe, Util::toTimeT(getAttrib(attribs, sDate, 3)));
-			cur->files.push_back(f);
+			pendingFiles.push_back(DirectoryListing::File::create(cur, n, size, tth, checkDupe, Util::toTimeT(getAttrib(attribs, sDate, 3))));
 		} else if(name == sDirectory) {
 			const string& n = getAttrib(attribs, sName, 0);
 			validateName(n);
@@ -370,14 +391,11 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 			const string& size = getAttrib(attribs, sSize, 2);
 			const string& date = getAttrib(attribs, sDate, 3);
 
-			DirectoryListing::Directory::Ptr d = nullptr;
+			DirectoryListing::Directory* d = nullptr;
 			if(updating) {
 				dirsLoaded++;
 
-				auto i = cur->directories.find(&n);
-				if (i != cur->directories.end()) {
-					d = i->second;
-				}
+				d = cur->findDirectory(n);
 			}
 
 			if(!d) {
@@ -391,7 +409,8 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 				}
 				d->setRemoteDate(Util::toTimeT(date));
 			}
-			cur = d.get();
+			cur = d;
+			startFiles();
 
 			if(simple) {
 				// To handle <Directory Name="..." />
@@ -412,6 +431,9 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 
 			cur = list->createBaseDirectory(base, listDownloadDate).get();
 
+			// Allow releasing the loaded content separately if the directory is reloaded
+			cur->separateContent();
+
 			dcassert(list->findDirectory(base));
 
 			const string& baseDate = getAttrib(attribs, sBaseDate, 3);
@@ -422,6 +444,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 		// This will prevent possible problems, such as GUI counting the size of this folder
 
 		inListing = true;
+		startFiles();
 
 		if(simple) {
 			// To handle <Directory Name="..." />
@@ -433,8 +456,11 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 void ListLoader::endTag(const string& name) {
 	if(inListing) {
 		if(name == sDirectory) {
+			flushFiles();
 			cur = cur->getParent();
 		} else if(name == sFileListing) {
+			flushFiles();
+
 			// Cur should be the loaded base path now
 
 			cur->setComplete();
@@ -447,64 +473,146 @@ void ListLoader::endTag(const string& name) {
 	}
 }
 
-DirectoryListing::File::File(Directory* aDir, const string& aName, int64_t aSize, const TTHValue& aTTH, bool checkDupe, time_t aRemoteDate) noexcept : 
-	name(aName), size(aSize), parent(aDir), tthRoot(aTTH), remoteDate(aRemoteDate) {
+DirectoryListing::File* DirectoryListing::File::create(Directory* aDir, const string& aName, int64_t aSize, const TTHValue& aTTH, bool aCheckDupe, time_t aRemoteDate) {
+	auto& arena = aDir->getArena();
+	return new (arena.allocate(sizeof(File), alignof(File))) File(aDir, arena.addString(aName), aSize, aTTH, aCheckDupe, aRemoteDate);
+}
+
+DirectoryListing::File* DirectoryListing::File::create(Directory* aDir, const File& aFile, bool aAdls) {
+	auto& arena = aDir->getArena();
+	auto f = new (arena.allocate(sizeof(File), alignof(File))) File(aFile, aAdls);
+	f->setParent(aDir);
+
+	// The name can be shared if the source arena will outlive the new item
+	if (!arena.isWithin(aFile.parent->getArena())) {
+		f->name = arena.addString(aFile.name, strlen(aFile.name));
+	}
+
+	return f;
+}
+
+DirectoryListing::File::Ptr DirectoryListing::File::getPtr() const noexcept {
+	return Ptr(parent->getArena().getHandle(), const_cast<File*>(this));
+}
+
+DirectoryListing::File::File(Directory* aDir, const char* aName, int64_t aSize, const TTHValue& aTTH, bool checkDupe, time_t aRemoteDate) noexcept : 
+	size(aSize), parent(aDir), tthRoot(aTTH), remoteDate(aRemoteDate), name(aName) {
 
 	if (checkDupe && size > 0) {
 		dupe = AirUtil::checkFileDupe(tthRoot);
 	}
 
-	//dcdebug("DirectoryListing::File (copy) %s was created\n", aName.c_str());
+	//dcdebug("DirectoryListing::File (copy) %s was created\n", aName);
 }
 
-DirectoryListing::File::File(const File& rhs, bool _adls) noexcept : name(rhs.name), size(rhs.size), parent(rhs.parent), tthRoot(rhs.tthRoot), adls(_adls), dupe(rhs.dupe), remoteDate(rhs.remoteDate)
+DirectoryListing::File::File(const File& rhs, bool _adls) noexcept : size(rhs.size), parent(rhs.parent), tthRoot(rhs.tthRoot), adls(_adls), dupe(rhs.dupe), remoteDate(rhs.remoteDate), name(rhs.name)
 {
-	//dcdebug("DirectoryListing::File (copy) %s was created\n", rhs.getName().c_str());
+	//dcdebug("DirectoryListing::File (copy) %s was created\n", rhs.name);
+}
+
+DirectoryListing::Directory::Ptr DirectoryListing::Directory::createRoot() {
+	auto arena = make_shared<Arena>();
+	auto root = new (arena->allocate(sizeof(Directory), alignof(Directory))) Directory(*arena, nullptr, arena->addString(ADC_ROOT_STR), TYPE_INCOMPLETE_NOCHILD, 0, false, DirectoryContentInfo(), Util::emptyString, 0);
+
+	// The root is kept when the list is reloaded
+	root->separateContent();
+	return root->getPtr();
 }
 
-DirectoryListing::Directory::Ptr DirectoryListing::Directory::create(Directory* aParent, const string& aName, DirType aType, time_t aUpdateDate, bool aCheckDupe, const DirectoryContentInfo& aContentInfo, const string& aSize, time_t aRemoteDate) {
-	auto dir = Ptr(new Directory(aParent, aName, aType, aUpdateDate, aCheckDupe, aContentInfo, aSize, aRemoteDate));
-	if (aParent && aType != TYPE_ADLS) { // This would cause an infinite recursion in ADL search
-		dcassert(aParent->directories.find(&dir->getName()) == aParent->directories.end());
-		auto res = aParent->directories.emplace(&dir->getName(), dir);
-		if (!res.second) {
-			throw AbortException("The directory " + dir->getAdcPath() + " contains items with duplicate names (" + dir->getName() + ", " + *(*res.first).first + ")");
+// Key of the child arena for the ADL search directories
+static const char adlArenaKey = 0;
+
+DirectoryListing::Directory* DirectoryListing::Directory::create(Directory* aParent, const string& aName, DirType aType, time_t aUpdateDate, bool aCheckDupe, const DirectoryContentInfo& aContentInfo, const string& aSize, time_t aRemoteDate) {
+	dcassert(aParent);
+
+	// ADL search directories are released separately when the search is repeated
+	auto& arena = aType == TYPE_ADLS ? aParent->arena->getChild(&adlArenaKey) : *aParent->arena;
+	auto dir = new (arena.allocate(sizeof(Directory), alignof(Directory))) Directory(arena, aParent, arena.addString(aName), aType, aUpdateDate, aCheckDupe, aContentInfo, aSize, aRemoteDate);
+	if (aType != TYPE_ADLS) { // This would cause an infinite recursion in ADL search
+		if (!aParent->addDirectory(dir)) {
+			throw AbortException("The directory " + dir->getAdcPath() + " contains items with duplicate names (" + aName + ", " + (*aParent->lowerBound(dir->name))->name + ")");
 		}
 	}
 
 	return dir;
 }
 
-DirectoryListing::AdlDirectory::Ptr DirectoryListing::AdlDirectory::create(const string& aFullPath, Directory* aParent, const string& aName) {
+DirectoryListing::Directory::Ptr DirectoryListing::Directory::getPtr() const noexcept {
+	return Ptr(arena->getHandle(), const_cast<Directory*>(this));
+}
+
+Arena& DirectoryListing::Directory::getParentArena() const noexcept {
+	if (parent) {
+		return *parent->arena;
+	}
+
+	// Root is always stored in the base arena
+	auto a = arena;
+	while (a->getParent()) {
+		a = a->getParent();
+	}
+
+	return *a;
+}
+
+DirectoryListing::Directory::List::const_iterator DirectoryListing::Directory::lowerBound(const char* aName) const noexcept {
+	return std::lower_bound(directories.begin(), directories.end(), aName, [](const Directory* a, const char* b) {
+		return Util::stricmp(a->name, b) < 0;
+	});
+}
+
+bool DirectoryListing::Directory::addDirectory(Directory* aDir) noexcept {
+	auto i = lowerBound(aDir->name);
+	if (i != directories.end() && Util::stricmp((*i)->name, aDir->name) == 0) {
+		return false;
+	}
+
+	directories.insert(i, aDir);
+	return true;
+}
+
+DirectoryListing::Directory* DirectoryListing::Directory::findDirectory(const string& aName) const noexcept {
+	auto i = lowerBound(aName.c_str());
+	if (i != directories.end() && Util::stricmp((*i)->name, aName.c_str()) == 0) {
+		return *i;
+	}
+
+	return nullptr;
+}
+
+DirectoryListing::AdlDirectory* DirectoryListing::AdlDirectory::create(const string& aFullPath, Directory* aParent, const string& aName) {
 	dcassert(aParent);
 
 	auto name = aName;
-	if (aParent->directories.find(&name) != aParent->directories.end()) {
+	if (aParent->findDirectory(name)) {
 		// No duplicate file names
 		int num = 0;
 		for (;;) {
 			name = aName + " (" + Util::toString(num++) + ")";
-			if (aParent->directories.find(&name) == aParent->directories.end()) {
+			if (!aParent->findDirectory(name)) {
 				break;
 			}
 		}
 	}
 
-	auto dir = Ptr(new AdlDirectory(aFullPath, aParent, name));
+	auto& arena = aParent->getArena();
+	auto dir = new (arena.allocate(sizeof(AdlDirectory), alignof(AdlDirectory))) AdlDirectory(aFullPath, aParent, arena.addString(name));
 
-	dcassert(aParent->directories.find(&dir->getName()) == aParent->directories.end());
-	aParent->directories.emplace(&dir->getName(), dir);
+	auto added = aParent->addDirectory(dir);
+	dcassert(added);
+	(void)added;
 
 	return dir;
 }
 
-DirectoryListing::AdlDirectory::AdlDirectory(const string& aFullAdcPath, DirectoryListing::Directory* aParent, const string& aName) : 
-	Directory(aParent, aName, Directory::TYPE_ADLS, GET_TIME(), false, DirectoryContentInfo(), Util::emptyString, 0), fullAdcPath(aFullAdcPath) {
+DirectoryListing::AdlDirectory::AdlDirectory(const string& aFullAdcPath, DirectoryListing::Directory* aParent, const char* aName) : 
+	Directory(aParent->getArena(), aParent, aName, Directory::TYPE_ADLS, GET_TIME(), false, DirectoryContentInfo(), Util::emptyString, 0), fullAdcPath(aParent->getArena().addString(aFullAdcPath)) {
 
 }
 
-DirectoryListing::Directory::Directory(Directory* aParent, const string& aName, Directory::DirType aType, time_t aUpdateDate, bool aCheckDupe, const DirectoryContentInfo& aContentInfo, const string& aSize, time_t aRemoteDate /*0*/)
-	: name(aName), parent(aParent), type(aType), remoteDate(aRemoteDate), lastUpdateDate(aUpdateDate), contentInfo(aContentInfo) {
+DirectoryListing::Directory::Directory(Arena& aArena, Directory* aParent, const char* aName, Directory::DirType aType, time_t aUpdateDate, bool aCheckDupe, const DirectoryContentInfo& aContentInfo, const string& aSize, time_t aRemoteDate /*0*/)
+	: directories(Arena::Allocator<Directory*>(&aArena)), files(Arena::Allocator<File*>(&aArena)), parent(aParent), type(aType), remoteDate(aRemoteDate), lastUpdateDate(aUpdateDate),
+	contentInfo(aContentInfo), arena(&aArena), name(aName) {
 
 	if (!aSize.empty()) {
 		partialSize = Util::toInt64(aSize);
@@ -514,7 +622,7 @@ DirectoryListing::Directory::Directory(Directory* aParent, const string& aName,
 		dupe = AirUtil::checkAdcDirectoryDupe(getAdcPath(), partialSize);
 	}
 
-	//dcdebug("DirectoryListing::Directory %s was created\n", aName.c_str());
+	//dcdebug("DirectoryListing::Directory %s was created\n", aName);
 }
 
 void DirectoryListing::Directory::search(OrderedStringSet& aResults, SearchQuery& aStrings) const noexcept {
@@ -529,14 +637,17 @@ void DirectoryListing::Directory::search(OrderedStringSet& aResults, SearchQuery
 		}
 	}
 
+	string fileName;
 	for (auto& f: files) {
-		if (aStrings.matchesFile(f->getName(), f->getSize(), f->getRemoteDate(), f->getTTH())) {
+		const auto n = f->getName();
+		fileName.assign(n.data(), n.size());
+		if (aStrings.matchesFile(fileName, f->getSize(), f->getRemoteDate(), f->getTTH())) {
 			aResults.insert(getAdcPath());
 			break;
 		}
 	}
 
-	for (const auto& d: directories | map_values) {
+	for (const auto& d: directories) {
 		d->search(aResults, aStrings);
 		if (aResults.size() >= aStrings.maxResults) return;
 	}
@@ -548,9 +659,9 @@ bool DirectoryListing::Directory::findIncomplete() const noexcept {
 		return true;
 	}
 
-	return find_if(directories | map_values, [](const Directory::Ptr& dir) { 
+	return any_of(directories.begin(), directories.end(), [](const Directory* dir) { 
 		return dir->findIncomplete(); 
-	}).base() != directories.end();
+	});
 }
 
 DirectoryContentInfo DirectoryListing::Directory::getContentInfoRecursive(bool aCountAdls) const noexcept {
@@ -572,7 +683,7 @@ void DirectoryListing::Directory::getContentInfo(size_t& directories_, size_t& f
 		directories_ += directories.size();
 		files_ += files.size();
 
-		for (const auto& d : directories | map_values) {
+		for (const auto& d : directories) {
 			d->getContentInfo(directories_, files_, aCountAdls);
 		}
 	} else if (Util::hasContentInfo(contentInfo)) {
@@ -589,7 +700,7 @@ BundleDirectoryItemInfo::List DirectoryListing::Directory::toBundleInfoList() co
 
 void DirectoryListing::Directory::toBundleInfoList(const string& aTarget, BundleDirectoryItemInfo::List& aFiles) const noexcept {
 	// First, recurse over the directories
-	for (const auto& d: directories | map_values) {
+	for (const auto& d: directories) {
 		d->toBundleInfoList(aTarget + d->getName() + PATH_SEPARATOR, aFiles);
 	}
 
@@ -638,22 +749,22 @@ DirectoryListing::Directory::Ptr DirectoryListing::findDirectory(const string& a
 	dcassert(end != string::npos);
 	string name = aName.substr(1, end - 1);
 
-	auto i = aCurrent->directories.find(&name);
-	if (i != aCurrent->directories.end()) {
+	auto d = aCurrent->findDirectory(name);
+	if (d) {
 		if (end == (aName.size() - 1)) {
-			return i->second;
+			return d->getPtr();
 		} else {
-			return findDirectory(aName.substr(end), i->second.get());
+			return findDirectory(aName.substr(end), d);
 		}
 	}
 
 	return nullptr;
 }
 
-void DirectoryListing::Directory::findFiles(const boost::regex& aReg, File::List& aResults) const noexcept {
-	copy_if(files.begin(), files.end(), back_inserter(aResults), [&aReg](const File::Ptr& df) { return boost::regex_match(df->getName(), aReg); });
+void DirectoryListing::Directory::findFiles(const boost::regex& aReg, vector<File*>& aResults) const noexcept {
+	copy_if(files.begin(), files.end(), back_inserter(aResults), [&aReg](const File* df) { return boost::regex_match(df->getName().c_str(), aReg); });
 
-	for (const auto& d : directories | map_values) {
+	for (const auto& d : directories) {
 		d->findFiles(aReg, aResults);
 	}
 }
@@ -661,30 +772,104 @@ void DirectoryListing::Directory::findFiles(const boost::regex& aReg, File::List
 struct HashContained {
 	HashContained(const DirectoryListing::Directory::TTHSet& l) : tl(l) { }
 	const DirectoryListing::Directory::TTHSet& tl;
-	bool operator()(const DirectoryListing::File::Ptr& i) const {
+	bool operator()(const DirectoryListing::File* i) const {
 		return tl.count(i->getTTH()) > 0;
 	}
 };
 
 struct DirectoryEmpty {
-	bool operator()(const DirectoryListing::Directory::Ptr& aDir) const {
+	bool operator()(const DirectoryListing::Directory* aDir) const {
 		return Util::directoryEmpty(aDir->getContentInfo());
 	}
 };
 
 struct SizeLess {
-	bool operator()(const DirectoryListing::File::Ptr& f) const {
+	bool operator()(const DirectoryListing::File* f) const {
 		return f->getSize() < Util::convertSize(SETTING(SKIP_SUBTRACT), Util::KB);
 	}
 };
 
-DirectoryListing::Directory::~Directory() {
-	//dcdebug("DirectoryListing::Directory %s deleted\n", name.c_str());
+DirectoryListing::Directory* DirectoryListing::Directory::clearAll() noexcept {
+	dcassert(!getAdls());
+
+	Directory* detached = nullptr;
+	if (!directories.empty() || !files.empty()) {
+		// The removed items may still be referenced, their parent must be stored in the same arena so that
+		// their handles will keep the correct arena in memory
+		auto& oldArena = *arena;
+		detached = new (oldArena.allocate(sizeof(Directory), alignof(Directory))) Directory(oldArena, parent, name, type, lastUpdateDate, false, contentInfo, Util::emptyString, remoteDate);
+		detached->copyAttributes(*this);
+		detached->directories = move(directories);
+		detached->files = move(files);
+
+		for (const auto& d: detached->directories) {
+			d->parent = detached;
+		}
+
+		for (const auto& f: detached->files) {
+			f->setParent(detached);
+		}
+	}
+
+	// Replaces the previous child arena of this directory
+	auto& contentArena = getParentArena().createChild(this);
+	directories = List(Arena::Allocator<Directory*>(&contentArena));
+	files = File::List(Arena::Allocator<File*>(&contentArena));
+	arena = &contentArena;
+	return detached;
 }
 
-void DirectoryListing::Directory::clearAll() noexcept {
-	directories.clear();
-	files.clear();
+void DirectoryListing::Directory::separateContent() noexcept {
+	// Existing items would have to be detached under a parent allocated from a different arena,
+	// keep them in the parent arena until the directory is cleared
+	if (arena != &getParentArena() || !directories.empty() || !files.empty()) {
+		return;
+	}
+
+	clearAll();
+}
+
+void DirectoryListing::Directory::compactContent() {
+	// Keep the current content in memory while it's being copied
+	auto oldContent = arena->getHandle();
+
+	auto old = clearAll();
+	if (old) {
+		old->copyContent(*this);
+	}
+}
+
+void DirectoryListing::Directory::copyContent(Directory& aTarget) const {
+	aTarget.files.reserve(files.size());
+	for (const auto& f: files) {
+		aTarget.files.push_back(File::create(&aTarget, *f, f->getAdls()));
+	}
+
+	aTarget.directories.reserve(directories.size());
+	for (const auto& d: directories) {
+		Directory* dir;
+		if (d->getAdls() && getAdls()) {
+			dir = AdlDirectory::create(static_cast<const AdlDirectory*>(d)->getFullAdcPath(), &aTarget, d->name);
+		} else {
+			dir = create(&aTarget, d->name, d->type, d->lastUpdateDate);
+			if (d->getAdls()) {
+				// ADL search destination directory
+				aTarget.addDirectory(dir);
+			}
+		}
+
+		dir->copyAttributes(*d);
+		d->copyContent(*dir);
+	}
+}
+
+void DirectoryListing::Directory::copyAttributes(const Directory& aSource) noexcept {
+	type = aSource.type;
+	dupe = aSource.dupe;
+	partialSize = aSource.partialSize;
+	remoteDate = aSource.remoteDate;
+	lastUpdateDate = aSource.lastUpdateDate;
+	contentInfo = aSource.contentInfo;
 }
 
 void DirectoryListing::Directory::filterList(DirectoryListing& dirList) noexcept {
@@ -697,7 +882,7 @@ void DirectoryListing::Directory::filterList(DirectoryListing& dirList) noexcept
 
 void DirectoryListing::Directory::filterList(DirectoryListing::Directory::TTHSet& l) noexcept {
 	for (auto i = directories.begin(); i != directories.end();) {
-		auto d = i->second.get();
+		auto d = *i;
 
 		d->filterList(l);
 
@@ -716,7 +901,7 @@ void DirectoryListing::Directory::filterList(DirectoryListing::Directory::TTHSet
 }
 
 void DirectoryListing::Directory::getHashList(DirectoryListing::Directory::TTHSet& l) const noexcept {
-	for(const auto& d: directories | map_values)  
+	for(const auto& d: directories)  
 		d->getHashList(l);
 
 	for(const auto& f: files) 
@@ -764,7 +949,7 @@ int64_t DirectoryListing::Directory::getTotalSize(bool countAdls) const noexcept
 		return 0;
 	
 	auto x = getFilesSize();
-	for (const auto& d: directories | map_values) {
+	for (const auto& d: directories) {
 		if(!countAdls && d->getAdls())
 			continue;
 		x += d->getTotalSize(getAdls());
@@ -786,12 +971,14 @@ size_t DirectoryListing::Directory::getTotalFileCount(bool aCountAdls) const noe
 
 void DirectoryListing::Directory::clearAdls() noexcept {
 	for (auto i = directories.begin(); i != directories.end();) {
-		if (i->second->getAdls()) {
+		if ((*i)->getAdls()) {
 			i = directories.erase(i);
 		} else {
 			++i;
 		}
 	}
+
+	arena->releaseChild(&adlArenaKey);
 }
 
 string DirectoryListing::Directory::getAdcPath() const noexcept {
@@ -819,7 +1006,7 @@ bool DirectoryListing::File::isInQueue() const noexcept {
 uint8_t DirectoryListing::Directory::checkShareDupes() noexcept {
 	uint8_t result = DUPE_NONE;
 	bool first = true;
-	for(auto& d: directories | map_values) {
+	for(auto& d: directories) {
 		result = d->checkShareDupes();
 		if(dupe == DUPE_NONE && first)
 			setDupe((DupeType)result);
@@ -968,6 +1155,11 @@ void DirectoryListing::listDiffImpl(const string& aFile, bool aOwnList) {
 	dirList.loadFile();
 
 	root->filterList(dirList);
+
+	// Release the filtered items
+	root->compactContent();
+	updateCurrentLocation(root);
+
 	fire(DirectoryListingListener::LoadingFinished(), start, ADC_ROOT_STR, false);
 }
 
@@ -994,7 +1186,7 @@ void DirectoryListing::loadFileImpl(const string& aInitialDir) {
 
 	fire(DirectoryListingListener::LoadingStarted(), false);
 
-	// In case we are reloading...
+	// In case we are reloading... (the old content is released with its arena once it's no longer referenced)
 	root->clearAll();
 
 	loadFile();
@@ -26,6 +26,7 @@
 #include "ShareManagerListener.h"
 #include "TimerManagerListener.h"
 
+#include "Arena.h"
 #include "BundleInfo.h"
 #include "DirectSearch.h"
 #include "DispatcherQueue.h"
@@ -40,6 +41,8 @@
 #include "Streams.h"
 #include "TrackableDownloadItem.h"
 
+#include <boost/utility/string_ref.hpp>
+
 namespace dcpp {
 
 class ListLoader;
@@ -50,28 +53,58 @@ class DirectoryListing : public UserInfoBase, public TrackableDownloadItem,
 	private ClientManagerListener, private ShareManagerListener
 {
 public:
+	/*
+	 * The items are allocated from an arena that is shared by the whole list (names included) and
+	 * the child items are stored in sorted arrays inside the same arena. The items are never destructed,
+	 * the memory is released all at once when the last Ptr referencing the list tree is removed.
+	 * Content of loaded directories and ADL search results are allocated from child arenas
+	 * so that the old items can be released separately.
+	 *
+	 * Ptr handles keep the whole tree in memory, the items must only be referenced with raw pointers
+	 * inside the tree to avoid reference cycles.
+	 */
+
+	// Name of a list item, stored in the list arena (null-terminated)
+	// Can be used like a string without copying the name
+	class Name : public boost::string_ref {
+	public:
+		explicit Name(const char* aName) noexcept : boost::string_ref(aName) { }
+
+		const char* c_str() const noexcept { return data(); }
+		operator string() const { return to_string(); }
+	};
+
 	class Directory;
 	class File : boost::noncopyable {
 
 	public:
 		typedef std::shared_ptr<File> Ptr;
 
-		struct Sort { bool operator()(const Ptr& a, const Ptr& b) const; };
+		struct Sort {
+			bool operator()(const File* a, const File* b) const noexcept;
+			bool operator()(const Ptr& a, const Ptr& b) const noexcept { return (*this)(a.get(), b.get()); }
+		};
 
-		typedef std::vector<Ptr> List;
+		typedef std::vector<File*, Arena::Allocator<File*>> List;
 		typedef List::const_iterator Iter;
-		
-		File(Directory* aDir, const string& aName, int64_t aSize, const TTHValue& aTTH, bool checkDupe, time_t aRemoteDate) noexcept;
-		File(const File& rhs, bool _adls = false) noexcept;
 
-		~File() { }
+		// The file must be added in the file list of the directory by the caller
+		static File* create(Directory* aDir, const string& aName, int64_t aSize, const TTHValue& aTTH, bool aCheckDupe, time_t aRemoteDate);
 
+		// Copy the file for an ADL search directory
+		static File* create(Directory* aDir, const File& aFile, bool aAdls);
 
 		string getAdcPath() const noexcept {
 			return parent->getAdcPath() + name;
 		}
 
-		GETSET(string, name, Name);
+		Name getName() const noexcept {
+			return Name(name);
+		}
+
+		// Returns a handle that keeps the list tree in memory
+		Ptr getPtr() const noexcept;
+
 		GETSET(int64_t, size, Size);
 		GETSET(Directory*, parent, Parent);
 		GETSET(TTHValue, tthRoot, TTH);
@@ -80,6 +113,12 @@ public:
 		IGETSET(time_t, remoteDate, RemoteDate, 0);
 
 		bool isInQueue() const noexcept;
+	private:
+		File(Directory* aDir, const char* aName, int64_t aSize, const TTHValue& aTTH, bool aCheckDupe, time_t aRemoteDate) noexcept;
+		File(const File& rhs, bool _adls) noexcept;
+
+		// Stored in the list arena
+		const char* name;
 	};
 
 	class Directory : boost::noncopyable {
@@ -93,20 +132,33 @@ public:
 
 		typedef std::shared_ptr<Directory> Ptr;
 
-		struct Sort { bool operator()(const Ptr& a, const Ptr& b) const; };
+		struct Sort {
+			bool operator()(const Directory* a, const Directory* b) const noexcept;
+			bool operator()(const Ptr& a, const Ptr& b) const noexcept { return (*this)(a.get(), b.get()); }
+		};
 
-		typedef std::vector<Ptr> List;
+		// Sorted by name (case-insensitive)
+		typedef std::vector<Directory*, Arena::Allocator<Directory*>> List;
 		typedef unordered_set<TTHValue> TTHSet;
-		typedef map<const string*, Ptr, noCaseStringLess> Map;
-		
-		Map directories;
+
+		List directories;
 		File::List files;
 
-		static Directory::Ptr create(Directory* aParent, const string& aName, DirType aType, time_t aUpdateDate, 
+		// Creates a new list tree with an empty root directory
+		static Directory::Ptr createRoot();
+
+		// Directories with the type TYPE_ADLS won't be added in the parent
+		// Throws AbortException if the parent has a directory with the same name
+		static Directory* create(Directory* aParent, const string& aName, DirType aType, time_t aUpdateDate,
 			bool checkDupe = false, const DirectoryContentInfo& aContentInfo = DirectoryContentInfo(),
 			const string& aSize = Util::emptyString, time_t aRemoteDate = 0);
 
-		virtual ~Directory();
+		// Returns a handle that keeps the list tree in memory
+		Ptr getPtr() const noexcept;
+
+		// Returns false if a directory with the same name exists already
+		bool addDirectory(Directory* aDir) noexcept;
+		Directory* findDirectory(const string& aName) const noexcept;
 
 		size_t getTotalFileCount(bool countAdls) const noexcept;
 		int64_t getTotalSize(bool countAdls) const noexcept;
@@ -114,11 +166,20 @@ public:
 		void filterList(TTHSet& l) noexcept;
 		void getHashList(TTHSet& l) const noexcept;
 		void clearAdls() noexcept;
-		void clearAll() noexcept;
+
+		// The content is moved in a new child arena and the old one is released once it's no longer referenced
+		// The removed items are moved under a detached copy of this directory, which is returned (nullptr if there was no content)
+		Directory* clearAll() noexcept;
+
+		// Allocates the content from an arena of its own (if it's empty and isn't in one already) so that it can be released when the directory is reloaded
+		void separateContent() noexcept;
+
+		// Copies the content in a new arena so that the removed items are released
+		void compactContent();
 
 		bool findIncomplete() const noexcept;
 		void search(OrderedStringSet& aResults, SearchQuery& aStrings) const noexcept;
-		void findFiles(const boost::regex& aReg, File::List& aResults) const noexcept;
+		void findFiles(const boost::regex& aReg, vector<File*>& aResults) const noexcept;
 		
 		int64_t getFilesSize() const noexcept;
 
@@ -140,8 +201,8 @@ public:
 		// Create recursive bundle file info listing with relative paths
 		BundleDirectoryItemInfo::List toBundleInfoList() const noexcept;
 
-		const string& getName() const noexcept {
-			return name;
+		Name getName() const noexcept {
+			return Name(name);
 		}
 
 		// This function not thread safe as it will go through all complete directories
@@ -156,24 +217,49 @@ public:
 			contentInfo.files = aContentInfo.files;
 			contentInfo.directories = aContentInfo.directories;
 		}
+
+		Arena& getArena() const noexcept {
+			return *arena;
+		}
 	protected:
+		friend class File;
+
 		void toBundleInfoList(const string& aTarget, BundleDirectoryItemInfo::List& aFiles) const noexcept;
 
-		Directory(Directory* aParent, const string& aName, DirType aType, time_t aUpdateDate, bool aCheckDupe, const DirectoryContentInfo& aContentInfo, const string& aSize, time_t aRemoteDate);
+		Directory(Arena& aArena, Directory* aParent, const char* aName, DirType aType, time_t aUpdateDate, bool aCheckDupe, const DirectoryContentInfo& aContentInfo, const string& aSize, time_t aRemoteDate);
 
 		void getContentInfo(size_t& directories_, size_t& files_, bool aCountAdls) const noexcept;
 
+		void copyContent(Directory& aTarget) const;
+		void copyAttributes(const Directory& aSource) noexcept;
+
+		// Arena where the directory itself is stored
+		Arena& getParentArena() const noexcept;
+
+		// Position of the directory in the sorted list
+		List::const_iterator lowerBound(const char* aName) const noexcept;
+
 		DirectoryContentInfo contentInfo;
-		const string name;
+
+		// Arena for the content
+		Arena* arena;
+
+		// Stored in the list arena
+		const char* name;
 	};
 
 	class AdlDirectory : public Directory {
 	public:
-		typedef shared_ptr<AdlDirectory> Ptr;
-		GETSET(string, fullAdcPath, FullAdcPath);
-		static Ptr create(const string& aFullAdcPath, Directory* aParent, const string& aName);
+		string getFullAdcPath() const noexcept {
+			return fullAdcPath;
+		}
+
+		static AdlDirectory* create(const string& aFullAdcPath, Directory* aParent, const string& aName);
 	private:
-		AdlDirectory(const string& aFullPath, Directory* aParent, const string& aName);
+		AdlDirectory(const string& aFullPath, Directory* aParent, const char* aName);
+
+		// Stored in the list arena
+		const char* fullAdcPath;
 	};
 
 	DirectoryListing(const HintedUser& aUser, bool aPartial, const string& aFileName, bool isClientView, bool aIsOwnList=false);
@@ -348,8 +434,15 @@ private:
 	DispatcherQueue tasks;
 };
 
-inline bool operator==(const DirectoryListing::Directory::Ptr& a, const string& b) { return Util::stricmp(a->getName(), b) == 0; }
-inline bool operator==(const DirectoryListing::File::Ptr& a, const string& b) { return Util::stricmp(a->getName(), b) == 0; }
+inline bool operator==(const DirectoryListing::Directory::Ptr& a, const string& b) { return Util::stricmp(a->getName().c_str(), b.c_str()) == 0; }
+inline bool operator==(const DirectoryListing::File::Ptr& a, const string& b) { return Util::stricmp(a->getName().c_str(), b.c_str()) == 0; }
+
+inline string operator+(const string& a, const DirectoryListing::Name& b) { string ret(a); ret.append(b.data(), b.size()); return ret; }
+inline string operator+(string&& a, const DirectoryListing::Name& b) { a.append(b.data(), b.size()); return move(a); }
+inline string operator+(const char* a, const DirectoryListing::Name& b) { return string(a) + b; }
+inline string operator+(const DirectoryListing::Name& a, const string& b) { return a.to_string() + b; }
+inline string operator+(const DirectoryListing::Name& a, const char* b) { return a.to_string() + b; }
+inline string operator+(const DirectoryListing::Name& a, char b) { return a.to_string() + b; }
 
 } // namespace dcpp
 
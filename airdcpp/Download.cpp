@@ -259,7 +259,8 @@ void Download::open(int64_t bytes, bool z, bool hasDownloadedBytes) {
 		output.reset(new MerkleTreeOutputStream<TigerTree>(tt));
 	}
 
-	if((getType() == Transfer::TYPE_FILE || getType() == Transfer::TYPE_FULL_LIST) && SETTING(BUFFER_SIZE) > 0 ) {
+	// SharedFileStream has its own write-back buffer
+	if(getType() == Transfer::TYPE_FULL_LIST && SETTING(BUFFER_SIZE) > 0 ) {
 		output.reset(new BufferedOutputStream<true>(output.release()));
 	}
 
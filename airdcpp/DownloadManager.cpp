@@ -487,7 +487,15 @@ void DownloadManager::endData(UserConnection* aSource) {
 		dcdebug("Download finished: %s, size " I64_FMT ", downloaded " I64_FMT " in " U64_FMT " ms\n", d->getPath().c_str(), d->getSegmentSize(), d->getPos(), GET_TICK() - d->getStart());
 	}
 
-	removeDownload(d);
+	auto error = removeDownload(d);
+	if (!error.empty()) {
+		fire(DownloadManagerListener::Failed(), d, error);
+		QueueManager::getInstance()->putDownload(d, false);
+
+		removeRunningUser(aSource);
+		removeConnection(aSource);
+		return;
+	}
 
 	fire(DownloadManagerListener::Complete(), d, d->getType() == Transfer::TYPE_TREE);
 	try {
@@ -569,13 +577,17 @@ void DownloadManager::removeConnection(UserConnectionPtr aConn) {
 	aConn->disconnect();
 }
 
-void DownloadManager::removeDownload(Download* d) {
+string DownloadManager::removeDownload(Download* d) {
 	// Write the leftover bytes into file
+	string error;
 	if(d->getOutput()) {
 		if(d->getActual() > 0) {
 			try {
 				d->getOutput()->flushBuffers(false);
-			} catch(const Exception&) {
+			} catch(const Exception& e) {
+				// The data may not have been written in the background, don't mark any of it as downloaded
+				error = e.getError();
+				d->resetPos();
 			}
 		}
 	}
@@ -591,6 +603,8 @@ void DownloadManager::removeDownload(Download* d) {
 		dcassert(find(downloads.begin(), downloads.end(), d) != downloads.end());
 		downloads.erase(remove(downloads.begin(), downloads.end(), d), downloads.end());
 	}
+
+	return error;
 }
 
 BundlePtr DownloadManager::findRunningBundle(QueueToken aBundleToken) const noexcept {
@@ -86,7 +86,8 @@ private:
 
 	void removeRunningUser(UserConnection* aSource, bool sendRemoved=false) noexcept;
 	void removeConnection(UserConnectionPtr aConn);
-	void removeDownload(Download* aDown);
+	// Returns the error if the buffered data couldn't be written
+	string removeDownload(Download* aDown);
 	void fileNotAvailable(UserConnection* aSource, bool aNoAccess, const string& aMessage = Util::emptyString);
 	void noSlots(UserConnection* aSource, const string& param = Util::emptyString);
 
@@ -25,10 +25,36 @@ using std::string;
 
 #define ARRAY_BITS (sizeof(MaskType)*8)
 
+namespace {
+
+template<class IsUpperCaseF>
+string toNormalCase(const char* aLower, size_t aLength, IsUpperCaseF&& aIsUpperCase) {
+	string ret;
+	ret.reserve(aLength);
+
+	const char* end = aLower + aLength;
+	for (const char* p = aLower; p < end;) {
+		if (aIsUpperCase(p - aLower)) {
+			wchar_t c = 0;
+			int n = dcpp::Text::utf8ToWc(p, c);
+
+			dcpp::Text::wcToUtf8(dcpp::Text::toUpper(c), ret);
+			p += n;
+		} else {
+			ret += p[0];
+			p++;
+		}
+	}
+
+	return ret;
+}
+
+}
+
 // Text::toLower should be used for initial conversion due to UTF-16 surrogate handling
 // Text::utf8ToWc should be sufficient for equality checks
 DualString::DualString(const string& aStr) : string(dcpp::Text::toLower(aStr)) {
-	int arrayPos = 0, bitPos = 0;
+	size_t pos = 0;
 	auto a = aStr.c_str();
 	auto b = this->c_str();
 	while (*a) {
@@ -36,86 +62,103 @@ DualString::DualString(const string& aStr) : string(dcpp::Text::toLower(aStr)) {
 		int na = dcpp::Text::utf8ToWc(a, ca);
 		int nb = dcpp::Text::utf8ToWc(b, cb);
 		if (ca != cb) {
-			if (!charSizes) {
-				initSizeArray(aStr.size());
-			}
-			charSizes[arrayPos] |= (1 << bitPos);
+			setUpperCase(pos, aStr.size());
 		}
 
 		a += abs(na);
 		b += abs(nb);
 
-		bitPos += abs(na);
+		pos += abs(na);
+	}
+}
 
-		// move to the next array?
-		if (bitPos >= static_cast<int>(ARRAY_BITS)) {
-			bitPos = 0 + bitPos - ARRAY_BITS;
-			arrayPos++;
-		}
+void DualString::setUpperCase(size_t aPos, size_t aStrLen) {
+	if (aStrLen <= INLINE_BITS) {
+		charSizes |= 1 | (static_cast<uintptr_t>(1) << (aPos + 1));
+		return;
+	}
+
+	if (!charSizes) {
+		initSizeArray(aStrLen);
 	}
+
+	reinterpret_cast<MaskType*>(charSizes)[aPos / ARRAY_BITS] |= (1 << (aPos % ARRAY_BITS));
+}
+
+bool DualString::isUpperCase(size_t aPos) const noexcept {
+	if (charSizes & 1) {
+		return aPos < INLINE_BITS && (charSizes & (static_cast<uintptr_t>(1) << (aPos + 1))) != 0;
+	}
+
+	return (reinterpret_cast<const MaskType*>(charSizes)[aPos / ARRAY_BITS] & (1 << (aPos % ARRAY_BITS))) != 0;
 }
 
 // Create an array with minumum possible length that will store the character sizes (unset=lowercase, set=uppercase)
 size_t DualString::initSizeArray(size_t strLen) {
 	size_t arrSize = strLen % ARRAY_BITS == 0 ? strLen / ARRAY_BITS : (strLen / ARRAY_BITS) + 1;
-	charSizes = new MaskType[arrSize];
+	auto arr = new MaskType[arrSize];
 	for (size_t s = 0; s < arrSize; ++s) {
-		charSizes[s] = 0;
+		arr[s] = 0;
 	}
 
+	charSizes = reinterpret_cast<uintptr_t>(arr);
 	return arrSize;
 }
 
 DualString& DualString::operator=(DualString&& rhs) {
 	assign(rhs.begin(), rhs.end());
 	charSizes = rhs.charSizes;
-	rhs.charSizes = nullptr;
+	rhs.charSizes = 0;
 	return *this; 
 }
 
 DualString::DualString(DualString&& rhs) : charSizes(rhs.charSizes) {
 	assign(rhs.begin(), rhs.end());
-	rhs.charSizes = nullptr;
+	rhs.charSizes = 0;
 }
 
 DualString::~DualString() { 
-	if (charSizes)
-		delete[] charSizes; 
+	if (charSizes && !(charSizes & 1))
+		delete[] reinterpret_cast<MaskType*>(charSizes);
 }
 
 string DualString::getNormal() const {
 	if (!charSizes)
 		return *this;
 
-	string ret;
-	ret.reserve(size());
-
-	int bitPos = 0, arrayPos = 0;
-	const char* end = &c_str()[0] + string::size();
-	for (const char* p = &c_str()[0]; p < end;) {
-		if (charSizes[arrayPos] & (1 << bitPos)) {
-			wchar_t c = 0;
-			int n = dcpp::Text::utf8ToWc(p, c);
+	return toNormalCase(c_str(), string::size(), [this](size_t aPos) { return isUpperCase(aPos); });
+}
 
-			dcpp::Text::wcToUtf8(dcpp::Text::toUpper(c), ret);
+string DualString::getNormal(const char* aLower, size_t aLength, const uint8_t* aCaseMask) {
+	return toNormalCase(aLower, aLength, [aCaseMask](size_t aPos) { return (aCaseMask[aPos / 8] & (1 << (aPos % 8))) != 0; });
+}
 
-			bitPos += n;
-			p += n;
-		} else {
-			ret += p[0];
-			bitPos++;
-			p++;
-		}
+void DualString::getCaseMask(uint8_t* mask_) const noexcept {
+	auto len = string::size();
+	std::fill_n(mask_, getCaseMaskSize(len), 0);
+	if (!charSizes) {
+		return;
+	}
 
-		if (bitPos >= static_cast<int>(ARRAY_BITS)) {
-			bitPos = 0 + bitPos-ARRAY_BITS;
-			arrayPos++;
+	for (size_t pos = 0; pos < len; ++pos) {
+		if (isUpperCase(pos)) {
+			mask_[pos / 8] |= 1 << (pos % 8);
 		}
 	}
-
-	return ret;
 }
 
 bool DualString::lowerCaseOnly() const noexcept {
 	return !charSizes; 
-}
\ No newline at end of file
+}
+
+size_t DualString::getAllocatedSize() const noexcept {
+	// Short strings are stored inside the object
+	static const auto inlineCapacity = string().capacity();
+
+	size_t ret = capacity() > inlineCapacity ? capacity() + 1 : 0;
+	if (charSizes && !(charSizes & 1)) {
+		ret += ((size() + ARRAY_BITS - 1) / ARRAY_BITS) * sizeof(MaskType);
+	}
+
+	return ret;
+}
@@ -41,13 +41,31 @@ public:
 
 	bool lowerCaseOnly() const noexcept;
 
+	// Packed case mask (one bit for each byte of the lowercase string) for storing the name outside the object
+	static size_t getCaseMaskSize(size_t aLength) noexcept { return (aLength + 7) / 8; }
+	void getCaseMask(uint8_t* mask_) const noexcept;
+
+	// Restores the original string from the lowercase string and the packed case mask
+	static string getNormal(const char* aLower, size_t aLength, const uint8_t* aCaseMask);
+
+	// Heap memory used by the string (excluding the object itself)
+	size_t getAllocatedSize() const noexcept;
+
 	DualString(DualString&& rhs);
 	DualString& operator=(DualString&&);
 	DualString(const DualString&) = delete;
 	DualString& operator= (const DualString& other) = delete;
 private:
+	// Uppercase flags of shorter strings are stored in place of the array pointer
+	static const size_t INLINE_BITS = sizeof(uintptr_t) * 8 - 1;
+
+	void setUpperCase(size_t aPos, size_t aStrLen);
+	bool isUpperCase(size_t aPos) const noexcept;
+
 	size_t initSizeArray(size_t strLen);
-	MaskType* charSizes = nullptr;
+
+	// Pointer to the mask array or an inline mask (with the lowest bit set)
+	uintptr_t charSizes = 0;
 };
 
 #endif
\ No newline at end of file
@@ -218,6 +218,27 @@ size_t File::write(const void* buf, size_t len) {
 	dcassert(x == len);
 	return x;
 }
+
+size_t File::writeAt(const void* buf, size_t len, int64_t aPos) {
+	// WriteFile moves the file pointer of synchronous handles even when the offset is given
+	auto oldPos = getPos();
+
+	OVERLAPPED over = { 0 };
+	over.Offset = (DWORD)(aPos & 0xffffffff);
+	over.OffsetHigh = (DWORD)(aPos >> 32);
+
+	DWORD x;
+	auto ret = ::WriteFile(h, buf, (DWORD)len, &x, &over);
+	auto error = GetLastError();
+
+	setPos(oldPos);
+	if(!ret) {
+		throw FileException(Util::translateError(error));
+	}
+	dcassert(x == len);
+	return x;
+}
+
 void File::setEOF() {
 	dcassert(isOpen());
 	if(!SetEndOfFile(h)) {
@@ -528,6 +549,26 @@ size_t File::write(const void* buf, size_t len) {
 	return len;
 }
 
+size_t File::writeAt(const void* buf, size_t len, int64_t aPos) {
+	ssize_t result;
+	char* pointer = (char*)buf;
+	ssize_t left = len;
+
+	while (left > 0) {
+		result = ::pwrite(h, pointer, left, (off_t)aPos);
+		if (result == -1) {
+			if (errno != EINTR) {
+				throw FileException(Util::translateError(errno));
+			}
+		} else {
+			pointer += result;
+			left -= result;
+			aPos += result;
+		}
+	}
+	return len;
+}
+
 // some ftruncate implementations can't extend files like SetEndOfFile,
 // not sure if the client code needs this...
 int File::extendFile(int64_t len) noexcept {
@@ -128,6 +128,15 @@ public:
 	size_t read(void* buf, size_t& len) override;
 	size_t write(const void* buf, size_t len) override;
 
+	// Writes at the given position, the current file position is preserved
+	// (it's changed temporarily on Windows so reading/writing from other threads isn't safe without locking)
+	size_t writeAt(const void* buf, size_t len, int64_t aPos);
+
+	File* getDirectFile(int64_t& maxBytes_) noexcept override {
+		maxBytes_ = max(getSize() - getPos(), static_cast<int64_t>(0));
+		return this;
+	}
+
 	// This has no effect if aForce is false
 	// Generally the operating system should decide when the buffered data is written on disk
 	size_t flushBuffers(bool aForce = true) override;
@@ -93,11 +93,11 @@ void FileQueue::findFiles(const TTHValue& tth, QueueItemList& ql_) const noexcep
 }
 
 void FileQueue::matchListing(const DirectoryListing& dl, QueueItemList& ql_) const noexcept {
-	matchDir(dl.getRoot(), ql_);
+	matchDir(dl.getRoot().get(), ql_);
 }
 
-void FileQueue::matchDir(const DirectoryListing::Directory::Ptr& aDir, QueueItemList& ql_) const noexcept{
-	for(const auto& d: aDir->directories | map_values) {
+void FileQueue::matchDir(const DirectoryListing::Directory* aDir, QueueItemList& ql_) const noexcept{
+	for(const auto& d: aDir->directories) {
 		if (!d->getAdls()) {
 			matchDir(d, ql_);
 		}
@@ -48,7 +48,7 @@ public:
 
 	void findFiles(const TTHValue& tth, QueueItemList& ql_) const noexcept;
 	void matchListing(const DirectoryListing& dl, QueueItemList& ql_) const noexcept;
-	void matchDir(const DirectoryListing::Directory::Ptr& dir, QueueItemList& ql_) const noexcept;
+	void matchDir(const DirectoryListing::Directory* dir, QueueItemList& ql_) const noexcept;
 
 	// find some PFS sources to exchange parts info
 	void findPFSSources(PFSSourceList&) const noexcept;
@@ -23,6 +23,7 @@
 #include "debug.h"
 #include "File.h"
 #include "Exception.h"
+#include "ScopedFunctor.h"
 #include "Text.h"
 #include "Util.h"
 
@@ -43,13 +44,16 @@ size_t FileReader::read(const string& aPath, const DataCallback& callback) {
 	size_t ret = READ_FAILED;
 
 	if(direct) {
+		strategy = DIRECT;
 		ret = readDirect(aPath, callback);
 	}
 
 	if(ret == READ_FAILED) {
-			ret = readMapped(aPath, callback);
+		strategy = MAPPED;
+		ret = readMapped(aPath, callback);
 
 		if(ret == READ_FAILED) {
+			strategy = CACHED;
 			ret = readCached(aPath, callback);
 		}
 	}
@@ -272,11 +276,313 @@ size_t FileReader::readMapped(const string& /*file*/, const DataCallback& /*call
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+
+#define HAVE_READ_RING
+
+// Minimal io_uring instance (using the raw system calls) for queuing reads
+class FileReader::ReadRing : boost::noncopyable {
+public:
+	ReadRing(unsigned aEntries) : entries(aEntries) {
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+
+		fd = static_cast<int>(syscall(__NR_io_uring_setup, aEntries, &p));
+		if (fd < 0) {
+			dcdebug("io_uring_setup failed: %s\n", Util::translateError(errno).c_str());
+			if (errno == ENOSYS || errno == EPERM) {
+				// Not supported by the kernel (or disabled), don't try it again for the following files
+				unavailable = true;
+			}
+
+			return;
+		}
+
+		sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+		bool singleMap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMap) {
+			sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+		}
+
+		sqRing = mapRing(sqRingSize, IORING_OFF_SQ_RING);
+		cqRing = singleMap ? sqRing : mapRing(cqRingSize, IORING_OFF_CQ_RING);
+		sqes = static_cast<io_uring_sqe*>(mapRing(p.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+		sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+		if (!sqRing || !cqRing || !sqes) {
+			return;
+		}
+
+		auto sq = static_cast<uint8_t*>(sqRing);
+		sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+		sqMask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+		sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+
+		auto cq = static_cast<uint8_t*>(cqRing);
+		cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+		cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+		cqMask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+		valid = true;
+	}
+
+	~ReadRing() {
+		if (sqes) {
+			munmap(sqes, sqesSize);
+		}
+
+		if (cqRing && cqRing != sqRing) {
+			munmap(cqRing, cqRingSize);
+		}
+
+		if (sqRing) {
+			munmap(sqRing, sqRingSize);
+		}
+
+		if (fd >= 0) {
+			::close(fd);
+		}
+	}
+
+	bool isValid() const noexcept { return valid; }
+
+	// Set if io_uring can't be used in this system
+	static atomic<bool> unavailable;
+	unsigned getEntries() const noexcept { return entries; }
+
+	// The read will be started on the next call to enter()
+	void queueRead(int aFd, void* aBuf, unsigned aLen, uint64_t aOffset, uint64_t aUserData) noexcept {
+		auto tail = *sqTail;
+		auto index = tail & *sqMask;
+
+		auto& sqe = sqes[index];
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_READ;
+		sqe.fd = aFd;
+		sqe.addr = reinterpret_cast<uint64_t>(aBuf);
+		sqe.len = aLen;
+		sqe.off = aOffset;
+		sqe.user_data = aUserData;
+
+		sqArray[index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+		queued++;
+	}
+
+	// Submit the queued reads and wait until at least aMinComplete reads have completed
+	bool enter(unsigned aMinComplete) noexcept {
+		while (queued > 0 || aMinComplete > 0) {
+			auto ret = syscall(__NR_io_uring_enter, fd, queued, aMinComplete, aMinComplete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+			if (ret < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+
+				dcdebug("io_uring_enter failed: %s\n", Util::translateError(errno).c_str());
+				return false;
+			}
+
+			queued -= static_cast<unsigned>(ret);
+			if (queued == 0) {
+				break;
+			}
+		}
+
+		return true;
+	}
+
+	bool popCompletion(uint64_t& userData_, int& result_) noexcept {
+		auto head = *cqHead;
+		if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+			return false;
+		}
+
+		const auto& cqe = cqes[head & *cqMask];
+		userData_ = cqe.user_data;
+		result_ = cqe.res;
+
+		__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+private:
+	void* mapRing(size_t aSize, off_t aOffset) noexcept {
+		auto p = mmap(0, aSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, aOffset);
+		if (p == MAP_FAILED) {
+			dcdebug("Failed to map io_uring: %s\n", Util::translateError(errno).c_str());
+			return nullptr;
+		}
+
+		return p;
+	}
+
+	int fd = -1;
+	bool valid = false;
+	unsigned queued = 0;
+	const unsigned entries;
+
+	void* sqRing = nullptr;
+	size_t sqRingSize = 0;
+	void* cqRing = nullptr;
+	size_t cqRingSize = 0;
+	io_uring_sqe* sqes = nullptr;
+	size_t sqesSize = 0;
+
+	unsigned* sqTail = nullptr;
+	unsigned* sqMask = nullptr;
+	unsigned* sqArray = nullptr;
+
+	unsigned* cqHead = nullptr;
+	unsigned* cqTail = nullptr;
+	unsigned* cqMask = nullptr;
+	io_uring_cqe* cqes = nullptr;
+};
+
+atomic<bool> FileReader::ReadRing::unavailable { false };
+
+/**
+ * Keep queueDepth unbuffered reads in flight, each one into its own slot of the buffer ring.
+ * Reads may complete in any order but the blocks are always passed to the callback in file order.
+ */
+size_t FileReader::readDirect(const string& aPath, const DataCallback& callback) {
+	if (queueDepth == 0 || ReadRing::unavailable) {
+		return READ_FAILED;
+	}
+
+	int fd = open(aPath.c_str(), O_RDONLY | O_DIRECT);
+	if (fd == -1) {
+		dcdebug("Failed to open unbuffered file %s: %s\n", aPath.c_str(), Util::translateError(errno).c_str());
+		return READ_FAILED;
+	}
+
+	ScopedFunctor([fd] { ::close(fd); });
+
+	struct stat statbuf;
+	if (fstat(fd, &statbuf) == -1) {
+		dcdebug("Error opening file %s: %s\n", aPath.c_str(), Util::translateError(errno).c_str());
+		return READ_FAILED;
+	}
+
+	// The ring is kept for the following files
+	if (!ring || ring->getEntries() != queueDepth) {
+		ring.reset(new ReadRing(static_cast<unsigned>(queueDepth)));
+	}
+
+	if (!ring->isValid()) {
+		// Try again with the next file
+		ring.reset();
+		return READ_FAILED;
+	}
+
+	const size_t alignment = getpagesize();
+	const size_t bufSize = getBlockSize(alignment);
+	const auto slots = queueDepth;
+	const int64_t size = statbuf.st_size;
+
+	buffer.resize(bufSize * slots + alignment);
+	auto buf = static_cast<uint8_t*>(align(&buffer[0], alignment));
+
+	static const int PENDING = std::numeric_limits<int>::min();
+	vector<int> results(slots, PENDING);
+
+	int64_t queuedPos = 0;
+	size_t inFlight = 0;
+	bool ringFailed = false;
+	auto queueBlock = [&](size_t aSlot) {
+		// The length must stay aligned for the last block as well (the read will end at EOF)
+		results[aSlot] = PENDING;
+		ring->queueRead(fd, buf + aSlot * bufSize, static_cast<unsigned>(bufSize), queuedPos, aSlot);
+		queuedPos += bufSize;
+		inFlight++;
+	};
+
+	auto waitCompletion = [&]() -> bool {
+		if (!ring->enter(1)) {
+			ringFailed = true;
+			return false;
+		}
+
+		uint64_t slot;
+		int res;
+		while (ring->popCompletion(slot, res)) {
+			results[static_cast<size_t>(slot)] = res;
+			inFlight--;
+		}
+
+		return true;
+	};
+
+	// The kernel may still write into the buffer
+	// Completions of this file must not be left in the ring either, create a new one if that isn't possible
+	ScopedFunctor([&] {
+		while (inFlight > 0 && waitCompletion()) { }
+		if (ringFailed || inFlight > 0) {
+			ring.reset();
+		}
+	});
+
+	for (size_t i = 0; i < slots && queuedPos < size; ++i) {
+		queueBlock(i);
+	}
+
+	int64_t pos = 0;
+	size_t slot = 0;
+	bool go = true;
+	while (pos < size && go) {
+		while (results[slot] == PENDING) {
+			if (!waitCompletion()) {
+				if (pos == 0) {
+					return READ_FAILED;
+				}
+
+				throw FileException(Util::translateError(errno));
+			}
+		}
+
+		auto res = results[slot];
+		auto expected = std::min(static_cast<int64_t>(bufSize), size - pos);
+		if (res != expected) {
+			// O_DIRECT reads aren't supported by every file system and the reads are aligned so
+			// they shouldn't be short unless the file is being modified
+			dcdebug("Direct read failed for file %s: %d\n", aPath.c_str(), res);
+			if (pos == 0) {
+				return READ_FAILED;
+			}
+
+			throw FileException(Util::translateError(res < 0 ? -res : EIO));
+		}
+
+		go = callback(buf + slot * bufSize, static_cast<size_t>(res));
+		pos += res;
+
+		if (go && queuedPos < size) {
+			queueBlock(slot);
+			if (!ring->enter(0)) {
+				ringFailed = true;
+				throw FileException(Util::translateError(errno));
+			}
+		}
+
+		slot = (slot + 1) % slots;
+	}
+
+	return static_cast<size_t>(pos);
+}
+
+#else
 
 size_t FileReader::readDirect(const string& file, const DataCallback& callback) {
 	return READ_FAILED;
 }
 
+#endif
+
 static const int64_t BUF_SIZE = 0x1000000 - (0x1000000 % getpagesize());
 static sigjmp_buf sb_env;
 
@@ -339,9 +645,12 @@ size_t FileReader::readMapped(const string& filename, const DataCallback& callba
 			break;
 		}
 
-		if (posix_madvise(buf, size_read, POSIX_MADV_SEQUENTIAL | POSIX_MADV_WILLNEED) == -1) {
-			dcdebug("Error calling madvise for file %s: %s\n", filename.c_str(), Util::translateError(errno).c_str());
-			break;
+		// The advice values can't be combined (and failures are harmless as they are only hints)
+		for (auto advice: { POSIX_MADV_SEQUENTIAL, POSIX_MADV_WILLNEED }) {
+			auto error = posix_madvise(buf, size_read, advice);
+			if (error != 0) {
+				dcdebug("Error calling madvise for file %s: %s\n", filename.c_str(), Util::translateError(error).c_str());
+			}
 		}
 
 		if(!callback(buf, size_read)) {
@@ -371,4 +680,13 @@ size_t FileReader::readMapped(const string& filename, const DataCallback& callba
 }
 
 #endif
+
+#ifndef HAVE_READ_RING
+class FileReader::ReadRing { };
+#endif
+
+FileReader::FileReader(bool direct, size_t blockSize, size_t queueDepth) : direct(direct), blockSize(blockSize), queueDepth(queueDepth) { }
+
+FileReader::~FileReader() { }
+
 }
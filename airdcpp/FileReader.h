@@ -20,6 +20,7 @@
 #define DCPLUSPLUS_DCPP_FILE_READER_H
 
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -30,6 +31,7 @@ namespace dcpp {
 using std::function;
 using std::pair;
 using std::string;
+using std::unique_ptr;
 using std::vector;
 
 /** Helper class for reading an entire file */
@@ -49,8 +51,16 @@ public:
 	 * Set up file reader
 	 * @param direct Bypass system caches - good for reading files which are not in the cache and should not be there (for example when hashing)
 	 * @param blockSize Read block size, 0 = use default
+	 * @param queueDepth Number of direct reads to keep in flight (Linux only, 0 = don't use asynchronous direct reads)
 	 */
-	FileReader(bool direct = false, size_t blockSize = 0) : direct(direct), blockSize(blockSize) { }
+	FileReader(bool direct = false, size_t blockSize = 0, size_t queueDepth = 0);
+	~FileReader();
+
+	/**
+	 * Change the number of direct reads to keep in flight for the following files
+	 * The same reader (and its asynchronous I/O instance) should be reused for reading multiple files
+	 */
+	void setQueueDepth(size_t aQueueDepth) noexcept { queueDepth = aQueueDepth; }
 
 	/**
 	 * Read file - callback will be called for each read chunk which may or may not be a multiple of the requested block size.
@@ -61,6 +71,8 @@ public:
 	 */
 	size_t read(const string& file, const DataCallback& callback);
 
+	/** The strategy that was used for reading the previous file */
+	Strategy getStrategy() const noexcept { return strategy; }
 private:
 	static const size_t DEFAULT_BLOCK_SIZE = 256*1024;
 	static const size_t DEFAULT_MMAP_SIZE = 64*1024*1024;
@@ -68,9 +80,15 @@ private:
 	string file;
 	bool direct;
 	size_t blockSize;
+	size_t queueDepth;
+	Strategy strategy = CACHED;
 
 	vector<uint8_t> buffer;
 
+	// Asynchronous I/O instance for direct reads (created on the first use and reset after failures)
+	class ReadRing;
+	unique_ptr<ReadRing> ring;
+
 	/** Return an aligned buffer which is at least twice the size of ret.second */
 	size_t getBlockSize(size_t alignment);
 	void* align(void* buf, size_t alignment);
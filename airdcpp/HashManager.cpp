@@ -28,6 +28,7 @@
 #include "ResourceManager.h"
 #include "ScopedFunctor.h"
 #include "SimpleXMLReader.h"
+#include "TimerManager.h"
 #include "Util.h"
 #include "version.h"
 #include "ZUtils.h"
@@ -45,13 +46,22 @@ SharedMutex HashManager::Hasher::hcs;
 const int64_t HashManager::MIN_BLOCK_SIZE = 64 * 1024;
 
 HashManager::HashManager() {
-
+	TimerManager::getInstance()->addListener(this);
 }
 
 HashManager::~HashManager() {
+	TimerManager::getInstance()->removeListener(this);
 	optimizer.join();
 }
 
+void HashManager::on(TimerManagerListener::Second, uint64_t /*aTick*/) noexcept {
+	try {
+		store.commit();
+	} catch (const HashException& e) {
+		LogManager::getInstance()->message(e.getError(), LogMessage::SEV_ERROR);
+	}
+}
+
 bool HashManager::checkTTH(const string& aFileLower, const string& aFileName, HashedFile& fi_) {
 	dcassert(Text::isLower(aFileLower));
 	if (!store.checkTTH(aFileLower, fi_)) {
@@ -61,6 +71,25 @@ bool HashManager::checkTTH(const string& aFileLower, const string& aFileName, Ha
 	return true;
 }
 
+void HashManager::getDirectoryFiles(const string& aPathLower, DirectoryFileList& files_) noexcept {
+	dcassert(Text::isLower(aPathLower));
+	store.getDirectoryFiles(aPathLower, files_);
+}
+
+bool HashManager::checkTTH(const DirectoryFileList& aDirectoryFiles, const string& aNameLower, const string& aFileLower, const string& aFileName, HashedFile& fi_) {
+	auto i = lower_bound(aDirectoryFiles.begin(), aDirectoryFiles.end(), aNameLower, [](const pair<string, HashedFile>& aFile, const string& aName) {
+		return aFile.first < aName;
+	});
+
+	if (i != aDirectoryFiles.end() && i->first == aNameLower && i->second.getTimeStamp() == fi_.getTimeStamp() && i->second.getSize() == fi_.getSize()) {
+		fi_.setRoot(i->second.getRoot());
+		return true;
+	}
+
+	// New or modified file (or it was hashed after the list was loaded)
+	return checkTTH(aFileLower, aFileName, fi_);
+}
+
 void HashManager::getFileInfo(const string& aFileLower, const string& aFileName, HashedFile& fi_) {
 	dcassert(Text::isLower(aFileLower));
 	auto found = store.getFileInfo(aFileLower, fi_);
@@ -177,7 +206,7 @@ void HashManager::getFileTTH(const string& aFile, int64_t aSize, bool addStore,
 		auto start = GET_TICK();
 		int64_t tickHashed = 0;
 
-		FileReader fr(true);
+		FileReader fr(true, 0, max(SETTING(HASH_READ_QUEUE_DEPTH), 0));
 		fr.read(aFile, [&](const void* buf, size_t n) -> bool {
 			tt.update(buf, n);
 
@@ -258,24 +287,92 @@ void HashManager::HashStore::addHashedFile(const string& aFileLower, const Tiger
 }
 
 void HashManager::HashStore::addFile(const string& aFileLower, const HashedFile& fi_) {
-	auto sz = getFileInfoSize(fi_);
-	void* buf = malloc(sz);
-	saveFileInfo(buf, fi_);
+	string value(getFileInfoSize(fi_), 0);
+	saveFileInfo(&value[0], fi_);
 
-	try {
-		fileDb->put((void*)aFileLower.c_str(), aFileLower.length(), (void*)buf, sz);
-	} catch(DbException& e) {
-		throw HashException(STRING_F(WRITE_FAILED_X, fileDb->getNameLower() % e.getError()));
+	queueWrite(fileQueue, string(aFileLower), move(value));
+}
+
+void HashManager::HashStore::removeFile(const string& aFilePathLower) {
+	queueWrite(fileQueue, string(aFilePathLower), string());
+}
+
+void HashManager::HashStore::queueWrite(WriteQueue& aQueue, string&& aKey, string&& aValue) {
+	{
+		Lock l(cs);
+		aQueue.pendingBytes += aKey.size() + aValue.size();
+		aQueue.pending[move(aKey)] = move(aValue);
+		if (aQueue.pendingBytes < MAX_BATCH_BYTES) {
+			return;
+		}
 	}
 
-	free(buf);
+	commit();
 }
 
-void HashManager::HashStore::removeFile(const string& aFilePathLower) {
+bool HashManager::HashStore::getPending(const WriteQueue& aQueue, const string& aKey, string& value_) const noexcept {
+	Lock l(cs);
+	auto i = aQueue.pending.find(aKey);
+	if (i == aQueue.pending.end()) {
+		i = aQueue.committing.find(aKey);
+		if (i == aQueue.committing.end()) {
+			return false;
+		}
+	}
+
+	value_ = i->second;
+	return true;
+}
+
+bool HashManager::HashStore::get(DbHandler& aDb, const WriteQueue& aQueue, const string& aKey, size_t aInitialValueLen, std::function<bool(void* aValue, size_t aValueLen)> loadF) {
+	string value;
+	if (getPending(aQueue, aKey, value)) {
+		return !value.empty() && loadF((void*)value.data(), value.size());
+	}
+
+	return aDb.get((void*)aKey.data(), aKey.size(), aInitialValueLen, loadF);
+}
+
+void HashManager::HashStore::commit() {
+	Lock l(commitCs);
+	if (!hashDb || !fileDb) {
+		return;
+	}
+
+	{
+		// Both queues must be taken at once, a file entry could be added after the tree queue has been taken otherwise
+		// Keep the entries visible for lookups until they have been written
+		Lock l(cs);
+		if (treeQueue.pending.empty() && fileQueue.pending.empty()) {
+			return;
+		}
+
+		for (auto queue: { &treeQueue, &fileQueue }) {
+			queue->committing.swap(queue->pending);
+			queue->pendingBytes = 0;
+		}
+	}
+
+	ScopedFunctor([&] {
+		Lock l(cs);
+		treeQueue.committing.clear();
+		fileQueue.committing.clear();
+	});
+
+	// Trees first so that there won't be file entries without a tree (the file entries are dropped if the trees can't be written)
+	write(*hashDb, treeQueue);
+	write(*fileDb, fileQueue);
+}
+
+void HashManager::HashStore::write(DbHandler& aDb, WriteQueue& aQueue) {
+	if (aQueue.committing.empty()) {
+		return;
+	}
+
 	try {
-		fileDb->remove((void*) aFilePathLower.c_str(), aFilePathLower.length());
-	} catch (DbException& e) {
-		throw HashException(STRING_F(WRITE_FAILED_X, fileDb->getNameLower() % e.getError()));
+		aDb.write(aQueue.committing);
+	} catch (const DbException& e) {
+		throw HashException(STRING_F(WRITE_FAILED_X, aDb.getNameLower() % e.getError()));
 	}
 }
 
@@ -283,12 +380,10 @@ void HashManager::HashStore::addTree(const TigerTree& tt) {
 	size_t treelen = tt.getLeaves().size() == 1 ? 0 : tt.getLeaves().size() * TTHValue::BYTES;
 	auto sz = sizeof(uint8_t) + sizeof(int64_t) + sizeof(int64_t) + treelen;
 
-	//allocate the memory
-	void* buf = malloc(sz);
-
+	string value(sz, 0);
 
 	//set the data
-	char *p = (char *)buf;
+	char *p = &value[0];
 
 	uint8_t version = HASHDATA_VERSION;
 	memcpy(p, &version, sizeof(uint8_t));
@@ -305,20 +400,12 @@ void HashManager::HashStore::addTree(const TigerTree& tt) {
 	if (treelen > 0)
 		memcpy(p, tt.getLeaves()[0].data, treelen);
 
-	//throw HashException(STRING_F(WRITE_FAILED_X, hashDb->getNameLower() % "TEST"));
-	try {
-		hashDb->put((void*)tt.getRoot().data, sizeof(TTHValue), buf, sz);
-	} catch(DbException& e) {
-		free(buf);
-		throw HashException(STRING_F(WRITE_FAILED_X, hashDb->getNameLower() % e.getError()));
-	}
-
-	free(buf);
+	queueWrite(treeQueue, string((const char*)tt.getRoot().data, sizeof(TTHValue)), move(value));
 }
 
 bool HashManager::HashStore::getTree(const TTHValue& aRoot, TigerTree& tt) {
 	try {
-		return hashDb->get((void*)aRoot.data, sizeof(TTHValue), 100*1024, [&](void* aValue, size_t valueLen) {
+		return get(*hashDb, treeQueue, string((const char*)aRoot.data, sizeof(TTHValue)), 100*1024, [&](void* aValue, size_t valueLen) {
 			return loadTree(aValue, valueLen, aRoot, tt, true);
 		});
 	} catch(DbException& e) {
@@ -329,6 +416,11 @@ bool HashManager::HashStore::getTree(const TTHValue& aRoot, TigerTree& tt) {
 }
 
 bool HashManager::HashStore::hasTree(const TTHValue& aRoot) {
+	string value;
+	if (getPending(treeQueue, string((const char*)aRoot.data, sizeof(TTHValue)), value)) {
+		return !value.empty();
+	}
+
 	bool ret = false;
 	try {
 		ret = hashDb->hasKey((void*)aRoot.data, sizeof(TTHValue));
@@ -448,7 +540,7 @@ void HashManager::HashStore::loadLegacyTree(File& f, int64_t aSize, int64_t aInd
 int64_t HashManager::HashStore::getRootInfo(const TTHValue& root, InfoType aType) noexcept {
 	int64_t ret = 0;
 	try {
-		hashDb->get((void*)root.data, sizeof(TTHValue), 100*1024, [&](void* aValue, size_t /*valueLen*/) {
+		get(*hashDb, treeQueue, string((const char*)root.data, sizeof(TTHValue)), 100*1024, [&](void* aValue, size_t /*valueLen*/) {
 			char* p = (char*)aValue;
 
 			uint8_t version;
@@ -485,7 +577,7 @@ bool HashManager::HashStore::checkTTH(const string& aFileLower, HashedFile& fi_)
 
 bool HashManager::HashStore::getFileInfo(const string& aFileLower, HashedFile& fi_) noexcept {
 	try {
-		return fileDb->get((void*)aFileLower.c_str(), aFileLower.length(), sizeof(HashedFile), [&](void* aValue, size_t valueLen) {
+		return get(*fileDb, fileQueue, aFileLower, sizeof(HashedFile), [&](void* aValue, size_t valueLen) {
 			return loadFileInfo(aValue, valueLen, fi_);
 		});
 	} catch(const DbException& e) {
@@ -495,6 +587,49 @@ bool HashManager::HashStore::getFileInfo(const string& aFileLower, HashedFile& f
 	return false;
 }
 
+void HashManager::HashStore::getDirectoryFiles(const string& aPathLower, DirectoryFileList& files_) noexcept {
+	try {
+		fileDb->forEachChild((void*)aPathLower.c_str(), aPathLower.length(), PATH_SEPARATOR, [&](void* aKey, size_t aKeyLen, void* aValue, size_t aValueLen) {
+			HashedFile fi;
+			if (loadFileInfo(aValue, aValueLen, fi)) {
+				files_.emplace_back(string((const char*)aKey + aPathLower.length(), aKeyLen - aPathLower.length()), fi);
+			}
+		});
+	} catch (const DbException& e) {
+		LogManager::getInstance()->message(STRING_F(READ_FAILED_X, fileDb->getNameLower() % e.getError()), LogMessage::SEV_ERROR);
+		files_.clear();
+		return;
+	}
+
+	// Apply the changes that haven't been committed yet (the pending ones override the ones being committed)
+	Lock l(cs);
+	for (const auto queue: { &fileQueue.committing, &fileQueue.pending }) {
+		for (auto i = queue->lower_bound(aPathLower); i != queue->end() && i->first.compare(0, aPathLower.length(), aPathLower) == 0; ++i) {
+			auto name = i->first.substr(aPathLower.length());
+			if (name.find(PATH_SEPARATOR) != string::npos) {
+				continue;
+			}
+
+			auto f = lower_bound(files_.begin(), files_.end(), name, [](const pair<string, HashedFile>& aFile, const string& aName) {
+				return aFile.first < aName;
+			});
+
+			auto exists = f != files_.end() && f->first == name;
+
+			HashedFile fi;
+			if (i->second.empty() || !loadFileInfo(i->second.data(), i->second.size(), fi)) {
+				if (exists) {
+					files_.erase(f);
+				}
+			} else if (exists) {
+				f->second = fi;
+			} else {
+				files_.emplace(f, move(name), fi);
+			}
+		}
+	}
+}
+
 void HashManager::HashStore::optimize(bool doVerify) noexcept {
 	getInstance()->fire(HashManagerListener::MaintananceStarted());
 
@@ -512,8 +647,21 @@ void HashManager::HashStore::optimize(bool doVerify) noexcept {
 		unordered_set<TTHValue> usedRoots;
 
 		//make sure that the databases stay in sync so that trees added during this operation won't get removed
-		unique_ptr<DbSnapshot> fileSnapshot(fileDb->getSnapshot()); 
-		unique_ptr<DbSnapshot> hashSnapshot(hashDb->getSnapshot()); 
+		unique_ptr<DbSnapshot> fileSnapshot;
+		unique_ptr<DbSnapshot> hashSnapshot;
+
+		{
+			// The snapshots must include the pending changes
+			Lock l(commitCs);
+			try {
+				commit();
+			} catch (const HashException& e) {
+				LogManager::getInstance()->message(e.getError(), LogMessage::SEV_ERROR);
+			}
+
+			fileSnapshot.reset(fileDb->getSnapshot());
+			hashSnapshot.reset(hashDb->getSnapshot());
+		}
 
 		HashedFile fi;
 		string path;
@@ -900,6 +1048,16 @@ HashManager::HashStore::HashStore() {
 }
 
 void HashManager::HashStore::closeDb() noexcept {
+	// The pending changes may be committed from the timer thread
+	Lock l(commitCs);
+	if (hashDb && fileDb) {
+		try {
+			commit();
+		} catch (const HashException& e) {
+			LogManager::getInstance()->message(e.getError(), LogMessage::SEV_ERROR);
+		}
+	}
+
 	hashDb.reset(nullptr);
 	fileDb.reset(nullptr);
 }
@@ -1064,7 +1222,7 @@ void HashManager::Hasher::instantPause() {
 	}
 }
 
-HashManager::Hasher::Hasher(bool isPaused, int aHasherID) : paused(isPaused), hasherID(aHasherID), totalBytesLeft(0), lastSpeed(0) {
+HashManager::Hasher::Hasher(bool isPaused, int aHasherID) : paused(isPaused), hasherID(aHasherID), totalBytesLeft(0), lastSpeed(0), fileReader(true) {
 	start();
 }
 
@@ -1142,8 +1300,10 @@ int HashManager::Hasher::run() {
 
 				uint64_t lastRead = GET_TICK();
  
-                FileReader fr(true);
-				fr.read(fname, [&](const void* buf, size_t n) -> bool {
+				// Keep multiple unbuffered reads in flight unless the device has been found not to support them
+				auto queueDepth = directReadFailedDevices.find(curDevID) == directReadFailedDevices.end() ? max(SETTING(HASH_READ_QUEUE_DEPTH), 0) : 0;
+				fileReader.setQueueDepth(queueDepth);
+				fileReader.read(fname, [&](const void* buf, size_t n) -> bool {
 					if(SETTING(MAX_HASH_SPEED)> 0) {
 						uint64_t now = GET_TICK();
 						uint64_t minTime = n * 1000LL / Util::convertSize(SETTING(MAX_HASH_SPEED), Util::MB);
@@ -1173,6 +1333,11 @@ int HashManager::Hasher::run() {
 
 				tt.finalize();
 
+				if (queueDepth > 0 && fileReader.getStrategy() != FileReader::DIRECT) {
+					// Use the buffered reads directly for the following files on this device
+					directReadFailedDevices.insert(curDevID);
+				}
+
 				failed = fileCRC && crc32.getValue() != *fileCRC;
 
 				uint64_t end = GET_TICK();
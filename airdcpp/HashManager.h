@@ -22,7 +22,9 @@
 #include <functional>
 #include "typedefs.h"
 
+#include "CriticalSection.h"
 #include "DbHandler.h"
+#include "FileReader.h"
 #include "HashedFile.h"
 #include "HashManagerListener.h"
 #include "MerkleTree.h"
@@ -32,6 +34,7 @@
 #include "SortedVector.h"
 #include "Speaker.h"
 #include "Thread.h"
+#include "TimerManagerListener.h"
 
 namespace dcpp {
 
@@ -39,7 +42,7 @@ class File;
 class HashLoader;
 class FileException;
 
-class HashManager : public Singleton<HashManager>, public Speaker<HashManagerListener> {
+class HashManager : public Singleton<HashManager>, public Speaker<HashManagerListener>, private TimerManagerListener {
 
 public:
 
@@ -54,6 +57,20 @@ public:
 	 */
 	bool checkTTH(const string& fileLower, const string& aFileName, HashedFile& fi_);
 
+	// Stored file information for the files of a single directory (without subdirectories), sorted by the lowercase file name
+	typedef vector<pair<string, HashedFile>> DirectoryFileList;
+
+	/**
+	 * Loads the stored information of all files in the directory with a single database scan
+	 * Missing or unreadable entries are left out (checkTTH will fall back to normal lookups)
+	 */
+	void getDirectoryFiles(const string& aPathLower, DirectoryFileList& files_) noexcept;
+
+	/**
+	 * Checks the file against a list returned by getDirectoryFiles before falling back to a database lookup
+	 */
+	bool checkTTH(const DirectoryFileList& aDirectoryFiles, const string& aNameLower, const string& fileLower, const string& aFileName, HashedFile& fi_);
+
 	void stopHashing(const string& baseDir) noexcept;
 	void setPriority(Thread::Priority p) noexcept;
 
@@ -185,6 +202,12 @@ private:
 		DirSFVReader sfv;
 
 		map<devid, int> devices;
+
+		// Devices that don't support asynchronous unbuffered reads
+		set<devid> directReadFailedDevices;
+
+		// Reused for all files so that the asynchronous I/O instance is kept for the whole thread
+		FileReader fileReader;
 	};
 
 	friend class Hasher;
@@ -209,6 +232,7 @@ private:
 
 		void addTree(const TigerTree& tt);
 		bool getFileInfo(const string& aFileLower, HashedFile& aFile) noexcept;
+		void getDirectoryFiles(const string& aPathLower, DirectoryFileList& files_) noexcept;
 		bool getTree(const TTHValue& root, TigerTree& tth);
 		bool hasTree(const TTHValue& root);
 
@@ -228,10 +252,42 @@ private:
 
 		void getDbSizes(int64_t& fileDbSize_, int64_t& hashDbSize_) const noexcept;
 		void compact() noexcept;
+
+		// Writes the pending changes to the databases
+		// Throws HashException
+		void commit();
 	private:
 		std::unique_ptr<DbHandler> fileDb;
 		std::unique_ptr<DbHandler> hashDb;
 
+		// Changes are collected into batches that are committed when they grow large enough or once in a second
+		// (LevelDB syncs each write to the disk). Lookups check the pending changes before accessing the database.
+		struct WriteQueue {
+			DbWriteBatch pending;
+			DbWriteBatch committing; // Being written to the database
+			size_t pendingBytes = 0;
+		};
+
+		WriteQueue fileQueue;
+		WriteQueue treeQueue;
+
+		mutable CriticalSection cs;
+		CriticalSection commitCs;
+
+		static const size_t MAX_BATCH_BYTES = 1024 * 1024;
+
+		void queueWrite(WriteQueue& aQueue, string&& aKey, string&& aValue);
+
+		// Returns true if the key has pending changes (the value is empty for removed keys)
+		bool getPending(const WriteQueue& aQueue, const string& aKey, string& value_) const noexcept;
+
+		// Throws DbException
+		bool get(DbHandler& aDb, const WriteQueue& aQueue, const string& aKey, size_t aInitialValueLen, std::function<bool(void* aValue, size_t aValueLen)> loadF);
+
+		// Writes the entries being committed
+		// Throws HashException
+		void write(DbHandler& aDb, WriteQueue& aQueue);
+
 
 		friend class HashLoader;
 
@@ -276,6 +332,9 @@ private:
 	};
 
 	Optimizer optimizer;
+
+	// TimerManagerListener
+	void on(TimerManagerListener::Second, uint64_t aTick) noexcept override;
 };
 
 } // namespace dcpp
@@ -175,6 +175,20 @@ void LevelDB::remove(void* aKey, size_t keyLen, DbSnapshot* /*aSnapshot*/ /*null
 	DBACTION(db->Delete(writeoptions, key));
 }
 
+void LevelDB::write(const DbWriteBatch& aBatch) {
+	leveldb::WriteBatch wb;
+	for (const auto& p: aBatch) {
+		if (p.second.empty()) {
+			wb.Delete(p.first);
+		} else {
+			wb.Put(p.first, p.second);
+		}
+	}
+
+	totalWrites += aBatch.size();
+	DBACTION(db->Write(writeoptions, &wb));
+}
+
 int64_t LevelDB::getSizeOnDisk() {
 	return File::getDirSize(getPath(), false);
 }
@@ -226,6 +240,35 @@ void LevelDB::remove_if(std::function<bool(void* aKey, size_t key_len, void* aVa
 	DBACTION(db->Write(writeoptions, &wb));
 }
 
+void LevelDB::forEachChild(void* aPrefix, size_t aPrefixLen, char aSeparator, std::function<void(void* aKey, size_t key_len, void* aValue, size_t valueLen)> f, DbSnapshot* aSnapshot /*nullptr*/) {
+	totalReads++;
+	leveldb::ReadOptions options = readoptions;
+	if (aSnapshot)
+		options.snapshot = static_cast<LevelSnapshot*>(aSnapshot)->snapshot;
+
+	leveldb::Slice prefix((const char*)aPrefix, aPrefixLen);
+	string skipKey;
+
+	auto it = unique_ptr<leveldb::Iterator>(db->NewIterator(options));
+	it->Seek(prefix);
+	while (it->Valid() && it->key().starts_with(prefix)) {
+		auto key = it->key();
+		auto sep = (const char*)memchr(key.data() + aPrefixLen, aSeparator, key.size() - aPrefixLen);
+		if (sep) {
+			// All keys of the sub path are between "sub<separator>" and "sub<separator + 1>"
+			skipKey.assign(key.data(), sep - key.data());
+			skipKey += static_cast<char>(aSeparator + 1);
+			it->Seek(skipKey);
+			continue;
+		}
+
+		f((void*)key.data(), key.size(), (void*)it->value().data(), it->value().size());
+		it->Next();
+	}
+
+	checkDbError(it->status());
+}
+
 // free up some space, https://code.google.com/p/leveldb/issues/detail?id=158
 // LevelDB will perform some kind of compaction on every startup but it's not as comprehensive as manual one
 // The issue has been "fixed" in version 1.13 but it still won't match the manual one (possibly because only ranges that are iterated
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+
+#include "MappedFile.h"
+
+#include "Exception.h"
+#include "File.h"
+#include "Util.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+namespace dcpp {
+
+MappedFile::MappedFile(const string& aPath) {
+	File f(aPath, File::READ, File::OPEN, File::BUFFER_SEQUENTIAL);
+
+	auto size = f.getSize();
+	if (size < 0 || static_cast<uint64_t>(size) > std::numeric_limits<size_t>::max()) {
+		throw FileException("Invalid file size");
+	}
+
+	len = static_cast<size_t>(size);
+	if (len == 0) {
+		return;
+	}
+
+#ifdef _WIN32
+	// The view will keep the mapping open
+	auto mapping = ::CreateFileMapping(f.getNativeHandle(), NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping) {
+		throw FileException(Util::translateError(::GetLastError()));
+	}
+
+	buf = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, len);
+	auto error = ::GetLastError();
+	::CloseHandle(mapping);
+
+	if (!buf) {
+		throw FileException(Util::translateError(error));
+	}
+#else
+	buf = mmap(0, len, PROT_READ, MAP_PRIVATE, f.getNativeHandle(), 0);
+	if (buf == MAP_FAILED) {
+		buf = nullptr;
+		throw FileException(Util::translateError(errno));
+	}
+
+	// The advice values can't be combined
+	posix_madvise(buf, len, POSIX_MADV_SEQUENTIAL);
+	posix_madvise(buf, len, POSIX_MADV_WILLNEED);
+#endif
+}
+
+MappedFile::~MappedFile() {
+	if (!buf) {
+		return;
+	}
+
+#ifdef _WIN32
+	::UnmapViewOfFile(buf);
+#else
+	munmap(buf, len);
+#endif
+}
+
+} // namespace dcpp
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_MAPPED_FILE_H
+#define DCPLUSPLUS_DCPP_MAPPED_FILE_H
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+namespace dcpp {
+
+using std::string;
+
+/** Read-only memory mapping of an entire file */
+class MappedFile : boost::noncopyable {
+public:
+	// Throws FileException
+	MappedFile(const string& aPath);
+	~MappedFile();
+
+	const uint8_t* data() const noexcept { return static_cast<const uint8_t*>(buf); }
+	size_t size() const noexcept { return len; }
+private:
+	void* buf = nullptr;
+	size_t len = 0;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_MAPPED_FILE_H)
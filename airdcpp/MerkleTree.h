@@ -43,6 +43,9 @@ public:
 	static const size_t BYTES = Hasher::BYTES;
 	static const size_t BASE_BLOCK_SIZE = baseBlockSize;
 
+	/** Maximum number of full leaves that are hashed at once */
+	static const size_t LEAF_BATCH_SIZE = 64;
+
 	typedef HashValue<Hasher> MerkleValue;
 	typedef vector<MerkleValue> MerkleList;
 	typedef typename MerkleList::const_iterator MerkleIter;
@@ -106,16 +109,24 @@ public:
 			return;
 		
 		do {
+			// Hash multiple full leaves at once if possible
+			size_t fullBlocks = min((len - i) / baseBlockSize, LEAF_BATCH_SIZE);
+			if(fullBlocks > 1) {
+				uint8_t hashes[LEAF_BATCH_SIZE * Hasher::BYTES];
+				Hasher::hashLeaves(buf + i, baseBlockSize, fullBlocks, hashes);
+				for(size_t j = 0; j < fullBlocks; ++j) {
+					addLeaf(MerkleValue(hashes + j * Hasher::BYTES));
+				}
+
+				i += fullBlocks * baseBlockSize;
+				continue;
+			}
+
 			size_t n = min(baseBlockSize, len-i);
 			Hasher h;
 			h.update(&zero, 1);
 			h.update(buf + i, n);
-			if((int64_t)baseBlockSize < blockSize) {
-				blocks.emplace_back(MerkleValue(h.finalize()), baseBlockSize);
-				reduceBlocks();
-			} else {
-				leaves.emplace_back(h.finalize());
-			}
+			addLeaf(MerkleValue(h.finalize()));
 			i += n;
 		} while(i < len);
 		fileSize += len;
@@ -183,6 +194,15 @@ private:
 	/** Final block size */
 	int64_t blockSize;
 	
+	void addLeaf(const MerkleValue& aHash) {
+		if((int64_t)baseBlockSize < blockSize) {
+			blocks.emplace_back(aHash, baseBlockSize);
+			reduceBlocks();
+		} else {
+			leaves.push_back(aHash);
+		}
+	}
+
 	MerkleValue getHash(int64_t start, int64_t length) {
 		dcassert((start % blockSize) == 0);
 		if(length <= blockSize) {
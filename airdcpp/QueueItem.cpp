@@ -438,29 +438,56 @@ Segment QueueItem::getNextSegment(int64_t aBlockSize, int64_t aWantedSize, int64
 	}		
 
 	int64_t start = 0;
-	int64_t curSize = targetSize;
-
 	while(start < size) {
-		int64_t end = std::min(size, start + curSize);
+		int64_t end = std::min(size, start + aBlockSize);
+
+		auto d = getDoneSegment(start);
+		if(d != done.end() && d->getEnd() >= end) {
+			// Skip all blocks that have been fully downloaded
+			if(d->getEnd() >= size)
+				break;
+
+			start = d->getEnd() - d->getEnd() % aBlockSize;
+			continue;
+		}
+
+		// Find the first position that a larger block can't overlap
+		// (a partially done single block is accepted, see below)
+		int64_t limit = size;
+		if(d != done.end()) {
+			limit = start;
+		} else {
+			auto next = done.upper_bound(Segment(start, numeric_limits<int64_t>::max()));
+			if(next != done.end()) {
+				limit = next->getStart();
+			}
+		}
+
+		for(auto dl: downloads) {
+			const auto& running = dl->getSegment();
+			if(running.getEnd() > start) {
+				limit = std::min(limit, std::max(running.getStart(), start));
+			}
+		}
+
+		int64_t curSize = aBlockSize;
+		if(limit == size) {
+			curSize = targetSize;
+		} else if(limit - start > aBlockSize) {
+			curSize = std::min(targetSize, limit - start - (limit - start) % aBlockSize);
+		}
+
+		end = std::min(size, start + curSize);
 		Segment block(start, end - start);
+
 		bool overlaps = false;
-		for(auto i = done.begin(); !overlaps && i != done.end(); ++i) {
-			if(curSize <= aBlockSize) {
-				int64_t dstart = i->getStart();
-				int64_t dend = i->getEnd();
-				// We accept partial overlaps, only consider the block done if it is fully consumed by the done block
-				if(dstart <= start && dend >= end) {
-					overlaps = true;
-				}
-			} else {
-				overlaps = block.overlaps(*i);
+		if(curSize <= aBlockSize) {
+			// We accept partial overlaps with done segments, only consider the block done if it is fully consumed by the done block (checked earlier)
+			for(auto i = downloads.begin(); !overlaps && i != downloads.end(); ++i) {
+				overlaps = block.overlaps((*i)->getSegment());
 			}
 		}
-		
-		for(auto i = downloads.begin(); !overlaps && i != downloads.end(); ++i) {
-			overlaps = block.overlaps((*i)->getSegment());
-		}
-		
+
 		if(!overlaps) {
 			if(aPartialSource) {
 				// store all chunks we could need
@@ -481,13 +508,8 @@ Segment QueueItem::getNextSegment(int64_t aBlockSize, int64_t aWantedSize, int64
 				return block;
 			}
 		}
-		
-		if(overlaps && (curSize > aBlockSize)) {
-			curSize -= aBlockSize;
-		} else {
-			start = end;
-			curSize = targetSize;
-		}
+
+		start = end;
 	}
 
 	if(!neededParts.empty()) {
@@ -503,6 +525,17 @@ Segment QueueItem::getNextSegment(int64_t aBlockSize, int64_t aWantedSize, int64
 	return checkOverlaps(aBlockSize, aLastSpeed, aPartialSource, aAllowOverlap);
 }
 
+QueueItem::SegmentConstIter QueueItem::getDoneSegment(int64_t aPos) const noexcept {
+	// Last segment starting at or before the position
+	auto i = done.upper_bound(Segment(aPos, numeric_limits<int64_t>::max()));
+	if(i == done.begin()) {
+		return done.end();
+	}
+
+	--i;
+	return i->getEnd() > aPos ? i : done.end();
+}
+
 Segment QueueItem::checkOverlaps(int64_t aBlockSize, int64_t aLastSpeed, const PartialSource::Ptr& aPartialSource, bool aAllowOverlap) const noexcept {
 	if(aAllowOverlap && !aPartialSource && bundle && SETTING(OVERLAP_SLOW_SOURCES) && aLastSpeed > 0) {
 		// overlap slow running chunk
@@ -576,7 +609,7 @@ void QueueItem::addFinishedSegment(const Segment& segment) noexcept {
 			auto prev = i;
 			prev--;
 			if(prev->getEnd() >= i->getStart()) {
-				Segment big(prev->getStart(), i->getEnd() - prev->getStart());
+				Segment big(prev->getStart(), max(prev->getEnd(), i->getEnd()) - prev->getStart());
 				auto newBytes = big.getSize() - (*prev == segment ? i->getSize() : prev->getSize()); //minus the part that has been counted before...
 
 				done.erase(prev);
@@ -302,6 +302,10 @@ private:
 
 	static uint8_t getMaxSegments(int64_t aFileSize) noexcept;
 
+	// Returns the done segment containing the position or done.end()
+	// The done segments are merged when they are added so they can't overlap with each other
+	SegmentConstIter getDoneSegment(int64_t aPos) const noexcept;
+
 	int64_t blockSize = -1;
 };
 
@@ -72,12 +72,12 @@ optional<uint32_t> DirSFVReader::hasFile(const string& aFileName) const noexcept
 	return nullopt;
 }
 
-bool DirSFVReader::isCrcValid(const string& aFileName) const {
+bool DirSFVReader::isCrcValid(const string& aFileName, size_t aBlockSize, size_t aQueueDepth) const {
 	dcassert(Text::isLower(aFileName));
 	auto p = content.find(aFileName);
 	if (p != content.end()) {
 		CRC32Filter crc32;
-		FileReader(true).read(path + aFileName, [&](const void* x, size_t n) {
+		FileReader(true, aBlockSize, aQueueDepth).read(path + aFileName, [&](const void* x, size_t n) {
 			return crc32(x, n), true;
 		});
 		return crc32.getValue() == p->second;
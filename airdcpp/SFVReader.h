@@ -47,7 +47,14 @@ public:
 	optional<uint32_t> hasFile(const string& fileName) const noexcept;
 
 	bool hasSFV() const { return !sfvFiles.empty(); }
-	bool isCrcValid(const string& aFile) const;
+
+	/**
+	 * Compare the CRC32 of the file with the one in the SFV file (returns true for unlisted files)
+	 * @param aBlockSize Read block size, 0 = use the default
+	 * @param aQueueDepth Number of blocks to read ahead, 0 = read synchronously
+	 * @throw FileException if the file can't be read
+	 */
+	bool isCrcValid(const string& aFile, size_t aBlockSize = 0, size_t aQueueDepth = 0) const;
 
 	/* Loops through the file names */
 	void read(std::function<void (const string&)> aReadF) const;
@@ -19,6 +19,7 @@
 #include "stdinc.h"
 #include "SSLSocket.h"
 
+#include "File.h"
 #include "LogManager.h"
 #include "SettingsManager.h"
 #include "ResourceManager.h"
@@ -27,6 +28,10 @@
 
 #include <openssl/err.h>
 
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+#define HAVE_KTLS
+#endif
+
 namespace dcpp {
 
 SSLSocket::SSLSocket(CryptoManager::SSLContext context, bool allowUntrusted, const string& expKP) : SSLSocket(context) {
@@ -66,6 +71,8 @@ bool SSLSocket::waitConnected(uint64_t millis) {
 			SSL_set_verify(ssl, SSL_VERIFY_NONE, NULL);
 		} else SSL_set_ex_data(ssl, CryptoManager::idxVerifyData, verifyData.get());
 
+		setKernelTLS();
+
 		if (!hostname.empty()) {
 			// https://github.com/openssl/openssl/issues/7147#issuecomment-419621673
 			SSL_set_tlsext_host_name(ssl, hostname.c_str());
@@ -103,6 +110,8 @@ bool SSLSocket::waitAccepted(uint64_t millis) {
 			SSL_set_verify(ssl, SSL_VERIFY_NONE, NULL);
 		} else SSL_set_ex_data(ssl, CryptoManager::idxVerifyData, verifyData.get());
 
+		setKernelTLS();
+
 		checkSSL(SSL_set_fd(ssl, static_cast<int>(getSock())));
 	}
 
@@ -162,6 +171,48 @@ int SSLSocket::write(const void* aBuffer, int aLen) {
 	return ret;
 }
 
+void SSLSocket::setKernelTLS() noexcept {
+#ifdef HAVE_KTLS
+	// The keys are passed to the kernel after the handshake if both the cipher and the kernel support it
+	if (SETTING(KERNEL_TLS)) {
+		SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+	}
+#endif
+}
+
+bool SSLSocket::canSendFile() const noexcept {
+#ifdef HAVE_KTLS
+	return ssl && BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+	return false;
+#endif
+}
+
+int SSLSocket::sendFile(File& aFile, int aLen) {
+#ifdef HAVE_KTLS
+	if (!ssl) {
+		return -1;
+	}
+
+	// The file position isn't updated by OpenSSL
+	auto ret = SSL_sendfile(ssl, aFile.getNativeHandle(), aFile.getPos(), aLen, 0);
+	if (ret == 0) {
+		return 0;
+	}
+
+	ret = checkSSL(static_cast<int>(ret));
+	if (ret > 0) {
+		aFile.movePos(ret);
+		stats.totalUp += ret;
+	}
+
+	return static_cast<int>(ret);
+#else
+	dcassert(0);
+	return 0;
+#endif
+}
+
 int SSLSocket::checkSSL(int ret) {
 	if(!ssl) {
 		return -1;
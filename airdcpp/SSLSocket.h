@@ -52,6 +52,10 @@ public:
 
 	virtual int read(void* aBuffer, int aBufLen) override;
 	virtual int write(const void* aBuffer, int aLen) override;
+
+	// Available when the kernel handles the encryption (kTLS)
+	virtual int sendFile(File& aFile, int aLen) override;
+	virtual bool canSendFile() const noexcept override;
 	virtual std::pair<bool, bool> wait(uint64_t millis, bool checkRead, bool checkWrite) override;
 	virtual void shutdown() noexcept override;
 	virtual void close() noexcept override;
@@ -77,6 +81,7 @@ private:
 
 	int checkSSL(int ret);
 	bool waitWant(int ret, uint64_t millis);
+	void setKernelTLS() noexcept;
 	string hostname;
 };
 
@@ -193,7 +193,8 @@ SearchInstanceList SearchManager::getSearchInstances() const noexcept {
 bool SearchManager::decryptPacket(string& x, size_t aLen, const ByteVector& aBuf) {
 	RLock l (cs);
 	for(auto& i: searchKeys | reversed) {
-		boost::scoped_array<uint8_t> out(new uint8_t[aBuf.size()]);
+		// Leave space for the final block
+		boost::scoped_array<uint8_t> out(new uint8_t[aLen + 16]);
 
 		uint8_t ivd[16] = { };
 
@@ -630,11 +631,16 @@ void SearchManager::respond(const AdcCommand& adc, OnlineUser& aUser, bool isUdp
 
 
 	adc.getParam("KY", 0, key);
-	for(const auto& sr: results) {
-		AdcCommand cmd = sr->toRES(AdcCommand::TYPE_UDP);
-		if(!token.empty())
-			cmd.addParam("TO", token);
-		ClientManager::getInstance()->sendUDP(cmd, aUser.getUser()->getCID(), false, false, key, aUser.getHubUrl());
+	if (!results.empty()) {
+		vector<AdcCommand> commands;
+		for(const auto& sr: results) {
+			AdcCommand cmd = sr->toRES(AdcCommand::TYPE_UDP);
+			if(!token.empty())
+				cmd.addParam("TO", token);
+			commands.push_back(move(cmd));
+		}
+
+		ClientManager::getInstance()->sendUDP(commands, aUser.getUser()->getCID(), false, false, key, aUser.getHubUrl());
 	}
 
 end:
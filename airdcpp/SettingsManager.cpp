@@ -232,7 +232,7 @@ const string SettingsManager::settingTags[] =
 "QueueSplitterPosition", "FullListDLLimit", "ASDelayHours", "LastListProfile", "MaxHashingThreads", "HashersPerVolume", "SubtractlistSkip", "BloomMode", "FavUsersSplitterPos", "AwayIdleTime",
 "SearchHistoryMax", "ExcludeHistoryMax", "DirectoryHistoryMax", "MinDupeCheckSize", "DbCacheSize", "DLAutoDisconnectMode", "RemovedTrees", "RemovedFiles", "MultithreadedRefresh", "MonitoringMode",
 "MonitoringDelay", "DelayCountMode", "MaxRunningBundles", "DefaultShareProfile", "UpdateChannel", "ColorStatusFinished", "ColorStatusShared", "ProgressLighten",
-"ConfigBuildNumber", "PmMessageCache", "HubMessageCache", "LogMessageCache", "MaxRecentHubs", "MaxRecentPrivateChats", "MaxRecentFilelists",
+"ConfigBuildNumber", "PmMessageCache", "HubMessageCache", "LogMessageCache", "MaxRecentHubs", "MaxRecentPrivateChats", "MaxRecentFilelists", "RefreshThreadsPerVolume", "HashReadQueueDepth", "SocketIoThreads",
 "SENTRY",
 
 // Bools
@@ -281,6 +281,7 @@ const string SettingsManager::settingTags[] =
 	"FilterFLShared", "FilterFLQueued", "FilterFLInversed", "FilterFLTop", "FilterFLPartialDupes", "FilterFLResetChange", "FilterSearchShared", "FilterSearchQueued", "FilterSearchInversed", "FilterSearchTop", "FilterSearchPartialDupes", "FilterSearchResetChange",
 	"SearchAschOnlyMan", "UseUploadBundles", "CloseMinimize", "LogIgnored", "UsersFilterIgnore", "NfoExternal", "SingleClickTray", "QueueShowFinished", "RemoveFinishedBundles", "LogCRCOk",
 	"FilterQueueInverse", "FilterQueueTop", "FilterQueueReset", "AlwaysCCPM", "OpenAutoSearch", "SaveLastState",
+	"KernelTls",
 	"SENTRY",
 	// Int64
 	"TotalUpload", "TotalDownload",
@@ -849,6 +850,10 @@ SettingsManager::SettingsManager() : connectionRegex("(\\d+(\\.\\d+)?)")
 
 	setDefault(DL_AUTO_DISCONNECT_MODE, QUEUE_FILE);
 	setDefault(REFRESH_THREADING, MULTITHREAD_MANUAL);
+	setDefault(REFRESH_THREADS_PER_VOLUME, 2);
+	setDefault(HASH_READ_QUEUE_DEPTH, 4);
+	setDefault(SOCKET_IO_THREADS, 2);
+	setDefault(KERNEL_TLS, true);
 
 	setDefault(REMOVE_EXPIRED_AS, false);
 
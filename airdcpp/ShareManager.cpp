@@ -27,6 +27,7 @@
 #include "File.h"
 #include "FilteredFile.h"
 #include "LogManager.h"
+#include "MappedFile.h"
 #include "HashManager.h"
 #include "ResourceManager.h"
 #include "ScopedFunctor.h"
@@ -58,13 +59,16 @@ using boost::range::remove_if;
 
 #define SHARE_CACHE_VERSION "3"
 
+// Maximum total size of the cached filelist XML of share directories
+static const size_t FILELIST_XML_CACHE_SIZE = 64 * 1024 * 1024;
+
 #ifdef ATOMIC_FLAG_INIT
 atomic_flag ShareManager::refreshing = ATOMIC_FLAG_INIT;
 #else
 atomic_flag ShareManager::refreshing;
 #endif
 
-ShareManager::ShareManager() : bloom(new ShareBloom(1 << 20)), validator(new SharePathValidator())
+ShareManager::ShareManager() : bloom(new ShareBloom(1 << 20)), validator(new SharePathValidator()), filelistXmlCache(FILELIST_XML_CACHE_SIZE)
 { 
 	SettingsManager::getInstance()->addListener(this);
 	HashManager::getInstance()->addListener(this);
@@ -122,7 +126,7 @@ void ShareManager::abortRefresh() noexcept {
 }
 
 void ShareManager::shutdown(function<void(float)> progressF) noexcept {
-	saveXmlList(progressF);
+	saveShareCache(progressF);
 
 	try {
 		RLock l (cs);
@@ -168,7 +172,7 @@ ShareManager::Directory::Directory(DualString&& aRealName, const ShareManager::D
 }
 
 ShareManager::Directory::~Directory() { 
-	for_each(files, DeleteFunction());
+
 }
 
 void ShareManager::Directory::updateModifyDate() {
@@ -231,9 +235,8 @@ StringList ShareManager::getRealPaths(const TTHValue& root) const noexcept {
 	StringList ret;
 
 	RLock l(cs);
-	const auto i = tthIndex.equal_range(const_cast<TTHValue*>(&root)); 
-	for (auto f = i.first; f != i.second; ++f) {
-		ret.push_back((*f).second->getRealPath());
+	for (const auto& f : tthIndex.equal_range(root)) {
+		ret.push_back(f->getRealPath());
 	}
 
 	const auto k = tempShares.find(root);
@@ -247,7 +250,7 @@ StringList ShareManager::getRealPaths(const TTHValue& root) const noexcept {
 
 bool ShareManager::isTTHShared(const TTHValue& tth) const noexcept {
 	RLock l(cs);
-	return tthIndex.find(const_cast<TTHValue*>(&tth)) != tthIndex.end();
+	return tthIndex.find(tth) != nullptr;
 }
 
 void ShareManager::Directory::increaseSize(int64_t aSize, int64_t& totalSize_) noexcept {
@@ -357,9 +360,9 @@ string ShareManager::toVirtual(const TTHValue& tth, ProfileToken aProfile) const
 		return Transfer::USER_LIST_NAME;
 	}
 
-	auto i = tthIndex.find(const_cast<TTHValue*>(&tth)); 
-	if (i != tthIndex.end()) {
-		return i->second->getAdcPath();
+	auto f = tthIndex.find(tth);
+	if (f) {
+		return f->getAdcPath();
 	}
 
 	//nothing found throw;
@@ -394,13 +397,12 @@ void ShareManager::toRealWithSize(const string& aVirtualFile, const ProfileToken
 
 		RLock l(cs);
 		if(any_of(aProfiles.begin(), aProfiles.end(), [](ProfileToken s) { return s != SP_HIDDEN; })) {
-			const auto flst = tthIndex.equal_range(const_cast<TTHValue*>(&tth));
-			for(auto f = flst.first; f != flst.second; ++f) {
+			for(const auto& f: tthIndex.equal_range(tth)) {
 				noAccess_ = false; //we may throw if the file doesn't exist on the disk so always reset this to prevent invalid access denied messages
 				auto profiles = aProfiles;
-				if (f->second->getParent()->hasProfile(profiles)) {
-					path_ = f->second->getRealPath();
-					size_ = f->second->getSize();
+				if (f->getParent()->hasProfile(profiles)) {
+					path_ = f->getRealPath();
+					size_ = f->getSize();
 					return;
 				} else {
 					noAccess_ = true;
@@ -429,8 +431,8 @@ void ShareManager::toRealWithSize(const string& aVirtualFile, const ProfileToken
 		for(const auto& d: dirs) {
 			auto it = d->files.find(fileName);
 			if(it != d->files.end()) {
-				path_ = (*it)->getRealPath();
-				size_ = (*it)->getSize();
+				path_ = it->getRealPath();
+				size_ = it->getSize();
 				return;
 			}
 		}
@@ -491,9 +493,8 @@ AdcCommand ShareManager::getFileInfo(const string& aFile, ProfileToken aProfile)
 	TTHValue val(aFile.substr(4));
 	
 	RLock l(cs);
-	auto i = tthIndex.find(const_cast<TTHValue*>(&val)); 
-	if(i != tthIndex.end()) {
-		const Directory::File* f = i->second;
+	auto f = tthIndex.find(val);
+	if(f) {
 		AdcCommand cmd(AdcCommand::CMD_RES);
 		cmd.addParam("FN", f->getAdcPath());
 		cmd.addParam("SI", Util::toString(f->getSize()));
@@ -647,7 +648,7 @@ void ShareManager::getRealPaths(const string& aVirtualPath, StringList& realPath
 		for(const auto& d: dirs) {
 			auto it = d->files.find(fileName);
 			if(it != d->files.end()) {
-				realPaths_.push_back((*it)->getRealPath());
+				realPaths_.push_back(it->getRealPath());
 				return;
 			}
 		}
@@ -722,7 +723,7 @@ void ShareManager::loadProfile(SimpleXML& aXml, const string& aName, ProfileToke
 
 			// Validate in case we have changed the rules
 			auto vName = validateVirtualName(loadedVirtualName.empty() ? Util::getLastDir(realPath) : loadedVirtualName);
-			Directory::createRoot(realPath, vName, { aToken }, incoming, 0, rootPaths, lowerDirNameMap, *bloom.get(), lastRefreshTime);
+			Directory::createRoot(realPath, vName, { aToken }, incoming, 0, rootPaths, lowerDirNameMap, searchIndex, *bloom.get(), lastRefreshTime);
 		}
 	}
 
@@ -777,7 +778,7 @@ void ShareManager::on(SettingsManagerListener::LoadCompleted, bool) noexcept {
 			if (find_if(rootPathsCopy | map_keys, [&dp](const string& aPath) {
 				return AirUtil::isSubLocal(dp.first, aPath);
 			}).base() != rootPathsCopy.end()) {
-				removeDirName(*dp.second.get(), lowerDirNameMap);
+				removeDirName(*dp.second.get(), lowerDirNameMap, searchIndex);
 				rootPaths.erase(dp.first);
 
 				LogManager::getInstance()->message("The directory " + dp.first + " was not loaded: parent of this directory is shared in another profile, which is not supported in this client version.", LogMessage::SEV_WARNING);
@@ -810,7 +811,7 @@ OptionalProfileToken ShareManager::getProfileByName(const string& aName) const n
 	return (*p)->getToken();
 }
 
-ShareManager::Directory::Ptr ShareManager::Directory::createNormal(DualString&& aRealName, const Ptr& aParent, time_t aLastWrite, Directory::MultiMap& dirNameMap_, ShareBloom& bloom) noexcept {
+ShareManager::Directory::Ptr ShareManager::Directory::createNormal(DualString&& aRealName, const Ptr& aParent, time_t aLastWrite, Directory::MultiMap& dirNameMap_, SearchIndex& searchIndex_, ShareBloom& bloom) noexcept {
 	auto dir = Ptr(new Directory(move(aRealName), aParent, aLastWrite, nullptr));
 
 	if (aParent) {
@@ -820,19 +821,19 @@ ShareManager::Directory::Ptr ShareManager::Directory::createNormal(DualString&&
 		}
 	}
 
-	addDirName(dir, dirNameMap_, bloom);
+	addDirName(dir, dirNameMap_, searchIndex_, bloom);
 	return dir;
 }
 
 ShareManager::Directory::Ptr ShareManager::Directory::createRoot(const string& aRootPath, const string& aVname, const ProfileTokenSet& aProfiles, bool aIncoming, 
-	time_t aLastWrite, Map& rootPaths_, Directory::MultiMap& dirNameMap_, ShareBloom& bloom, time_t aLastRefreshTime) noexcept
+	time_t aLastWrite, Map& rootPaths_, Directory::MultiMap& dirNameMap_, SearchIndex& searchIndex_, ShareBloom& bloom, time_t aLastRefreshTime) noexcept
 {
 	auto dir = Ptr(new Directory(Util::getLastDir(aRootPath), nullptr, aLastWrite, RootDirectory::create(aRootPath, aVname, aProfiles, aIncoming, aLastRefreshTime)));
 
 	dcassert(rootPaths_.find(dir->getRealPath()) == rootPaths_.end());
 	rootPaths_[dir->getRealPath()] = dir;
 
-	addDirName(dir, dirNameMap_, bloom);
+	addDirName(dir, dirNameMap_, searchIndex_, bloom);
 	return dir;
 }
 
@@ -851,50 +852,58 @@ bool ShareManager::Directory::setParent(const Directory::Ptr& aDirectory, const
 	return true;
 }
 
-void ShareManager::Directory::cleanIndices(Directory& aDirectory, int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& dirNames_) noexcept {
-	aDirectory.cleanIndices(sharedSize_, tthIndex_, dirNames_);
+void ShareManager::Directory::cleanIndices(Directory& aDirectory, int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& dirNames_, SearchIndex& searchIndex_) noexcept {
+	aDirectory.cleanIndices(sharedSize_, tthIndex_, dirNames_, searchIndex_);
+
+	detach(aDirectory);
+	aDirectory.parent = nullptr;
+}
 
+void ShareManager::Directory::detach(Directory& aDirectory) noexcept {
 	if (aDirectory.parent) {
 		aDirectory.parent->directories.erase_key(aDirectory.realName.getLower());
-		aDirectory.parent = nullptr;
 	}
 }
 
-void ShareManager::Directory::File::updateIndices(ShareBloom& bloom_, int64_t& sharedSize_, TTHMap& tthIndex_) noexcept {
+void ShareManager::Directory::File::updateIndices(ShareBloom& bloom_, int64_t& sharedSize_, TTHMap& tthIndex_, SearchIndex& searchIndex_) noexcept {
 	parent->increaseSize(size, sharedSize_);
-#ifdef _DEBUG
-	checkAddedTTHDebug(this, tthIndex_);
-#endif
 
-	tthIndex_.emplace(const_cast<TTHValue*>(&tth), this);
-	bloom_.add(name.getLower());
+	tthIndex_.add(this);
+
+	const auto nameLower = getNameLower().to_string();
+	searchIndex_.add(parent, nameLower);
+	bloom_.add(nameLower);
 }
 
-void ShareManager::Directory::cleanIndices(int64_t& sharedSize_, HashFileMap& tthIndex_, Directory::MultiMap& dirNames_) noexcept {
+void ShareManager::Directory::cleanIndices(int64_t& sharedSize_, HashFileMap& tthIndex_, Directory::MultiMap& dirNames_, SearchIndex& searchIndex_) noexcept {
 	for (auto& d : directories) {
-		d->cleanIndices(sharedSize_, tthIndex_, dirNames_);
+		d->cleanIndices(sharedSize_, tthIndex_, dirNames_, searchIndex_);
 	}
 
+	cleanLevelIndices(sharedSize_, tthIndex_, dirNames_, searchIndex_);
+}
+
+void ShareManager::Directory::cleanLevelIndices(int64_t& sharedSize_, HashFileMap& tthIndex_, Directory::MultiMap& dirNames_, SearchIndex& searchIndex_) noexcept {
 	//remove from the name map
-	removeDirName(*this, dirNames_);
+	removeDirName(*this, dirNames_, searchIndex_);
 
 	//remove all files
-	for (const auto& f : files) {
-		f->cleanIndices(sharedSize_, tthIndex_);
+	for (auto& f : files) {
+		f.cleanIndices(sharedSize_, tthIndex_, searchIndex_);
 	}
 }
 
-void ShareManager::Directory::File::cleanIndices(int64_t& sharedSize_, File::TTHMap& tthIndex_) noexcept {
+void ShareManager::Directory::File::cleanIndices(int64_t& sharedSize_, File::TTHMap& tthIndex_, SearchIndex& searchIndex_) noexcept {
 	parent->decreaseSize(size, sharedSize_);
+	searchIndex_.remove(parent, getNameLower().to_string());
 
-	auto flst = tthIndex_.equal_range(const_cast<TTHValue*>(&tth));
-	auto p = find(flst | map_values, this);
-	if (p.base() != flst.second)
-		tthIndex_.erase(p.base());
-	else
+	if (!tthIndex_.remove(this))
 		dcassert(0);
 }
 
+// Maximum number of index entries to merge while holding the write lock when applying refresh changes
+static const size_t APPLY_BATCH_SIZE = 10000;
+
 static const string SDIRECTORY = "Directory";
 static const string SFILE = "File";
 static const string SNAME = "Name";
@@ -903,9 +912,86 @@ static const string DATE = "Date";
 static const string SHARE = "Share";
 static const string SVERSION = "Version";
 
-struct ShareManager::ShareLoader : public SimpleXMLReader::ThreadedCallBack, public ShareManager::RefreshInfo {
-	ShareLoader(const string& aPath, const ShareManager::Directory::Ptr& aOldRoot, ShareManager::ShareBloom& aBloom) :
-		ShareManager::RefreshInfo(aPath, aOldRoot, 0, aBloom),
+// Binary share cache
+// All values are stored in the native byte order (the magic won't match on a different architecture)
+static const uint32_t SHARE_CACHE_MAGIC = 0x43534441;
+static const uint32_t SHARE_CACHE_BINARY_VERSION = 1;
+
+enum ShareCacheTag : uint8_t {
+	CACHE_TAG_FILE = 1,
+	CACHE_TAG_DIRECTORY,
+	CACHE_TAG_DIRECTORY_END,
+	CACHE_TAG_END
+};
+
+template<typename T>
+static void writeCacheValue(OutputStream& os_, T aValue) {
+	os_.write(&aValue, sizeof(T));
+}
+
+static void writeCacheString(OutputStream& os_, const string& aStr) {
+	writeCacheValue<uint32_t>(os_, static_cast<uint32_t>(aStr.size()));
+	os_.write(aStr);
+}
+
+// Bounds-checked reader for the mapped cache file
+class ShareCacheReader {
+public:
+	ShareCacheReader(const uint8_t* aData, size_t aSize) noexcept : pos(aData), end(aData + aSize) { }
+
+	template<typename T>
+	T read() {
+		T ret;
+		memcpy(&ret, readBytes(sizeof(T)), sizeof(T));
+		return ret;
+	}
+
+	string readString() {
+		auto len = read<uint32_t>();
+		return string(reinterpret_cast<const char*>(readBytes(len)), len);
+	}
+
+	const uint8_t* readBytes(size_t aLen) {
+		if (static_cast<size_t>(end - pos) < aLen) {
+			throw Exception("Unexpected end of the cache file");
+		}
+
+		auto ret = pos;
+		pos += aLen;
+		return ret;
+	}
+
+	bool atEnd() const noexcept {
+		return pos == end;
+	}
+private:
+	const uint8_t* pos;
+	const uint8_t* end;
+};
+
+struct ShareManager::ShareLoader : public ShareManager::RefreshInfo {
+	ShareLoader(const string& aPath, const ShareManager::Directory::Ptr& aOldRoot, ShareManager::ShareBloom& aBloom, const string& aCachePath) :
+		ShareManager::RefreshInfo(aPath, aOldRoot, 0, aBloom), cachePath(aCachePath) { }
+
+	virtual ~ShareLoader() { }
+
+	// Throws Exception
+	virtual void load() = 0;
+
+	const string cachePath;
+protected:
+	// Files of the current directory, they are added when moving to another directory
+	ShareManager::PendingFileList curFiles;
+
+	void addCurFiles(const ShareManager::Directory::Ptr& aDirectory) noexcept {
+		ShareManager::addFiles(curFiles, aDirectory, tthIndexNew, searchIndexNew, bloom, addedSize);
+	}
+};
+
+// Cache format used by the older versions
+struct ShareManager::XmlShareLoader : public ShareManager::ShareLoader, public SimpleXMLReader::ThreadedCallBack {
+	XmlShareLoader(const string& aPath, const ShareManager::Directory::Ptr& aOldRoot, ShareManager::ShareBloom& aBloom) :
+		ShareManager::ShareLoader(aPath, aOldRoot, aBloom, aOldRoot->getRoot()->getCacheXmlPath()),
 		ThreadedCallBack(aOldRoot->getRoot()->getCacheXmlPath()),
 		curDirPath(aOldRoot->getRoot()->getPath()),
 		curDirPathLower(aOldRoot->getRoot()->getPathLower())
@@ -913,6 +999,10 @@ struct ShareManager::ShareLoader : public SimpleXMLReader::ThreadedCallBack, pub
 		cur = newShareDirectory;
 	}
 
+	void load() override {
+		SimpleXMLReader(this).parse(*file);
+		addCurFiles(cur);
+	}
 
 	void startTag(const string& aName, StringPairList& attribs, bool simple) {
 		if(compare(aName, SDIRECTORY) == 0) {
@@ -922,7 +1012,8 @@ struct ShareManager::ShareLoader : public SimpleXMLReader::ThreadedCallBack, pub
 			if(!name.empty()) {
 				curDirPath += name + PATH_SEPARATOR;
 
-				cur = ShareManager::Directory::createNormal(name, cur, Util::toTimeT(date), lowerDirNameMapNew, bloom);
+				addCurFiles(cur);
+				cur = ShareManager::Directory::createNormal(name, cur, Util::toTimeT(date), lowerDirNameMapNew, searchIndexNew, bloom);
 				if (!cur) {
 					throw Exception("Duplicate directory name");
 				}
@@ -946,7 +1037,7 @@ struct ShareManager::ShareLoader : public SimpleXMLReader::ThreadedCallBack, pub
 				DualString name(fname);
 				HashedFile fi;
 				HashManager::getInstance()->getFileInfo(curDirPathLower + name.getLower(), curDirPath + fname, fi);
-				addFile(move(name), cur, fi, tthIndexNew, bloom, addedSize);
+				curFiles.emplace_back(move(name), fi);
 			} catch(Exception& e) {
 				hashSize += File::getSize(curDirPath + fname);
 				dcdebug("Error loading file list %s \n", e.getError().c_str());
@@ -962,6 +1053,7 @@ struct ShareManager::ShareLoader : public SimpleXMLReader::ThreadedCallBack, pub
 	void endTag(const string& name) {
 		if(compare(name, SDIRECTORY) == 0) {
 			if(cur) {
+				addCurFiles(cur);
 				curDirPath = Util::getParentDir(curDirPath);
 				curDirPathLower = Util::getParentDir(curDirPathLower);
 				cur = cur->getParent();
@@ -978,6 +1070,134 @@ private:
 	string curDirPath;
 };
 
+// The file information is stored in the cache so that the hash database doesn't need to be accessed separately for each file
+// (the information is still validated against the database with a single scan per directory)
+struct ShareManager::BinaryShareLoader : public ShareManager::ShareLoader {
+	BinaryShareLoader(const string& aPath, const ShareManager::Directory::Ptr& aOldRoot, ShareManager::ShareBloom& aBloom) :
+		ShareManager::ShareLoader(aPath, aOldRoot, aBloom, aOldRoot->getRoot()->getCachePath()),
+		curDirPath(aOldRoot->getRoot()->getPath()),
+		curDirPathLower(aOldRoot->getRoot()->getPathLower())
+	{ }
+
+	void load() override {
+		MappedFile f(cachePath);
+		ShareCacheReader reader(f.data(), f.size());
+
+		if (reader.read<uint32_t>() != SHARE_CACHE_MAGIC) {
+			throw Exception("Invalid cache file");
+		}
+
+		if (reader.read<uint32_t>() != SHARE_CACHE_BINARY_VERSION) {
+			throw Exception("Unsupported cache version");
+		}
+
+		if (reader.readString() != oldShareDirectory->getRoot()->getPath()) {
+			throw Exception("The cache belongs to a different directory");
+		}
+
+		newShareDirectory->setLastWrite(static_cast<time_t>(reader.read<int64_t>()));
+
+		auto cur = newShareDirectory;
+		for (;;) {
+			switch (reader.read<uint8_t>()) {
+				case CACHE_TAG_FILE: {
+					auto name = reader.readString();
+					auto size = reader.read<int64_t>();
+					auto timeStamp = reader.read<uint64_t>();
+					TTHValue tth(reader.readBytes(TTHValue::BYTES));
+					if (name.empty()) {
+						throw Exception("Invalid file name");
+					}
+
+					DualString dualName(name);
+					HashedFile fi(tth, timeStamp, size);
+					if (checkFile(dualName.getLower(), name, fi)) {
+						curFiles.emplace_back(move(dualName), fi);
+					}
+					break;
+				}
+				case CACHE_TAG_DIRECTORY: {
+					auto name = reader.readString();
+					auto date = reader.read<int64_t>();
+					if (name.empty()) {
+						throw Exception("Invalid directory name");
+					}
+
+					addCurFiles(cur);
+					cur = ShareManager::Directory::createNormal(DualString(name), cur, static_cast<time_t>(date), lowerDirNameMapNew, searchIndexNew, bloom);
+					if (!cur) {
+						throw Exception("Duplicate directory name");
+					}
+
+					curDirPath += name + PATH_SEPARATOR;
+					curDirPathLower += cur->realName.getLower() + PATH_SEPARATOR;
+					break;
+				}
+				case CACHE_TAG_DIRECTORY_END: {
+					if (cur == newShareDirectory) {
+						throw Exception("Invalid directory structure");
+					}
+
+					addCurFiles(cur);
+					curDirPath = Util::getParentDir(curDirPath);
+					curDirPathLower = Util::getParentDir(curDirPathLower);
+					cur = cur->getParent();
+					break;
+				}
+				case CACHE_TAG_END: {
+					if (cur != newShareDirectory || !reader.atEnd()) {
+						throw Exception("Invalid directory structure");
+					}
+
+					addCurFiles(cur);
+					return;
+				}
+				default: throw Exception("Invalid cache file");
+			}
+		}
+	}
+private:
+	// The hash database is used instead of the cached information if they differ (as with the XML cache)
+	// Returns false if the file isn't hashed (it will be queued for hashing)
+	bool checkFile(const string& aNameLower, const string& aName, HashedFile& fi_) noexcept {
+		if (hashedFilesPath != curDirPathLower) {
+			// The files of each directory are stored before the subdirectories
+			hashedFiles.clear();
+			HashManager::getInstance()->getDirectoryFiles(curDirPathLower, hashedFiles);
+			hashedFilesPath = curDirPathLower;
+		}
+
+		auto i = lower_bound(hashedFiles.begin(), hashedFiles.end(), aNameLower, [](const pair<string, HashedFile>& aFile, const string& aName) {
+			return aFile.first < aName;
+		});
+
+		if (i != hashedFiles.end() && i->first == aNameLower) {
+			if (i->second.getRoot() != fi_.getRoot() || i->second.getTimeStamp() != fi_.getTimeStamp() || i->second.getSize() != fi_.getSize()) {
+				dcdebug("Cached information differs from the hash database for file %s\n", (curDirPath + aName).c_str());
+			}
+
+			fi_ = i->second;
+			return true;
+		}
+
+		try {
+			HashManager::getInstance()->getFileInfo(curDirPathLower + aNameLower, curDirPath + aName, fi_);
+			return true;
+		} catch (const Exception& e) {
+			hashSize += File::getSize(curDirPath + aName);
+			dcdebug("Error loading file list %s \n", e.getError().c_str());
+		}
+
+		return false;
+	}
+
+	string curDirPath;
+	string curDirPathLower;
+
+	HashManager::DirectoryFileList hashedFiles;
+	string hashedFilesPath;
+};
+
 typedef shared_ptr<ShareManager::ShareLoader> ShareLoaderPtr;
 typedef vector<ShareLoaderPtr> LoaderList;
 
@@ -995,17 +1215,35 @@ bool ShareManager::loadCache(function<void(float)> progressF) noexcept{
 
 	LoaderList cacheLoaders;
 
+	auto hasCacheFile = [&fileList](const string& aPath) {
+		return find_if(fileList.begin(), fileList.end(), [&aPath](const string& p) { return Util::stricmp(aPath, p) == 0; }) != fileList.end();
+	};
+
 	// Create loaders
 	for (const auto& p : fileList) {
-		if (Util::getFileExt(p) == ".xml") {
+		auto ext = Util::getFileExt(p);
+		if (ext == ".bin" || ext == ".xml") {
+			auto binary = ext == ".bin";
+
 			// Find the corresponding directory pointer for this path
-			auto rp = find_if(rootPaths | map_values, [&p](const Directory::Ptr& aDir) {
-				return Util::stricmp(aDir->getRoot()->getCacheXmlPath(), p) == 0; 
+			auto rp = find_if(rootPaths | map_values, [&p, binary](const Directory::Ptr& aDir) {
+				return Util::stricmp(binary ? aDir->getRoot()->getCachePath() : aDir->getRoot()->getCacheXmlPath(), p) == 0; 
 			});
 
 			if (rp.base() != rootPaths.end()) {
+				if (!binary && hasCacheFile((*rp)->getRoot()->getCachePath())) {
+					// Saved only for the older versions
+					continue;
+				}
+
 				try {
-					auto loader = std::make_shared<ShareLoader>(rp.base()->first, *rp, *bloom.get());
+					ShareLoaderPtr loader;
+					if (binary) {
+						loader = std::make_shared<BinaryShareLoader>(rp.base()->first, *rp, *bloom.get());
+					} else {
+						loader = std::make_shared<XmlShareLoader>(rp.base()->first, *rp, *bloom.get());
+					}
+
 					cacheLoaders.emplace_back(loader);
 					continue;
 				} catch (...) {}
@@ -1030,14 +1268,14 @@ bool ShareManager::loadCache(function<void(float)> progressF) noexcept{
 				//LogManager::getInstance()->message("Thread: " + Util::toString(::GetCurrentThreadId()) + "Size " + Util::toString(loader.size), LogMessage::SEV_INFO);
 				auto& loader = *i;
 				try {
-					SimpleXMLReader(&loader).parse(*loader.file);
-				} catch (SimpleXMLException& e) {
-					LogManager::getInstance()->message(STRING_F(LOAD_FAILED_X, loader.xmlPath % e.getError()), LogMessage::SEV_ERROR);
+					loader.load();
+				} catch (Exception& e) {
+					LogManager::getInstance()->message(STRING_F(LOAD_FAILED_X, loader.cachePath % e.getError()), LogMessage::SEV_ERROR);
 					hasFailedCaches = true;
-					File::deleteFile(loader.xmlPath);
+					File::deleteFile(loader.cachePath);
 				} catch (...) {
 					hasFailedCaches = true;
-					File::deleteFile(loader.xmlPath);
+					File::deleteFile(loader.cachePath);
 				}
 
 				if (progressF) {
@@ -1105,10 +1343,10 @@ void ShareManager::Directory::countStats(time_t& totalAge_, size_t& totalDirs_,
 	}
 
 	for (const auto& f: files) {
-		totalSize_ += f->getSize();
-		totalAge_ += f->getLastWrite();
-		totalStrLen_ += f->name.getLower().length();
-		if (f->name.lowerCaseOnly()) {
+		totalSize_ += f.getSize();
+		totalAge_ += f.getLastWrite();
+		totalStrLen_ += f.getNameLower().length();
+		if (f.lowerCaseOnly()) {
 			lowerCaseFiles_++;
 		}
 	}
@@ -1118,6 +1356,19 @@ void ShareManager::Directory::countStats(time_t& totalAge_, size_t& totalDirs_,
 	totalFiles_ += files.size();
 }
 
+size_t ShareManager::Directory::getAllocatedSize() const noexcept {
+	size_t ret = sizeof(Directory) + realName.getAllocatedSize() + directories.capacity() * sizeof(Ptr) + files.capacity() * sizeof(File);
+	if (fileNames.capacity() > string().capacity()) {
+		ret += fileNames.capacity() + 1;
+	}
+
+	for (const auto& d : directories) {
+		ret += d->getAllocatedSize();
+	}
+
+	return ret;
+}
+
 void ShareManager::countStats(time_t& totalAge_, size_t& totalDirs_, int64_t& totalSize_, size_t& totalFiles_, size_t& lowerCaseFiles_, size_t& totalStrLen_, size_t& roots_) const noexcept{
 	RLock l(cs);
 	for (const auto& d : rootPaths | map_values) {
@@ -1128,16 +1379,23 @@ void ShareManager::countStats(time_t& totalAge_, size_t& totalDirs_, int64_t& to
 }
 
 optional<ShareManager::ShareItemStats> ShareManager::getShareItemStats() const noexcept {
-	unordered_set<decltype(tthIndex)::key_type> uniqueTTHs;
+	unordered_set<TTHValue*> uniqueTTHs;
+	size_t treeMemoryUsage = 0;
 
 	{
 		RLock l(cs);
-		for (auto tth : tthIndex | map_keys) {
-			uniqueTTHs.insert(tth);
+		for (const auto& f : tthIndex) {
+			uniqueTTHs.insert(const_cast<TTHValue*>(&f->getTTH()));
+		}
+
+		treeMemoryUsage = tthIndex.getAllocatedSize();
+		for (const auto& d : rootPaths | map_values) {
+			treeMemoryUsage += d->getAllocatedSize();
 		}
 	}
 
 	ShareItemStats stats;
+	stats.treeMemoryUsage = treeMemoryUsage;
 	stats.profileCount = shareProfiles.size() - 1; // remove hidden
 	stats.uniqueFileCount = uniqueTTHs.size();
 
@@ -1171,6 +1429,7 @@ ShareManager::ShareSearchStats ShareManager::getSearchMatchingStats() const noex
 
 	stats.autoSearches = autoSearches;
 	stats.tthSearches = tthSearches;
+	stats.indexedSearches = indexedSearches;
 
 	return stats;
 }
@@ -1192,7 +1451,8 @@ Total shared files: %d (of which %d%% are lowercase)\r\n\
 Unique TTHs: %d (%d%%)\r\n\
 Total shared directories: %d (%d files per directory)\r\n\
 Average age of a file: %s\r\n\
-Average name length of a shared item: %d bytes (total size %s)")
+Average name length of a shared item: %d bytes (total size %s)\r\n\
+Memory used by the share tree (estimate): %s (%d bytes per file)")
 
 		% itemStats.profileCount
 		% itemStats.rootDirectoryCount
@@ -1203,6 +1463,7 @@ Average name length of a shared item: %d bytes (total size %s)")
 		% Util::formatTime(itemStats.averageFileAge, false, true)
 		% itemStats.averageNameLength
 		% Util::formatBytes(itemStats.totalNameSize)
+		% Util::formatBytes(itemStats.treeMemoryUsage) % Util::countAverage(itemStats.treeMemoryUsage, itemStats.totalFileCount)
 	);
 
 	auto searchStats = getSearchMatchingStats();
@@ -1211,6 +1472,7 @@ Average name length of a shared item: %d bytes (total size %s)")
 Total incoming searches: %d (%d per second)\r\n\
 Incoming text searches: %d (of which %d were matched per second)\r\n\
 Filtered text searches: %d%% (%d%% of the matched ones returned results)\r\n\
+Text searches using the search index: %d%%\r\n\
 Average search tokens (non-filtered only): %d (%d bytes per token)\r\n\
 Auto searches (text, ADC only): %d%%\r\n\
 Average time for matching a recursive search: %d ms\r\n\
@@ -1219,6 +1481,7 @@ TTH searches: %d%% (hash bloom mode: %s)")
 		% searchStats.totalSearches % searchStats.totalSearchesPerSecond
 		% searchStats.recursiveSearches % searchStats.unfilteredRecursiveSearchesPerSecond
 		% Util::countPercentage(searchStats.filteredSearches, searchStats.recursiveSearches) % Util::countPercentage(searchStats.recursiveSearchesResponded, searchStats.recursiveSearches - searchStats.filteredSearches)
+		% Util::countPercentage(searchStats.indexedSearches, searchStats.recursiveSearches - searchStats.filteredSearches)
 		% searchStats.averageSearchTokenCount  % searchStats.averageSearchTokenLength
 		% Util::countAverage(searchStats.autoSearches, searchStats.recursiveSearches)
 		% searchStats.averageSearchMatchMs
@@ -1414,14 +1677,13 @@ ShareManager::Directory::Ptr ShareManager::Directory::findDirectoryByName(const
 
 bool ShareManager::isFileShared(const TTHValue& aTTH) const noexcept{
 	RLock l (cs);
-	return tthIndex.find(const_cast<TTHValue*>(&aTTH)) != tthIndex.end();
+	return tthIndex.find(aTTH) != nullptr;
 }
 
 bool ShareManager::isFileShared(const TTHValue& aTTH, ProfileToken aProfile) const noexcept{
 	RLock l (cs);
-	const auto files = tthIndex.equal_range(const_cast<TTHValue*>(&aTTH));
-	for(auto i = files.first; i != files.second; ++i) {
-		if(i->second->getParent()->hasProfile(aProfile)) {
+	for(const auto& f: tthIndex.equal_range(aTTH)) {
+		if(f->getParent()->hasProfile(aProfile)) {
 			return true;
 		}
 	}
@@ -1432,39 +1694,142 @@ bool ShareManager::isFileShared(const TTHValue& aTTH, ProfileToken aProfile) con
 bool ShareManager::RefreshInfo::checkContent(const Directory::Ptr& aDirectory) noexcept {
 	if (SETTING(SKIP_EMPTY_DIRS_SHARE) && aDirectory->getDirectories().empty() && aDirectory->files.empty()) {
 		// Remove from parent
-		Directory::cleanIndices(*aDirectory.get(), addedSize, tthIndexNew, lowerDirNameMapNew);
+		Directory::cleanIndices(*aDirectory.get(), addedSize, tthIndexNew, lowerDirNameMapNew, searchIndexNew);
 		return false;
 	}
 
 	return true;
 }
 
-ShareManager::ShareBuilder::ShareBuilder(const string& aPath, const Directory::Ptr& aOldRoot, time_t aLastWrite, ShareBloom& bloom_, ShareManager* aSm) :
-	sm(*aSm), RefreshInfo(aPath, aOldRoot, aLastWrite, bloom_) {
+ShareManager::ShareBuilder::ShareBuilder(const string& aPath, const Directory::Ptr& aOldRoot, time_t aLastWrite, ShareBloom& bloom_, ShareManager* aSm, const VolumeWalkerCounter& aVolumeWalkers, bool aAllowParallel) :
+	sm(*aSm), RefreshInfo(aPath, aOldRoot, aLastWrite, bloom_), volumeWalkers(aVolumeWalkers), allowParallel(aAllowParallel) {
 
 }
 
 bool ShareManager::ShareBuilder::buildTree() noexcept {
-	try {
-		buildTree(path, Text::toLower(path), newShareDirectory, oldShareDirectory);
-	} catch (const std::bad_alloc&) {
-		LogManager::getInstance()->message(STRING_F(DIR_REFRESH_FAILED, path % STRING(OUT_OF_MEMORY)), LogMessage::SEV_ERROR);
+	(*volumeWalkers)++;
+	walkDirectoryTask(path, Text::toLower(path), newShareDirectory, oldShareDirectory);
+
+	// Wait for the subdirectory walkers
+	tasks.wait();
+	if (failed) {
 		return false;
-	} catch (...) {
-		LogManager::getInstance()->message(STRING_F(DIR_REFRESH_FAILED, path % STRING(UNKNOWN_ERROR)), LogMessage::SEV_ERROR);
+	}
+
+	mergeContexts();
+
+	if (SETTING(SKIP_EMPTY_DIRS_SHARE)) {
+		removeEmptyDirectories(newShareDirectory);
+	}
+
+	return true;
+}
+
+bool ShareManager::ShareBuilder::startWalker() noexcept {
+	if (!allowParallel) {
 		return false;
 	}
 
+	auto maxWalkers = SETTING(REFRESH_THREADS_PER_VOLUME);
+	auto cur = volumeWalkers->load();
+	do {
+		if (maxWalkers > 0 && cur >= maxWalkers) {
+			return false;
+		}
+	} while (!volumeWalkers->compare_exchange_weak(cur, cur + 1));
+
 	return true;
 }
 
-void ShareManager::ShareBuilder::buildTree(const string& aPath, const string& aPathLower, const Directory::Ptr& aParent, const Directory::Ptr& aOldParent) {
+void ShareManager::ShareBuilder::walkDirectoryTask(const string& aPath, const string& aPathLower, const Directory::Ptr& aDirectory, const Directory::Ptr& aOldDirectory) noexcept {
+	auto context = getContext();
+	ScopedFunctor([&] {
+		releaseContext(context);
+		(*volumeWalkers)--;
+	});
+
+	try {
+		buildTree(aPath, aPathLower, aDirectory, aOldDirectory, *context);
+	} catch (const std::bad_alloc&) {
+		LogManager::getInstance()->message(STRING_F(DIR_REFRESH_FAILED, aPath % STRING(OUT_OF_MEMORY)), LogMessage::SEV_ERROR);
+		failed = true;
+	} catch (...) {
+		LogManager::getInstance()->message(STRING_F(DIR_REFRESH_FAILED, aPath % STRING(UNKNOWN_ERROR)), LogMessage::SEV_ERROR);
+		failed = true;
+	}
+}
+
+ShareManager::ShareBuilder::BuildContext* ShareManager::ShareBuilder::getContext() noexcept {
+	Lock l(contextCS);
+	if (freeContexts.empty()) {
+		contexts.push_back(make_unique<BuildContext>());
+		return contexts.back().get();
+	}
+
+	auto ret = freeContexts.back();
+	freeContexts.pop_back();
+	return ret;
+}
+
+void ShareManager::ShareBuilder::releaseContext(BuildContext* aContext) noexcept {
+	Lock l(contextCS);
+	freeContexts.push_back(aContext);
+}
+
+void ShareManager::ShareBuilder::mergeContexts() noexcept {
+	for (const auto& c : contexts) {
+		lowerDirNameMapNew.insert(c->lowerDirNameMap.begin(), c->lowerDirNameMap.end());
+		changedFilePaths.insert(changedFilePaths.end(), c->changedFilePaths.begin(), c->changedFilePaths.end());
+		tthIndexNew.merge(c->tthIndex);
+		searchIndexNew.merge(c->searchIndex);
+		bloom.merge(c->bloom);
+
+		addedSize += c->addedSize;
+		newDirectoriesCount += c->newDirectoriesCount;
+	}
+
+	hashSize += queuedHashSize;
+
+	contexts.clear();
+	freeContexts.clear();
+}
+
+void ShareManager::ShareBuilder::removeEmptyDirectories(const Directory::Ptr& aDirectory) noexcept {
+	// Removing a directory modifies the list of the parent
+	auto directories = aDirectory->getDirectories();
+	for (const auto& d : directories) {
+		removeEmptyDirectories(d);
+		checkContent(d);
+	}
+}
+
+void ShareManager::ShareBuilder::buildTree(const string& aPath, const string& aPathLower, const Directory::Ptr& aParent, const Directory::Ptr& aOldParent, BuildContext& aContext) {
+	// Copy the old content so that the tree doesn't need to be locked for each item
+	Directory::Set oldDirectories;
+	StringSet oldFiles;
+	if (aOldParent) {
+		RLock l(sm.cs);
+		oldDirectories = aOldParent->getDirectories();
+		if (sm.validator->newFileValidationHook.hasSubscribers()) {
+			for (const auto& f : aOldParent->files) {
+				oldFiles.insert(f.getNameLower().to_string());
+			}
+		}
+	}
+
+	// Load the hash information for all files at once instead of performing a database lookup for each file
+	HashManager::DirectoryFileList hashedFiles;
+	HashManager::getInstance()->getDirectoryFiles(aPathLower, hashedFiles);
+
+	// The files are added after the listing has been read
+	PendingFileList files;
+
 	ErrorCollector errors;
 	FileFindIter end;
 	for(FileFindIter i(aPath, "*"); i != end && !sm.stopping; ++i) {
 		const auto name = i->getFileName();
 		if(name.empty()) {
-			return;
+			break;
 		}
 
 		const auto isDirectory = i->isDirectory();
@@ -1495,9 +1860,8 @@ void ShareManager::ShareBuilder::buildTree(const string& aPath, const string& aP
 		if (isDirectory) {
 			Directory::Ptr oldDir = nullptr;
 			if (aOldParent) {
-				RLock l(sm.cs);
-				auto dirIter = aOldParent->getDirectories().find(dualName.getLower());
-				if (dirIter != aOldParent->getDirectories().end()) {
+				auto dirIter = oldDirectories.find(dualName.getLower());
+				if (dirIter != oldDirectories.end()) {
 					oldDir = *dirIter;
 				}
 			}
@@ -1509,13 +1873,19 @@ void ShareManager::ShareBuilder::buildTree(const string& aPath, const string& aP
 					continue;
 				}
 			} else {
-				newDirectoriesCount++;
+				aContext.newDirectoriesCount++;
 			}
 
-			auto curDir = Directory::createNormal(move(dualName), aParent, i->getLastWriteTime(), lowerDirNameMapNew, bloom);
+			auto curDir = Directory::createNormal(move(dualName), aParent, i->getLastWriteTime(), aContext.lowerDirNameMap, aContext.searchIndex, aContext.bloom);
 			if (curDir) {
-				buildTree(curPath, curPathLower, curDir, oldDir);
-				checkContent(curDir);
+				if (startWalker()) {
+					// The content of the new directory is only modified by the task
+					tasks.run([=] {
+						walkDirectoryTask(curPath, curPathLower, curDir, oldDir);
+					});
+				} else {
+					buildTree(curPath, curPathLower, curDir, oldDir, aContext);
+				}
 			}
 		} else {
 			// Not a directory, assume it's a file...
@@ -1524,9 +1894,7 @@ void ShareManager::ShareBuilder::buildTree(const string& aPath, const string& aP
 			if (sm.validator->newFileValidationHook.hasSubscribers()) {
 				auto isNew = !aOldParent;
 				if (aOldParent) {
-					RLock l(sm.cs);
-					auto fileIter = aOldParent->files.find(dualName.getLower());
-					isNew = fileIter != aOldParent->files.end();
+					isNew = oldFiles.find(dualName.getLower()) != oldFiles.end();
 				}
 
 				if (isNew) {
@@ -1539,12 +1907,12 @@ void ShareManager::ShareBuilder::buildTree(const string& aPath, const string& aP
 			}
 
 			try {
-				if (SETTING(MAX_HASH_QUEUE) == 0 || hashSize <= Util::convertSize(SETTING(MAX_HASH_QUEUE), Util::GB)) {
+				if (SETTING(MAX_HASH_QUEUE) == 0 || queuedHashSize <= Util::convertSize(SETTING(MAX_HASH_QUEUE), Util::GB)) {
 					HashedFile fi(i->getLastWriteTime(), size);
-					if(HashManager::getInstance()->checkTTH(aPathLower + dualName.getLower(), aPath + name, fi)) {
-						addFile(move(dualName), aParent, fi, tthIndexNew, bloom, addedSize);
+					if(HashManager::getInstance()->checkTTH(hashedFiles, dualName.getLower(), aPathLower + dualName.getLower(), aPath + name, fi)) {
+						files.emplace_back(move(dualName), fi);
 					} else {
-						hashSize += size;
+						queuedHashSize += size;
 					}
 				} else {
 					LogManager::getInstance()->message(STRING_F(HASHING_QUEUE_LIMIT_REACHED, Util::formatBytes(Util::convertSize(SETTING(MAX_HASH_QUEUE), Util::GB))), LogMessage::SEV_INFO);
@@ -1555,6 +1923,16 @@ void ShareManager::ShareBuilder::buildTree(const string& aPath, const string& aP
 		}
 	}
 
+	addFiles(files, aParent, aContext.tthIndex, aContext.searchIndex, aContext.bloom, aContext.addedSize);
+
+	// The cached filelist XML of the path is kept if the files haven't changed
+	{
+		RLock l(sm.cs);
+		if (!aOldParent || !aParent->hasSameFiles(*aOldParent)) {
+			aContext.changedFilePaths.push_back(aPath);
+		}
+	}
+
 	auto msg = errors.getMessage();
 	if (!msg.empty()) {
 		LogManager::getInstance()->message(STRING_F(SHARE_FILES_BLOCKED, aPath % msg), LogMessage::SEV_INFO);
@@ -1573,12 +1951,6 @@ void ShareManager::checkAddedDirNameDebug(const Directory::Ptr& aDir, Directory:
 	dcassert(findByPath.base() == directories.second);
 }
 
-void ShareManager::checkAddedTTHDebug(const Directory::File* aFile, HashFileMap& aTTHIndex) noexcept {
-	auto flst = aTTHIndex.equal_range(const_cast<TTHValue*>(&aFile->getTTH()));
-	auto p = find(flst | map_values, aFile);
-	dcassert(p.base() == flst.second);
-}
-
 void ShareManager::validateDirectoryTreeDebug() noexcept {
 	OrderedStringSet directories, files;
 
@@ -1595,7 +1967,7 @@ void ShareManager::validateDirectoryTreeDebug() noexcept {
 	StringList filesDiff, directoriesDiff;
 	if (files.size() != tthIndex.size()) {
 		OrderedStringSet indexed;
-		for (const auto& f : tthIndex | map_values) {
+		for (const auto& f : tthIndex) {
 			indexed.insert(f->getRealPath());
 		}
 
@@ -1633,15 +2005,14 @@ void ShareManager::validateDirectoryRecursiveDebug(const Directory::Ptr& aDir, O
 
 	int64_t realDirectorySize = 0;
 	for (const auto& f : aDir->files) {
-		auto flst = tthIndex.equal_range(const_cast<TTHValue*>(&f->getTTH()));
-		dcassert(boost::count_if(flst | map_values, [&](const Directory::File* aFile) {
-			return aFile->getRealPath() == f->getRealPath();
+		dcassert(boost::count_if(tthIndex.equal_range(f.getTTH()), [&](const Directory::File* aFile) {
+			return aFile == &f;
 		}) == 1);
 
-		dcassert(bloom->match(f->name.getLower()));
-		auto res = filePaths_.insert(f->getRealPath());
+		dcassert(bloom->match(f.getNameLower().to_string()));
+		auto res = filePaths_.insert(f.getRealPath());
 		dcassert(res.second);
-		realDirectorySize += f->getSize();
+		realDirectorySize += f.getSize();
 	}
 
 	auto cachedDirectorySize = aDir->getLevelSize();
@@ -1897,6 +2268,7 @@ bool ShareManager::addRootDirectory(const ShareDirectoryInfoPtr& aDirectoryInfo)
 	const auto& path = aDirectoryInfo->path;
 
 	{
+		Lock applyLock(applyCS);
 		WLock l(cs);
 		auto i = rootPaths.find(path);
 		if (i != rootPaths.end()) {
@@ -1905,7 +2277,7 @@ bool ShareManager::addRootDirectory(const ShareDirectoryInfoPtr& aDirectoryInfo)
 			dcassert(find_if(rootPaths | map_keys, IsParentOrExact(path, PATH_SEPARATOR)).base() == rootPaths.end());
 
 			// It's a new parent, will be handled in the task thread
-			Directory::createRoot(path, aDirectoryInfo->virtualName, aDirectoryInfo->profiles, aDirectoryInfo->incoming, File::getLastModified(path), rootPaths, lowerDirNameMap, *bloom.get(), 0);
+			Directory::createRoot(path, aDirectoryInfo->virtualName, aDirectoryInfo->profiles, aDirectoryInfo->incoming, File::getLastModified(path), rootPaths, lowerDirNameMap, searchIndex, *bloom.get(), 0);
 		}
 	}
 
@@ -1925,6 +2297,7 @@ bool ShareManager::removeRootDirectory(const string& aPath) noexcept {
 	ProfileTokenSet dirtyProfiles;
 
 	{
+		Lock applyLock(applyCS);
 		WLock l(cs);
 		auto k = rootPaths.find(aPath);
 		if (k == rootPaths.end()) {
@@ -1938,7 +2311,7 @@ bool ShareManager::removeRootDirectory(const string& aPath) noexcept {
 		rootPaths.erase(k);
 
 		// Remove the root
-		Directory::cleanIndices(*sd, sharedSize, tthIndex, lowerDirNameMap);
+		Directory::cleanIndices(*sd, sharedSize, tthIndex, lowerDirNameMap, searchIndex);
 		File::deleteFile(sd->getRoot()->getCacheXmlPath());
 	}
 
@@ -1969,6 +2342,7 @@ bool ShareManager::updateRootDirectory(const ShareDirectoryInfoPtr& aDirectoryIn
 	ProfileTokenSet dirtyProfiles = aDirectoryInfo->profiles;
 
 	{
+		Lock applyLock(applyCS);
 		WLock l(cs);
 		auto p = rootPaths.find(aDirectoryInfo->path);
 		if (p != rootPaths.end()) {
@@ -1978,9 +2352,9 @@ bool ShareManager::updateRootDirectory(const ShareDirectoryInfoPtr& aDirectoryIn
 			// Make sure that all removed profiles are set dirty as well
 			dirtyProfiles.insert(rootDirectory->getRootProfiles().begin(), rootDirectory->getRootProfiles().end());
 
-			removeDirName(*p->second, lowerDirNameMap);
+			removeDirName(*p->second, lowerDirNameMap, searchIndex);
 			rootDirectory->setName(vName);
-			addDirName(p->second, lowerDirNameMap, *bloom.get());
+			addDirName(p->second, lowerDirNameMap, searchIndex, *bloom.get());
 
 			rootDirectory->setIncoming(aDirectoryInfo->incoming);
 			rootDirectory->setRootProfiles(aDirectoryInfo->profiles);
@@ -2062,10 +2436,10 @@ ShareManager::RefreshInfo::RefreshInfo(const string& aPath, const Directory::Ptr
 	// Use a different directory for building the tree
 	if (aOldShareDirectory && aOldShareDirectory->getRoot()) {
 		newShareDirectory = Directory::createRoot(aPath, aOldShareDirectory->getVirtualName(), aOldShareDirectory->getRoot()->getRootProfiles(), aOldShareDirectory->getRoot()->getIncoming(),
-			aLastWrite, rootPathsNew, lowerDirNameMapNew, bloom_, aOldShareDirectory->getRoot()->getLastRefreshTime());
+			aLastWrite, rootPathsNew, lowerDirNameMapNew, searchIndexNew, bloom_, aOldShareDirectory->getRoot()->getLastRefreshTime());
 	} else {
 		// We'll set the parent later
-		newShareDirectory = Directory::createNormal(Util::getLastDir(aPath), nullptr, aLastWrite, lowerDirNameMapNew, bloom_);
+		newShareDirectory = Directory::createNormal(Util::getLastDir(aPath), nullptr, aLastWrite, lowerDirNameMapNew, searchIndexNew, bloom_);
 	}
 }
 
@@ -2107,12 +2481,22 @@ void ShareManager::runTasks(function<void (float)> progressF /*nullptr*/) noexce
 
 		ShareBloom* refreshBloom = t.first == REFRESH_ALL ? new ShareBloom(1 << 20) : bloom.get();
 
+		auto multithreaded = SETTING(REFRESH_THREADING) == SettingsManager::MULTITHREAD_ALWAYS || (SETTING(REFRESH_THREADING) == SettingsManager::MULTITHREAD_MANUAL && (task->type == TYPE_MANUAL || task->type == TYPE_STARTUP_BLOCKING));
+
 		// Get refresh infos for each path
 		{
+			// Directory walkers running on each volume
+			unordered_map<int64_t, ShareBuilder::VolumeWalkerCounter> volumeWalkers;
+
 			RLock l (cs);
 			for(auto& refreshPath: dirs) {
+				auto& walkers = volumeWalkers[File::getDeviceId(refreshPath)];
+				if (!walkers) {
+					walkers = make_shared<atomic<int>>(0);
+				}
+
 				auto directory = findDirectory(refreshPath);
-				refreshDirs.insert(std::make_shared<ShareBuilder>(refreshPath, directory, File::getLastModified(refreshPath), *refreshBloom, this));
+				refreshDirs.insert(std::make_shared<ShareBuilder>(refreshPath, directory, File::getLastModified(refreshPath), *refreshBloom, this, walkers, multithreaded));
 			}
 		}
 
@@ -2144,7 +2528,6 @@ void ShareManager::runTasks(function<void (float)> progressF /*nullptr*/) noexce
 
 			// Apply the changes
 			if (succeed) {
-				WLock l(cs);
 				applyRefreshChanges(ri, totalHash, &dirtyProfiles);
 			}
 
@@ -2156,7 +2539,7 @@ void ShareManager::runTasks(function<void (float)> progressF /*nullptr*/) noexce
 		};
 
 		try {
-			if (SETTING(REFRESH_THREADING) == SettingsManager::MULTITHREAD_ALWAYS || (SETTING(REFRESH_THREADING) == SettingsManager::MULTITHREAD_MANUAL && (task->type == TYPE_MANUAL || task->type == TYPE_STARTUP_BLOCKING))) {
+			if (multithreaded) {
 				TaskScheduler s;
 				parallel_for_each(refreshDirs.begin(), refreshDirs.end(), doRefresh);
 			} else {
@@ -2188,37 +2571,28 @@ void ShareManager::runTasks(function<void (float)> progressF /*nullptr*/) noexce
 #endif
 }
 
-void ShareManager::RefreshInfo::mergeRefreshChanges(Directory::MultiMap& lowerDirNameMap_, Directory::Map& rootPaths_, HashFileMap& tthIndex_, int64_t& totalHash_, int64_t& totalAdded_, ProfileTokenSet* dirtyProfiles_) noexcept {
-#ifdef _DEBUG
-	for (const auto& d: lowerDirNameMapNew | map_values) {
-		checkAddedDirNameDebug(d, lowerDirNameMap_);
-	}
+bool ShareManager::RefreshInfo::mergeSearchIndex(SearchIndex& searchIndex_, size_t aMaxEntries) noexcept {
+	return searchIndex_.merge(searchIndexNew, aMaxEntries);
+}
 
-	for (const auto& f : tthIndexNew | map_values) {
-		checkAddedTTHDebug(f, tthIndex_);
-	}
+bool ShareManager::RefreshInfo::mergeIndices(Directory::MultiMap& lowerDirNameMap_, HashFileMap& tthIndex_, size_t aMaxEntries) noexcept {
+	size_t merged = 0;
+	for (auto i = lowerDirNameMapNew.begin(); i != lowerDirNameMapNew.end() && merged < aMaxEntries; ++merged) {
+#ifdef _DEBUG
+		// The old directory with the same path is still indexed when refreshing existing directories
+		if (!oldShareDirectory) {
+			checkAddedDirNameDebug(i->second, lowerDirNameMap_);
+		}
 #endif
-
-	lowerDirNameMap_.insert(lowerDirNameMapNew.begin(), lowerDirNameMapNew.end());
-	tthIndex_.insert(tthIndexNew.begin(), tthIndexNew.end());
-
-	for (const auto& rp : rootPathsNew) {
-		//dcassert(rootPaths_.find(rp.first) == rootPaths_.end());
-		rootPaths_[rp.first] = rp.second;
+		lowerDirNameMap_.insert(*i);
+		i = lowerDirNameMapNew.erase(i);
 	}
 
-	totalHash_ += hashSize;
-	totalAdded_ += addedSize;
-
-	if (dirtyProfiles_) {
-		newShareDirectory->copyRootProfiles(*dirtyProfiles_, true);
+	if (merged == aMaxEntries) {
+		return false;
 	}
 
-	// Save some memory
-	lowerDirNameMapNew.clear();
-	tthIndexNew.clear();
-	oldShareDirectory = nullptr;
-	newShareDirectory = nullptr;
+	return tthIndex_.merge(tthIndexNew, aMaxEntries - merged);
 }
 
 void ShareManager::setRefreshState(const string& aRefreshPath, RefreshState aState, bool aUpdateRefreshTime) noexcept {
@@ -2250,51 +2624,137 @@ void ShareManager::setRefreshState(const string& aRefreshPath, RefreshState aSta
 }
 
 bool ShareManager::applyRefreshChanges(RefreshInfo& ri, int64_t& totalHash_, ProfileTokenSet* aDirtyProfiles) {
+	// Other structural changes must wait until the indices have been updated
+	// (everything that modifies the tree or the indices holds this lock)
+	Lock applyLock(applyCS);
+
+	bool linked = true;
 	Directory::Ptr parent = nullptr;
 
-	// Recursively remove the content of this dir from TTHIndex and directory name map
-	if (ri.oldShareDirectory) {
-		// Root removed while refreshing?
-		if (ri.oldShareDirectory->isRoot() && rootPaths.find(ri.path) == rootPaths.end()) {
-			return false;
+	// Find the place for the new directory
+	{
+		WLock l(cs);
+		if (ri.oldShareDirectory) {
+			// Root removed while refreshing?
+			if (ri.oldShareDirectory->isRoot() && rootPaths.find(ri.path) == rootPaths.end()) {
+				return false;
+			}
+
+			parent = ri.oldShareDirectory->getParent();
 		}
 
-		parent = ri.oldShareDirectory->getParent();
+		// Set the parent for refreshed subdirectories
+		// (previous directory should always be available for roots)
+		if (!ri.oldShareDirectory || !ri.oldShareDirectory->isRoot()) {
+			if (!ri.checkContent(ri.newShareDirectory)) {
+				// All content was removed
+				linked = false;
+			} else if (!parent) {
+				// Create new parent
+				parent = getDirectory(Util::getParentDir(ri.path));
+				linked = parent != nullptr;
+			}
+		}
+	}
 
-		// Remove the old directory
-		Directory::cleanIndices(*ri.oldShareDirectory, sharedSize, tthIndex, lowerDirNameMap);
+	// The search index is only used for skipping directories while walking the tree so the new content 
+	// can be indexed before it's linked (the new directories can't be modified by anyone else before that)
+	if (linked) {
+		for (auto merged = false; !merged;) {
+			WLock l(cs);
+			merged = ri.mergeSearchIndex(searchIndex, APPLY_BATCH_SIZE);
+		}
 	}
 
-	// Set the parent for refreshed subdirectories
-	// (previous directory should always be available for roots)
-	if (!ri.oldShareDirectory || !ri.oldShareDirectory->isRoot()) {
-		// All content was removed?
-		if (!ri.checkContent(ri.newShareDirectory)) {
-			return false;
+	// Replace the old directory in the tree
+	{
+		WLock l(cs);
+		if (ri.oldShareDirectory) {
+			// The old content stays indexed (and resolvable) until it has been cleaned below
+			Directory::detach(*ri.oldShareDirectory);
 		}
 
-		if (!parent) {
-			// Create new parent
-			parent = getDirectory(Util::getParentDir(ri.path));
-			if (!parent) {
-				return false;
+		if (linked) {
+			if (parent && !Directory::setParent(ri.newShareDirectory, parent)) {
+				// Nothing has been merged except the search index
+				Directory::setParent(ri.newShareDirectory, nullptr);
+				Directory::cleanIndices(*ri.newShareDirectory, ri.addedSize, ri.tthIndexNew, ri.lowerDirNameMapNew, searchIndex);
+				linked = false;
 			}
 		}
 
-		// Set the parent
-		if (!Directory::setParent(ri.newShareDirectory, parent)) {
-			return false;
+		if (linked) {
+			for (const auto& rp : ri.rootPathsNew) {
+				//dcassert(rootPaths.find(rp.first) == rootPaths.end());
+				rootPaths[rp.first] = rp.second;
+			}
+		}
+
+		for (const auto& p : ri.changedFilePaths) {
+			filelistXmlCache.invalidate(p);
 		}
 	}
 
-	ri.mergeRefreshChanges(lowerDirNameMap, rootPaths, tthIndex, totalHash_, sharedSize, aDirtyProfiles);
-	dcdebug("Share changes applied for the directory %s\n", ri.path.c_str());
-	return true;
+	// Index the new content
+	// The old files are still in the TTH index until the new ones have been added
+	if (linked) {
+		for (auto merged = false; !merged;) {
+			WLock l(cs);
+			merged = ri.mergeIndices(lowerDirNameMap, tthIndex, APPLY_BATCH_SIZE);
+		}
+	}
+
+	// Remove the old content from the indices
+	if (ri.oldShareDirectory) {
+		// Nothing else can access the old tree anymore
+		Directory::List oldDirectories = { ri.oldShareDirectory };
+		for (size_t i = 0; i < oldDirectories.size(); ++i) {
+			const auto& subDirectories = oldDirectories[i]->getDirectories();
+			oldDirectories.insert(oldDirectories.end(), subDirectories.begin(), subDirectories.end());
+		}
+
+		for (auto i = oldDirectories.begin(); i != oldDirectories.end();) {
+			WLock l(cs);
+			for (size_t removed = 0; i != oldDirectories.end() && removed < APPLY_BATCH_SIZE; ++i) {
+				removed += (*i)->files.size() + 1;
+				(*i)->cleanLevelIndices(sharedSize, tthIndex, lowerDirNameMap, searchIndex);
+			}
+		}
+	}
+
+	{
+		WLock l(cs);
+		if (ri.oldShareDirectory) {
+			Directory::setParent(ri.oldShareDirectory, nullptr);
+		}
+
+		if (linked) {
+			sharedSize += ri.addedSize;
+		}
+	}
+
+	if (linked) {
+		totalHash_ += ri.hashSize;
+		if (aDirtyProfiles) {
+			ri.newShareDirectory->copyRootProfiles(*aDirtyProfiles, true);
+		}
+
+		dcdebug("Share changes applied for the directory %s\n", ri.path.c_str());
+	}
+
+	// Save some memory
+	ri.lowerDirNameMapNew.clear();
+	ri.tthIndexNew.clear();
+	ri.searchIndexNew.clear();
+	ri.changedFilePaths.clear();
+	ri.oldShareDirectory = nullptr;
+	ri.newShareDirectory = nullptr;
+	return linked;
 }
 
 void ShareManager::on(TimerManagerListener::Minute, uint64_t aTick) noexcept {
 	if(lastSave == 0 || lastSave + 15*60*1000 <= aTick) {
-		saveXmlList();
+		saveShareCache();
 	}
 
 	if(SETTING(AUTO_REFRESH_TIME) > 0 && lastFullUpdate + SETTING(AUTO_REFRESH_TIME) * 60 * 1000 <= aTick) {
@@ -2348,8 +2808,8 @@ ShareDirectoryInfoList ShareManager::getRootInfos() const noexcept {
 		
 void ShareManager::getBloom(HashBloom& bloom_) const noexcept {
 	RLock l(cs);
-	for(const auto tth: tthIndex | map_keys)
-		bloom_.add(*tth);
+	for(const auto& f: tthIndex)
+		bloom_.add(f->getTTH());
 
 	for(const auto& tth: tempShares | map_keys)
 		bloom_.add(tth);
@@ -2392,17 +2852,34 @@ FileList* ShareManager::generateXmlList(ProfileToken aProfile, bool forced /*fal
 				{
 					File f(tmpName, File::RW, File::TRUNCATE | File::CREATE, File::BUFFER_SEQUENTIAL, false);
 
-					toFilelist(f, ADC_ROOT_STR, aProfile, true);
+					// Only the serialization needs the share lock (taken by toFilelist), don't hold it while compressing
+					{
+						// The XML is generated in small pieces so write it in bigger chunks
+						BufferedOutputStream<false> xmlBuffer(&f, 256 * 1024);
+						toFilelist(xmlBuffer, ADC_ROOT_STR, aProfile, true);
+						xmlBuffer.flushBuffers(false);
+					}
 
 					fl->setXmlListLen(f.getSize());
 
 					File bz(fl->getFileName(), File::WRITE, File::TRUNCATE | File::CREATE, File::BUFFER_SEQUENTIAL, false);
 					// We don't care about the leaves...
 					CalcOutputStream<TTFilter<1024 * 1024 * 1024>, false> bzTree(&bz);
-					FilteredOutputStream<BZFilter, false> bzipper(&bzTree);
+					FilteredOutputStream<ParallelBZFilter, false> bzipper(&bzTree);
 					CalcOutputStream<TTFilter<1024 * 1024 * 1024>, false> newXmlFile(&bzipper);
 
-					newXmlFile.write(f.read());
+					// Pass the XML to the filters in chunks without reading all of it in memory
+					f.setPos(0);
+					ByteVector buf(256 * 1024);
+					for (;;) {
+						size_t len = buf.size();
+						f.read(&buf[0], len);
+						if (len == 0) {
+							break;
+						}
+
+						newXmlFile.write(&buf[0], len);
+					}
 					newXmlFile.flushBuffers(false);
 
 					newXmlFile.getFilter().getTree().finalize();
@@ -2421,6 +2898,7 @@ FileList* ShareManager::generateXmlList(ProfileToken aProfile, bool forced /*fal
 
 				// do we have anything to send?
 				if (fl->getCurrentNumber() == 0) {
+					File::deleteFile(tmpName);
 					throw ShareException(UserConnection::FILE_NOT_AVAILABLE);
 				}
 			}
@@ -2492,9 +2970,9 @@ void ShareManager::toFilelist(OutputStream& os_, const string& aVirtualPath, con
 		"\" Generator=\"" + shortVersionString + "\">\r\n");
 
 	for (const auto ld : listRoot.listDirs | map_values) {
-		ld->toXml(os_, indent, tmp, aRecursive);
+		ld->toXml(os_, indent, tmp, aRecursive, filelistXmlCache);
 	}
-	listRoot.filesToXml(os_, indent, tmp, !aRecursive);
+	listRoot.filesToXml(os_, indent, tmp, !aRecursive, filelistXmlCache);
 
 	os_.write("</FileListing>");
 }
@@ -2526,7 +3004,7 @@ ShareManager::FilelistDirectory::~FilelistDirectory() {
 }
 
 #define LITERAL(n) n, sizeof(n)-1
-void ShareManager::FilelistDirectory::toXml(OutputStream& xmlFile, string& indent, string& tmp2, bool aRecursive) const {
+void ShareManager::FilelistDirectory::toXml(OutputStream& xmlFile, string& indent, string& tmp2, bool aRecursive, FilelistXmlCache& xmlCache_) const {
 	xmlFile.write(indent);
 	xmlFile.write(LITERAL("<Directory Name=\""));
 	xmlFile.write(SimpleXML::escape(name, tmp2, true));
@@ -2538,10 +3016,10 @@ void ShareManager::FilelistDirectory::toXml(OutputStream& xmlFile, string& inden
 
 		indent += '\t';
 		for(const auto& d: listDirs | map_values) {
-			d->toXml(xmlFile, indent, tmp2, aRecursive);
+			d->toXml(xmlFile, indent, tmp2, aRecursive, xmlCache_);
 		}
 
-		filesToXml(xmlFile, indent, tmp2, !aRecursive);
+		filesToXml(xmlFile, indent, tmp2, !aRecursive, xmlCache_);
 
 		indent.erase(indent.length()-1);
 		xmlFile.write(indent);
@@ -2576,15 +3054,20 @@ void ShareManager::FilelistDirectory::toXml(OutputStream& xmlFile, string& inden
 	}
 }
 
-void ShareManager::FilelistDirectory::filesToXml(OutputStream& xmlFile, string& indent, string& tmp2, bool addDate) const {
+void ShareManager::FilelistDirectory::filesToXml(OutputStream& xmlFile, string& indent, string& tmp2, bool addDate, FilelistXmlCache& xmlCache_) const {
+	if (shareDirs.size() == 1 && !addDate) {
+		shareDirs.front()->filesToFilelistXml(xmlFile, indent, tmp2, xmlCache_);
+		return;
+	}
+
 	bool filesAdded = false;
 	int dupeFiles = 0;
 	for(auto di = shareDirs.begin(); di != shareDirs.end(); ++di) {
 		if (filesAdded) {
 			for(const auto& fi: (*di)->files) {
 				//go through the dirs that we have added already
-				if (none_of(shareDirs.begin(), di, [&fi](const Directory::Ptr& d) { return d->files.find(fi->name.getLower()) != d->files.end(); })) {
-					fi->toXml(xmlFile, indent, tmp2, addDate);
+				if (none_of(shareDirs.begin(), di, [&fi](const Directory::Ptr& d) { return d->files.find(fi.getNameLower()) != d->files.end(); })) {
+					fi.toXml(xmlFile, indent, tmp2, addDate);
 				} else {
 					dupeFiles++;
 				}
@@ -2592,7 +3075,7 @@ void ShareManager::FilelistDirectory::filesToXml(OutputStream& xmlFile, string&
 		} else if (!(*di)->files.empty()) {
 			filesAdded = true;
 			for(const auto& f: (*di)->files)
-				f->toXml(xmlFile, indent, tmp2, addDate);
+				f.toXml(xmlFile, indent, tmp2, addDate);
 		}
 	}
 
@@ -2605,28 +3088,157 @@ void ShareManager::FilelistDirectory::filesToXml(OutputStream& xmlFile, string&
 	}
 }
 
-void ShareManager::Directory::filesToXmlList(OutputStream& xmlFile, string& indent, string& tmp2) const {
-	for(const auto& f: files) {
-		xmlFile.write(indent);
-		xmlFile.write(LITERAL("<File Name=\""));
-		xmlFile.write(SimpleXML::escape(f->name.lowerCaseOnly() ? f->name.getLower() : f->name.getNormal(), tmp2, true));
-		xmlFile.write(LITERAL("\"/>\r\n"));
+void ShareManager::Directory::filesToFilelistXml(OutputStream& xmlFile, string& indent, string& tmp2, FilelistXmlCache& xmlCache_) const {
+	if (files.empty()) {
+		return;
 	}
+
+	// Recursive partial lists start from a different level so the indentation may not match
+	auto path = getRealPath();
+	auto xml = xmlCache_.get(path, indent.length());
+	if (!xml) {
+		string newXml;
+		{
+			StringOutputStream sos(newXml);
+			for (const auto& f : files) {
+				f.toXml(sos, indent, tmp2, false);
+			}
+		}
+
+		xml = make_shared<const string>(move(newXml));
+		xmlCache_.put(path, indent.length(), xml);
+	}
+
+	xmlFile.write(*xml);
+}
+
+bool ShareManager::Directory::hasSameFiles(const Directory& aOther) const noexcept {
+	// Both sets are sorted by the lowercase name
+	return equal(files.begin(), files.end(), aOther.files.begin(), aOther.files.end(), [](const File& a, const File& b) {
+		return a.hasSameName(b) && a.getSize() == b.getSize() && 
+			a.getLastWrite() == b.getLastWrite() && a.getTTH() == b.getTTH();
+	});
 }
 
-ShareManager::Directory::File::File(DualString&& aName, const Directory::Ptr& aParent, const HashedFile& aFileInfo) : 
-	size(aFileInfo.getSize()), parent(aParent.get()), tth(aFileInfo.getRoot()), lastWrite(aFileInfo.getTimeStamp()), name(move(aName)) {
+shared_ptr<const string> ShareManager::FilelistXmlCache::get(const string& aPath, size_t aIndentLength) noexcept {
+	Lock l(cs);
+	auto i = entries.find(aPath);
+	if (i == entries.end() || i->second.indentLength != aIndentLength) {
+		return nullptr;
+	}
+
+	lru.splice(lru.begin(), lru, i->second.lruPos);
+	return i->second.xml;
+}
+
+void ShareManager::FilelistXmlCache::put(const string& aPath, size_t aIndentLength, const shared_ptr<const string>& aXml) noexcept {
+	if (aXml->size() > maxSize) {
+		return;
+	}
+
+	Lock l(cs);
+	auto i = entries.find(aPath);
+	if (i != entries.end()) {
+		removeEntry(i);
+	}
+
+	lru.push_front(aPath);
+	entries.emplace(aPath, Entry({ aIndentLength, aXml, lru.begin() }));
+	totalSize += aXml->size();
+
+	while (totalSize > maxSize) {
+		removeEntry(entries.find(lru.back()));
+	}
+}
+
+void ShareManager::FilelistXmlCache::invalidate(const string& aPath) noexcept {
+	Lock l(cs);
+	auto i = entries.find(aPath);
+	if (i != entries.end()) {
+		removeEntry(i);
+	}
+}
+
+void ShareManager::FilelistXmlCache::removeEntry(unordered_map<string, Entry>::iterator aEntry) noexcept {
+	totalSize -= aEntry->second.xml->size();
+	lru.erase(aEntry->second.lruPos);
+	entries.erase(aEntry);
+}
+
+ShareManager::Directory::File::File(Directory* aParent, const HashedFile& aFileInfo) noexcept : 
+	size(aFileInfo.getSize()), parent(aParent), tth(aFileInfo.getRoot()), lastWrite(aFileInfo.getTimeStamp()), nameLength(0), hasCaseMask(0) {
 	
 }
 
-ShareManager::Directory::File::~File() {
+boost::string_ref ShareManager::Directory::File::getNameLower() const noexcept {
+	return boost::string_ref(parent->fileNames.data() + nameOffset, nameLength);
+}
 
+string ShareManager::Directory::File::getName() const noexcept {
+	auto name = parent->fileNames.data() + nameOffset;
+	if (!hasCaseMask) {
+		return string(name, nameLength);
+	}
+
+	return DualString::getNormal(name, nameLength, reinterpret_cast<const uint8_t*>(name + nameLength));
+}
+
+bool ShareManager::Directory::File::hasSameName(const File& aOther) const noexcept {
+	if (nameLength != aOther.nameLength || hasCaseMask != aOther.hasCaseMask) {
+		return false;
+	}
+
+	// Compare the lowercase names and the case masks
+	auto len = hasCaseMask ? nameLength + DualString::getCaseMaskSize(nameLength) : nameLength;
+	return parent->fileNames.compare(nameOffset, len, aOther.parent->fileNames, aOther.nameOffset, len) == 0;
+}
+
+size_t ShareManager::Directory::getFileNameSize(const DualString& aName) noexcept {
+	return aName.size() + (aName.lowerCaseOnly() ? 0 : DualString::getCaseMaskSize(aName.size()));
+}
+
+void ShareManager::Directory::setFileName(File& aFile, const DualString& aName) noexcept {
+	const auto& nameLower = aName.getLower();
+	auto storedSize = getFileNameSize(aName);
+
+	// Only the case may differ when replacing the name of an existing file
+	auto oldSize = aFile.hasCaseMask ? aFile.nameLength + DualString::getCaseMaskSize(aFile.nameLength) : aFile.nameLength;
+	if (aFile.nameLength != nameLower.size() || storedSize > oldSize) {
+		aFile.nameOffset = static_cast<uint32_t>(fileNames.size());
+		fileNames.resize(fileNames.size() + storedSize);
+	}
+
+	auto pos = &fileNames[aFile.nameOffset];
+	memcpy(pos, nameLower.data(), nameLower.size());
+	if (!aName.lowerCaseOnly()) {
+		aName.getCaseMask(reinterpret_cast<uint8_t*>(pos + nameLower.size()));
+	}
+
+	aFile.nameLength = static_cast<uint32_t>(nameLower.size());
+	aFile.hasCaseMask = !aName.lowerCaseOnly();
+}
+
+void ShareManager::Directory::reserveFiles(size_t aCount, size_t aNameBytes, File::TTHMap& tthIndex_) noexcept {
+	if (aCount > files.capacity()) {
+		// The files are moved in memory
+		for (const auto& f : files) {
+			tthIndex_.remove(&f);
+		}
+
+		files.reserve(aCount);
+
+		for (const auto& f : files) {
+			tthIndex_.add(&f);
+		}
+	}
+
+	fileNames.reserve(fileNames.size() + aNameBytes);
 }
 
 void ShareManager::Directory::File::toXml(OutputStream& xmlFile, string& indent, string& tmp2, bool addDate) const {
 	xmlFile.write(indent);
 	xmlFile.write(LITERAL("<File Name=\""));
-	xmlFile.write(SimpleXML::escape(name.lowerCaseOnly() ? name.getLower() : name.getNormal(), tmp2, true));
+	xmlFile.write(SimpleXML::escape(getName(), tmp2, true));
 	xmlFile.write(LITERAL("\" Size=\""));
 	xmlFile.write(Util::toString(size));
 	xmlFile.write(LITERAL("\" TTH=\""));
@@ -2644,18 +3256,77 @@ string ShareManager::RootDirectory::getCacheXmlPath() const noexcept {
 	return Util::getPath(Util::PATH_SHARECACHE) + "ShareCache_" + Util::validateFileName(path) + ".xml";
 }
 
+string ShareManager::RootDirectory::getCachePath() const noexcept {
+	return Util::getPath(Util::PATH_SHARECACHE) + "ShareCache_" + Util::validateFileName(path) + ".bin";
+}
+
 void ShareManager::RootDirectory::setName(const string& aName) noexcept {
 	virtualName.reset(new DualString(aName));
 }
 
 #define LITERAL(n) n, sizeof(n)-1
 
-void ShareManager::saveXmlList(function<void(float)> progressF /*nullptr*/) noexcept {
+void ShareManager::saveBinaryCache(const Directory::Ptr& aRoot) {
+	string path = aRoot->getRoot()->getCachePath();
+
+	{
+		//create a backup first in case we get interrupted on creation.
+		File ff(path + ".tmp", File::WRITE, File::TRUNCATE | File::CREATE);
+		BufferedOutputStream<false> cacheFile(&ff);
+
+		writeCacheValue<uint32_t>(cacheFile, SHARE_CACHE_MAGIC);
+		writeCacheValue<uint32_t>(cacheFile, SHARE_CACHE_BINARY_VERSION);
+		writeCacheString(cacheFile, aRoot->getRoot()->getPath());
+		writeCacheValue<int64_t>(cacheFile, aRoot->getLastWrite());
+
+		aRoot->toCache(cacheFile);
 
-	if(xml_saving)
+		writeCacheValue<uint8_t>(cacheFile, CACHE_TAG_END);
+		cacheFile.flushBuffers(false);
+	}
+
+	File::deleteFile(path);
+	File::renameFile(path + ".tmp", path);
+}
+
+void ShareManager::saveXmlCache(const Directory::Ptr& aRoot) {
+	string path = aRoot->getRoot()->getCacheXmlPath();
+
+	{
+		string indent, tmp;
+
+		//create a backup first in case we get interrupted on creation.
+		File ff(path + ".tmp", File::WRITE, File::TRUNCATE | File::CREATE);
+		BufferedOutputStream<false> xmlFile(&ff);
+
+		xmlFile.write(SimpleXML::utf8Header);
+		xmlFile.write(LITERAL("<Share Version=\"" SHARE_CACHE_VERSION));
+		xmlFile.write(LITERAL("\" Path=\""));
+		xmlFile.write(SimpleXML::escape(aRoot->getRoot()->getPath(), tmp, true));
+
+		xmlFile.write(LITERAL("\" Date=\""));
+		xmlFile.write(SimpleXML::escape(Util::toString(aRoot->getLastWrite()), tmp, true));
+		xmlFile.write(LITERAL("\">\r\n"));
+		indent += '\t';
+
+		for (const auto& child : aRoot->getDirectories()) {
+			child->toXmlList(xmlFile, indent, tmp);
+		}
+		aRoot->filesToXmlList(xmlFile, indent, tmp);
+
+		xmlFile.write(LITERAL("</Share>"));
+	}
+
+	File::deleteFile(path);
+	File::renameFile(path + ".tmp", path);
+}
+
+void ShareManager::saveShareCache(function<void(float)> progressF /*nullptr*/) noexcept {
+
+	if(cache_saving)
 		return;
 
-	xml_saving = true;
+	cache_saving = true;
 
 	if (progressF)
 		progressF(0);
@@ -2669,37 +3340,17 @@ void ShareManager::saveXmlList(function<void(float)> progressF /*nullptr*/) noex
 
 		try {
 			parallel_for_each(dirtyDirs.begin(), dirtyDirs.end(), [&](const Directory::Ptr& d) {
-				string path = d->getRoot()->getCacheXmlPath();
 				try {
-					{
-						string indent, tmp;
-
-						//create a backup first in case we get interrupted on creation.
-						File ff(path + ".tmp", File::WRITE, File::TRUNCATE | File::CREATE);
-						BufferedOutputStream<false> xmlFile(&ff);
-
-						xmlFile.write(SimpleXML::utf8Header);
-						xmlFile.write(LITERAL("<Share Version=\"" SHARE_CACHE_VERSION));
-						xmlFile.write(LITERAL("\" Path=\""));
-						xmlFile.write(SimpleXML::escape(d->getRoot()->getPath(), tmp, true));
-
-						xmlFile.write(LITERAL("\" Date=\""));
-						xmlFile.write(SimpleXML::escape(Util::toString(d->getLastWrite()), tmp, true));
-						xmlFile.write(LITERAL("\">\r\n"));
-						indent += '\t';
-
-						for (const auto& child : d->getDirectories()) {
-							child->toXmlList(xmlFile, indent, tmp);
-						}
-						d->filesToXmlList(xmlFile, indent, tmp);
-
-						xmlFile.write(LITERAL("</Share>"));
-					}
+					saveBinaryCache(d);
+				} catch (Exception& e) {
+					LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, d->getRoot()->getCachePath() % e.getError()), LogMessage::SEV_WARNING);
+				}
 
-					File::deleteFile(path);
-					File::renameFile(path + ".tmp", path);
+				// Only loaded by the versions without the binary cache so that the share won't need to be rehashed after downgrading
+				try {
+					saveXmlCache(d);
 				} catch (Exception& e) {
-					LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, path % e.getError()), LogMessage::SEV_WARNING);
+					LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, d->getRoot()->getCacheXmlPath() % e.getError()), LogMessage::SEV_WARNING);
 				}
 
 				d->getRoot()->setCacheDirty(false);
@@ -2713,11 +3364,11 @@ void ShareManager::saveXmlList(function<void(float)> progressF /*nullptr*/) noex
 		}
 	}
 
-	xml_saving = false;
+	cache_saving = false;
 	lastSave = GET_TICK();
 }
 
-void ShareManager::Directory::toXmlList(OutputStream& xmlFile, string& indent, string& tmp) {
+void ShareManager::Directory::toXmlList(OutputStream& xmlFile, string& indent, string& tmp) const {
 	xmlFile.write(indent);
 	xmlFile.write(LITERAL("<Directory Name=\""));
 	xmlFile.write(SimpleXML::escape(realName.lowerCaseOnly() ? realName.getLower() : realName.getNormal(), tmp, true));
@@ -2738,6 +3389,35 @@ void ShareManager::Directory::toXmlList(OutputStream& xmlFile, string& indent, s
 	xmlFile.write(LITERAL("</Directory>\r\n"));
 }
 
+void ShareManager::Directory::filesToXmlList(OutputStream& xmlFile, string& indent, string& tmp2) const {
+	for(const auto& f: files) {
+		xmlFile.write(indent);
+		xmlFile.write(LITERAL("<File Name=\""));
+		xmlFile.write(SimpleXML::escape(f.getName(), tmp2, true));
+		xmlFile.write(LITERAL("\"/>\r\n"));
+	}
+}
+
+void ShareManager::Directory::toCache(OutputStream& os_) const {
+	for (const auto& f : files) {
+		writeCacheValue<uint8_t>(os_, CACHE_TAG_FILE);
+		writeCacheString(os_, f.getName());
+		writeCacheValue<int64_t>(os_, f.getSize());
+		writeCacheValue<uint64_t>(os_, f.getLastWrite());
+		os_.write(f.getTTH().data, TTHValue::BYTES);
+	}
+
+	for (const auto& d : directories) {
+		writeCacheValue<uint8_t>(os_, CACHE_TAG_DIRECTORY);
+		writeCacheString(os_, d->realName.lowerCaseOnly() ? d->realName.getLower() : d->realName.getNormal());
+		writeCacheValue<int64_t>(os_, d->getLastWrite());
+
+		d->toCache(os_);
+
+		writeCacheValue<uint8_t>(os_, CACHE_TAG_DIRECTORY_END);
+	}
+}
+
 MemoryInputStream* ShareManager::generateTTHList(const string& dir, bool recurse, ProfileToken aProfile) const noexcept {
 	
 	if(aProfile == SP_HIDDEN)
@@ -2776,7 +3456,7 @@ void ShareManager::Directory::toTTHList(OutputStream& tthList, string& tmp2, boo
 
 	for(const auto& f: files) {
 		tmp2.clear();
-		tthList.write(f->getTTH().toBase32(tmp2));
+		tthList.write(f.getTTH().toBase32(tmp2));
 		tthList.write(LITERAL(" "));
 	}
 }
@@ -2841,12 +3521,72 @@ void ShareManager::nmdcSearch(SearchResultList& l, const string& nmdcString, int
 * but not the parents...
 */
 
-void ShareManager::Directory::search(SearchResultInfo::Set& results_, SearchQuery& aStrings, int aLevel) const noexcept{
+bool ShareManager::Directory::SearchCandidates::resolve(const SearchIndex& aIndex, const SearchQuery& aSearch) noexcept {
+	const auto& patterns = aSearch.include.getPatterns();
+	if (patterns.empty() || patterns.size() > sizeof(PatternMask) * 8) {
+		return false;
+	}
+
+	matches.resize(patterns.size());
+	paths.resize(patterns.size());
+	for (size_t i = 0; i < patterns.size(); ++i) {
+		allPatterns |= static_cast<PatternMask>(1) << i;
+		if (!aIndex.getItems(patterns[i].str(), matches[i])) {
+			// Pattern is too short, everything will match
+			unindexedPatterns |= static_cast<PatternMask>(1) << i;
+			continue;
+		}
+
+		// Parents must be walked through as well
+		for (const auto& d : matches[i]) {
+			for (auto cur = d; cur && paths[i].insert(cur).second; cur = cur->getParent()) {
+				//
+			}
+		}
+	}
+
+	// Parent directory names are used for matching only with partial path searches
+	inheritParentMatches = aSearch.matchType == Search::MATCH_PATH_PARTIAL;
+	return unindexedPatterns != allPatterns;
+}
+
+ShareManager::Directory::SearchCandidates::PatternMask ShareManager::Directory::SearchCandidates::getMatches(const Directory* aDir) const noexcept {
+	auto ret = unindexedPatterns;
+	for (size_t i = 0; i < matches.size(); ++i) {
+		if (matches[i].find(aDir) != matches[i].end()) {
+			ret |= static_cast<PatternMask>(1) << i;
+		}
+	}
+
+	return ret;
+}
+
+bool ShareManager::Directory::SearchCandidates::hasCandidates(const Directory* aDir, PatternMask aCovered) const noexcept {
+	for (size_t i = 0; i < paths.size(); ++i) {
+		if ((aCovered & (static_cast<PatternMask>(1) << i)) == 0 && paths[i].find(aDir) == paths[i].end()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void ShareManager::Directory::search(SearchResultInfo::Set& results_, SearchQuery& aStrings, int aLevel, const SearchCandidates* aCandidates, SearchCandidates::PatternMask aCovered) const noexcept{
 	const auto& dirName = getVirtualNameLower();
 	if (aStrings.isExcludedLower(dirName)) {
 		return;
 	}
 
+	// Files can match only if all patterns are contained in this directory (or in parents for path searches)
+	bool matchFiles = true;
+	if (aCandidates) {
+		aCovered |= aCandidates->getMatches(this);
+		matchFiles = aCovered == aCandidates->getAllPatterns();
+		if (!aCandidates->inheritMatches()) {
+			aCovered = aCandidates->getUnindexedPatterns();
+		}
+	}
+
 	auto old = aStrings.recursion;
 
 	unique_ptr<SearchQuery::Recursion> rec = nullptr;
@@ -2890,13 +3630,17 @@ void ShareManager::Directory::search(SearchResultInfo::Set& results_, SearchQuer
 	}
 
 	// Match files
-	if(aStrings.itemType != SearchQuery::TYPE_DIRECTORY) {
+	if(aStrings.itemType != SearchQuery::TYPE_DIRECTORY && matchFiles) {
+		// The names are matched as strings
+		string nameLower;
 		for(const auto& f: files) {
-			if (!aStrings.matchesFileLower(f->name.getLower(), f->getSize(), f->getLastWrite())) {
+			auto name = f.getNameLower();
+			nameLower.assign(name.data(), name.size());
+			if (!aStrings.matchesFileLower(nameLower, f.getSize(), f.getLastWrite())) {
 				continue;
 			}
 
-			results_.insert(Directory::SearchResultInfo(f, aStrings, aLevel));
+			results_.insert(Directory::SearchResultInfo(&f, aStrings, aLevel));
 			if (aStrings.addParents)
 				break;
 		}
@@ -2904,7 +3648,11 @@ void ShareManager::Directory::search(SearchResultInfo::Set& results_, SearchQuer
 
 	// Match directories
 	for(const auto& d: directories) {
-		d->search(results_, aStrings, aLevel);
+		if (aCandidates && !aCandidates->hasCandidates(d.get(), aCovered)) {
+			continue;
+		}
+
+		d->search(results_, aStrings, aLevel, aCandidates, aCovered);
 	}
 
 	// Moving to a lower level
@@ -2926,8 +3674,7 @@ void ShareManager::adcSearch(SearchResultList& results, SearchQuery& srch, const
 	RLock l(cs);
 	if(srch.root) {
 		tthSearches++;
-		const auto i = tthIndex.equal_range(const_cast<TTHValue*>(&(*srch.root)));
-		for(auto& f: i | map_values) {
+		for(const auto& f: tthIndex.equal_range(*srch.root)) {
 			if (f->hasProfile(aProfile) && AirUtil::isParentOrExactAdc(aDir, f->getAdcPath())) {
 				f->addSR(results, srch.addParents);
 				return;
@@ -2966,10 +3713,21 @@ void ShareManager::adcSearch(SearchResultList& results, SearchQuery& srch, const
 
 	auto start = GET_TICK();
 
+	// Skip the directories that can't contain matches
+	Directory::SearchCandidates candidates;
+	auto useIndex = candidates.resolve(searchIndex, srch);
+	if (useIndex) {
+		indexedSearches++;
+	}
+
 	// go them through recursively
 	Directory::SearchResultInfo::Set resultInfos;
 	for (const auto& d: roots) {
-		d->search(resultInfos, srch, 0);
+		if (useIndex && !candidates.hasCandidates(d.get(), candidates.getUnindexedPatterns())) {
+			continue;
+		}
+
+		d->search(resultInfos, srch, 0, useIndex ? &candidates : nullptr, candidates.getUnindexedPatterns());
 	}
 
 	// update statistics
@@ -2994,17 +3752,20 @@ void ShareManager::adcSearch(SearchResultList& results, SearchQuery& srch, const
 		recursiveSearchesResponded++;
 }
 
-void ShareManager::addDirName(const Directory::Ptr& aDir, Directory::MultiMap& aDirNames, ShareBloom& aBloom) noexcept {
+void ShareManager::addDirName(const Directory::Ptr& aDir, Directory::MultiMap& aDirNames, SearchIndex& aSearchIndex, ShareBloom& aBloom) noexcept {
 	const auto& nameLower = aDir->getVirtualNameLower();
 
 #ifdef _DEBUG
 	checkAddedDirNameDebug(aDir, aDirNames);
 #endif
 	aDirNames.emplace(const_cast<string*>(&nameLower), aDir);
+	aSearchIndex.add(aDir.get(), nameLower);
 	aBloom.add(nameLower);
 }
 
-void ShareManager::removeDirName(const Directory& aDir, Directory::MultiMap& aDirNames) noexcept {
+void ShareManager::removeDirName(const Directory& aDir, Directory::MultiMap& aDirNames, SearchIndex& aSearchIndex) noexcept {
+	aSearchIndex.remove(&aDir, aDir.getVirtualNameLower());
+
 	auto directories = aDirNames.equal_range(const_cast<string*>(&aDir.getVirtualNameLower()));
 	auto p = find_if(directories | map_values, [&aDir](const Directory::Ptr& d) { return d.get() == &aDir; });
 	if (p.base() == aDirNames.end()) {
@@ -3112,7 +3873,7 @@ ShareManager::Directory::Ptr ShareManager::getDirectory(const string& aRealPath)
 	// Tokens should have been validated earlier
 	for (const auto& curName : tokens) {
 		curDir->updateModifyDate();
-		curDir = Directory::createNormal(DualString(curName), curDir, File::getLastModified(curDir->getRealPath()), lowerDirNameMap, *bloom.get());
+		curDir = Directory::createNormal(DualString(curName), curDir, File::getLastModified(curDir->getRealPath()), lowerDirNameMap, searchIndex, *bloom.get());
 	}
 
 	return curDir;
@@ -3127,37 +3888,79 @@ ShareManager::Directory::Ptr ShareManager::findDirectory(const string& aRealPath
 void ShareManager::onFileHashed(const string& fname, HashedFile& fileInfo) noexcept {
 	ProfileTokenSet dirtyProfiles;
 	{
+		Lock applyLock(applyCS);
 		WLock l(cs);
 		auto d = getDirectory(Util::getFilePath(fname));
 		if (!d) {
 			return;
 		}
 
-		addFile(Util::getFileName(fname), d, fileInfo, tthIndex, *bloom.get(), sharedSize, &dirtyProfiles);
+		addFile(Util::getFileName(fname), d, fileInfo, tthIndex, searchIndex, *bloom.get(), sharedSize, &dirtyProfiles);
+		filelistXmlCache.invalidate(d->getRealPath());
 	}
 
 	setProfilesDirty(dirtyProfiles, false);
 }
 
-void ShareManager::addFile(DualString&& aName, const Directory::Ptr& aDir, const HashedFile& aFileInfo, HashFileMap& tthIndex_, ShareBloom& aBloom_, int64_t& sharedSize_, ProfileTokenSet* dirtyProfiles_) noexcept {
-	{
-		auto i = aDir->files.find(aName.getLower());
-		if (i != aDir->files.end()) {
-			// Get rid of false constness...
-			(*i)->cleanIndices(sharedSize_, tthIndex_);
-			delete *i;
-			aDir->files.erase(i);
+void ShareManager::addFile(const DualString& aName, const Directory::Ptr& aDir, const HashedFile& aFileInfo, HashFileMap& tthIndex_, SearchIndex& searchIndex_, ShareBloom& aBloom_, int64_t& sharedSize_, ProfileTokenSet* dirtyProfiles_) noexcept {
+	auto& files = aDir->files;
+	auto i = lower_bound(files.begin(), files.end(), aName.getLower(), [](const Directory::File& aFile, const string& aNameLower) {
+		return aFile.getNameLower().compare(aNameLower) < 0;
+	});
+
+	if (i != files.end() && i->getNameLower() == aName.getLower()) {
+		// Replace the existing file
+		i->cleanIndices(sharedSize_, tthIndex_, searchIndex_);
+		i->setSize(aFileInfo.getSize());
+		i->setLastWrite(aFileInfo.getTimeStamp());
+		i->setTTH(aFileInfo.getRoot());
+	} else {
+		// The following files are moved in memory (or all files if there is no space left)
+		auto pos = i - files.begin();
+		auto firstMoved = files.size() == files.capacity() ? 0 : pos;
+		for (auto f = files.begin() + firstMoved; f != files.end(); ++f) {
+			tthIndex_.remove(&*f);
+		}
+
+		i = files.insert(i, Directory::File(aDir.get(), aFileInfo));
+		for (auto f = files.begin() + firstMoved; f != files.end(); ++f) {
+			if (f != i) {
+				tthIndex_.add(&*f);
+			}
 		}
 	}
 
-	auto it = aDir->files.insert_sorted(new Directory::File(move(aName), aDir, aFileInfo)).first;
-	(*it)->updateIndices(aBloom_, sharedSize_, tthIndex_);
+	aDir->setFileName(*i, aName);
+	i->updateIndices(aBloom_, sharedSize_, tthIndex_, searchIndex_);
 
 	if (dirtyProfiles_) {
 		aDir->copyRootProfiles(*dirtyProfiles_, true);
 	}
 }
 
+void ShareManager::addFiles(PendingFileList& aFiles, const Directory::Ptr& aDir, HashFileMap& tthIndex_, SearchIndex& searchIndex_, ShareBloom& aBloom_, int64_t& sharedSize_) noexcept {
+	if (aFiles.empty()) {
+		return;
+	}
+
+	// Sorted files are appended after the existing ones
+	sort(aFiles.begin(), aFiles.end(), [](const PendingFileList::value_type& a, const PendingFileList::value_type& b) {
+		return a.first.getLower() < b.first.getLower();
+	});
+
+	size_t nameBytes = 0;
+	for (const auto& f : aFiles) {
+		nameBytes += Directory::getFileNameSize(f.first);
+	}
+
+	aDir->reserveFiles(aDir->files.size() + aFiles.size(), nameBytes, tthIndex_);
+	for (auto& f : aFiles) {
+		addFile(f.first, aDir, f.second, tthIndex_, searchIndex_, aBloom_, sharedSize_);
+	}
+
+	aFiles.clear();
+}
+
 ShareProfileList ShareManager::getProfiles() const noexcept {
 	RLock l(cs);
 	return shareProfiles; 
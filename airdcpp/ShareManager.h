@@ -26,6 +26,7 @@
 #include "TimerManagerListener.h"
 
 #include "BloomFilter.h"
+#include "concurrency.h"
 #include "CriticalSection.h"
 #include "DualString.h"
 #include "DupeType.h"
@@ -37,6 +38,8 @@
 #include "SearchQuery.h"
 #include "ShareDirectoryInfo.h"
 #include "ShareProfile.h"
+#include "ShareSearchIndex.h"
+#include "ShareTTHIndex.h"
 #include "Singleton.h"
 #include "SortedVector.h"
 #include "StringSearch.h"
@@ -45,6 +48,8 @@
 #include "TimerManager.h"
 #include "UserConnection.h"
 
+#include <boost/utility/string_ref.hpp>
+
 namespace dcpp {
 
 class File;
@@ -180,7 +185,7 @@ public:
 	MemoryInputStream* getTree(const string& virtualFile, ProfileToken aProfile) const noexcept;
 	void toFilelist(OutputStream& os_, const string& aVirtualPath, const OptionalProfileToken& aProfile, bool aRecursive) const;
 
-	void saveXmlList(function<void (float)> progressF = nullptr) noexcept;	//for filelist caching
+	void saveShareCache(function<void (float)> progressF = nullptr) noexcept;
 
 	// Throws ShareException
 	AdcCommand getFileInfo(const string& aFile, ProfileToken aProfile);
@@ -242,6 +247,9 @@ public:
 		double averageNameLength = 0;
 		size_t totalNameSize = 0;
 		time_t averageFileAge = 0;
+
+		// Estimated memory used by the directory tree and the TTH index (excluding the allocator overhead)
+		size_t treeMemoryUsage = 0;
 	};
 	optional<ShareItemStats> getShareItemStats() const noexcept;
 
@@ -258,6 +266,7 @@ public:
 		double averageSearchTokenLength = 0;
 
 		uint64_t autoSearches = 0, tthSearches = 0;
+		uint64_t indexedSearches = 0;
 	};
 	ShareSearchStats getSearchMatchingStats() const noexcept;
 
@@ -299,6 +308,8 @@ public:
 	mutable SharedMutex cs;
 
 	struct ShareLoader;
+	struct XmlShareLoader;
+	struct BinaryShareLoader;
 
 	void setDefaultProfile(ProfileToken aNewDefault) noexcept;
 
@@ -331,6 +342,7 @@ private:
 	uint64_t searchTokenCount = 0;
 	uint64_t searchTokenLength = 0;
 	uint64_t autoSearches = 0;
+	uint64_t indexedSearches = 0;
 	typedef BloomFilter<5> ShareBloom;
 
 	class RootDirectory : boost::noncopyable {
@@ -369,6 +381,7 @@ private:
 
 			void setName(const string& aName) noexcept;
 			string getCacheXmlPath() const noexcept;
+			string getCachePath() const noexcept;
 		private:
 			RootDirectory(const string& aRootPath, const string& aVname, const ProfileTokenSet& aProfiles, bool aIncoming, time_t aLastRefreshTime) noexcept;
 
@@ -381,6 +394,12 @@ private:
 	unique_ptr<ShareBloom> bloom;
 
 	struct FilelistDirectory;
+	class FilelistXmlCache;
+	class Directory;
+
+	// Directories are indexed with their own name and the names of the files inside them
+	typedef ShareSearchIndex<Directory> SearchIndex;
+
 	class Directory : public intrusive_ptr_base<Directory> {
 	public:
 		typedef boost::intrusive_ptr<Directory> Ptr;
@@ -393,35 +412,52 @@ private:
 			const string& operator()(const Ptr& a) const noexcept { return a->realName.getLower(); }
 		};
 
+		// Files are stored by value in the sorted file array of the directory and their names in the name buffer of the directory
+		// Adding files may move the existing ones in memory so the pointers must be updated in the TTH index (see ShareManager::addFile)
 		class File {
 		public:
 			struct NameLower {
-				const string& operator()(const File* a) const noexcept { return a->name.getLower(); }
+				boost::string_ref operator()(const File& a) const noexcept { return a.getNameLower(); }
 			};
 
-			//typedef set<File, FileLess> Set;
-			typedef SortedVector<File*, std::vector, string, Compare, NameLower> Set;
-			typedef unordered_multimap<TTHValue*, const Directory::File*> TTHMap;
+			struct NameCompare {
+				int operator()(boost::string_ref a, boost::string_ref b) const noexcept { return a.compare(b); }
+			};
+
+			typedef SortedVector<File, std::vector, boost::string_ref, NameCompare, NameLower> Set;
+			typedef ShareTTHIndex<Directory::File> TTHMap;
 
-			File(DualString&& aName, const Directory::Ptr& aParent, const HashedFile& aFileInfo);
-			~File();
+			// The name must be set with Directory::setFileName
+			File(Directory* aParent, const HashedFile& aFileInfo) noexcept;
 		
-			inline string getAdcPath() const noexcept{ return parent->getAdcPath() + name.getNormal(); }
-			inline string getRealPath() const noexcept { return parent->getRealPath(name.getNormal()); }
+			inline string getAdcPath() const noexcept{ return parent->getAdcPath() + getName(); }
+			inline string getRealPath() const noexcept { return parent->getRealPath(getName()); }
 			inline bool hasProfile(const OptionalProfileToken& aProfile) const noexcept { return parent->hasProfile(aProfile); }
 
 			void toXml(OutputStream& xmlFile, string& indent, string& tmp2, bool addDate) const;
 			void addSR(SearchResultList& aResults, bool addParent) const noexcept;
 
+			boost::string_ref getNameLower() const noexcept;
+			string getName() const noexcept;
+			bool lowerCaseOnly() const noexcept { return !hasCaseMask; }
+
+			// Returns true if the names are equal (including the case)
+			bool hasSameName(const File& aOther) const noexcept;
+
 			GETSET(int64_t, size, Size);
 			GETSET(Directory*, parent, Parent);
 			GETSET(time_t, lastWrite, LastWrite);
 			GETSET(TTHValue, tth, TTH);
 
-			DualString name;
+			void updateIndices(ShareBloom& aBloom_, int64_t& sharedSize_, File::TTHMap& tthIndex_, SearchIndex& searchIndex_) noexcept;
+			void cleanIndices(int64_t& sharedSize_, TTHMap& tthIndex_, SearchIndex& searchIndex_) noexcept;
+		private:
+			friend class Directory;
 
-			void updateIndices(ShareBloom& aBloom_, int64_t& sharedSize_, File::TTHMap& tthIndex_) noexcept;
-			void cleanIndices(int64_t& sharedSize_, TTHMap& tthIndex_) noexcept;
+			// Position of the lowercase name in the name buffer of the parent (followed by the case mask for mixed-case names)
+			uint32_t nameOffset = 0;
+			uint32_t nameLength : 31;
+			uint32_t hasCaseMask : 1;
 		};
 
 		class SearchResultInfo {
@@ -431,7 +467,7 @@ private:
 			};
 
 			explicit SearchResultInfo(const File* f, const SearchQuery& aSearch, int aLevel) :
-				file(f), type(FILE), scores(SearchQuery::getRelevanceScore(aSearch, aLevel, false, f->name.getLower())) {
+				file(f), type(FILE), scores(SearchQuery::getRelevanceScore(aSearch, aLevel, false, f->getNameLower().to_string())) {
 
 			}
 
@@ -457,18 +493,62 @@ private:
 			double scores;
 		};
 
+		// Directories that may contain matches for each include pattern of a search (resolved from the search index)
+		class SearchCandidates {
+		public:
+			typedef uint64_t PatternMask;
+
+			// Returns false if none of the include patterns can be resolved by using the index
+			bool resolve(const SearchIndex& aIndex, const SearchQuery& aSearch) noexcept;
+
+			// Patterns matched by the directory name or names of its files
+			PatternMask getMatches(const Directory* aDir) const noexcept;
+
+			// Returns true if the directory or any of its children may contain matches for all patterns that haven't been covered yet
+			bool hasCandidates(const Directory* aDir, PatternMask aCovered) const noexcept;
+
+			PatternMask getAllPatterns() const noexcept { return allPatterns; }
+			PatternMask getUnindexedPatterns() const noexcept { return unindexedPatterns; }
+			bool inheritMatches() const noexcept { return inheritParentMatches; }
+		private:
+			// Directories containing the pattern
+			vector<SearchIndex::ItemSet> matches;
+
+			// Directories containing the pattern and all their parents
+			vector<SearchIndex::ItemSet> paths;
+
+			PatternMask allPatterns = 0;
+			PatternMask unindexedPatterns = 0;
+			bool inheritParentMatches = false;
+		};
+
 		typedef SortedVector<Ptr, std::vector, string, Compare, NameLower> Set;
 		File::Set files;
 
-		static Ptr createNormal(DualString&& aRealName, const Ptr& aParent, time_t aLastWrite, Directory::MultiMap& dirNameMap_, ShareBloom& bloom) noexcept;
-		static Ptr createRoot(const string& aRootPath, const string& aVname, const ProfileTokenSet& aProfiles, bool aIncoming, time_t aLastWrite, Map& rootPaths_, Directory::MultiMap& dirNameMap_, ShareBloom& bloom_, time_t aLastRefreshTime) noexcept;
+		// Stores the name in the name buffer
+		// Replacing the name of an existing file reuses the old space when possible
+		void setFileName(File& aFile, const DualString& aName) noexcept;
+
+		// Reserve space for the files and their names (the TTH index is updated if the files are moved in memory)
+		void reserveFiles(size_t aCount, size_t aNameBytes, File::TTHMap& tthIndex_) noexcept;
+		static size_t getFileNameSize(const DualString& aName) noexcept;
+
+		static Ptr createNormal(DualString&& aRealName, const Ptr& aParent, time_t aLastWrite, Directory::MultiMap& dirNameMap_, SearchIndex& searchIndex_, ShareBloom& bloom) noexcept;
+		static Ptr createRoot(const string& aRootPath, const string& aVname, const ProfileTokenSet& aProfiles, bool aIncoming, time_t aLastWrite, Map& rootPaths_, Directory::MultiMap& dirNameMap_, SearchIndex& searchIndex_, ShareBloom& bloom_, time_t aLastRefreshTime) noexcept;
 
 		// Set a new parent for the directory
 		// Possible directories with the same name must be removed from the parent first
 		static bool setParent(const Directory::Ptr& aDirectory, const Directory::Ptr& aParent) noexcept;
 
 		// Remove directory from possible parent and all shared containers
-		static void cleanIndices(Directory& aDirectory, int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& aDirNames_) noexcept;
+		static void cleanIndices(Directory& aDirectory, int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& aDirNames_, SearchIndex& searchIndex_) noexcept;
+
+		// Remove directory from possible parent without clearing the parent pointer
+		// The content can still be resolved while it's being removed from the shared containers with cleanLevelIndices
+		static void detach(Directory& aDirectory) noexcept;
+
+		// Remove the directory name and the files directly inside this directory from the shared containers
+		void cleanLevelIndices(int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& dirNames_, SearchIndex& searchIndex_) noexcept;
 
 		struct HasRootProfile {
 			HasRootProfile(const OptionalProfileToken& aProfile) : profile(aProfile) { }
@@ -499,15 +579,26 @@ private:
 
 		void getProfileInfo(ProfileToken aProfile, int64_t& totalSize, size_t& filesCount) const noexcept;
 
-		void search(SearchResultInfo::Set& aResults, SearchQuery& aStrings, int aLevel) const noexcept;
+		// Candidates may be used for skipping directories that can't contain any matches
+		// aCovered contains the patterns that have been matched by the parent directories
+		void search(SearchResultInfo::Set& aResults, SearchQuery& aStrings, int aLevel, const SearchCandidates* aCandidates = nullptr, SearchCandidates::PatternMask aCovered = 0) const noexcept;
 
 		void toFileList(FilelistDirectory& aListDir, bool aRecursive);
 		void toTTHList(OutputStream& tthList, string& tmp2, bool recursive) const;
 
-		//for file list caching
-		void toXmlList(OutputStream& xmlFile, string& indent, string& tmp);
+		// Writes the content in the binary share cache format
+		void toCache(OutputStream& os_) const;
+
+		// Writes the content in the XML share cache format (used by the older versions)
+		void toXmlList(OutputStream& xmlFile, string& indent, string& tmp) const;
 		void filesToXmlList(OutputStream& xmlFile, string& indent, string& tmp2) const;
 
+		// Writes the files of a recursive filelist by using the cached XML when possible
+		void filesToFilelistXml(OutputStream& xmlFile, string& indent, string& tmp2, FilelistXmlCache& xmlCache_) const;
+
+		// Returns true if the directories contain identical files (names, sizes, dates and TTHs)
+		bool hasSameFiles(const Directory& aOther) const noexcept;
+
 		GETSET(time_t, lastWrite, LastWrite);
 
 		~Directory();
@@ -518,6 +609,10 @@ private:
 		//void addBloom(ShareBloom& aBloom) const noexcept;
 
 		void countStats(time_t& totalAge_, size_t& totalDirs_, int64_t& totalSize_, size_t& totalFiles, size_t& lowerCaseFiles, size_t& totalStrLen_) const noexcept;
+
+		// Estimated memory used by the directory and its content (recursive)
+		size_t getAllocatedSize() const noexcept;
+
 		DualString realName;
 
 		// check for an updated modify date from filesystem
@@ -559,11 +654,14 @@ private:
 			const char separator;
 		};
 	private:
-		void cleanIndices(int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& dirNames_) noexcept;
+		void cleanIndices(int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& dirNames_, SearchIndex& searchIndex_) noexcept;
 
 		Directory* parent;
 		Set directories;
 
+		// Lowercase names of the files followed by the case masks of mixed-case names
+		string fileNames;
+
 		// Size for files directly inside this directory
 		int64_t size = 0;
 		RootDirectory::Ptr root;
@@ -586,10 +684,46 @@ private:
 
 		Map listDirs;
 
-		void toXml(OutputStream& xmlFile, string& indent, string& tmp2, bool fullList) const;
-		void filesToXml(OutputStream& xmlFile, string& indent, string& tmp2, bool addDate) const;
+		void toXml(OutputStream& xmlFile, string& indent, string& tmp2, bool fullList, FilelistXmlCache& xmlCache_) const;
+		void filesToXml(OutputStream& xmlFile, string& indent, string& tmp2, bool addDate, FilelistXmlCache& xmlCache_) const;
 	};
 
+	// Filelist XML of the files directly inside share directories (as they don't change as often as the whole list)
+	// Entries are keyed by the real directory path so that they survive refreshes of unchanged directories
+	class FilelistXmlCache : boost::noncopyable {
+	public:
+		FilelistXmlCache(size_t aMaxSize) : maxSize(aMaxSize) { }
+
+		// Returns nullptr if there's no XML cached with the same indentation
+		shared_ptr<const string> get(const string& aPath, size_t aIndentLength) noexcept;
+
+		// Least recently used entries are removed when the size limit is exceeded
+		void put(const string& aPath, size_t aIndentLength, const shared_ptr<const string>& aXml) noexcept;
+
+		// Must be called when the files directly inside the directory are modified
+		void invalidate(const string& aPath) noexcept;
+	private:
+		struct Entry {
+			size_t indentLength;
+			shared_ptr<const string> xml;
+			list<string>::iterator lruPos;
+		};
+
+		void removeEntry(unordered_map<string, Entry>::iterator aEntry) noexcept;
+
+		unordered_map<string, Entry> entries;
+
+		// Most recently used paths first
+		list<string> lru;
+
+		size_t totalSize = 0;
+		const size_t maxSize;
+
+		CriticalSection cs;
+	};
+
+	mutable FilelistXmlCache filelistXmlCache;
+
 	ShareDirectoryInfoPtr getRootInfo(const Directory::Ptr& aDir) const noexcept;
 
 	void addAsyncTask(AsyncF aF) noexcept;
@@ -626,6 +760,10 @@ private:
 
 	bool loadCache(function<void(float)> progressF) noexcept;
 
+	// Both throw FileException
+	static void saveBinaryCache(const Directory::Ptr& aRoot);
+	static void saveXmlCache(const Directory::Ptr& aRoot);
+
 	bool stopping = false;
 	
 	static atomic_flag refreshing;
@@ -635,7 +773,7 @@ private:
 	uint64_t lastIncomingUpdate = GET_TICK();
 	uint64_t lastSave = 0;
 	
-	bool xml_saving = false;
+	bool cache_saving = false;
 
 	// Map real name to virtual name - multiple real names may be mapped to a single virtual one
 	Directory::Map rootPaths;
@@ -643,6 +781,9 @@ private:
 	// All directory names cached for easy lookups
 	Directory::MultiMap lowerDirNameMap;
 
+	// Name tokens of all directories and files for text searches
+	SearchIndex searchIndex;
+
 	class RefreshInfo : boost::noncopyable {
 	public:
 		RefreshInfo(const string& aPath, const Directory::Ptr& aOldRoot, time_t aLastWrite, ShareBloom& bloom_);
@@ -656,32 +797,84 @@ private:
 		Directory::Map rootPathsNew;
 		Directory::MultiMap lowerDirNameMapNew;
 		HashFileMap tthIndexNew;
+		SearchIndex searchIndexNew;
+
+		// Directories whose files differ from the old tree (the cached filelist XML must be invalidated)
+		StringList changedFilePaths;
 
 		string path;
 
 		ShareManager::ShareBloom& bloom;
 
-		void mergeRefreshChanges(Directory::MultiMap& aDirNameMap, Directory::Map& aRootPaths, HashFileMap& aTTHIndex, int64_t& totalHash, int64_t& totalAdded, ProfileTokenSet* dirtyProfiles) noexcept;
+		// Move (at most) the given number of new index entries to the shared containers
+		// Returns true when all entries have been moved
+		bool mergeIndices(Directory::MultiMap& aDirNameMap, HashFileMap& aTTHIndex, size_t aMaxEntries) noexcept;
+		bool mergeSearchIndex(SearchIndex& aSearchIndex, size_t aMaxEntries) noexcept;
 		bool checkContent(const Directory::Ptr& aDirectory) noexcept;
 	};
 
 	class ShareBuilder : public RefreshInfo {
 	public:
-		ShareBuilder(const string& aPath, const Directory::Ptr& aOldRoot, time_t aLastWrite, ShareBloom& bloom_, ShareManager* sm);
+		// Number of directory walkers running on the same volume (shared by all builders of the volume)
+		typedef shared_ptr<atomic<int>> VolumeWalkerCounter;
+
+		ShareBuilder(const string& aPath, const Directory::Ptr& aOldRoot, time_t aLastWrite, ShareBloom& bloom_, ShareManager* sm, const VolumeWalkerCounter& aVolumeWalkers, bool aAllowParallel);
 
 		// Recursive function for building a new share tree from a path
+		// Subdirectories may be walked in parallel if allowed by the volume limits
 		bool buildTree() noexcept;
 	private:
-		void buildTree(const string& aPath, const string& aPathLower, const Directory::Ptr& aCurrentDirectory, const Directory::Ptr& aOldDirectory);
+		// Content added by a single walker, merged in the refresh info after the whole tree has been walked
+		struct BuildContext : boost::noncopyable {
+			BuildContext() : bloom(1 << 20) { }
+
+			Directory::MultiMap lowerDirNameMap;
+			HashFileMap tthIndex;
+			SearchIndex searchIndex;
+			ShareBloom bloom;
+			StringList changedFilePaths;
+			int64_t addedSize = 0;
+			size_t newDirectoriesCount = 0;
+		};
+
+		void buildTree(const string& aPath, const string& aPathLower, const Directory::Ptr& aCurrentDirectory, const Directory::Ptr& aOldDirectory, BuildContext& aContext);
+		void walkDirectoryTask(const string& aPath, const string& aPathLower, const Directory::Ptr& aCurrentDirectory, const Directory::Ptr& aOldDirectory) noexcept;
+
+		bool startWalker() noexcept;
+
+		BuildContext* getContext() noexcept;
+		void releaseContext(BuildContext* aContext) noexcept;
+		void mergeContexts() noexcept;
+
+		// Remove empty subdirectories recursively (can't be done while their content is still being walked)
+		void removeEmptyDirectories(const Directory::Ptr& aDirectory) noexcept;
 
 		const ShareManager& sm;
+
+		const VolumeWalkerCounter volumeWalkers;
+		const bool allowParallel;
+
+		atomic<int64_t> queuedHashSize { 0 };
+		atomic<bool> failed { false };
+
+		task_group tasks;
+
+		CriticalSection contextCS;
+		vector<unique_ptr<BuildContext>> contexts;
+		vector<BuildContext*> freeContexts;
 	};
 
 	typedef shared_ptr<ShareBuilder> ShareBuilderPtr;
 	typedef set<ShareBuilderPtr, std::less<ShareBuilderPtr>> ShareBuilderSet;
 
+	// Replace the old directory with the refreshed one and update the indices in batches
+	// Returns false if the directory couldn't be added (the old content is removed in any case)
 	bool applyRefreshChanges(RefreshInfo& ri, int64_t& totalHash_, ProfileTokenSet* aDirtyProfiles);
 
+	// Held while applying changes that are performed in multiple steps (the share lock is released between the steps)
+	// All other changes to the directory tree or the shared indices must hold this lock as well
+	CriticalSection applyCS;
+
 	// Display a log message if the refresh can't be started immediately
 	void reportPendingRefresh(TaskType aTask, const RefreshPathList& aDirectories, const string& displayName) const noexcept;
 
@@ -695,15 +888,18 @@ private:
 	// Safe to call with non-root directories
 	void setRefreshState(const string& aPath, RefreshState aState, bool aUpdateRefreshTime) noexcept;
 
-	static void addFile(DualString&& aName, const Directory::Ptr& aDir, const HashedFile& fi, HashFileMap& tthIndex_, ShareBloom& aBloom_, int64_t& sharedSize_, ProfileTokenSet* dirtyProfiles_ = nullptr) noexcept;
+	static void addFile(const DualString& aName, const Directory::Ptr& aDir, const HashedFile& fi, HashFileMap& tthIndex_, SearchIndex& searchIndex_, ShareBloom& aBloom_, int64_t& sharedSize_, ProfileTokenSet* dirtyProfiles_ = nullptr) noexcept;
+
+	// Adds all files of a directory at once so that the existing files won't be moved for each file (the list is cleared)
+	typedef vector<pair<DualString, HashedFile>> PendingFileList;
+	static void addFiles(PendingFileList& aFiles, const Directory::Ptr& aDir, HashFileMap& tthIndex_, SearchIndex& searchIndex_, ShareBloom& aBloom_, int64_t& sharedSize_) noexcept;
 
-	static void addDirName(const Directory::Ptr& dir, Directory::MultiMap& aDirNames, ShareBloom& aBloom) noexcept;
-	static void removeDirName(const Directory& dir, Directory::MultiMap& aDirNames) noexcept;
+	static void addDirName(const Directory::Ptr& dir, Directory::MultiMap& aDirNames, SearchIndex& aSearchIndex, ShareBloom& aBloom) noexcept;
+	static void removeDirName(const Directory& dir, Directory::MultiMap& aDirNames, SearchIndex& aSearchIndex) noexcept;
 
 #ifdef _DEBUG
 	// Checks that duplicate/incorrect directories/files won't get through
 	static void checkAddedDirNameDebug(const Directory::Ptr& dir, Directory::MultiMap& aDirNames) noexcept;
-	static void checkAddedTTHDebug(const Directory::File* f, HashFileMap& aTTHIndex) noexcept;
 
 	// Go through the whole tree and check that the global maps have been filled properly
 	void validateDirectoryTreeDebug() noexcept;
@@ -772,6 +968,7 @@ private:
 	Directory::Ptr findDirectory(const string& aRealPath) const noexcept;
 
 	// Attempt to add the path in share
+	// applyCS and the write lock must be held when calling this
 	Directory::Ptr getDirectory(const string& aRealPath) noexcept;
 
 	// Attempts to find directory from share and returns the last existing directory
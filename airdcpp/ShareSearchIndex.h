@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_SHARE_SEARCH_INDEX_H
+#define DCPLUSPLUS_DCPP_SHARE_SEARCH_INDEX_H
+
+#include "typedefs.h"
+
+#include "Text.h"
+
+namespace dcpp {
+
+/**
+* Inverted index that maps name tokens (separator-free parts of lowercase names) to the items
+* whose name contains them. The same item may be added with multiple names (e.g. a directory with
+* the names of its files) so each entry is reference counted.
+*
+* Search patterns are substrings so they are resolved to tokens via the trigrams of the token
+* vocabulary. The returned items are always a superset of the real matches and the caller
+* is expected to perform the actual matching.
+*/
+template<class T>
+class ShareSearchIndex {
+public:
+	typedef unordered_set<const T*> ItemSet;
+
+	// Shorter tokens/patterns can't be indexed
+	static const size_t MIN_TOKEN_LENGTH = 3;
+
+	ShareSearchIndex() { }
+	ShareSearchIndex(ShareSearchIndex&) = delete;
+	ShareSearchIndex& operator=(ShareSearchIndex&) = delete;
+
+	void add(const T* aItem, const string& aNameLower) noexcept {
+		for (const auto& t : tokenize(aNameLower)) {
+			addToken(t, aItem, 1);
+		}
+	}
+
+	void remove(const T* aItem, const string& aNameLower) noexcept {
+		for (const auto& t : tokenize(aNameLower)) {
+			auto p = tokens.find(t);
+			if (p == tokens.end()) {
+				dcassert(0);
+				continue;
+			}
+
+			auto& items = p->second;
+			auto i = items.find(aItem);
+			if (i == items.end()) {
+				dcassert(0);
+				continue;
+			}
+
+			if (--i->second == 0) {
+				items.erase(i);
+				if (items.empty()) {
+					removeTrigrams(*p);
+					tokens.erase(p);
+				}
+			}
+		}
+	}
+
+	// Move all entries from another index
+	void merge(ShareSearchIndex& aIndex) noexcept {
+		for (const auto& t : aIndex.tokens) {
+			for (const auto& i : t.second) {
+				addToken(t.first, i.first, i.second);
+			}
+		}
+
+		aIndex.clear();
+	}
+
+	// Move the entries of (at most) the given number of tokens from another index
+	// Returns true when the other index is empty
+	bool merge(ShareSearchIndex& aIndex, size_t aMaxTokens) noexcept {
+		// The trigrams of the other index would point to removed tokens
+		aIndex.trigrams.clear();
+
+		auto t = aIndex.tokens.begin();
+		for (size_t merged = 0; t != aIndex.tokens.end() && merged < aMaxTokens; ++merged) {
+			for (const auto& i : t->second) {
+				addToken(t->first, i.first, i.second);
+			}
+
+			t = aIndex.tokens.erase(t);
+		}
+
+		return aIndex.tokens.empty();
+	}
+
+	void clear() noexcept {
+		tokens.clear();
+		trigrams.clear();
+	}
+
+	size_t getTokenCount() const noexcept {
+		return tokens.size();
+	}
+
+	// Adds the items containing the longest separator-free fragment of the (lowercase) pattern
+	// Returns false if the pattern can't be resolved by using the index
+	bool getItems(const string& aPatternLower, ItemSet& items_) const noexcept {
+		auto fragment = getSearchFragment(aPatternLower);
+		if (fragment.empty()) {
+			return false;
+		}
+
+		// Use the trigram with the least tokens
+		const TokenList* tokenList = nullptr;
+		for (size_t i = 0; i + MIN_TOKEN_LENGTH <= fragment.size(); ++i) {
+			auto p = trigrams.find(toTrigram(fragment, i));
+			if (p == trigrams.end()) {
+				// Nothing can match
+				return true;
+			}
+
+			if (!tokenList || p->second.size() < tokenList->size()) {
+				tokenList = &p->second;
+			}
+		}
+
+		for (const auto& t : *tokenList) {
+			if (t->first.find(fragment) != string::npos) {
+				for (const auto& i : t->second) {
+					items_.insert(i.first);
+				}
+			}
+		}
+
+		return true;
+	}
+
+	// Returns the longest separator-free part of the pattern (or an empty string if it's too short for the index)
+	static string getSearchFragment(const string& aPatternLower) noexcept {
+		string ret;
+		for (const auto& t : tokenize(aPatternLower)) {
+			if (t.size() > ret.size()) {
+				ret = t;
+			}
+		}
+
+		return ret;
+	}
+private:
+	typedef unordered_map<const T*, uint32_t> ItemMap;
+	typedef unordered_map<string, ItemMap> TokenMap;
+	typedef vector<const typename TokenMap::value_type*> TokenList;
+
+	TokenMap tokens;
+	unordered_map<uint32_t, TokenList> trigrams;
+
+	void addToken(const string& aToken, const T* aItem, uint32_t aCount) noexcept {
+		auto p = tokens.find(aToken);
+		if (p == tokens.end()) {
+			p = tokens.emplace(aToken, ItemMap()).first;
+			addTrigrams(*p);
+		}
+
+		p->second[aItem] += aCount;
+	}
+
+	void addTrigrams(const typename TokenMap::value_type& aToken) noexcept {
+		const auto& name = aToken.first;
+		for (size_t i = 0; i + MIN_TOKEN_LENGTH <= name.size(); ++i) {
+			auto& tokenList = trigrams[toTrigram(name, i)];
+
+			// The same trigram may appear multiple times in a token
+			if (tokenList.empty() || tokenList.back() != &aToken) {
+				tokenList.push_back(&aToken);
+			}
+		}
+	}
+
+	void removeTrigrams(const typename TokenMap::value_type& aToken) noexcept {
+		const auto& name = aToken.first;
+		for (size_t i = 0; i + MIN_TOKEN_LENGTH <= name.size(); ++i) {
+			auto p = trigrams.find(toTrigram(name, i));
+			if (p == trigrams.end()) {
+				continue;
+			}
+
+			auto& tokenList = p->second;
+			auto t = find(tokenList.begin(), tokenList.end(), &aToken);
+			if (t != tokenList.end()) {
+				*t = tokenList.back();
+				tokenList.pop_back();
+			}
+
+			if (tokenList.empty()) {
+				trigrams.erase(p);
+			}
+		}
+	}
+
+	static uint32_t toTrigram(const string& aStr, size_t aPos) noexcept {
+		return static_cast<uint32_t>(static_cast<uint8_t>(aStr[aPos])) |
+			(static_cast<uint32_t>(static_cast<uint8_t>(aStr[aPos + 1])) << 8) |
+			(static_cast<uint32_t>(static_cast<uint8_t>(aStr[aPos + 2])) << 16);
+	}
+
+	// Unique tokens that are long enough for indexing
+	static StringList tokenize(const string& aNameLower) noexcept {
+		StringList ret;
+
+		size_t start = 0;
+		for (size_t i = 0; i <= aNameLower.size(); ++i) {
+			if (i == aNameLower.size() || Text::isSeparator(aNameLower[i])) {
+				if (i - start >= MIN_TOKEN_LENGTH) {
+					auto token = aNameLower.substr(start, i - start);
+					if (find(ret.begin(), ret.end(), token) == ret.end()) {
+						ret.push_back(move(token));
+					}
+				}
+
+				start = i + 1;
+			}
+		}
+
+		return ret;
+	}
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_SHARE_SEARCH_INDEX_H)
@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_SHARE_TTH_INDEX_H
+#define DCPLUSPLUS_DCPP_SHARE_TTH_INDEX_H
+
+#include "typedefs.h"
+
+#include "MerkleTree.h"
+
+#include <boost/range/iterator_range.hpp>
+
+namespace dcpp {
+
+/**
+* Open addressing hash table (linear probing) for finding shared items by their TTH. Only the item
+* pointers are stored and the TTH is read from the item (T::getTTH) so each slot takes a single pointer
+* instead of a separately allocated node. The same TTH may be used by multiple items.
+*/
+template<class T>
+class ShareTTHIndex {
+public:
+	// Iterates through the items with the given TTH or through all items
+	class Iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef const T* value_type;
+		typedef ptrdiff_t difference_type;
+		typedef const T* const* pointer;
+		typedef const T* const& reference;
+
+		Iterator(const ShareTTHIndex* aIndex, size_t aPos, const TTHValue* aTTH) noexcept : index(aIndex), pos(aPos), tth(aTTH) {
+			if (pos == index->table.size()) {
+				return;
+			}
+
+			if (tth && !index->table[pos]) {
+				// Nothing in the probe sequence
+				pos = index->table.size();
+			} else if (!matches()) {
+				++(*this);
+			}
+		}
+
+		reference operator*() const noexcept { return index->table[pos]; }
+		pointer operator->() const noexcept { return &index->table[pos]; }
+
+		Iterator& operator++() noexcept {
+			const auto& table = index->table;
+			if (tth) {
+				// The matching items are always located before the next free slot
+				do {
+					pos = (pos + 1) & (table.size() - 1);
+				} while (table[pos] && *tth != table[pos]->getTTH());
+
+				if (!table[pos]) {
+					pos = table.size();
+				}
+			} else {
+				do {
+					pos++;
+				} while (pos != table.size() && !table[pos]);
+			}
+
+			return *this;
+		}
+
+		Iterator operator++(int) noexcept {
+			auto ret = *this;
+			++(*this);
+			return ret;
+		}
+
+		bool operator==(const Iterator& rhs) const noexcept { return pos == rhs.pos; }
+		bool operator!=(const Iterator& rhs) const noexcept { return pos != rhs.pos; }
+	private:
+		bool matches() const noexcept {
+			const auto item = index->table[pos];
+			return item && (!tth || *tth == item->getTTH());
+		}
+
+		const ShareTTHIndex* index;
+		size_t pos;
+		const TTHValue* tth;
+	};
+
+	typedef boost::iterator_range<Iterator> Range;
+
+	ShareTTHIndex() { }
+	ShareTTHIndex(ShareTTHIndex&) = delete;
+	ShareTTHIndex& operator=(ShareTTHIndex&) = delete;
+
+	void add(const T* aItem) noexcept {
+#ifdef _DEBUG
+		auto items = equal_range(aItem->getTTH());
+		dcassert(std::find(items.begin(), items.end(), aItem) == items.end());
+#endif
+
+		if ((count + 1) * 4 > table.size() * 3) {
+			resize(table.empty() ? MIN_SIZE : table.size() * 2);
+		}
+
+		insert(aItem);
+		count++;
+	}
+
+	// Returns false if the item wasn't found
+	bool remove(const T* aItem) noexcept {
+		if (table.empty()) {
+			return false;
+		}
+
+		const auto mask = table.size() - 1;
+		auto pos = getPos(aItem->getTTH());
+		while (table[pos] != aItem) {
+			if (!table[pos]) {
+				return false;
+			}
+
+			pos = (pos + 1) & mask;
+		}
+
+		// Move the following items of the same probe sequence to fill the gap
+		auto free = pos;
+		for (;;) {
+			pos = (pos + 1) & mask;
+			const auto item = table[pos];
+			if (!item) {
+				break;
+			}
+
+			// Items can't be moved before their initial position
+			auto initialPos = getPos(item->getTTH());
+			if (((pos - initialPos) & mask) >= ((pos - free) & mask)) {
+				table[free] = item;
+				free = pos;
+			}
+		}
+
+		table[free] = nullptr;
+		count--;
+		return true;
+	}
+
+	// Returns the first item with the given TTH (or nullptr)
+	const T* find(const TTHValue& aTTH) const noexcept {
+		auto i = equal_range(aTTH);
+		return i.empty() ? nullptr : *i.begin();
+	}
+
+	Range equal_range(const TTHValue& aTTH) const noexcept {
+		if (table.empty()) {
+			return Range(end(), end());
+		}
+
+		return Range(Iterator(this, getPos(aTTH), &aTTH), end());
+	}
+
+	Iterator begin() const noexcept {
+		return Iterator(this, 0, nullptr);
+	}
+
+	Iterator end() const noexcept {
+		return Iterator(this, table.size(), nullptr);
+	}
+
+	size_t size() const noexcept {
+		return count;
+	}
+
+	// Memory used by the table
+	size_t getAllocatedSize() const noexcept {
+		return table.capacity() * sizeof(const T*);
+	}
+
+	void clear() noexcept {
+		table.clear();
+		table.shrink_to_fit();
+		count = 0;
+	}
+
+	// Move all items from another index
+	void merge(ShareTTHIndex& aIndex) noexcept {
+		merge(aIndex, aIndex.count);
+	}
+
+	// Move (at most) the given number of items from another index
+	// The other index can't be used for lookups afterwards (until it's empty)
+	// Returns true when the other index is empty
+	bool merge(ShareTTHIndex& aIndex, size_t aMaxItems) noexcept {
+		if ((count + min(aMaxItems, aIndex.count)) * 4 > table.size() * 3) {
+			auto newSize = table.empty() ? MIN_SIZE : table.size();
+			while ((count + min(aMaxItems, aIndex.count)) * 4 > newSize * 3) {
+				newSize *= 2;
+			}
+
+			resize(newSize);
+		}
+
+		// Take the items from the end so that the table of the other index can be shrunk as we go
+		auto& other = aIndex.table;
+		for (size_t moved = 0; aIndex.count > 0 && moved < aMaxItems; ++moved) {
+			while (!other.back()) {
+				other.pop_back();
+			}
+
+			insert(other.back());
+			other.pop_back();
+
+			aIndex.count--;
+			count++;
+		}
+
+		if (aIndex.count == 0) {
+			aIndex.clear();
+			return true;
+		}
+
+		return false;
+	}
+private:
+	static const size_t MIN_SIZE = 16;
+
+	// Size is always a power of two (or zero)
+	vector<const T*> table;
+	size_t count = 0;
+
+	size_t getPos(const TTHValue& aTTH) const noexcept {
+		return std::hash<TTHValue>()(aTTH) & (table.size() - 1);
+	}
+
+	void insert(const T* aItem) noexcept {
+		auto pos = getPos(aItem->getTTH());
+		while (table[pos]) {
+			pos = (pos + 1) & (table.size() - 1);
+		}
+
+		table[pos] = aItem;
+	}
+
+	void resize(size_t aSize) noexcept {
+		vector<const T*> old(aSize, nullptr);
+		table.swap(old);
+
+		for (const auto& item : old) {
+			if (item) {
+				insert(item);
+			}
+		}
+	}
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_SHARE_TTH_INDEX_H)
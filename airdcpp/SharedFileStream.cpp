@@ -20,6 +20,7 @@
 #include "stdinc.h"
 
 #include "SharedFileStream.h"
+#include "Exception.h"
 
 #ifdef _WIN32
 # include "Winioctl.h"
@@ -27,15 +28,40 @@
 
 namespace dcpp {
 
+// Size of the blocks that are queued for writing
+#define WRITE_BACK_SIZE (1024 * 1024)
+
+// The blocks end at offsets that are multiples of this (unless the write is forced)
+#define WRITE_BACK_ALIGN (64 * 1024)
+
+// Writing will block if the disk can't keep up with this much data for a single stream
+#define MAX_PENDING_BYTES (8 * 1024 * 1024)
+
+// Each device has its own writer thread so that a slow disk won't delay writing to the other ones
+static DispatcherQueue* getWriteQueue(const string& aPath) {
+	static CriticalSection queueCS;
+	static unordered_map<int64_t, unique_ptr<DispatcherQueue>> writeQueues;
+
+	auto deviceId = File::getDeviceId(aPath);
+
+	Lock l(queueCS);
+	auto& queue = writeQueues[deviceId];
+	if (!queue) {
+		queue = make_unique<DispatcherQueue>(true);
+	}
+
+	return queue.get();
+}
+
 CriticalSection SharedFileStream::cs;
 SharedFileStream::SharedFileHandleMap SharedFileStream::readpool;
 SharedFileStream::SharedFileHandleMap SharedFileStream::writepool;
 
 SharedFileHandle::SharedFileHandle(const string& aPath, int aAccess, int aMode) : 
-	File(aPath, aAccess, aMode), ref_cnt(1), path(aPath), mode(aMode)
+	File(aPath, aAccess, aMode), ref_cnt(1), path(aPath), mode(aMode), writeQueue(aAccess == File::READ ? nullptr : getWriteQueue(aPath))
 { }
 
-SharedFileStream::SharedFileStream(const string& aFileName, int aAccess, int aMode) {
+SharedFileStream::SharedFileStream(const string& aFileName, int aAccess, int aMode) : pos(0) {
 	Lock l(cs);
 	auto& pool = aAccess == File::READ ? readpool : writepool;
 	auto p = pool.find(aFileName);
@@ -49,6 +75,23 @@ SharedFileStream::SharedFileStream(const string& aFileName, int aAccess, int aMo
 }
 
 SharedFileStream::~SharedFileStream() {
+	if (writeBack) {
+		// The handle must stay open until everything has been written
+		// Write errors can't be reported from here, the owner must call flushBuffers before the stream is destroyed
+		try {
+			queueWrite();
+		} catch (const std::bad_alloc&) {
+			setError("Out of memory");
+		}
+
+		unique_lock<mutex> l(writeBack->m);
+		writeBack->cond.wait(l, [this] { return writeBack->pendingBytes == 0; });
+
+		if (!writeBack->error.empty()) {
+			dcdebug("SharedFileStream: unreported write error for %s: %s\n", sfh->path.c_str(), writeBack->error.c_str());
+		}
+	}
+
 	Lock l(cs);
 
 	sfh->ref_cnt--;
@@ -58,17 +101,99 @@ SharedFileStream::~SharedFileStream() {
     }
 }
 
-size_t SharedFileStream::write(const void* buf, size_t len) {
-	Lock l(sfh->cs);
+size_t SharedFileStream::write(const void* aBuf, size_t len) {
+	if (!writeBack) {
+		writeBack = make_shared<WriteBack>();
+	}
 
-	sfh->setPos(pos);
-	sfh->write(buf, len);
+	// Don't block unless the disk can't keep up
+	waitPending(MAX_PENDING_BYTES);
+
+	if (buf.empty()) {
+		buf.reserve(WRITE_BACK_SIZE + WRITE_BACK_ALIGN);
+		bufStart = pos;
+	}
+
+	auto data = static_cast<const uint8_t*>(aBuf);
+	buf.insert(buf.end(), data, data + len);
+	pos += len;
+
+	if (buf.size() >= WRITE_BACK_SIZE) {
+		// Keep the unaligned tail for the next block
+		auto alignedEnd = pos - pos % WRITE_BACK_ALIGN;
+		queueWrite(alignedEnd > bufStart ? alignedEnd : -1);
+	}
 
-    pos += len;
 	return len;
 }
 
+void SharedFileStream::queueWrite(int64_t aEnd) {
+	auto len = aEnd == -1 ? buf.size() : static_cast<size_t>(aEnd - bufStart);
+	if (len == 0) {
+		return;
+	}
+
+	ByteVector data;
+	if (len == buf.size()) {
+		data.swap(buf);
+	} else {
+		data.assign(buf.begin(), buf.begin() + len);
+		buf.erase(buf.begin(), buf.begin() + len);
+	}
+
+	auto start = bufStart;
+	bufStart += len;
+
+	{
+		lock_guard<mutex> l(writeBack->m);
+		writeBack->pendingBytes += len;
+	}
+
+	sfh->writeQueue->addTask([handle = sfh, wb = writeBack, start, data = move(data)] {
+		string error;
+		try {
+#ifdef _WIN32
+			// The file position is changed temporarily
+			Lock l(handle->cs);
+#endif
+			handle->writeAt(&data[0], data.size(), start);
+		} catch (const FileException& e) {
+			error = e.getError();
+		}
+
+		lock_guard<mutex> l(wb->m);
+		wb->pendingBytes -= data.size();
+		if (wb->error.empty()) {
+			wb->error = error;
+		}
+
+		wb->cond.notify_all();
+	});
+}
+
+void SharedFileStream::setError(const string& aError) noexcept {
+	lock_guard<mutex> l(writeBack->m);
+	if (writeBack->error.empty()) {
+		writeBack->error = aError;
+	}
+}
+
+void SharedFileStream::waitPending(size_t aMaxPending) {
+	unique_lock<mutex> l(writeBack->m);
+	writeBack->cond.wait(l, [&] { return writeBack->pendingBytes <= aMaxPending || !writeBack->error.empty(); });
+
+	if (!writeBack->error.empty()) {
+		throw FileException(writeBack->error);
+	}
+}
+
 size_t SharedFileStream::read(void* buf, size_t& len) {
+	if (writeBack) {
+		// Read the written data from the disk
+		queueWrite();
+		waitPending(0);
+	}
+
 	Lock l(sfh->cs);
 
 	sfh->setPos(pos);
@@ -89,11 +214,26 @@ void SharedFileStream::setSize(int64_t newSize) {
 }
 
 size_t SharedFileStream::flushBuffers(bool aForce) {
+	if (writeBack) {
+		queueWrite();
+		waitPending(0);
+	}
+
 	Lock l(sfh->cs);
 	return sfh->flushBuffers(aForce);
 }
 
 void SharedFileStream::setPos(int64_t aPos) noexcept {
+	if (!buf.empty() && aPos != pos) {
+		// Not continuing the buffered block
+		try {
+			queueWrite();
+		} catch (const std::bad_alloc&) {
+			// Thrown from the next write
+			setError("Out of memory");
+		}
+	}
+
 	pos = aPos;
 }
 
@@ -21,10 +21,14 @@
 #define _SHAREDFILESTREAM_H
 
 #include "CriticalSection.h"
+#include "DispatcherQueue.h"
 #include "File.h"
 #include "GetSet.h"
 #include "Thread.h"
 
+#include <condition_variable>
+#include <mutex>
+
 namespace dcpp {
 
 struct SharedFileHandle : File {
@@ -35,8 +39,19 @@ struct SharedFileHandle : File {
 	int	ref_cnt;
 	string path;
 	int mode;
+
+	// Writer thread of the device (not used for reading)
+	DispatcherQueue* const writeQueue;
 };
 
+/**
+ * File stream that can be used by multiple segments of the same file simultaneously
+ *
+ * Written data is collected into large aligned blocks that are written by a background thread of the
+ * device so that the socket threads won't block on disk I/O (or on other segments writing to the same file).
+ * Write errors are thrown from the following write or flushBuffers call. flushBuffers must be called
+ * before the stream is destroyed if the errors need to be handled.
+ */
 class SharedFileStream : public IOStream
 {
 
@@ -60,8 +75,31 @@ public:
 
 	void setPos(int64_t aPos) noexcept override;
 private:
+	// Write-back state that is shared with the queued writes
+	struct WriteBack {
+		mutex m;
+		condition_variable cond;
+		size_t pendingBytes = 0;
+		string error;
+	};
+
 	SharedFileHandle* sfh;
 	int64_t pos;
+
+	// Data that hasn't been queued for writing yet
+	ByteVector buf;
+	int64_t bufStart = 0;
+
+	shared_ptr<WriteBack> writeBack;
+
+	// Queue the buffered data until aEnd (or everything if it's -1)
+	void queueWrite(int64_t aEnd = -1);
+
+	// Store an error to be thrown from the following write or flush call
+	void setError(const string& aError) noexcept;
+
+	// Wait until there are less than aMaxPending bytes waiting to be written, throws on write errors
+	void waitPending(size_t aMaxPending);
 };
 
 }
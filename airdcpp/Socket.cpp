@@ -20,6 +20,7 @@
 #include "Socket.h"
 
 #include "ConnectivityManager.h"
+#include "File.h"
 #include "format.h"
 #include "SettingsManager.h"
 #include "TimerManager.h"
@@ -32,6 +33,10 @@
 #endif
 #endif
 
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
 #ifndef AI_ADDRCONFIG
 #define AI_ADDRCONFIG 0
 #endif
@@ -613,6 +618,74 @@ int Socket::read(void* aBuffer, int aBufLen, string &aIP) {
 	return len;
 }
 
+#ifdef HAVE_RECVMMSG
+struct Socket::ReadBatch::Headers {
+	Headers(uint8_t* aBuffer, int aBufLen, int aCount) : msgs(aCount), iovecs(aCount), addrs(aCount) {
+		for (int i = 0; i < aCount; ++i) {
+			iovecs[i].iov_base = aBuffer + i * aBufLen;
+			iovecs[i].iov_len = aBufLen;
+
+			auto& hdr = msgs[i].msg_hdr;
+			hdr.msg_iov = &iovecs[i];
+			hdr.msg_iovlen = 1;
+			hdr.msg_name = &addrs[i].sa;
+		}
+	}
+
+	vector<mmsghdr> msgs;
+	vector<iovec> iovecs;
+	vector<addr> addrs;
+};
+#else
+struct Socket::ReadBatch::Headers {
+	Headers(uint8_t*, int, int) { }
+};
+#endif
+
+Socket::ReadBatch::ReadBatch(int aBufLen, int aCount) : bufLen(aBufLen), count(aCount), buffer(aBufLen * aCount),
+	headers(new Headers(buffer.data(), aBufLen, aCount)) {
+
+}
+
+Socket::ReadBatch::~ReadBatch() { }
+
+int Socket::readBatch(ReadBatch& aBatch, vector<pair<int, string>>& datagrams_) {
+	dcassert(type == TYPE_UDP);
+	datagrams_.clear();
+
+#ifdef HAVE_RECVMMSG
+	auto& msgs = aBatch.headers->msgs;
+	auto& addrs = aBatch.headers->addrs;
+	for (auto& msg : msgs) {
+		// Modified by the previous read
+		msg.msg_hdr.msg_namelen = sizeof(addr);
+		msg.msg_hdr.msg_flags = 0;
+	}
+
+	auto count = check([&] {
+		return ::recvmmsg(readable(sock4, sock6), &msgs[0], aBatch.count, MSG_DONTWAIT, nullptr);
+	}, true);
+
+	for (int i = 0; i < count; ++i) {
+		auto len = static_cast<int>(msgs[i].msg_len);
+		datagrams_.emplace_back(len, resolveName(&addrs[i].sa, msgs[i].msg_hdr.msg_namelen));
+		stats.totalDown += len;
+	}
+#else
+	string ip;
+	while (static_cast<int>(datagrams_.size()) < aBatch.count) {
+		auto len = read(&aBatch.buffer[datagrams_.size() * aBatch.bufLen], aBatch.bufLen, ip);
+		if (len <= 0) {
+			break;
+		}
+
+		datagrams_.emplace_back(len, ip);
+	}
+#endif
+
+	return static_cast<int>(datagrams_.size());
+}
+
 int Socket::socksRead(ByteVector& aBuffer, int aBufLen, std::function<bool(const ByteVector& aBuffer, int aBufLen)>&& aIsComplete, uint64_t aTimeout) {
 	int i = 0;
 	while (i <= 0 || !aIsComplete(aBuffer, i)) {
@@ -665,6 +738,49 @@ int Socket::write(const void* aBuffer, int aLen) {
 	return sent;
 }
 
+#ifdef HAVE_SYS_SENDFILE_H
+
+bool Socket::canSendFile() const noexcept {
+	return true;
+}
+
+int Socket::sendFile(File& aFile, int aLen) {
+	dcassert(!isSecure());
+	for (;;) {
+		auto sent = ::sendfile(getSock(), aFile.getNativeHandle(), nullptr, aLen);
+		if (sent != -1) {
+			stats.totalUp += sent;
+			return static_cast<int>(sent);
+		}
+
+		auto error = getLastError();
+		if (error == EINVAL || error == ENOSYS) {
+			// The file system doesn't support it
+			return 0;
+		}
+
+		if (error == EWOULDBLOCK || error == ENOBUFS || error == EAGAIN) {
+			return -1;
+		}
+
+		if (error != EINTR) {
+			throw SocketException(error);
+		}
+	}
+}
+
+#else
+
+bool Socket::canSendFile() const noexcept {
+	return false;
+}
+
+int Socket::sendFile(File&, int) {
+	return 0;
+}
+
+#endif
+
 /**
  * Sends data, will block until all data has been sent or an exception occurs
  * @param aBuffer Buffer with data
@@ -739,6 +855,53 @@ void Socket::writeTo(const string& aAddr, const string& aPort, const void* aBuff
 	stats.totalUp += sent;
 }
 
+void Socket::writeTo(const string& aAddr, const string& aPort, const StringList& aDatagrams) {
+#ifdef HAVE_SENDMMSG
+	if (aDatagrams.size() > 1 && !(CONNSETTING(OUTGOING_CONNECTIONS) == SettingsManager::OUTGOING_SOCKS5 && socksUdpInitialized())) {
+		if (aAddr.empty() || aPort.empty()) {
+			throw SocketException(EADDRNOTAVAIL);
+		}
+
+		auto ai = resolveAddr(aAddr, aPort);
+		if ((ai->ai_family == AF_INET && !sock4.valid()) || (ai->ai_family == AF_INET6 && !sock6.valid())) {
+			create(*ai);
+		}
+
+		vector<mmsghdr> msgs(aDatagrams.size());
+		vector<iovec> iovecs(aDatagrams.size());
+		for (size_t i = 0; i < aDatagrams.size(); ++i) {
+			iovecs[i].iov_base = const_cast<char*>(aDatagrams[i].data());
+			iovecs[i].iov_len = aDatagrams[i].size();
+
+			auto& hdr = msgs[i].msg_hdr;
+			hdr.msg_iov = &iovecs[i];
+			hdr.msg_iovlen = 1;
+			hdr.msg_name = ai->ai_addr;
+			hdr.msg_namelen = ai->ai_addrlen;
+		}
+
+		socket_t sock = ai->ai_family == AF_INET ? sock4 : sock6;
+		for (size_t pos = 0; pos < msgs.size();) {
+			auto sent = check([&] {
+				return ::sendmmsg(sock, &msgs[pos], static_cast<unsigned int>(msgs.size() - pos), 0);
+			});
+
+			for (int i = 0; i < sent; ++i) {
+				stats.totalUp += msgs[pos + i].msg_len;
+			}
+
+			pos += sent;
+		}
+
+		return;
+	}
+#endif
+
+	for (const auto& d : aDatagrams) {
+		writeTo(aAddr, aPort, d);
+	}
+}
+
 /**
  * Blocks until timeout is reached one of the specified conditions have been fulfilled
  * @param millis Max milliseconds to block.
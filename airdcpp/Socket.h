@@ -92,6 +92,27 @@ public:
 	typedef std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> addrinfo_p;
 	typedef vector<addrinfo_p> AddrinfoList;
 
+	// Buffers for readBatch, allocated once and reused for all reads
+	class ReadBatch : boost::noncopyable {
+	public:
+		ReadBatch(int aBufLen, int aCount);
+		~ReadBatch();
+
+		// Data of the datagram with the given index
+		const uint8_t* getData(int aIndex) const noexcept { return &buffer[aIndex * bufLen]; }
+		int getCount() const noexcept { return count; }
+	private:
+		friend class Socket;
+
+		const int bufLen;
+		const int count;
+		ByteVector buffer;
+
+		// Message headers of the platform (if available)
+		struct Headers;
+		std::unique_ptr<Headers> headers;
+	};
+
 	explicit Socket(SocketType type) : type(type) { }
 
 	virtual ~Socket() { }
@@ -115,6 +136,22 @@ public:
 	int write(const string& aData) { return write(aData.data(), (int)aData.length()); }
 	virtual void writeTo(const string& aIp, const string& aPort, const void* aBuffer, int aLen);
 	void writeTo(const string& aIp, const string& aPort, const string& aData) { writeTo(aIp, aPort, aData.data(), (int)aData.length()); }
+
+	/**
+	 * Sends multiple datagrams to the same address with as few calls as possible
+	 * @throw SocketException Send failed.
+	 */
+	void writeTo(const string& aIp, const string& aPort, const StringList& aDatagrams);
+
+	/**
+	 * Sends data starting from the current position of the file without copying it through
+	 * user space. This may only be used if canSendFile returns true.
+	 * @return Number of bytes sent, -1 if the call would block or 0 if the file can't be sent directly.
+	 * @throw SocketException On any failure.
+	 */
+	virtual int sendFile(File& aFile, int aLen);
+	virtual bool canSendFile() const noexcept;
+
 	virtual void shutdown() noexcept;
 	virtual void close() noexcept;
 	void disconnect() noexcept;
@@ -140,6 +177,15 @@ public:
 	 */
 	virtual int read(void* aBuffer, int aBufLen, string &aIP);
 
+	/**
+	 * Reads up to aBatch.getCount() datagrams with as few calls as possible. The data of each
+	 * datagram can be accessed with aBatch.getData.
+	 * @param datagrams_ Length and remote IP address of each received datagram
+	 * @return Number of datagrams read, 0 if the call would block.
+	 * @throw SocketException On any failure.
+	 */
+	int readBatch(ReadBatch& aBatch, vector<pair<int, string>>& datagrams_);
+
 	virtual std::pair<bool, bool> wait(uint64_t millis, bool checkRead, bool checkWrite);
 
 	static string resolve(const string& aDns, int af = AF_UNSPEC) noexcept;
@@ -186,6 +232,10 @@ public:
 	}
 
 	bool isV6Valid() const noexcept;
+
+	// Returns the handle of the connected socket
+	socket_t getSock() const;
+
 	static string resolveName(const sockaddr* sa, socklen_t sa_len, int flags = NI_NUMERICHOST);
 protected:
 	typedef union {
@@ -195,8 +245,6 @@ protected:
 		sockaddr_storage sas;
 	} addr;
 
-	socket_t getSock() const;
-
 	mutable SocketHandle sock4;
 	mutable SocketHandle sock6;
 
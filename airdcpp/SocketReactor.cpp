@@ -0,0 +1,413 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "SocketReactor.h"
+
+#include "BufferedSocket.h"
+#include "SettingsManager.h"
+#include "TimerManager.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace dcpp {
+
+// How long to wait before retrying sockets that ran out of bandwidth limiter tokens
+#define THROTTLE_RETRY 20
+
+#define MAX_EVENTS 128
+
+SocketReactor::SocketReactor() {
+
+}
+
+SocketReactor::~SocketReactor() {
+	for (auto& l : loops) {
+		l->stop();
+		l->join();
+	}
+}
+
+bool SocketReactor::adopt(BufferedSocket* aSocket) noexcept {
+	Loop* loop = nullptr;
+
+	{
+		Lock l(cs);
+		if (loops.empty()) {
+			// Started on demand so that the current setting is used
+			auto threads = SETTING(SOCKET_IO_THREADS);
+			try {
+				for (int i = 0; i < threads; ++i) {
+					auto newLoop = make_unique<Loop>();
+					newLoop->start();
+					loops.push_back(move(newLoop));
+				}
+			} catch (const Exception& e) {
+				dcdebug("Failed to start the socket reactor: %s\n", e.getError().c_str());
+			}
+
+			if (loops.empty()) {
+				return false;
+			}
+		}
+
+		loop = loops[nextLoop++ % loops.size()].get();
+	}
+
+	loop->adopt(aSocket);
+	return true;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+bool SocketReactor::isSupported() noexcept {
+	return true;
+}
+
+SocketReactor::Loop::Loop() {
+	pollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (pollFd == -1) {
+		throw Exception(Util::translateError(errno));
+	}
+
+	eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (eventFd == -1) {
+		auto error = errno;
+		::close(pollFd);
+		throw Exception(Util::translateError(error));
+	}
+
+	// Wakeups are identified by a null pointer
+	epoll_event ev = { 0 };
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+	epoll_ctl(pollFd, EPOLL_CTL_ADD, eventFd, &ev);
+}
+
+SocketReactor::Loop::~Loop() {
+	::close(eventFd);
+	::close(pollFd);
+}
+
+void SocketReactor::Loop::adopt(BufferedSocket* aSocket) noexcept {
+	{
+		Lock l(cs);
+		adopted.push_back(aSocket);
+	}
+
+	wakeup();
+}
+
+void SocketReactor::Loop::schedule(BufferedSocket* aSocket) noexcept {
+	{
+		Lock l(cs);
+		scheduled.push_back(aSocket);
+	}
+
+	wakeup();
+}
+
+void SocketReactor::Loop::stop() noexcept {
+	{
+		Lock l(cs);
+		stopping = true;
+	}
+
+	wakeup();
+}
+
+void SocketReactor::Loop::wakeup() noexcept {
+	uint64_t value = 1;
+	if (::write(eventFd, &value, sizeof(value)) == -1) {
+		// The counter is full so there is a pending wakeup already
+	}
+}
+
+void SocketReactor::Loop::registerSocket(BufferedSocket* aSocket) noexcept {
+	// Wait for the thread of the socket to exit
+	aSocket->join();
+
+	{
+		Lock l(aSocket->cs);
+		aSocket->reactorLoop = this;
+	}
+
+	if (aSocket->state == BufferedSocket::RUNNING) {
+		epoll_event ev = { 0 };
+		ev.events = EPOLLIN;
+		ev.data.ptr = aSocket;
+		if (epoll_ctl(pollFd, EPOLL_CTL_ADD, aSocket->sock->getSock(), &ev) == 0) {
+			aSocket->reactorRegistered = true;
+			aSocket->reactorEvents = EPOLLIN;
+		} else {
+			aSocket->fail(Util::translateError(errno));
+		}
+	}
+
+	// Tasks that were added before the loop was set
+	runTasks(aSocket);
+}
+
+void SocketReactor::Loop::update(BufferedSocket* aSocket) noexcept {
+	if (!aSocket->reactorRegistered) {
+		return;
+	}
+
+	uint32_t events = 0;
+	if (!aSocket->readParked) {
+		events |= EPOLLIN;
+	}
+
+	if (!aSocket->writeParked && aSocket->hasPendingWrite()) {
+		events |= EPOLLOUT;
+	}
+
+	if (events == aSocket->reactorEvents) {
+		return;
+	}
+
+	epoll_event ev = { 0 };
+	ev.events = events;
+	ev.data.ptr = aSocket;
+	if (epoll_ctl(pollFd, EPOLL_CTL_MOD, aSocket->sock->getSock(), &ev) == 0) {
+		aSocket->reactorEvents = events;
+	} else {
+		dcdebug("SocketReactor: failed to update the events (%s)\n", Util::translateError(errno).c_str());
+	}
+}
+
+void SocketReactor::Loop::remove(BufferedSocket* aSocket) noexcept {
+	if (aSocket->reactorRegistered) {
+		epoll_ctl(pollFd, EPOLL_CTL_DEL, aSocket->sock->getSock(), nullptr);
+		aSocket->reactorRegistered = false;
+	}
+
+	parked.erase(std::remove_if(parked.begin(), parked.end(), [aSocket](const pair<uint64_t, BufferedSocket*>& p) { return p.second == aSocket; }), parked.end());
+	readAgain.erase(std::remove(readAgain.begin(), readAgain.end(), aSocket), readAgain.end());
+}
+
+void SocketReactor::Loop::close(BufferedSocket* aSocket) noexcept {
+	remove(aSocket);
+
+	aSocket->reactorClosed = true;
+	closed.push_back(aSocket);
+}
+
+void SocketReactor::Loop::park(BufferedSocket* aSocket, bool aRead) noexcept {
+	auto& isParked = aRead ? aSocket->readParked : aSocket->writeParked;
+	if (isParked) {
+		return;
+	}
+
+	isParked = true;
+	parked.emplace_back(GET_TICK() + THROTTLE_RETRY, aSocket);
+}
+
+void SocketReactor::Loop::resumeParked() noexcept {
+	if (parked.empty()) {
+		return;
+	}
+
+	auto tick = GET_TICK();
+	for (auto i = parked.begin(); i != parked.end();) {
+		if (i->first > tick) {
+			++i;
+			continue;
+		}
+
+		// The events will be received again if the socket is still ready
+		auto s = i->second;
+		s->readParked = false;
+		s->writeParked = false;
+		i = parked.erase(i);
+
+		update(s);
+	}
+}
+
+void SocketReactor::Loop::runTasks(BufferedSocket* aSocket) noexcept {
+	// The remaining tasks (such as shutdown) must be handled after a failure
+	for (;;) {
+		try {
+			aSocket->reactorTasks();
+			break;
+		} catch (const Exception& e) {
+			aSocket->fail(e.getError());
+		}
+	}
+
+	if (!aSocket->reactorClosed) {
+		update(aSocket);
+	}
+}
+
+void SocketReactor::Loop::handleRead(BufferedSocket* aSocket, bool aHangup) noexcept {
+	try {
+		auto ret = aSocket->reactorRead(aHangup);
+		if (ret == BufferedSocket::REACTOR_THROTTLED) {
+			park(aSocket, true);
+		} else if (ret == BufferedSocket::REACTOR_AGAIN) {
+			readAgain.push_back(aSocket);
+		}
+	} catch (const Exception& e) {
+		aSocket->fail(e.getError());
+	}
+
+	update(aSocket);
+}
+
+void SocketReactor::Loop::handleWrite(BufferedSocket* aSocket) noexcept {
+	try {
+		if (aSocket->reactorWrite() == BufferedSocket::REACTOR_THROTTLED) {
+			park(aSocket, false);
+		}
+	} catch (const Exception& e) {
+		aSocket->fail(e.getError());
+	}
+
+	update(aSocket);
+}
+
+int SocketReactor::Loop::pollTimeout() const noexcept {
+	if (!readAgain.empty()) {
+		return 0;
+	}
+
+	if (parked.empty()) {
+		return -1;
+	}
+
+	auto tick = GET_TICK();
+	auto next = min_element(parked.begin(), parked.end())->first;
+	return next > tick ? static_cast<int>(next - tick) : 0;
+}
+
+int SocketReactor::Loop::run() {
+	epoll_event events[MAX_EVENTS];
+
+	for (;;) {
+		vector<BufferedSocket*> newSockets, pendingTasks;
+
+		{
+			Lock l(cs);
+			if (stopping) {
+				break;
+			}
+
+			adopted.swap(newSockets);
+			scheduled.swap(pendingTasks);
+		}
+
+		for (auto s : newSockets) {
+			registerSocket(s);
+		}
+
+		for (auto s : pendingTasks) {
+			if (s->reactorClosed) {
+				continue;
+			}
+
+			s->reactorScheduled = false;
+			runTasks(s);
+		}
+
+		{
+			vector<BufferedSocket*> pendingReads;
+			pendingReads.swap(readAgain);
+			for (auto s : pendingReads) {
+				if (s->reactorRegistered && !s->readParked) {
+					handleRead(s, false);
+				}
+			}
+		}
+
+		resumeParked();
+
+		// Nothing refers to the closed sockets after they have been removed from the poll set
+		for (auto s : closed) {
+			delete s;
+		}
+
+		closed.clear();
+
+		int n = epoll_wait(pollFd, events, MAX_EVENTS, pollTimeout());
+		if (n == -1 && errno != EINTR) {
+			dcdebug("SocketReactor: epoll_wait failed (%s)\n", Util::translateError(errno).c_str());
+		}
+
+		for (int i = 0; i < n; ++i) {
+			auto s = static_cast<BufferedSocket*>(events[i].data.ptr);
+			if (!s) {
+				uint64_t value;
+				while (::read(eventFd, &value, sizeof(value)) > 0) {
+					// Just clear the counter
+				}
+				continue;
+			}
+
+			// The socket may have been removed while handling the previous events
+			if (!s->reactorRegistered) {
+				continue;
+			}
+
+			auto ev = events[i].events;
+			if (ev & (EPOLLERR | EPOLLHUP)) {
+				handleRead(s, true);
+				continue;
+			}
+
+			if (ev & EPOLLIN) {
+				handleRead(s, false);
+			}
+
+			if ((ev & EPOLLOUT) && s->reactorRegistered) {
+				handleWrite(s);
+			}
+		}
+
+	}
+
+	return 0;
+}
+
+#else
+
+bool SocketReactor::isSupported() noexcept {
+	return false;
+}
+
+// Sockets are never handed over on platforms without a supported polling mechanism
+SocketReactor::Loop::Loop() {
+	throw Exception("Not supported");
+}
+
+SocketReactor::Loop::~Loop() { }
+void SocketReactor::Loop::adopt(BufferedSocket*) noexcept { dcassert(0); }
+void SocketReactor::Loop::schedule(BufferedSocket*) noexcept { dcassert(0); }
+void SocketReactor::Loop::stop() noexcept { }
+void SocketReactor::Loop::remove(BufferedSocket*) noexcept { dcassert(0); }
+void SocketReactor::Loop::close(BufferedSocket*) noexcept { dcassert(0); }
+int SocketReactor::Loop::run() { return 0; }
+
+#endif
+
+} // namespace dcpp
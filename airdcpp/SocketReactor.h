@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_SOCKET_REACTOR_H
+#define DCPLUSPLUS_DCPP_SOCKET_REACTOR_H
+
+#include "typedefs.h"
+
+#include "CriticalSection.h"
+#include "Singleton.h"
+#include "Thread.h"
+
+namespace dcpp {
+
+/**
+* Event loops (epoll) that run the connected buffered sockets with a small fixed number of threads
+* instead of having a separate thread for each socket.
+*
+* Each socket is owned by a single loop so that the listener events of a socket are still fired
+* from one thread at a time. Sockets use their own threads while connecting (name resolution,
+* proxies and TLS handshakes are blocking) and they are handed over to a loop after that.
+*/
+class SocketReactor : public Singleton<SocketReactor> {
+public:
+	class Loop : public Thread {
+	public:
+		Loop();
+		~Loop();
+
+		// Start running an already connected socket (the thread of the socket must be exiting)
+		void adopt(BufferedSocket* aSocket) noexcept;
+
+		// Process the pending tasks of the socket
+		void schedule(BufferedSocket* aSocket) noexcept;
+
+		void stop() noexcept;
+
+		// The following methods may only be called from the loop thread
+
+		// Stop polling the socket (e.g. it has failed)
+		void remove(BufferedSocket* aSocket) noexcept;
+
+		// Remove the socket and delete it after the events of the current round have been handled
+		void close(BufferedSocket* aSocket) noexcept;
+	private:
+		int run() override;
+
+		void registerSocket(BufferedSocket* aSocket) noexcept;
+		void update(BufferedSocket* aSocket) noexcept;
+		void park(BufferedSocket* aSocket, bool aRead) noexcept;
+		void resumeParked() noexcept;
+
+		void runTasks(BufferedSocket* aSocket) noexcept;
+		void handleRead(BufferedSocket* aSocket, bool aHangup) noexcept;
+		void handleWrite(BufferedSocket* aSocket) noexcept;
+
+		int pollTimeout() const noexcept;
+		void wakeup() noexcept;
+
+		CriticalSection cs;
+		vector<BufferedSocket*> adopted;
+		vector<BufferedSocket*> scheduled;
+		bool stopping = false;
+
+		int pollFd = -1;
+		int eventFd = -1;
+
+		// Loop thread only
+		vector<pair<uint64_t, BufferedSocket*>> parked;
+		vector<BufferedSocket*> readAgain;
+		vector<BufferedSocket*> closed;
+	};
+
+	SocketReactor();
+	~SocketReactor();
+
+	// Returns false if the socket should keep using its own thread
+	bool adopt(BufferedSocket* aSocket) noexcept;
+
+	static bool isSupported() noexcept;
+private:
+	CriticalSection cs;
+	vector<unique_ptr<Loop>> loops;
+	size_t nextLoop = 0;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_SOCKET_REACTOR_H)
@@ -79,6 +79,16 @@ public:
 	/* This only works for file streams */
 	virtual void setPos(int64_t /*pos*/) noexcept { }
 	virtual InputStream* releaseRootStream() { return this; }
+
+	/**
+		* Returns the file that the data can be sent from without reading it through the stream
+		* (starting from the current file position) or nullptr if the stream modifies the data.
+		* maxBytes_ is set to the number of bytes that may be sent from the file.
+		*/
+	virtual File* getDirectFile(int64_t& /*maxBytes_*/) noexcept { return nullptr; }
+
+	/* Must be called after sending data directly from the file */
+	virtual void directRead(int64_t /*aBytes*/) noexcept { }
 };
 
 class IOStream : public InputStream, public OutputStream {
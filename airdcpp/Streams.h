@@ -85,6 +85,12 @@ public:
 		auto as = s.release();
 		return as->releaseRootStream();
 	}
+
+	File* getDirectFile(int64_t& maxBytes_) noexcept override { return s->getDirectFile(maxBytes_); }
+	void directRead(int64_t aBytes) noexcept override {
+		s->directRead(aBytes);
+		readBytes += aBytes;
+	}
 private:
 	unique_ptr<InputStream> s;
 	uint64_t readBytes;
@@ -115,6 +121,17 @@ public:
 		auto as = s.release();
 		return as->releaseRootStream();
 	}
+
+	File* getDirectFile(int64_t& maxBytes_) noexcept override {
+		auto f = s->getDirectFile(maxBytes_);
+		maxBytes_ = min(maxBytes_, maxBytes);
+		return f;
+	}
+
+	void directRead(int64_t aBytes) noexcept override {
+		s->directRead(aBytes);
+		maxBytes -= aBytes;
+	}
 private:
 	unique_ptr<InputStream> s;
 	int64_t maxBytes;
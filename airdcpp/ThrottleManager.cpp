@@ -28,11 +28,13 @@ namespace dcpp {
 	// The actual limiting code is from StrongDC++
 	// Bandwidth limiting in DC++ is broken: https://www.airdcpp.net/forum/viewtopic.php?f=7&t=4485&p=8856#p8856
 
-	#define CONDWAIT_TIMEOUT		250
+	// Maximum time to sleep while waiting for new tokens (ms)
+	#define MAX_WAIT		250
 
 	// constructor
 	ThrottleManager::ThrottleManager(void)
 	{
+		updateLimits();
 		TimerManager::getInstance()->addListener(this);
 	}
 
@@ -40,80 +42,120 @@ namespace dcpp {
 	ThrottleManager::~ThrottleManager()
 	{
 		TimerManager::getInstance()->removeListener(this);
-
-		// release conditional variables on exit
-		downCond.notify_all();
-		upCond.notify_all();
 	}
 
-	/*
-	 * Limits a traffic and reads a packet from the network
-	 */
-	int ThrottleManager::read(Socket* sock, void* buffer, size_t len)
+	ThrottleManager::Tokens ThrottleManager::takeTokens(Limiter& aLimiter, TokenBucket& aBucket, size_t aLen, bool aWait) noexcept
 	{
-		size_t downs = DownloadManager::getInstance()->getTotalDownloadConnectionCount();
-		if (getDownLimit() == 0 || downs == 0)
-			return sock->read(buffer, len);
+		Tokens ret;
 
-		unique_lock<mutex> lock(downMutex);
+		auto rate = aLimiter.rate.load();
+		if (rate == 0)
+		{
+			ret.charged = aLen;
+			return ret;
+		}
 
+		auto share = aLimiter.share.load();
+		auto now = TokenBucket::now();
+		auto len = static_cast<int64_t>(aLen);
 
-		if(downTokens > 0)
+		// guaranteed share of the connection, the global bucket is allowed to go in debt for a while
+		// so that it won't be emptied by connections borrowing tokens
+		auto taken = aBucket.take(len, share, now);
+		if (taken > 0)
 		{
-			size_t slice = (getDownLimit() * 1024) / downs;
-			size_t readSize = min(slice, min(len, downTokens));
-				
-			// read from socket
-			readSize = sock->read(buffer, readSize);
-				
-			if(readSize > 0)
-				downTokens -= readSize;
-
-			// next code can't be in critical section, so we must unlock here
-			lock.unlock();
-
-			// give a chance to other transfers to get a token
-			Thread::yield();
-			return readSize;
+			auto charged = aLimiter.bucket.take(taken, rate, now, -TokenBucket::getCapacity(rate));
+			if (charged < taken)
+			{
+				// the connection count is outdated
+				aBucket.giveBack(taken - charged, share);
+				taken = charged;
+			}
 		}
 
-		// no tokens, wait for them
-		downCond.wait_for(lock, std::chrono::milliseconds(CONDWAIT_TIMEOUT));
-		return -1;	// from BufferedSocket: -1 = retry, 0 = connection close
+		// borrow tokens that haven't been used by other connections
+		int64_t borrowed = 0;
+		if (taken < len)
+			borrowed = aLimiter.bucket.take(len - taken, rate, now);
+
+		if (taken == 0 && borrowed == 0 && aWait)
+		{
+			// sleep until either of the buckets has new tokens
+			auto wait = min(aBucket.getWaitTime(share), aLimiter.bucket.getWaitTime(rate)) / 1000;
+			Thread::sleep(static_cast<uint32_t>(min(max(wait, static_cast<uint64_t>(1)), static_cast<uint64_t>(MAX_WAIT))));
+		}
+
+		ret.charged = static_cast<size_t>(taken);
+		ret.borrowed = static_cast<size_t>(borrowed);
+		return ret;
+	}
+
+	void ThrottleManager::returnTokens(Limiter& aLimiter, TokenBucket& aBucket, const Tokens& aTaken, size_t aUnused) noexcept
+	{
+		auto rate = aLimiter.rate.load();
+		if (rate == 0 || aUnused == 0)
+			return;
+
+		dcassert(aUnused <= aTaken.get());
+
+		// the borrowed tokens were taken last, they are returned to the global bucket only
+		auto borrowed = min(aUnused, aTaken.borrowed);
+		auto charged = min(aUnused - borrowed, aTaken.charged);
+
+		aLimiter.bucket.giveBack(static_cast<int64_t>(borrowed + charged), rate);
+		if (charged > 0)
+			aBucket.giveBack(static_cast<int64_t>(charged), aLimiter.share.load());
+	}
+
+	/*
+	 * Limits a traffic and reads a packet from the network
+	 */
+	int ThrottleManager::read(Socket* sock, TokenBucket& aBucket, void* buffer, size_t len, bool aWait)
+	{
+		auto tokens = takeTokens(down, aBucket, len, aWait);
+		auto readSize = tokens.get();
+		if (readSize == 0)
+			return -1;	// from BufferedSocket: -1 = retry, 0 = connection close
+
+		// read from socket
+		auto ret = sock->read(buffer, readSize);
+		if (static_cast<size_t>(max(ret, 0)) < readSize)
+			returnTokens(down, aBucket, tokens, readSize - max(ret, 0));
+
+		return ret;
 	}
 	
 	/*
 	 * Limits a traffic and writes a packet to the network
 	 * We must handle this a little bit differently than downloads, because of that stupidity in OpenSSL
 	 */		
-	int ThrottleManager::write(Socket* sock, void* buffer, size_t& len)
+	int ThrottleManager::write(Socket* sock, TokenBucket& aBucket, void* buffer, size_t& len, bool aWait)
 	{
-		size_t ups = UploadManager::getInstance()->getUploadCount();
-		if(getUpLimit() == 0 || ups == 0)
-			return sock->write(buffer, len);
-		
-		unique_lock<mutex> lock(upMutex);
-		
-		if(upTokens > 0)
-		{
-			size_t slice = (getUpLimit() * 1024) / ups;
-			len = min(slice, min(len, upTokens));
-			upTokens -= len;
+		auto tokens = takeTokens(up, aBucket, len, aWait);
+		auto writeSize = tokens.get();
+		if (writeSize == 0)
+			return 0;	// from BufferedSocket: -1 = failed, 0 = retry
 
-			// next code can't be in critical section, so we must unlock here
-			lock.unlock();
+		// the same size must be used when retrying
+		len = writeSize;
 
-			// write to socket			
-			int sent = sock->write(buffer, len);
+		// write to socket
+		// the tokens are kept if the write would block because it will be retried without the limiter
+		auto sent = sock->write(buffer, len);
+		if (sent >= 0 && static_cast<size_t>(sent) < len)
+			returnTokens(up, aBucket, tokens, len - sent);
 
-			// give a chance to other transfers to get a token
-			Thread::yield();
-			return sent;
-		}
-		
-		// no tokens, wait for them
-		upCond.wait_for(lock, std::chrono::milliseconds(CONDWAIT_TIMEOUT));
-		return 0;	// from BufferedSocket: -1 = failed, 0 = retry
+		return sent;
+	}
+
+	ThrottleManager::Tokens ThrottleManager::takeUpTokens(TokenBucket& aBucket, size_t len, bool aWait)
+	{
+		return takeTokens(up, aBucket, len, aWait);
+	}
+
+	void ThrottleManager::returnUpTokens(TokenBucket& aBucket, const Tokens& aTaken, size_t aUnused) noexcept
+	{
+		returnTokens(up, aBucket, aTaken, aUnused);
 	}
 
 	void ThrottleManager::setSetting(SettingsManager::IntSetting setting, int value) noexcept {
@@ -163,25 +205,20 @@ namespace dcpp {
 		}
 	}
 
+	void ThrottleManager::updateLimiter(Limiter& aLimiter, int64_t aRate, size_t aConnections) noexcept {
+		aLimiter.rate = aRate;
+		aLimiter.share = aRate / static_cast<int64_t>(max(aConnections, static_cast<size_t>(1)));
+	}
+
+	void ThrottleManager::updateLimits() noexcept {
+		updateLimiter(down, static_cast<int64_t>(getDownLimit()) * 1024, DownloadManager::getInstance()->getTotalDownloadConnectionCount());
+		updateLimiter(up, static_cast<int64_t>(getUpLimit()) * 1024, UploadManager::getInstance()->getUploadCount());
+	}
+
 	// TimerManagerListener
 	void ThrottleManager::on(TimerManagerListener::Second, uint64_t /*aTick*/) noexcept {
-		auto downLimit = getDownLimit() * 1024;
-		auto upLimit = getUpLimit() * 1024;
-		
-		// readd tokens
-		if(downLimit > 0)
-		{
-			lock_guard<mutex> lock(downMutex);
-			downTokens = downLimit;
-			downCond.notify_all();
-		}
-			
-		if(upLimit > 0)
-		{
-			lock_guard<mutex> lock(upMutex);
-			upTokens = upLimit;
-			upCond.notify_all();
-		}
+		// the tokens are added when they are needed, only the limits and the connection shares are updated here
+		updateLimits();
 	}
 
 
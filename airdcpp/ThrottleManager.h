@@ -22,9 +22,7 @@
 #include "Singleton.h"
 #include "SettingsManager.h"
 #include "TimerManagerListener.h"
-
-#include <condition_variable>
-#include <mutex>
+#include "TokenBucket.h"
 
 
 namespace dcpp
@@ -33,22 +31,51 @@ namespace dcpp
 	/**
 	 * Manager for throttling traffic flow speed.
 	 * Inspired by Token Bucket algorithm: http://en.wikipedia.org/wiki/Token_bucket
+	 *
+	 * Each limited connection has its own bucket that is refilled with an equal share of the global limit,
+	 * which guarantees bandwidth for slow transfers. Tokens that aren't used by other connections can be
+	 * borrowed from the global bucket so that the total limit is still reached.
 	 */
 	class ThrottleManager :
 		public Singleton<ThrottleManager>, private TimerManagerListener
 	{
 	public:
+		// Upload tokens taken for a single transfer
+		struct Tokens {
+			// Charged from both the connection and the global bucket
+			size_t charged = 0;
+
+			// Borrowed from the global bucket only
+			size_t borrowed = 0;
+
+			size_t get() const noexcept { return charged + borrowed; }
+		};
 
 		/*
 		 * Limits a traffic and reads a packet from the network
+		 * aBucket is the download bucket of the connection
+		 * Returns -1 without waiting for new tokens if aWait is false
 		 */
-		int read(Socket* sock, void* buffer, size_t len);
+		int read(Socket* sock, TokenBucket& aBucket, void* buffer, size_t len, bool aWait = true);
 		
 		/*
 		 * Limits a traffic and writes a packet to the network
+		 * aBucket is the upload bucket of the connection
 		 * We must handle this a little bit differently than downloads, because of that stupidity in OpenSSL
+		 * Returns 0 without waiting for new tokens if aWait is false
 		 */		
-		int write(Socket* sock, void* buffer, size_t& len);
+		int write(Socket* sock, TokenBucket& aBucket, void* buffer, size_t& len, bool aWait = true);
+
+		/*
+		 * Takes upload tokens for data that is sent without calling write (e.g. directly from a file)
+		 * The returned tokens tell the number of bytes that may be sent, none if the buckets are empty (see write for aWait)
+		 */
+		Tokens takeUpTokens(TokenBucket& aBucket, size_t len, bool aWait = true);
+
+		/*
+		 * Returns aUnused bytes of the upload tokens that were taken with takeUpTokens but couldn't be sent
+		 */
+		void returnUpTokens(TokenBucket& aBucket, const Tokens& aTaken, size_t aUnused) noexcept;
 
 		/*
 		 * Returns current download limit.
@@ -65,16 +92,26 @@ namespace dcpp
 
 		static const int MAX_LIMIT = 1024 * 1024; // 1 GiB/s
 	private:
-		
-		// download limiter
-		size_t						downTokens = 0;
-		condition_variable	downCond;
-		mutex				downMutex;
-		
-		// upload limiter
-		size_t						upTokens = 0;
-		condition_variable	upCond;
-		mutex				upMutex;
+		struct Limiter {
+			TokenBucket bucket;
+
+			// Bytes per second, 0 if unlimited
+			atomic<int64_t> rate { 0 };
+
+			// Rate guaranteed for each connection
+			atomic<int64_t> share { 0 };
+		};
+
+		Limiter down;
+		Limiter up;
+
+		// Returns the tokens for the bytes that may be transferred
+		static Tokens takeTokens(Limiter& aLimiter, TokenBucket& aBucket, size_t aLen, bool aWait) noexcept;
+
+		// Returns tokens that weren't used to the buckets where they were taken from
+		static void returnTokens(Limiter& aLimiter, TokenBucket& aBucket, const Tokens& aTaken, size_t aUnused) noexcept;
+		static void updateLimiter(Limiter& aLimiter, int64_t aRate, size_t aConnections) noexcept;
+		void updateLimits() noexcept;
 			
 		friend class Singleton<ThrottleManager>;
 		
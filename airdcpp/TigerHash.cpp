@@ -42,6 +42,17 @@
 #define TIGER_ARCH64
 #endif
 
+#ifdef TIGER_MULTI_BUFFER
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TIGER_TARGET(x)
+#else
+#define TIGER_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
 namespace dcpp {
 
 #define PASSES 3
@@ -249,6 +260,236 @@ uint8_t* TigerHash::finalize() {
 	return getResult();
 }
 
+#ifdef TIGER_MULTI_BUFFER
+
+/*
+ * Multi-buffer versions for hashing multiple tree leaves at once. Each SIMD lane contains the state
+ * of a different leaf and the S-box lookups are performed with gather instructions.
+ */
+
+#define vsbox(t, v, shift) \
+	vgather(t, vand(vsrl(v, shift), vset1(0xFF)))
+
+#define vround(a,b,c,x,mul) \
+	c = vxor(c, x); \
+	a = vsub(a, vxor(vxor(vsbox(t1, c, 0*8), vsbox(t2, c, 2*8)), \
+	                 vxor(vsbox(t3, c, 4*8), vsbox(t4, c, 6*8)))); \
+	b = vadd(b, vxor(vxor(vsbox(t4, c, 1*8), vsbox(t3, c, 3*8)), \
+	                 vxor(vsbox(t2, c, 5*8), vsbox(t1, c, 7*8)))); \
+	b = mul(b);
+
+// There's no 64 bit multiplication in AVX2
+#define vmul5(b) vadd(vsll(b, 2), b)
+#define vmul7(b) vsub(vsll(b, 3), b)
+#define vmul9(b) vadd(vsll(b, 3), b)
+
+#define vpass(a,b,c,mul) \
+	vround(a,b,c,x0,mul) \
+	vround(b,c,a,x1,mul) \
+	vround(c,a,b,x2,mul) \
+	vround(a,b,c,x3,mul) \
+	vround(b,c,a,x4,mul) \
+	vround(c,a,b,x5,mul) \
+	vround(a,b,c,x6,mul) \
+	vround(b,c,a,x7,mul)
+
+#define vkey_schedule \
+	x0 = vsub(x0, vxor(x7, vset1(_ULL(0xA5A5A5A5A5A5A5A5)))); \
+	x1 = vxor(x1, x0); \
+	x2 = vadd(x2, x1); \
+	x3 = vsub(x3, vxor(x2, vsll(vnot(x1), 19))); \
+	x4 = vxor(x4, x3); \
+	x5 = vadd(x5, x4); \
+	x6 = vsub(x6, vxor(x5, vsrl(vnot(x4), 23))); \
+	x7 = vxor(x7, x6); \
+	x0 = vadd(x0, x7); \
+	x1 = vsub(x1, vxor(x0, vsll(vnot(x7), 19))); \
+	x2 = vxor(x2, x1); \
+	x3 = vadd(x3, x2); \
+	x4 = vsub(x4, vxor(x3, vsrl(vnot(x2), 23))); \
+	x5 = vxor(x5, x4); \
+	x6 = vadd(x6, x5); \
+	x7 = vsub(x7, vxor(x6, vset1(_ULL(0x0123456789ABCDEF))));
+
+#define vcompress \
+	aa = a; \
+	bb = b; \
+	cc = c; \
+	vpass(a,b,c,vmul5) \
+	vkey_schedule \
+	vpass(c,a,b,vmul7) \
+	vkey_schedule \
+	vpass(b,c,a,vmul9) \
+	a = vxor(a, aa); \
+	b = vsub(b, bb); \
+	c = vadd(c, cc);
+
+// Message word at the given data offset for each leaf (the leaf data is preceded by a zero byte in the message)
+#define vmessage(offset) vload(aData + (offset))
+
+#define tiger_multi_leaves_macro(lanes) \
+{ \
+	const auto blocks = aLeafSize / BLOCK_SIZE; \
+	\
+	vtype a = vset1(_ULL(0x0123456789ABCDEF)); \
+	vtype b = vset1(_ULL(0xFEDCBA9876543210)); \
+	vtype c = vset1(_ULL(0xF096A5B4C3B2E187)); \
+	vtype aa, bb, cc; \
+	vtype x0, x1, x2, x3, x4, x5, x6, x7; \
+	\
+	for (size_t k = 0; k < blocks; ++k) { \
+		const auto pos = k * BLOCK_SIZE; \
+		x0 = k == 0 ? vsll(vmessage(0), 8) : vmessage(pos - 1); \
+		x1 = vmessage(pos + 7); \
+		x2 = vmessage(pos + 15); \
+		x3 = vmessage(pos + 23); \
+		x4 = vmessage(pos + 31); \
+		x5 = vmessage(pos + 39); \
+		x6 = vmessage(pos + 47); \
+		x7 = vmessage(pos + 55); \
+		vcompress \
+	} \
+	\
+	/* Last data byte, padding and the message length in bits */ \
+	x0 = vor(vsrl(vmessage(aLeafSize - 8), 56), vset1(0x0100)); \
+	x1 = x2 = x3 = x4 = x5 = x6 = vset1(0); \
+	x7 = vset1(static_cast<int64_t>((aLeafSize + 1) << 3)); \
+	vcompress \
+	\
+	uint64_t res[3][lanes]; \
+	vstore(res[0], a); \
+	vstore(res[1], b); \
+	vstore(res[2], c); \
+	for (size_t l = 0; l < lanes; ++l) { \
+		auto hash = reinterpret_cast<uint64_t*>(hashes_ + l * BYTES); \
+		hash[0] = res[0][l]; \
+		hash[1] = res[1][l]; \
+		hash[2] = res[2][l]; \
+	} \
+}
+
+#define vtype __m256i
+#define vset1(x) _mm256_set1_epi64x(x)
+#define vxor(a, b) _mm256_xor_si256(a, b)
+#define vor(a, b) _mm256_or_si256(a, b)
+#define vand(a, b) _mm256_and_si256(a, b)
+#define vnot(a) _mm256_xor_si256(a, _mm256_set1_epi64x(-1))
+#define vadd(a, b) _mm256_add_epi64(a, b)
+#define vsub(a, b) _mm256_sub_epi64(a, b)
+#define vsll(a, n) _mm256_slli_epi64(a, n)
+#define vsrl(a, n) _mm256_srli_epi64(a, n)
+#define vgather(t, idx) _mm256_i64gather_epi64(reinterpret_cast<const long long*>(t), idx, 8)
+#define vload(p) _mm256_i64gather_epi64(reinterpret_cast<const long long*>(p), leafOffsets, 1)
+#define vstore(p, a) _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a)
+
+TIGER_TARGET("avx2") void TigerHash::hashLeavesAVX2(const uint8_t* aData, size_t aLeafSize, uint8_t* hashes_) {
+	const auto leafOffsets = _mm256_set_epi64x(3 * aLeafSize, 2 * aLeafSize, aLeafSize, 0);
+	tiger_multi_leaves_macro(4);
+}
+
+#undef vtype
+#undef vset1
+#undef vxor
+#undef vor
+#undef vand
+#undef vnot
+#undef vadd
+#undef vsub
+#undef vsll
+#undef vsrl
+#undef vgather
+#undef vload
+#undef vstore
+
+#define vtype __m512i
+#define vset1(x) _mm512_set1_epi64(x)
+#define vxor(a, b) _mm512_xor_si512(a, b)
+#define vor(a, b) _mm512_or_si512(a, b)
+#define vand(a, b) _mm512_and_si512(a, b)
+#define vnot(a) _mm512_xor_si512(a, _mm512_set1_epi64(-1))
+#define vadd(a, b) _mm512_add_epi64(a, b)
+#define vsub(a, b) _mm512_sub_epi64(a, b)
+#define vsll(a, n) _mm512_slli_epi64(a, n)
+#define vsrl(a, n) _mm512_srli_epi64(a, n)
+#define vgather(t, idx) _mm512_i64gather_epi64(idx, reinterpret_cast<const long long*>(t), 8)
+#define vload(p) _mm512_i64gather_epi64(leafOffsets, reinterpret_cast<const long long*>(p), 1)
+#define vstore(p, a) _mm512_storeu_si512(p, a)
+
+TIGER_TARGET("avx512f") void TigerHash::hashLeavesAVX512(const uint8_t* aData, size_t aLeafSize, uint8_t* hashes_) {
+	const auto leafOffsets = _mm512_set_epi64(7 * aLeafSize, 6 * aLeafSize, 5 * aLeafSize, 4 * aLeafSize, 3 * aLeafSize, 2 * aLeafSize, aLeafSize, 0);
+	tiger_multi_leaves_macro(8);
+}
+
+int TigerHash::getMultiBufferLanes() noexcept {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return 1;
+	}
+
+	__cpuid(info, 1);
+	auto osxsave = (info[2] & (1 << 27)) != 0;
+	if (!osxsave) {
+		return 1;
+	}
+
+	auto xcr0 = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	if ((info[1] & (1 << 16)) && (xcr0 & 0xE6) == 0xE6) {
+		return 8;
+	}
+
+	if ((info[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6) {
+		return 4;
+	}
+
+	return 1;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return 8;
+	}
+
+	if (__builtin_cpu_supports("avx2")) {
+		return 4;
+	}
+
+	return 1;
+#endif
+}
+
+#endif
+
+void TigerHash::hashLeaves(const uint8_t* aData, size_t aLeafSize, size_t aCount, uint8_t* hashes_) {
+	size_t i = 0;
+
+#ifdef TIGER_MULTI_BUFFER
+	static const auto lanes = getMultiBufferLanes();
+	if (aLeafSize >= BLOCK_SIZE && aLeafSize % BLOCK_SIZE == 0) {
+		if (lanes >= 8) {
+			for (; i + 8 <= aCount; i += 8) {
+				hashLeavesAVX512(aData + i * aLeafSize, aLeafSize, hashes_ + i * BYTES);
+			}
+		}
+
+		if (lanes >= 4) {
+			for (; i + 4 <= aCount; i += 4) {
+				hashLeavesAVX2(aData + i * aLeafSize, aLeafSize, hashes_ + i * BYTES);
+			}
+		}
+	}
+#endif
+
+	uint8_t zero = 0;
+	for (; i < aCount; ++i) {
+		TigerHash h;
+		h.update(&zero, 1);
+		h.update(aData + i * aLeafSize, aLeafSize);
+		memcpy(hashes_ + i * BYTES, h.finalize(), BYTES);
+	}
+}
+
 uint64_t TigerHash::table[4*256] = {
 	_ULL(0x02AAB17CF7E90C5E)   /*    0 */,    _ULL(0xAC424B03E243A8EC)   /*    1 */,
 		_ULL(0x72CD5BE30DD5FCD3)   /*    2 */,    _ULL(0x6D019B93F6F97F3A)   /*    3 */,
@@ -34,6 +34,11 @@
 
 #include <stdint.h>
 
+// SIMD versions are available for hashing multiple tree leaves at once
+#if (defined(_M_X64) || defined(__x86_64__)) && (defined(_MSC_VER) || defined(__GNUC__))
+#define TIGER_MULTI_BUFFER
+#endif
+
 namespace dcpp {
 
 class TigerHash {
@@ -57,6 +62,14 @@ public:
 	uint8_t* finalize();
 
 	uint8_t* getResult() const noexcept { return (uint8_t*) res; }
+
+	/**
+	* Calculates the hashes of consecutive tree leaves (the leaf data is prefixed with a zero byte).
+	* Multiple leaves are hashed in parallel if the CPU supports it.
+	* @param aData Data for aCount leaves of aLeafSize bytes each
+	* @param hashes_ Hashes of the leaves, stored consecutively (aCount * BYTES)
+	*/
+	static void hashLeaves(const uint8_t* aData, size_t aLeafSize, size_t aCount, uint8_t* hashes_);
 private:
 	enum { BLOCK_SIZE = 512/8 };
 	/** 512 bit blocks for the compress function */
@@ -69,6 +82,14 @@ private:
 	static uint64_t table[];
 
 	void tigerCompress(const uint64_t* data, uint64_t state[3]);
+
+#ifdef TIGER_MULTI_BUFFER
+	// Returns the number of leaves that can be hashed in parallel
+	static int getMultiBufferLanes() noexcept;
+
+	static void hashLeavesAVX2(const uint8_t* aData, size_t aLeafSize, uint8_t* hashes_);
+	static void hashLeavesAVX512(const uint8_t* aData, size_t aLeafSize, uint8_t* hashes_);
+#endif
 };
 
 } // namespace dcpp
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_TOKEN_BUCKET_H
+#define DCPLUSPLUS_DCPP_TOKEN_BUCKET_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace dcpp {
+
+/**
+ * Lock-free token bucket that is refilled lazily whenever tokens are taken.
+ *
+ * The rate is passed with each call so that the same bucket keeps working when the limit
+ * (or the fair share of a connection) changes. The balance may go negative when tokens are
+ * taken with a floor below zero, which is used for charging a parent bucket.
+ */
+class TokenBucket {
+public:
+	// Microseconds from a monotonic clock
+	static uint64_t now() noexcept {
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Maximum amount of tokens that can be accumulated while the bucket isn't used
+	static int64_t getCapacity(int64_t aRate) noexcept {
+		auto burst = aRate / BURST_DIVIDER;
+		return burst > MIN_BURST ? burst : MIN_BURST;
+	}
+
+	/**
+	 * Takes up to aBytes tokens without letting the balance go below aFloor
+	 * Nothing is taken if there are less than MIN_TAKE tokens available (unless less is requested)
+	 * so that the transfers won't be split into tiny packets
+	 * @return Number of tokens taken
+	 */
+	int64_t take(int64_t aBytes, int64_t aRate, uint64_t aNow, int64_t aFloor = 0) noexcept {
+		refill(aRate, aNow);
+
+		auto cur = tokens.load(std::memory_order_relaxed);
+		int64_t taken;
+		do {
+			if (cur - aFloor < (aBytes < MIN_TAKE ? aBytes : MIN_TAKE)) {
+				return 0;
+			}
+
+			taken = std::min(aBytes, cur - aFloor);
+		} while (!tokens.compare_exchange_weak(cur, cur - taken, std::memory_order_relaxed));
+
+		return taken;
+	}
+
+	// Return tokens that were taken but not used
+	// The balance won't grow above the capacity (the bucket may have been refilled meanwhile)
+	void giveBack(int64_t aBytes, int64_t aRate) noexcept {
+		auto capacity = getCapacity(aRate);
+		auto cur = tokens.load(std::memory_order_relaxed);
+		while (!tokens.compare_exchange_weak(cur, std::min(cur + aBytes, std::max(cur, capacity)), std::memory_order_relaxed)) {
+			// Retry
+		}
+	}
+
+	// Microseconds until there are enough tokens to be taken again
+	uint64_t getWaitTime(int64_t aRate) const noexcept {
+		auto cur = tokens.load(std::memory_order_relaxed);
+		if (cur >= MIN_TAKE || aRate <= 0) {
+			return 0;
+		}
+
+		return static_cast<uint64_t>((MIN_TAKE - cur) * 1000000 / aRate);
+	}
+private:
+	static const int64_t BURST_DIVIDER = 10; // 100 ms
+	static const int64_t MIN_BURST = 8 * 1024;
+	static const int64_t MIN_TAKE = 4 * 1024;
+
+	void refill(int64_t aRate, uint64_t aNow) noexcept {
+		auto last = lastRefill.load(std::memory_order_relaxed);
+		if (aNow <= last || aRate <= 0) {
+			return;
+		}
+
+		auto capacity = getCapacity(aRate);
+
+		// Don't multiply huge intervals (the bucket will be full in any case)
+		auto maxElapsed = static_cast<uint64_t>(capacity * 1000000 / aRate) + 1;
+		auto elapsed = aNow - last;
+		auto start = last;
+		if (elapsed > maxElapsed) {
+			elapsed = maxElapsed;
+			start = aNow - maxElapsed;
+		}
+
+		auto add = static_cast<int64_t>(elapsed * aRate / 1000000);
+		if (add == 0) {
+			return;
+		}
+
+		// Only consume the time that corresponds to the added tokens so that the fractions won't get lost
+		if (!lastRefill.compare_exchange_strong(last, start + static_cast<uint64_t>(add) * 1000000 / aRate, std::memory_order_relaxed)) {
+			// Refilled by another thread
+			return;
+		}
+
+		auto cur = tokens.load(std::memory_order_relaxed);
+		while (!tokens.compare_exchange_weak(cur, std::min(cur + add, std::max(cur, capacity)), std::memory_order_relaxed)) {
+			// Retry
+		}
+	}
+
+	std::atomic<int64_t> tokens { MIN_BURST };
+	std::atomic<uint64_t> lastRefill { 0 };
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_TOKEN_BUCKET_H)
@@ -63,13 +63,14 @@ void UDPServer::disconnect() {
 	}
 }
 
-UDPServer::UDPServer() : stop(false), pp(true) { }
+#define BUFSIZE 8192
+#define READ_BATCH 64
+
+UDPServer::UDPServer() : stop(false), readBuffer(BUFSIZE, READ_BATCH), pp(true) { }
 UDPServer::~UDPServer() { }
 
-#define BUFSIZE 8192
 int UDPServer::run() {
-	int len;
-	string remoteAddr;
+	vector<pair<int, string>> datagrams;
 
 	while(!stop) {
 		try {
@@ -77,9 +78,19 @@ int UDPServer::run() {
 				continue;
 			}
 
-			auto buf = vector<uint8_t>(BUFSIZE);
-			if((len = socket->read(buf.data(), BUFSIZE, remoteAddr)) > 0) {
-				pp.addTask([=] { handlePacket(buf, len, remoteAddr); });
+			if(socket->readBatch(readBuffer, datagrams) > 0) {
+				auto packets = make_shared<vector<pair<ByteVector, string>>>();
+				packets->reserve(datagrams.size());
+				for (size_t i = 0; i < datagrams.size(); ++i) {
+					auto data = readBuffer.getData(static_cast<int>(i));
+					packets->emplace_back(ByteVector(data, data + datagrams[i].first), move(datagrams[i].second));
+				}
+
+				pp.addTask([=] {
+					for (const auto& p : *packets) {
+						handlePacket(p.first, p.first.size(), p.second);
+					}
+				});
 				continue;
 			}
 		} catch(const SocketException& e) {
@@ -21,6 +21,7 @@
 
 #include "AdcCommand.h"
 #include "DispatcherQueue.h"
+#include "Socket.h"
 
 namespace dcpp {
 
@@ -43,6 +44,9 @@ private:
 	string port;
 	bool stop;
 
+	// Reused for all reads, each batch is copied to the dispatcher without the unused space
+	Socket::ReadBatch readBuffer;
+
 	DispatcherQueue pp;
 	void handlePacket(const ByteVector& aBuf, size_t aLen, const string& aRemoteIp);
 
@@ -25,6 +25,19 @@
 #include "ScopedFunctor.h"
 #include "SettingsManager.h"
 
+#if (defined(_M_X64) || defined(__x86_64__)) && (defined(_MSC_VER) || defined(__GNUC__))
+#define CRC32_PCLMUL
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CRC32_TARGET(x)
+#else
+#define CRC32_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
 namespace dcpp {
 
 using std::max;
@@ -160,4 +173,140 @@ void GZ::decompress(const string& source, const string& target) {
 	}
 }
 
+#ifdef CRC32_PCLMUL
+
+/*
+ * CRC32 with carry-less multiplication, based on the Intel white paper "Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction". Four 128 bit lanes are folded in parallel, then folded into a single lane and finally
+ * reduced to 32 bits with Barrett reduction. The constants are for the bit-reflected IEEE 802.3 polynomial.
+ *
+ * The length must be at least 64 bytes and a multiple of 16. The CRC is passed without the final inversion.
+ */
+// Folds a 128 bit lane into the next one
+CRC32_TARGET("pclmul,sse4.1")
+static inline __m128i crc32Fold16(__m128i aLane, __m128i aNext, __m128i aConstants) noexcept {
+	auto lo = _mm_clmulepi64_si128(aLane, aConstants, 0x00);
+	auto hi = _mm_clmulepi64_si128(aLane, aConstants, 0x11);
+	return _mm_xor_si128(_mm_xor_si128(hi, aNext), lo);
+}
+
+CRC32_TARGET("pclmul,sse4.1")
+static uint32_t crc32PCLMUL(uint32_t aCrc, const uint8_t* aBuf, size_t aLen) noexcept {
+	alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+	alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+	alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+	alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+	auto x1 = _mm_loadu_si128((const __m128i*)(aBuf + 0x00));
+	auto x2 = _mm_loadu_si128((const __m128i*)(aBuf + 0x10));
+	auto x3 = _mm_loadu_si128((const __m128i*)(aBuf + 0x20));
+	auto x4 = _mm_loadu_si128((const __m128i*)(aBuf + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(aCrc)));
+
+	auto x0 = _mm_load_si128((const __m128i*)k1k2);
+
+	aBuf += 64;
+	aLen -= 64;
+
+	// Fold 64 bytes at a time
+	while (aLen >= 64) {
+		auto x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		auto x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		auto x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		auto x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(aBuf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(aBuf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(aBuf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(aBuf + 0x30)));
+
+		aBuf += 64;
+		aLen -= 64;
+	}
+
+	// Fold the lanes into 128 bits
+	x0 = _mm_load_si128((const __m128i*)k3k4);
+
+	x1 = crc32Fold16(x1, x2, x0);
+	x1 = crc32Fold16(x1, x3, x0);
+	x1 = crc32Fold16(x1, x4, x0);
+
+	// Fold the remaining 16 byte blocks
+	while (aLen >= 16) {
+		x1 = crc32Fold16(x1, _mm_loadu_si128((const __m128i*)aBuf), x0);
+
+		aBuf += 16;
+		aLen -= 16;
+	}
+
+	// Fold 128 bits into 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_load_si128((const __m128i*)poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+static bool hasPCLMUL() noexcept {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 1)) && (info[2] & (1 << 19));
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+#endif
+
+uint32_t CRC32Filter::update(uint32_t aCrc, const void* aBuf, size_t aLen) noexcept {
+	auto buf = static_cast<const uint8_t*>(aBuf);
+
+#ifdef CRC32_PCLMUL
+	static const auto pclmul = hasPCLMUL();
+	if (pclmul && aLen >= 64) {
+		auto len = aLen & ~static_cast<size_t>(15);
+		aCrc = ~crc32PCLMUL(~aCrc, buf, len);
+
+		buf += len;
+		aLen -= len;
+	}
+#endif
+
+	// zlib takes the length as 32 bit integer
+	while (aLen > 0) {
+		auto len = static_cast<uInt>(std::min(aLen, static_cast<size_t>(1 << 30)));
+		aCrc = crc32(aCrc, buf, len);
+
+		buf += len;
+		aLen -= len;
+	}
+
+	return aCrc;
+}
+
 } // namespace dcpp
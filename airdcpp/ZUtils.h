@@ -77,9 +77,11 @@ public:
 class CRC32Filter {
 public:
 	CRC32Filter() : crc(crc32(0, NULL, 0)) { }
-	// TODO 64-bits?
-	void operator()(const void* buf, size_t len) { crc = crc32(crc, (const Bytef*)buf, (uInt)len); }
+	void operator()(const void* buf, size_t len) { crc = update(crc, buf, len); }
 	uint32_t getValue() const { return crc; }
+
+	// Same as zlib's crc32 but uses carry-less multiplication for larger buffers if the CPU supports it
+	static uint32_t update(uint32_t aCrc, const void* aBuf, size_t aLen) noexcept;
 private:
 	uint32_t crc;
 };
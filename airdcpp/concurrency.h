@@ -86,6 +86,17 @@ public:
 
 #define parallel_for_each for_each
 
+	// Runs the tasks synchronously in the calling thread
+	class task_group {
+	public:
+		template <typename F>
+		void run(const F& f) {
+			f();
+		}
+
+		void wait() { }
+	};
+
 	template <typename T>
 	class concurrent_queue {
 	public:
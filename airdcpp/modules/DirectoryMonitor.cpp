@@ -21,10 +21,18 @@
 #include "DirectoryMonitor.h"
 
 #include <airdcpp/AirUtil.h>
+#include <airdcpp/File.h>
 #include <airdcpp/LogManager.h>
 #include <airdcpp/ResourceManager.h>
 #include <airdcpp/Text.h>
 
+#ifndef WIN32
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
 
 namespace dcpp {
 
@@ -64,7 +72,20 @@ void DirectoryMonitor::Server::init() {
 		throw MonitorException(Util::translateError(::GetLastError()));
 	}
 #else
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd == -1) {
+		threadRunning.clear();
+		throw MonitorException(getErrorStr(errno));
+	}
 
+	efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (efd == -1) {
+		auto error = errno;
+		::close(fd);
+		fd = -1;
+		threadRunning.clear();
+		throw MonitorException(getErrorStr(error));
+	}
 #endif
 
 	start();
@@ -189,13 +210,22 @@ void Monitor::openDirectory(HANDLE iocp) {
 
 #else
 
-Monitor::Monitor(const string& aPath, DirectoryMonitor::Server* aServer, int monitorFlags, size_t bufferSize) {
+Monitor::Monitor(const string& aPath, DirectoryMonitor::Server* aServer, int /*monitorFlags*/, size_t /*bufferSize*/) :
+	server(aServer),
+	changes(0),
+	path(aPath) {
+
 }
 
 Monitor::~Monitor() { }
 
 void Monitor::stopMonitoring() {
+	// Called from inside WLock
+	server->removeWatches(path);
+	stopped = true;
 
+	// Let the thread delete the monitor
+	server->wakeup();
 }
 
 DirectoryMonitor::Server::Server(DirectoryMonitor* aBase, int numThreads) : base(aBase), m_bTerminate(false), m_nThreads(numThreads) {
@@ -203,7 +233,18 @@ DirectoryMonitor::Server::Server(DirectoryMonitor* aBase, int numThreads) : base
 }
 
 DirectoryMonitor::Server::~Server() {
+	// Wake up the thread so that it will notice the termination
+	m_bTerminate = true;
+	wakeup();
+	join();
 
+	if (fd != -1) {
+		::close(fd);
+	}
+
+	if (efd != -1) {
+		::close(efd);
+	}
 }
 
 #endif
@@ -355,20 +396,248 @@ bool DirectoryMonitor::Server::addDirectory(const string& aPath) {
 
 #else
 
-bool DirectoryMonitor::Server::addDirectory(const string& aPath) {
-	return true;
+// IN_ONLYDIR and IN_DONT_FOLLOW prevent adding watches for files or following symlink loops
+static const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+void DirectoryMonitor::Server::addWatches(Monitor* aMonitor, const string& aPath, bool aIsRoot) {
+	auto wd = inotify_add_watch(fd, aPath.c_str(), WATCH_MASK);
+	if (wd == -1) {
+		auto error = errno;
+		if (error == ENOSPC) {
+			throw MonitorException(getErrorStr(error) + " (the maximum number of watches can be raised with the fs.inotify.max_user_watches kernel parameter)");
+		}
+
+		if (aIsRoot || error == ENOMEM) {
+			throw MonitorException(getErrorStr(error));
+		}
+
+		// The directory was removed or it can't be accessed
+		if (debug) {
+			LogManager::getInstance()->message("Failed to monitor the directory " + aPath + ": " + getErrorStr(error), LogMessage::SEV_WARNING);
+		}
+		return;
+	}
+
+	watches[wd] = { aMonitor, aPath };
+
+	for (FileFindIter i(aPath, "*"); i != FileFindIter(); ++i) {
+		if (i->isDirectory() && !i->isLink()) {
+			addWatches(aMonitor, aPath + i->getFileName() + PATH_SEPARATOR, false);
+		}
+	}
+}
+
+void DirectoryMonitor::Server::wakeup() noexcept {
+	uint64_t value = 1;
+	if (efd != -1 && ::write(efd, &value, sizeof(value)) == -1) {
+		// The counter is full so there is a pending wakeup already
+	}
+}
+
+void DirectoryMonitor::Server::removeWatches(const string& aPath) {
+	for (auto i = watches.begin(); i != watches.end();) {
+		if (AirUtil::isParentOrExactLocal(aPath, i->second.path)) {
+			inotify_rm_watch(fd, i->first);
+			i = watches.erase(i);
+		} else {
+			i++;
+		}
+	}
 }
 
 void DirectoryMonitor::Server::deleteDirectory(DirectoryMonitor::Server::MonitorMap::iterator mon) {
+	delete mon->second;
+	monitors.erase(mon);
+}
 
+bool DirectoryMonitor::Server::addDirectory(const string& aPath) {
+	{
+		RLock l(cs);
+		if (monitors.find(aPath) != monitors.end())
+			return false;
+	}
+
+	init();
+
+	Monitor* mon = new Monitor(aPath, this, 0, 0);
+	try {
+		WLock l(cs);
+		addWatches(mon, aPath, true);
+		monitors.emplace(aPath, mon);
+		failedDirectories.erase(aPath);
+	} catch (MonitorException& e) {
+		{
+			WLock l(cs);
+			removeWatches(aPath);
+			failedDirectories.insert(aPath);
+		}
+
+		delete mon;
+		throw e;
+	}
+
+	return true;
 }
 
 int DirectoryMonitor::Server::read() {
-	return 0;
-}
+	pollfd fds[2] = { { fd, POLLIN, 0 }, { efd, POLLIN, 0 } };
+	if (poll(fds, 2, -1) == -1) {
+		// Interrupted
+		return 1;
+	}
 
-void DirectoryMonitor::processNotification(const string& aPath, const ByteVector& aBuf) {
+	if (fds[1].revents & POLLIN) {
+		uint64_t value;
+		while (::read(efd, &value, sizeof(value)) > 0) {
+			// Just clear the counter
+		}
+	}
+
+	WLock l(cs);
+	for (auto i = monitors.begin(); i != monitors.end();) {
+		if (i->second->stopped) {
+			deleteDirectory(i++);
+		} else {
+			i++;
+		}
+	}
+
+	if (m_bTerminate && monitors.empty()) {
+		// shutting down
+		return 0;
+	}
+
+	if (!(fds[0].revents & POLLIN)) {
+		return 1;
+	}
+
+	auto monBase = base;
+	vector<DispatcherQueue::Callback> notifications;
+	StringMap failedRoots;
+	bool overflow = false;
+
+	// Renames are reported as two consecutive events with the same cookie
+	string movedFrom;
+	uint32_t moveCookie = 0;
+	auto flushMove = [&] {
+		if (!movedFrom.empty()) {
+			// Moved outside the monitored directories
+			notifications.push_back([=] { monBase->fire(DirectoryMonitorListener::FileDeleted(), movedFrom); });
+			movedFrom.clear();
+		}
+	};
+
+	auto watchDirectory = [&](Monitor* aMonitor, const string& aPath) {
+		try {
+			addWatches(aMonitor, aPath + PATH_SEPARATOR, false);
+		} catch (const MonitorException& e) {
+			failedRoots.emplace(aMonitor->path, e.getError());
+		}
+	};
+
+	ByteVector buf(64 * 1024);
+	for (;;) {
+		auto len = ::read(fd, &buf[0], buf.size());
+		if (len <= 0) {
+			break;
+		}
+
+		for (ssize_t pos = 0; pos < len;) {
+			auto ev = reinterpret_cast<const inotify_event*>(&buf[pos]);
+			pos += sizeof(inotify_event) + ev->len;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				overflow = true;
+				continue;
+			}
+
+			auto w = watches.find(ev->wd);
+			if (w == watches.end()) {
+				continue;
+			}
+
+			if (ev->mask & IN_IGNORED) {
+				// The watch was removed
+				watches.erase(w);
+				continue;
+			}
 
+			auto mon = w->second.monitor;
+			if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT)) {
+				// The changes are reported by the parent directory if this isn't a root
+				if (w->second.path == mon->path) {
+					failedRoots.emplace(mon->path, STRING(DEVICE_REMOVED));
+				}
+				continue;
+			}
+
+			mon->changes++;
+			auto path = w->second.path + ev->name;
+			auto isDirectory = (ev->mask & IN_ISDIR) > 0;
+
+			if (ev->mask & IN_MOVED_FROM) {
+				flushMove();
+				movedFrom = path;
+				moveCookie = ev->cookie;
+				if (isDirectory) {
+					removeWatches(path + PATH_SEPARATOR);
+				}
+			} else if (ev->mask & IN_MOVED_TO) {
+				if (!movedFrom.empty() && ev->cookie == moveCookie) {
+					auto oldPath = move(movedFrom);
+					movedFrom.clear();
+					notifications.push_back([=] { monBase->fire(DirectoryMonitorListener::FileRenamed(), oldPath, path); });
+				} else {
+					flushMove();
+					notifications.push_back([=] { monBase->fire(DirectoryMonitorListener::FileCreated(), path); });
+				}
+
+				if (isDirectory) {
+					watchDirectory(mon, path);
+				}
+			} else {
+				flushMove();
+				if (ev->mask & IN_CREATE) {
+					notifications.push_back([=] { monBase->fire(DirectoryMonitorListener::FileCreated(), path); });
+					if (isDirectory) {
+						watchDirectory(mon, path);
+					}
+				} else if (ev->mask & IN_DELETE) {
+					notifications.push_back([=] { monBase->fire(DirectoryMonitorListener::FileDeleted(), path); });
+				} else if (ev->mask & IN_CLOSE_WRITE) {
+					notifications.push_back([=] { monBase->fire(DirectoryMonitorListener::FileModified(), path); });
+				}
+			}
+		}
+	}
+
+	flushMove();
+
+	if (overflow) {
+		// Events were lost and there's no way to tell which directories were changed
+		for (const auto& m: monitors) {
+			auto root = m.first;
+			notifications.push_back([=] { monBase->fire(DirectoryMonitorListener::Overflow(), root); });
+		}
+	}
+
+	if (!notifications.empty()) {
+		monBase->callAsync([=] {
+			for (const auto& f: notifications) {
+				f();
+			}
+		});
+	}
+
+	for (const auto& p: failedRoots) {
+		if (debug) {
+			LogManager::getInstance()->message("Monitoring error for path " + p.first + ": " + p.second, LogMessage::SEV_WARNING);
+		}
+
+		failDirectory(p.first, p.second);
+	}
+
+	return 1;
 }
 
 #endif
@@ -543,8 +812,6 @@ void DirectoryMonitor::processNotification(const string& aPath, const ByteVector
 	};
 }
 
-#else
-
 #endif
 
 } //dcpp
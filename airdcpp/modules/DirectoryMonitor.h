@@ -124,8 +124,33 @@ private:
 #ifdef WIN32
 		HANDLE m_hIOCP;
 #else
-		int efd = -1;
+		// inotify instance shared by all monitors
 		int fd = -1;
+
+		// Wakes up the thread when monitors have been stopped
+		int efd = -1;
+
+		// inotify watches aren't recursive so each subdirectory has a watch of its own
+		struct Watch {
+			Monitor* monitor;
+			string path;
+		};
+
+		typedef std::unordered_map<int, Watch> WatchMap;
+		WatchMap watches;
+
+		// Adds watches for the directory and its subdirectories recursively
+		// Throws MonitorException if the directory can't be watched (failures with subdirectories are only thrown if the watch limit is reached)
+		// must be called from inside WLock
+		void addWatches(Monitor* aMonitor, const string& aPath, bool aIsRoot);
+
+		// Removes the watches of the directory and its subdirectories
+		// must be called from inside WLock
+		void removeWatches(const string& aPath);
+
+		void wakeup() noexcept;
+
+		friend class Monitor;
 #endif
 		int	m_nThreads;
 		set<string> failedDirectories;
@@ -133,7 +158,9 @@ private:
 
 	Server* server;
 
+#ifdef WIN32
 	void processNotification(const string& aPath, const ByteVector& aBuf);
+#endif
 	DispatcherQueue dispatcher;
 };
 
@@ -149,8 +176,6 @@ public:
 	void openDirectory(HANDLE iocp);
 	void beginRead();
 #else
-	//int addWatch(const string& aPath);
-
 	Monitor(const string& aPath, DirectoryMonitor::Server* aParent, int monitorFlags, size_t bufferSize);
 	~Monitor();
 #endif
@@ -180,7 +205,10 @@ private:
 	int errorCount;
 	int key;
 #else
+	const string path;
 
+	// Set when the monitor has been stopped and should be deleted by the server thread
+	bool stopped = false;
 #endif
 };
 
@@ -324,7 +324,7 @@ namespace dcpp {
 		if (monitorDebug)
 			LogManager::getInstance()->message("Monitoring overflow: " + aRootPath, LogMessage::SEV_INFO);
 
-		// Refresh the root
-		ShareManager::getInstance()->refreshPaths({ aRootPath });
+		// Refresh the root (repeated overflows during heavy activity are merged into a single refresh)
+		addModifyInfo(aRootPath);
 	}
 } // namespace dcpp
@@ -31,6 +31,8 @@
 
 #include <airdcpp/concurrency.h>
 
+#include <thread>
+
 namespace dcpp {
 
 #ifdef ATOMIC_FLAG_INIT
@@ -120,30 +122,32 @@ void ShareScannerManager::runSfvCheck(const StringList& rootPaths) {
 		}
 	}
 
-	/* Scan root files */
+	SFVCheckList items;
+
+	/* Root files */
+	unique_ptr<DirSFVReader> rootSfv;
 	if (!sfvFilePaths.empty()) {
-		DirSFVReader sfv(Util::getFilePath(rootPaths.front()));
+		rootSfv = make_unique<DirSFVReader>(Util::getFilePath(rootPaths.front()));
 		for (auto& path : sfvFilePaths) {
-			if (stop)
-				break;
-
-			checkFileSFV(path, sfv, false);
+			items.emplace_back(path, rootSfv.get(), false);
 		}
 	}
 
-	/* Scan all directories */
+	/* Files in all directories */
 	for (auto& i : sfvDirPaths) {
 		if (stop)
 			break;
 
 		File::forEachFile(i.first, "*", [&](const FilesystemItem& aInfo) {
-			if (stop || aInfo.isDirectory)
+			if (aInfo.isDirectory)
 				return;
 
-			checkFileSFV(aInfo.name, i.second, true);
+			items.emplace_back(aInfo.name, &i.second, true);
 		});
 	}
 
+	/* Scan */
+	runSfvChecks(items);
 
 	/* Report */
 	if (stop) {
@@ -153,6 +157,81 @@ void ShareScannerManager::runSfvCheck(const StringList& rootPaths) {
 	}
 }
 
+void ShareScannerManager::runSfvChecks(SFVCheckList& aItems) noexcept {
+	if (aItems.empty()) {
+		return;
+	}
+
+	/* Group the files by device */
+	map<int64_t, SFVCheckList> devices;
+	{
+		unordered_map<const DirSFVReader*, int64_t> readerDevices;
+		for (auto& item : aItems) {
+			auto p = readerDevices.find(item.reader);
+			if (p == readerDevices.end()) {
+				p = readerDevices.emplace(item.reader, File::getDeviceId(item.reader->getPath())).first;
+			}
+
+			devices[p->second].push_back(std::move(item));
+		}
+	}
+
+	auto maxThreads = max<size_t>(std::thread::hardware_concurrency(), 1);
+	auto threadsPerDevice = max<size_t>(min(static_cast<size_t>(SFV_THREADS_PER_DEVICE), maxThreads / devices.size()), 1);
+
+	/* Check each device in parallel */
+	vector<unique_ptr<DispatcherQueue>> workers;
+	Semaphore workersFinished;
+	for (auto& d : devices) {
+		const auto& items = d.second;
+		auto pos = make_shared<atomic<size_t>>(0);
+
+		auto worker = [this, &items, pos] {
+			for (;;) {
+				auto i = (*pos)++;
+				if (stop || i >= items.size()) {
+					return;
+				}
+
+				const auto& item = items[i];
+				try {
+					checkFileSFV(item.fileName, *item.reader, item.isDirScan);
+				} catch (const std::exception& e) {
+					// Continue with the other files
+					checkFailed++;
+					LogManager::getInstance()->message(STRING_F(CRC_FILE_ERROR, (item.reader->getPath() + item.fileName)) + " (" + e.what() + ")", LogMessage::SEV_ERROR);
+				}
+			}
+		};
+
+		auto threadCount = min(threadsPerDevice, items.size());
+		for (size_t t = 0; t < threadCount; t++) {
+			auto queue = make_unique<DispatcherQueue>(false);
+			try {
+				queue->start();
+			} catch (const ThreadException&) {
+				// Out of threads, check the rest of the files from this one
+				worker();
+				continue;
+			}
+
+			queue->addTask([worker, &workersFinished] {
+				worker();
+				workersFinished.signal();
+			});
+
+			workers.push_back(move(queue));
+		}
+	}
+
+	// The queued tasks must be completed before the threads are stopped
+	for (size_t i = 0; i < workers.size(); i++) {
+		workersFinished.wait();
+	}
+
+	workers.clear();
+}
+
 void ShareScannerManager::runShareScan(const StringList& aPaths) {
 	ScanType scanType = TYPE_PARTIAL;
 	auto rootPaths = aPaths;
@@ -617,7 +696,7 @@ void ShareScannerManager::prepareSFVScanFile(const string& aPath, StringList& fi
 	}
 }
 
-void ShareScannerManager::checkFileSFV(const string& aFileName, DirSFVReader& aSfvReader, bool aIsDirScan) noexcept {
+void ShareScannerManager::checkFileSFV(const string& aFileName, const DirSFVReader& aSfvReader, bool aIsDirScan) {
  
 	uint64_t checkStart = 0;
 	uint64_t checkEnd = 0;
@@ -628,7 +707,7 @@ void ShareScannerManager::checkFileSFV(const string& aFileName, DirSFVReader& aS
 		bool crcMatch = false;
 		try {
 			checkStart = GET_TICK();
-			crcMatch = aSfvReader.isCrcValid(fileNameLower);
+			crcMatch = aSfvReader.isCrcValid(fileNameLower, SFV_READ_BLOCK_SIZE, SFV_READ_QUEUE_DEPTH);
 			checkEnd = GET_TICK();
 		} catch(const FileException& ) {
 			// Couldn't read the file to get the CRC(!!!)
@@ -648,7 +727,7 @@ void ShareScannerManager::checkFileSFV(const string& aFileName, DirSFVReader& aS
 			crcInvalid++;
 		}
 
-		scanFolderSize = scanFolderSize - size;
+		auto remainingSize = scanFolderSize -= size;
 
 		// Report
 		if (SETTING(LOG_CRC_OK)) {
@@ -656,12 +735,12 @@ void ShareScannerManager::checkFileSFV(const string& aFileName, DirSFVReader& aS
 				(crcMatch ? STRING(CRC_OK) : STRING(CRC_FAILED)) %
 				(aSfvReader.getPath() + aFileName) %
 				Util::formatBytes(speed) %
-				Util::formatBytes(scanFolderSize)), (crcMatch ? LogMessage::SEV_INFO : LogMessage::SEV_ERROR));
+				Util::formatBytes(remainingSize)), (crcMatch ? LogMessage::SEV_INFO : LogMessage::SEV_ERROR));
 		} else if (!crcMatch) {
 				LogManager::getInstance()->message(STRING_F(CRC_FILE_FAILED,
 				(aSfvReader.getPath() + aFileName) %
 				Util::formatBytes(speed) %
-				Util::formatBytes(scanFolderSize)), LogMessage::SEV_ERROR);
+				Util::formatBytes(remainingSize)), LogMessage::SEV_ERROR);
 		}
 
 
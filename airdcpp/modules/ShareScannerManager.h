@@ -63,13 +63,32 @@ public:
 	void checkSfv(const StringList& paths) noexcept;
 	// bool onScanSharedDir(const string& aDir, bool report) noexcept;
 
-	void checkFileSFV(const string& path, DirSFVReader& sfv, bool isDirScan) noexcept;
+	void checkFileSFV(const string& path, const DirSFVReader& sfv, bool isDirScan);
 	void Stop();
 
 private:
 	friend class Singleton<ShareScannerManager>;
 	typedef vector<pair<string, DirSFVReader>> SFVScanList;
 
+	struct SFVCheckItem {
+		SFVCheckItem(const string& aFileName, const DirSFVReader* aReader, bool aIsDirScan) : fileName(aFileName), reader(aReader), isDirScan(aIsDirScan) { }
+
+		string fileName;
+		const DirSFVReader* reader;
+		bool isDirScan;
+	};
+
+	typedef vector<SFVCheckItem> SFVCheckList;
+
+	// Files on the same device are checked by a limited number of threads to avoid excessive seeking
+	static const size_t SFV_THREADS_PER_DEVICE = 2;
+
+	// Each thread keeps SFV_READ_QUEUE_DEPTH blocks of SFV_READ_BLOCK_SIZE bytes in flight
+	static const size_t SFV_READ_BLOCK_SIZE = 1024 * 1024;
+	static const size_t SFV_READ_QUEUE_DEPTH = 4;
+
+	void runSfvChecks(SFVCheckList& aItems) noexcept;
+
 	ShareScannerManager();
 	~ShareScannerManager();
 	
@@ -106,10 +125,10 @@ private:
 
 	static atomic_flag scanning;
 
-	int crcOk;
-	int crcInvalid;
-	int checkFailed;
-	int64_t scanFolderSize;
+	atomic<int> crcOk;
+	atomic<int> crcInvalid;
+	atomic<int> checkFailed;
+	atomic<int64_t> scanFolderSize;
 
 
 	volatile bool stop;
@@ -0,0 +1,525 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Micro-benchmarks for the hot paths that can be used without the full client startup
+//
+// Usage: airdcpp-bench [name filter]
+// Each benchmark prints a single JSON object per line (the input is generated with fixed seeds
+// so that the results are comparable between builds)
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/AdcCommand.h>
+#include <airdcpp/BloomFilter.h>
+#include <airdcpp/CID.h>
+#include <airdcpp/ClientManager.h>
+#include <airdcpp/HashBloom.h>
+#include <airdcpp/HashedFile.h>
+#include <airdcpp/HashManager.h>
+#include <airdcpp/MerkleTree.h>
+#include <airdcpp/QueueItem.h>
+#include <airdcpp/ResourceManager.h>
+#include <airdcpp/SearchQuery.h>
+#include <airdcpp/SettingsManager.h>
+#include <airdcpp/ShareManager.h>
+#include <airdcpp/SimpleXML.h>
+#include <airdcpp/SimpleXMLReader.h>
+#include <airdcpp/StringTokenizer.h>
+#include <airdcpp/TigerHash.h>
+#include <airdcpp/TimerManager.h>
+#include <airdcpp/UploadManager.h>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+using namespace dcpp;
+
+namespace {
+
+// Prevents the compiler from optimizing the benchmarked code away
+volatile size_t sink = 0;
+
+// Runs aF (which performs aOpsPerRun operations) until at least MIN_TIME has passed
+// and prints the results; aBytesPerOp is used for the throughput (if set)
+template<class F>
+void run(const string& aFilter, const char* aName, size_t aOpsPerRun, size_t aBytesPerOp, F&& aF) {
+	if (!aFilter.empty() && string(aName).find(aFilter) == string::npos) {
+		return;
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	const auto MIN_TIME = std::chrono::milliseconds(500);
+
+	// Warm up
+	aF();
+
+	size_t runs = 0;
+	auto start = Clock::now();
+	auto elapsed = Clock::duration::zero();
+	do {
+		aF();
+		runs++;
+		elapsed = Clock::now() - start;
+	} while (elapsed < MIN_TIME);
+
+	auto ops = runs * aOpsPerRun;
+	auto ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	auto nsPerOp = ns / ops;
+
+	printf("{\"benchmark\":\"%s\",\"operations\":" SIZET_FMT ",\"ns_per_op\":%.2f", aName, ops, nsPerOp);
+	if (aBytesPerOp > 0) {
+		printf(",\"mb_per_s\":%.2f", (static_cast<double>(aBytesPerOp) * ops / (1024 * 1024)) / (ns / 1e9));
+	}
+
+	printf("}\n");
+	fflush(stdout);
+}
+
+string randomString(std::mt19937& aGen, size_t aLen) {
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789 ._-";
+	std::uniform_int_distribution<size_t> dist(0, sizeof(chars) - 2);
+
+	string ret(aLen, ' ');
+	for (auto& c : ret) {
+		c = chars[dist(aGen)];
+	}
+
+	return ret;
+}
+
+TTHValue randomTTH(std::mt19937& aGen) {
+	TTHValue ret;
+	for (auto& b : ret.data) {
+		b = static_cast<uint8_t>(aGen());
+	}
+
+	return ret;
+}
+
+// Straightforward character-by-character tokenization of an ADC line (all tokens after the command name are returned)
+StringList tokenizeAdcLine(const string& aLine) {
+	StringList ret;
+	string cur;
+	for (size_t i = 5; i < aLine.length(); ++i) {
+		if (aLine[i] == '\\') {
+			++i;
+			cur += aLine[i] == 's' ? ' ' : aLine[i] == 'n' ? '\n' : aLine[i];
+		} else if (aLine[i] == ' ') {
+			ret.push_back(cur);
+			cur.clear();
+		} else {
+			cur += aLine[i];
+		}
+	}
+
+	if (!cur.empty()) {
+		ret.push_back(cur);
+	}
+
+	return ret;
+}
+
+// Compares the parsed parameters and the serialized command with the reference tokenization
+// Returns false if the results differ
+bool checkAdcCommand() {
+	StringList lines = {
+		"BINF AAAB IDFGRTWKMW4CGEFZTVF3X2ZHHUSK2SZVXJAJT3EQQ NIuser\\\\1 DE\\sdesc\\n\\\\ VEAirDC++\\s3.60",
+		"DCTM AAAB AAAC ADC/1.0 1412 token",
+		"FSCH AAAB +SEGA-ASCH ANfoo ANbar TOauto",
+		"IQUI AAAB MSline\\nbreak",
+		"HSUP ADBASE ADTIGR",
+		"ISTA 000  empty\\s\\s",
+		"BMSG AAAB \\\\",
+	};
+
+	// Random parameters with separators that need to be escaped
+	std::mt19937 gen(4);
+	for (int i = 0; i < 1000; ++i) {
+		string line = "BINF AAAB";
+		auto params = 1 + gen() % 10;
+		for (size_t j = 0; j < params; ++j) {
+			line += ' ';
+			line += AdcCommand::escape(randomString(gen, 1 + gen() % 40) + (gen() % 4 == 0 ? "\n\\" : ""), false);
+		}
+
+		lines.push_back(line);
+	}
+
+	for (const auto& l : lines) {
+		auto tokens = tokenizeAdcLine(l);
+		auto type = l[0];
+		auto headerTokens = type == AdcCommand::TYPE_BROADCAST ? 1 : type == AdcCommand::TYPE_DIRECT || type == AdcCommand::TYPE_FEATURE ? 2 : 0;
+		tokens.erase(tokens.begin(), tokens.begin() + headerTokens);
+
+		AdcCommand c(l);
+		auto ok = c.getParamCount() == tokens.size();
+		for (size_t i = 0; ok && i < tokens.size(); ++i) {
+			ok = c.getParamView(i) == tokens[i];
+		}
+
+		// Features aren't stored
+		if (ok && type != AdcCommand::TYPE_FEATURE) {
+			ok = c.toString(c.getFrom()) == l + "\n";
+		}
+
+		ok = ok && c.getParameters() == tokens;
+		if (!ok) {
+			printf("{\"check\":\"adc_command\",\"error\":\"Results differ\",\"line\":\"%s\"}\n", AdcCommand::escape(l, false).c_str());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void benchAdcCommand(const string& aFilter) {
+	const StringList lines = {
+		"BINF AAAB IDFGRTWKMW4CGEFZTVF3X2ZHHUSK2SZVXJAJT3EQQ NIuser1 SL3 SS1099511627776 SF123456 HN1 HR0 HO0 VEAirDC++\\s3.60 SUADC0,TCP4,UDP4,SEGA,ASCH,CCPM I4192.168.1.2 U41412 DE\\sdescription EMuser@example.com\n",
+		"BSCH AAAB TOauto ANubuntu ANdesktop ANiso NOsrc GRnet EXiso EXimg TY1\n",
+		"URES IDFGRTWKMW4CGEFZTVF3X2ZHHUSK2SZVXJAJT3EQQ FN/Linux/ubuntu-18.04-desktop-amd64.iso SI1953349632 SL3 TOauto TRJAE3GNZJ3ZTTHYSBHLYQ7NAR43VXO2TAIT7PMOQ\n",
+	};
+
+	vector<AdcCommand> commands;
+	for (const auto& l : lines) {
+		commands.emplace_back(l);
+	}
+
+	const size_t OPS = 10000;
+	run(aFilter, "adc_command_parse", OPS * lines.size(), 0, [&] {
+		for (size_t i = 0; i < OPS; ++i) {
+			for (const auto& l : lines) {
+				AdcCommand c(l);
+				for (size_t p = 0; p < c.getParamCount(); ++p) {
+					sink += c.getParamView(p).size();
+				}
+			}
+		}
+	});
+
+	// Callers using the string list API
+	run(aFilter, "adc_command_parse_strings", OPS * lines.size(), 0, [&] {
+		for (size_t i = 0; i < OPS; ++i) {
+			for (const auto& l : lines) {
+				AdcCommand c(l);
+				for (const auto& param : c.getParameters()) {
+					sink += param.size();
+				}
+			}
+		}
+	});
+
+	run(aFilter, "adc_command_to_string", OPS * commands.size(), 0, [&] {
+		string buf;
+		for (size_t i = 0; i < OPS; ++i) {
+			for (const auto& c : commands) {
+				buf.clear();
+				c.appendString(buf, 1);
+				sink += buf.size();
+			}
+		}
+	});
+}
+
+void benchTiger(const string& aFilter) {
+	const size_t SIZE = 16 * 1024 * 1024;
+	ByteVector data(SIZE);
+
+	std::mt19937 gen(1);
+	for (auto& b : data) {
+		b = static_cast<uint8_t>(gen());
+	}
+
+	run(aFilter, "tiger_hash", 1, SIZE, [&] {
+		TigerHash h;
+		h.update(&data[0], data.size());
+		sink += h.finalize()[0];
+	});
+
+	run(aFilter, "tiger_tree", 1, SIZE, [&] {
+		TigerTree tt(64 * 1024);
+
+		// Fed in the same sized chunks as when hashing files
+		for (size_t pos = 0; pos < SIZE; pos += 1024 * 1024) {
+			tt.update(&data[pos], 1024 * 1024);
+		}
+
+		sink += tt.finalize()[0];
+	});
+}
+
+void benchBloom(const string& aFilter) {
+	const size_t ITEMS = 100000;
+
+	std::mt19937 gen(2);
+	StringList names;
+	for (size_t i = 0; i < ITEMS; ++i) {
+		names.push_back(randomString(gen, 8 + i % 32));
+	}
+
+	// Same parameters as with the share bloom
+	BloomFilter<5> bloom(1 << 20);
+	run(aFilter, "bloom_filter_add", ITEMS, 0, [&] {
+		bloom.clear();
+		for (const auto& n : names) {
+			bloom.add(n);
+		}
+	});
+
+	run(aFilter, "bloom_filter_match", ITEMS, 0, [&] {
+		for (const auto& n : names) {
+			sink += bloom.match(n);
+		}
+	});
+
+	vector<TTHValue> tths;
+	for (size_t i = 0; i < ITEMS; ++i) {
+		tths.push_back(randomTTH(gen));
+	}
+
+	// Typical parameters requested by the hubs
+	const size_t k = 8, h = 24;
+	const auto m = static_cast<size_t>(HashBloom::get_m(ITEMS, k));
+
+	HashBloom hashBloom;
+	run(aFilter, "hash_bloom_add", ITEMS, 0, [&] {
+		hashBloom.reset(k, m, h);
+		for (const auto& tth : tths) {
+			hashBloom.add(tth);
+		}
+	});
+
+	run(aFilter, "hash_bloom_match", ITEMS, 0, [&] {
+		for (const auto& tth : tths) {
+			sink += hashBloom.match(tth);
+		}
+	});
+}
+
+void benchQueueSegments(const string& aFilter) {
+	const int64_t FILE_SIZE = 8LL * 1024 * 1024 * 1024;
+	const int64_t BLOCK_SIZE = 1024 * 1024;
+
+	std::mt19937 gen(3);
+	auto qi = make_shared<QueueItem>("/tmp/bench.bin", FILE_SIZE, Priority::DEFAULT, QueueItem::FLAG_NORMAL, 0, randomTTH(gen), "/tmp/bench.bin.dctmp");
+
+	// Fragmented progress (as with partial sources and aborted segments) over the first half
+	std::uniform_int_distribution<int64_t> blocks(1, 8);
+	for (int64_t pos = 0; pos < FILE_SIZE / 2;) {
+		auto size = blocks(gen) * BLOCK_SIZE;
+		qi->addFinishedSegment(Segment(pos, size));
+		pos += size + blocks(gen) * BLOCK_SIZE;
+	}
+
+	const size_t OPS = 1000;
+	run(aFilter, "queue_item_next_segment", OPS, 0, [&] {
+		for (size_t i = 0; i < OPS; ++i) {
+			auto s = qi->getNextSegment(BLOCK_SIZE, 16 * BLOCK_SIZE, 0, nullptr, false);
+			sink += static_cast<size_t>(s.getStart());
+		}
+	});
+}
+
+// Randomly named files in a fixed directory structure (the paths are relative and use ADC separators)
+struct SyntheticShare {
+	struct File {
+		string path;
+		int64_t size;
+		TTHValue tth;
+	};
+
+	vector<File> files;
+
+	SyntheticShare(size_t aDirs, size_t aSubdirs, size_t aFiles) {
+		static const char* exts[] = { ".iso", ".mkv", ".mp3", ".flac", ".jpg", ".nfo", ".rar", ".txt" };
+
+		std::mt19937 gen(5);
+		for (size_t d = 0; d < aDirs; ++d) {
+			auto dirPath = randomString(gen, 10 + d % 20) + " " + Util::toString(d) + "/";
+			for (size_t s = 0; s < aSubdirs; ++s) {
+				auto subdirPath = dirPath + randomString(gen, 5 + s % 10) + "/";
+				for (size_t f = 0; f < aFiles; ++f) {
+					auto name = randomString(gen, 8 + f % 40) + exts[gen() % (sizeof(exts) / sizeof(exts[0]))];
+					files.push_back({ subdirPath + name, static_cast<int64_t>(gen() % (1LL << 32)), randomTTH(gen) });
+				}
+			}
+		}
+	}
+
+	// Directory structure in the file list format
+	string toXml() const {
+		string xml = SimpleXML::utf8Header;
+		xml += "<FileListing Version=\"1\" CID=\"" + CID::generate().toBase32() + "\" Base=\"/\" Generator=\"airdcpp-bench\">\r\n";
+
+		StringList curPath;
+		for (const auto& f : files) {
+			auto tokens = StringTokenizer<string>(f.path, '/').getTokens();
+			auto fileName = tokens.back();
+			tokens.pop_back();
+
+			// Close the directories that differ
+			size_t common = 0;
+			while (common < curPath.size() && common < tokens.size() && curPath[common] == tokens[common]) {
+				common++;
+			}
+
+			for (auto i = curPath.size(); i > common; --i) {
+				xml += "</Directory>\r\n";
+			}
+
+			for (auto i = common; i < tokens.size(); ++i) {
+				xml += "<Directory Name=\"" + tokens[i] + "\" Date=\"1500000000\">\r\n";
+			}
+
+			curPath = tokens;
+			xml += "<File Name=\"" + fileName + "\" Size=\"" + Util::toString(f.size) + "\" TTH=\"" + f.tth.toBase32() + "\"/>\r\n";
+		}
+
+		for (size_t i = 0; i < curPath.size(); ++i) {
+			xml += "</Directory>\r\n";
+		}
+
+		xml += "</FileListing>";
+		return xml;
+	}
+};
+
+void benchSearchQuery(const string& aFilter) {
+	SyntheticShare share(100, 10, 20);
+
+	StringList namesLower;
+	for (const auto& f : share.files) {
+		namesLower.push_back(Text::toLower(Util::getFileName(f.path)));
+	}
+
+	// Typical search from a hub: two terms with an extension and an exclude
+	SearchQuery query({ "ANabc", "ANiso", "NOsrc", "EXiso" }, 10);
+	run(aFilter, "search_query_matches_file_lower", namesLower.size(), 0, [&] {
+		for (const auto& n : namesLower) {
+			sink += query.matchesFileLower(n, 1000, 0);
+		}
+	});
+}
+
+void benchShareSearch(const string& aFilter) {
+	SyntheticShare share(100, 10, 20);
+
+	const auto rootPath = Util::getTempPath() + "airdcpp-bench" + PATH_SEPARATOR_STR;
+	const auto profile = SETTING(DEFAULT_SP);
+
+	{
+		// Loaded in the same way as from the settings file
+		// The directory doesn't need to exist, the files are added as they would be after hashing
+		SimpleXML xml;
+		xml.addTag("DCPlusPlus");
+		xml.stepIn();
+		xml.addTag("Share");
+		xml.addChildAttrib("Token", profile);
+		xml.addChildAttrib("Name", string("Bench"));
+		xml.stepIn();
+		xml.addTag("Directory", rootPath);
+		xml.addChildAttrib("Virtual", string("Bench"));
+		xml.stepOut();
+
+		SettingsManager::getInstance()->fire(SettingsManagerListener::Load(), xml);
+	}
+
+	for (const auto& f : share.files) {
+		auto path = rootPath + f.path;
+		std::replace(path.begin(), path.end(), ADC_SEPARATOR, PATH_SEPARATOR);
+
+		HashedFile fi(f.tth, 1500000000, f.size);
+		ShareManager::getInstance()->onFileHashed(path, fi);
+	}
+
+	// Use existing words so that the bloom filter won't reject the searches
+	auto tokens = StringTokenizer<string>(Util::getFileName(share.files[share.files.size() / 2].path), ' ').getTokens();
+	const auto term = tokens.front().substr(0, 4);
+
+	const vector<StringList> searches = {
+		{ "AN" + term },
+		{ "AN" + term, "EXiso", "EXmkv" },
+		{ "AN" + term, "ANrar", "NOsrc" },
+		{ "TR" + share.files.front().tth.toBase32() },
+	};
+
+	const CID cid;
+	run(aFilter, "share_manager_adc_search", searches.size(), 0, [&] {
+		for (const auto& s : searches) {
+			SearchResultList results;
+			SearchQuery query(s, 10);
+			ShareManager::getInstance()->adcSearch(results, query, profile, cid, ADC_ROOT_STR);
+			sink += results.size();
+		}
+	});
+}
+
+void benchXmlReader(const string& aFilter) {
+	const auto xml = SyntheticShare(100, 10, 20).toXml();
+
+	struct Counter : public SimpleXMLReader::CallBack {
+		void startTag(const string&, StringPairList& aAttribs, bool) override {
+			count += aAttribs.size();
+		}
+
+		size_t count = 0;
+	};
+
+	run(aFilter, "simple_xml_reader", 1, xml.size(), [&] {
+		Counter counter;
+		SimpleXMLReader(&counter).parse(xml);
+		sink += counter.count;
+	});
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	string filter = argc > 1 ? argv[1] : Util::emptyString;
+
+	if (!checkAdcCommand()) {
+		return 1;
+	}
+
+	// Required by the queue items and the share (the search results are created with the slot information of the local user)
+	ResourceManager::newInstance();
+	SettingsManager::newInstance();
+	TimerManager::newInstance();
+	HashManager::newInstance();
+	ShareManager::newInstance();
+	ClientManager::newInstance();
+	UploadManager::newInstance();
+
+	benchAdcCommand(filter);
+	benchTiger(filter);
+	benchBloom(filter);
+	benchQueueSegments(filter);
+	benchSearchQuery(filter);
+	benchShareSearch(filter);
+	benchXmlReader(filter);
+
+	UploadManager::deleteInstance();
+	ClientManager::deleteInstance();
+	ShareManager::deleteInstance();
+	HashManager::deleteInstance();
+	TimerManager::getInstance()->shutdown();
+	TimerManager::deleteInstance();
+	SettingsManager::deleteInstance();
+	ResourceManager::deleteInstance();
+	return 0;
+}
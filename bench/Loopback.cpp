@@ -0,0 +1,575 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// End-to-end transfer checks over the loopback interface
+//
+// Usage: airdcpp-loopback [name filter] [work directory]
+// Hashed files are uploaded with BufferedSocket::transmitFile and the received data is verified
+// against the TTH of each file (plain and TLS connections with and without the socket reactor,
+// with and without the upload limiter). UDP datagrams are sent and received in batches.
+// Each scenario prints a single JSON object per line, the exit code is non-zero if any check fails.
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/AirUtil.h>
+#include <airdcpp/BufferedSocket.h>
+#include <airdcpp/ClientManager.h>
+#include <airdcpp/ConnectivityManager.h>
+#include <airdcpp/CryptoManager.h>
+#include <airdcpp/DownloadManager.h>
+#include <airdcpp/File.h>
+#include <airdcpp/LogManager.h>
+#include <airdcpp/MerkleTree.h>
+#include <airdcpp/ResourceManager.h>
+#include <airdcpp/SettingsManager.h>
+#include <airdcpp/Socket.h>
+#include <airdcpp/SocketReactor.h>
+#include <airdcpp/ThrottleManager.h>
+#include <airdcpp/TimerManager.h>
+#include <airdcpp/TokenBucket.h>
+#include <airdcpp/UploadManager.h>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+using namespace dcpp;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Maximum time for a single scenario
+const auto SCENARIO_TIMEOUT = std::chrono::seconds(120);
+
+double toSeconds(Clock::duration aDuration) {
+	return static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(aDuration).count()) / 1000000.0;
+}
+
+struct TestFile {
+	string path;
+	int64_t size;
+	TTHValue tth;
+};
+
+typedef vector<TestFile> TestFileList;
+
+// Writes files with random content and hashes them
+TestFileList createFiles(const string& aDir, size_t aCount, int64_t aSize) {
+	std::mt19937 gen(aCount);
+	TestFileList ret;
+
+	ByteVector buf(static_cast<size_t>(aSize));
+	for (size_t i = 0; i < aCount; ++i) {
+		for (auto& b : buf) {
+			b = static_cast<uint8_t>(gen());
+		}
+
+		// Vary the sizes a bit so that the files don't end at block boundaries
+		auto size = aSize - static_cast<int64_t>(i * 4099 % 8191);
+
+		TigerTree tt(64 * 1024);
+		tt.update(buf.data(), static_cast<size_t>(size));
+		tt.finalize();
+
+		auto path = aDir + "file" + Util::toString(i) + ".bin";
+		File f(path, File::WRITE, File::CREATE | File::TRUNCATE);
+		f.write(buf.data(), static_cast<size_t>(size));
+
+		ret.push_back({ path, size, tt.getRoot() });
+	}
+
+	return ret;
+}
+
+// Sends the requested files ("GET <index>" -> "SND <size>" followed by the file data)
+class Uploader : public BufferedSocketListener {
+public:
+	Uploader(const TestFileList& aFiles, BufferedSocket* aSocket) : files(aFiles), socket(aSocket) {
+		socket->addListener(this);
+	}
+
+	BufferedSocket* getSocket() const noexcept { return socket; }
+	bool hasFailed() const noexcept { return failed; }
+private:
+	void on(BufferedSocketListener::Line, const string& aLine) noexcept override {
+		if (aLine.compare(0, 4, "GET ") != 0) {
+			failed = true;
+			socket->disconnect();
+			return;
+		}
+
+		auto index = Util::toUInt32(aLine.substr(4));
+		if (index >= files.size()) {
+			failed = true;
+			socket->disconnect();
+			return;
+		}
+
+		// The previous file has been sent completely when the next one is requested
+		const auto& f = files[index];
+		try {
+			stream.reset(new File(f.path, File::READ, File::OPEN));
+		} catch (const FileException&) {
+			failed = true;
+			socket->disconnect();
+			return;
+		}
+
+		socket->write("SND " + Util::toString(f.size) + "\n");
+		socket->transmitFile(stream.get());
+	}
+
+	void on(BufferedSocketListener::Failed, const string&) noexcept override {
+		// The downloader closes the connection when it's done
+	}
+
+	const TestFileList& files;
+	BufferedSocket* socket;
+	unique_ptr<File> stream;
+	atomic<bool> failed { false };
+};
+
+// Requests the files one at a time and checks the TTH of the received data
+class Downloader : public BufferedSocketListener {
+public:
+	Downloader(const TestFileList& aFiles, size_t aFirst, size_t aCount, bool aSecure, bool aUseLimiter) :
+		files(aFiles), next(aFirst), left(aCount), secure(aSecure) {
+
+		socket = BufferedSocket::getSocket('\n');
+		socket->setUseLimiter(aUseLimiter);
+		socket->addListener(this);
+	}
+
+	void connect(const string& aPort) {
+		started = Clock::now();
+		socket->connect(AddressInfo("127.0.0.1", AddressInfo::TYPE_V4), aPort, secure, true, false);
+	}
+
+	BufferedSocket* getSocket() const noexcept { return socket; }
+
+	bool isDone() const noexcept { return done; }
+	const string& getError() const noexcept { return error; }
+
+	size_t getVerified() const noexcept { return verified; }
+	size_t getMismatches() const noexcept { return mismatches; }
+	int64_t getBytes() const noexcept { return bytes; }
+	const string& getEncryption() const noexcept { return encryption; }
+
+	Clock::time_point getStarted() const noexcept { return started; }
+	Clock::time_point getFirstByte() const noexcept { return firstByte; }
+	Clock::time_point getLastByte() const noexcept { return lastByte; }
+private:
+	void request() noexcept {
+		if (left == 0) {
+			done = true;
+			return;
+		}
+
+		current = next % files.size();
+		++next;
+		--left;
+		socket->write("GET " + Util::toString(current) + "\n");
+	}
+
+	void on(BufferedSocketListener::Connected) noexcept override {
+		encryption = socket->isSecure() ? socket->getEncryptionInfo() : "none";
+		request();
+	}
+
+	void on(BufferedSocketListener::Line, const string& aLine) noexcept override {
+		if (aLine.compare(0, 4, "SND ") != 0 || Util::toInt64(aLine.substr(4)) != files[current].size) {
+			fail("Unexpected reply " + aLine);
+			return;
+		}
+
+		tt.reset(new TigerTree(64 * 1024));
+		received = 0;
+		socket->setDataMode(files[current].size);
+	}
+
+	void on(BufferedSocketListener::Data, uint8_t* aBuf, size_t aLen) noexcept override {
+		auto now = Clock::now();
+		if (bytes == 0) {
+			firstByte = now;
+		}
+
+		lastByte = now;
+		bytes += static_cast<int64_t>(aLen);
+		received += static_cast<int64_t>(aLen);
+
+		// The tree may only be updated with full leaves (except for the last one)
+		pending.insert(pending.end(), aBuf, aBuf + aLen);
+		auto leafBytes = pending.size() - pending.size() % TigerTree::BASE_BLOCK_SIZE;
+		if (leafBytes > 0) {
+			tt->update(pending.data(), leafBytes);
+			pending.erase(pending.begin(), pending.begin() + leafBytes);
+		}
+	}
+
+	void on(BufferedSocketListener::ModeChange) noexcept override {
+		// All data of the current file has been received
+		if (!pending.empty()) {
+			tt->update(pending.data(), pending.size());
+			pending.clear();
+		}
+
+		tt->finalize();
+		if (received == files[current].size && tt->getRoot() == files[current].tth) {
+			++verified;
+		} else {
+			++mismatches;
+		}
+
+		request();
+	}
+
+	void on(BufferedSocketListener::Failed, const string& aError) noexcept override {
+		if (!done) {
+			fail(aError);
+		}
+	}
+
+	void fail(const string& aError) noexcept {
+		error = aError.empty() ? "Failed" : aError;
+		done = true;
+	}
+
+	const TestFileList& files;
+	size_t next;
+	size_t left;
+	size_t current = 0;
+	const bool secure;
+
+	BufferedSocket* socket;
+	unique_ptr<TigerTree> tt;
+	ByteVector pending;
+	int64_t received = 0;
+
+	// Written from the socket thread, read after done has been set
+	size_t verified = 0;
+	size_t mismatches = 0;
+	int64_t bytes = 0;
+	string encryption;
+	string error;
+
+	Clock::time_point started;
+	Clock::time_point firstByte;
+	Clock::time_point lastByte;
+
+	atomic<bool> done { false };
+};
+
+struct Scenario {
+	const char* name;
+	bool secure;
+	int ioThreads;
+	int uploadLimit; // KiB/s
+	size_t connections;
+	size_t filesPerConnection;
+};
+
+// Returns false if any of the checks failed
+bool runScenario(const string& aFilter, const Scenario& aScenario, const TestFileList& aFiles) {
+	if (!aFilter.empty() && string(aScenario.name).find(aFilter) == string::npos) {
+		return true;
+	}
+
+	// Socket mode is chosen when the socket is created
+	SettingsManager::getInstance()->set(SettingsManager::SOCKET_IO_THREADS, aScenario.ioThreads);
+
+	// The limits are updated by the throttle manager once per second
+	ThrottleManager::setSetting(SettingsManager::MAX_UPLOAD_SPEED_MAIN, aScenario.uploadLimit);
+	Thread::sleep(1100);
+
+	auto useLimiter = aScenario.uploadLimit > 0;
+	vector<unique_ptr<Uploader>> uploaders;
+	vector<unique_ptr<Downloader>> downloaders;
+
+	string error;
+	try {
+		Socket server(Socket::TYPE_TCP);
+		server.setV4only(true);
+		server.setLocalIp4("127.0.0.1");
+		auto port = server.listen("0");
+
+		for (size_t i = 0; i < aScenario.connections; ++i) {
+			downloaders.push_back(make_unique<Downloader>(aFiles, i * aScenario.filesPerConnection, aScenario.filesPerConnection, aScenario.secure, useLimiter));
+			downloaders.back()->connect(port);
+
+			auto waitStart = Clock::now();
+			while (!server.wait(100, true, false).first) {
+				if (Clock::now() - waitStart > std::chrono::seconds(10)) {
+					throw SocketException("Connection wasn't accepted");
+				}
+			}
+
+			auto sock = BufferedSocket::getSocket('\n');
+			sock->setUseLimiter(useLimiter);
+			uploaders.push_back(make_unique<Uploader>(aFiles, sock));
+			sock->accept(server, aScenario.secure, true);
+		}
+
+		auto start = Clock::now();
+		for (;;) {
+			auto finished = std::all_of(downloaders.begin(), downloaders.end(), [](const unique_ptr<Downloader>& d) { return d->isDone(); });
+			if (finished) {
+				break;
+			}
+
+			if (Clock::now() - start > SCENARIO_TIMEOUT) {
+				error = "Timed out";
+				break;
+			}
+
+			Thread::sleep(10);
+		}
+	} catch (const Exception& e) {
+		error = e.getError();
+	}
+
+	for (const auto& d : downloaders) {
+		BufferedSocket::putSocket(d->getSocket());
+	}
+
+	for (const auto& u : uploaders) {
+		BufferedSocket::putSocket(u->getSocket());
+	}
+
+	// The listeners may not be deleted while the sockets are running
+	BufferedSocket::waitShutdown();
+
+	size_t verified = 0, mismatches = 0;
+	int64_t bytes = 0;
+	double ttfb = 0, minSpeed = 0, maxSpeed = 0;
+	Clock::time_point first = Clock::time_point::max(), last = Clock::time_point::min();
+	string encryption;
+	for (const auto& d : downloaders) {
+		if (error.empty() && !d->getError().empty()) {
+			error = d->getError();
+		}
+
+		verified += d->getVerified();
+		mismatches += d->getMismatches();
+		bytes += d->getBytes();
+		encryption = d->getEncryption();
+		if (d->getBytes() == 0) {
+			continue;
+		}
+
+		first = min(first, d->getFirstByte());
+		last = max(last, d->getLastByte());
+		ttfb += toSeconds(d->getFirstByte() - d->getStarted()) * 1000.0 / static_cast<double>(downloaders.size());
+
+		auto speed = static_cast<double>(d->getBytes()) / 1024.0 / max(toSeconds(d->getLastByte() - d->getFirstByte()), 0.001);
+		minSpeed = minSpeed == 0 ? speed : min(minSpeed, speed);
+		maxSpeed = max(maxSpeed, speed);
+	}
+
+	for (const auto& u : uploaders) {
+		if (error.empty() && u->hasFailed()) {
+			error = "Invalid request";
+		}
+	}
+
+	auto seconds = bytes > 0 ? max(toSeconds(last - first), 0.001) : 0.0;
+	auto expected = aScenario.connections * aScenario.filesPerConnection;
+
+	// The aggregate rate may only exceed the limit by the burst of the global bucket
+	// (the initial tokens and the debt that the connections are allowed to take)
+	bool limitExceeded = false;
+	if (aScenario.uploadLimit > 0 && bytes > 0) {
+		auto rate = static_cast<int64_t>(aScenario.uploadLimit) * 1024;
+		auto allowed = static_cast<double>(rate) * seconds * 1.05 + static_cast<double>(2 * TokenBucket::getCapacity(rate));
+		limitExceeded = static_cast<double>(bytes) > allowed;
+	}
+
+	auto ok = error.empty() && mismatches == 0 && verified == expected && !limitExceeded;
+
+	printf("{\"name\":\"%s\",\"ok\":%s,\"connections\":%u,\"files\":%u,\"verified\":%u,\"mismatches\":%u,\"bytes\":%lld,\"seconds\":%.3f,\"mib_per_s\":%.2f,"
+		"\"ttfb_ms\":%.2f,\"limit_kib_s\":%d,\"min_conn_kib_s\":%.1f,\"max_conn_kib_s\":%.1f,\"encryption\":\"%s\",\"error\":\"%s\"}\n",
+		aScenario.name, ok ? "true" : "false", static_cast<unsigned>(aScenario.connections), static_cast<unsigned>(expected),
+		static_cast<unsigned>(verified), static_cast<unsigned>(mismatches), static_cast<long long>(bytes), seconds,
+		seconds > 0 ? static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds : 0.0,
+		ttfb, aScenario.uploadLimit, minSpeed, maxSpeed, encryption.c_str(), error.c_str());
+	fflush(stdout);
+
+	return ok;
+}
+
+// Sends datagrams of varying sizes with sendmmsg and reads them back with recvmmsg
+bool runUdpBatch(const string& aFilter) {
+	const char* name = "udp-batch";
+	if (!aFilter.empty() && string(name).find(aFilter) == string::npos) {
+		return true;
+	}
+
+	const int DATAGRAMS = 256;
+	const int BATCH_SIZE = 32;
+
+	std::mt19937 gen(DATAGRAMS);
+	StringList sent;
+	for (int i = 0; i < DATAGRAMS; ++i) {
+		string datagram(1 + gen() % 1400, '\0');
+		for (auto& c : datagram) {
+			c = static_cast<char>(gen());
+		}
+
+		sent.push_back(move(datagram));
+	}
+
+	size_t received = 0, mismatches = 0;
+	int reads = 0;
+	string error;
+	auto start = Clock::now();
+	try {
+		Socket receiver(Socket::TYPE_UDP);
+		receiver.setV4only(true);
+		receiver.setLocalIp4("127.0.0.1");
+		auto port = receiver.listen("0");
+
+		Socket sender(Socket::TYPE_UDP);
+		sender.setV4only(true);
+		sender.setLocalIp4("127.0.0.1");
+
+		// Stay below the default socket buffer size
+		for (size_t pos = 0; pos < sent.size(); pos += BATCH_SIZE) {
+			StringList batch(sent.begin() + pos, sent.begin() + min(pos + BATCH_SIZE, sent.size()));
+			sender.writeTo("127.0.0.1", port, batch);
+
+			Socket::ReadBatch readBatch(2048, BATCH_SIZE);
+			vector<pair<int, string>> datagrams;
+			size_t batchReceived = 0;
+			while (batchReceived < batch.size()) {
+				if (!receiver.wait(1000, true, false).first) {
+					throw SocketException("Datagrams were lost");
+				}
+
+				auto count = receiver.readBatch(readBatch, datagrams);
+				++reads;
+				for (int i = 0; i < count; ++i) {
+					const auto& expected = sent[received];
+					if (datagrams[i].first != static_cast<int>(expected.size()) || memcmp(readBatch.getData(i), expected.data(), expected.size()) != 0) {
+						++mismatches;
+					}
+
+					++received;
+					++batchReceived;
+				}
+			}
+		}
+	} catch (const Exception& e) {
+		error = e.getError();
+	}
+
+	auto ok = error.empty() && mismatches == 0 && received == sent.size();
+	printf("{\"name\":\"%s\",\"ok\":%s,\"datagrams\":%u,\"received\":%u,\"mismatches\":%u,\"reads\":%d,\"seconds\":%.3f,\"error\":\"%s\"}\n",
+		name, ok ? "true" : "false", static_cast<unsigned>(sent.size()), static_cast<unsigned>(received), static_cast<unsigned>(mismatches),
+		reads, toSeconds(Clock::now() - start), error.c_str());
+	fflush(stdout);
+
+	return ok;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+	string filter = argc > 1 ? argv[1] : Util::emptyString;
+	string dir = (argc > 2 ? Util::validatePath(argv[2], true) : Util::getTempPath()) + "airdcpp-loopback" PATH_SEPARATOR_STR;
+
+	// The managers that the sockets and the throttling depend on
+	ResourceManager::newInstance();
+	SettingsManager::newInstance();
+	AirUtil::init();
+
+	LogManager::newInstance();
+	TimerManager::newInstance();
+	CryptoManager::newInstance();
+	ClientManager::newInstance();
+	DownloadManager::newInstance();
+	UploadManager::newInstance();
+	ThrottleManager::newInstance();
+	SocketReactor::newInstance();
+	ConnectivityManager::newInstance();
+
+	TimerManager::getInstance()->start();
+
+	File::ensureDirectory(dir);
+
+	// Generate a temporary certificate
+	auto sm = SettingsManager::getInstance();
+	sm->set(SettingsManager::USE_DEFAULT_CERT_PATHS, false);
+	sm->set(SettingsManager::TLS_CERTIFICATE_FILE, dir + "client.crt");
+	sm->set(SettingsManager::TLS_PRIVATE_KEY_FILE, dir + "client.key");
+	sm->set(SettingsManager::TLS_TRUSTED_CERTIFICATES_PATH, dir);
+	CryptoManager::getInstance()->loadCertificates();
+
+	bool ok = true;
+	if (!CryptoManager::getInstance()->TLSOk()) {
+		printf("{\"name\":\"tls-setup\",\"ok\":false,\"error\":\"Failed to load the certificates\"}\n");
+		ok = false;
+	}
+
+	auto files = createFiles(dir, 8, 4 * 1024 * 1024);
+	auto smallFiles = createFiles(dir + "small-", 8, 512 * 1024);
+
+	const Scenario scenarios[] = {
+		{ "plain-threads", false, 0, 0, 2, 4 },
+		{ "plain-reactor", false, 2, 0, 2, 4 },
+		{ "tls-threads", true, 0, 0, 2, 4 },
+		{ "tls-reactor", true, 2, 0, 2, 4 },
+		{ "plain-threads-throttled", false, 0, 2048, 4, 2 },
+		{ "plain-reactor-throttled", false, 2, 2048, 4, 2 },
+		{ "tls-threads-throttled", true, 0, 2048, 4, 2 },
+		{ "tls-reactor-throttled", true, 2, 2048, 4, 2 },
+	};
+
+	for (const auto& s : scenarios) {
+		if (s.secure && !CryptoManager::getInstance()->TLSOk()) {
+			continue;
+		}
+
+		if (!runScenario(filter, s, s.uploadLimit > 0 ? smallFiles : files)) {
+			ok = false;
+		}
+	}
+
+	if (!runUdpBatch(filter)) {
+		ok = false;
+	}
+
+	try {
+		File::removeDirectoryForced(dir);
+	} catch (const FileException&) {
+		// Leave the files
+	}
+
+	TimerManager::getInstance()->shutdown();
+	ConnectivityManager::deleteInstance();
+	SocketReactor::deleteInstance();
+	ThrottleManager::deleteInstance();
+	UploadManager::deleteInstance();
+	DownloadManager::deleteInstance();
+	ClientManager::deleteInstance();
+	CryptoManager::deleteInstance();
+	LogManager::deleteInstance();
+	SettingsManager::deleteInstance();
+	TimerManager::deleteInstance();
+	ResourceManager::deleteInstance();
+	return ok ? 0 : 1;
+}